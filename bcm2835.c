@@ -14,6 +14,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -57,14 +58,32 @@ volatile uint32_t *bcm2835_bsc1        = (uint32_t *)MAP_FAILED;
 volatile uint32_t *bcm2835_st	       = (uint32_t *)MAP_FAILED;
 volatile uint32_t *bcm2835_aux	       = (uint32_t *)MAP_FAILED;
 volatile uint32_t *bcm2835_spi1        = (uint32_t *)MAP_FAILED;
+volatile uint32_t *bcm2835_dma         = (uint32_t *)MAP_FAILED;
 
 
 
 /* This variable allows us to test on hardware other than RPi.
 // It prevents access to the kernel memory, and does not do any peripheral access
 // Instead it prints out what it _would_ do if debug were 0
+// Building with BCM2835_NO_DEBUG makes it a constant 0, so every debug branch
+// is compiled out of the production library.
  */
+#ifdef BCM2835_NO_DEBUG
+#define debug 0
+#else
 static uint8_t debug = 0;
+#endif
+
+/* Trace ring for BCM2835_DEBUG_TRACE, see bcm2835_trace_record() */
+static struct
+{
+    bcm2835TraceEntry *ring;
+    uint32_t mask;
+    uint32_t seq;
+    uint32_t spi0_rx;   /* Bytes waiting in the modelled SPI0 RX FIFO */
+    uint32_t spi1_rx;   /* Words waiting in the modelled AUX SPI RX FIFO */
+    bcm2835PeriModel model;  /* Replaces the built in model when model.read is set */
+} bcm2835_trace = { NULL, 0, 0, 0, 0, { NULL, NULL, NULL } };
 
 /* RPI 4 has different pullup registers - we need to know if we have that type */
 
@@ -155,6 +174,8 @@ uint32_t* bcm2835_regbase(uint8_t regbase)
 	    return (uint32_t *)bcm2835_aux;
 	case BCM2835_REGBASE_SPI1:
 	    return (uint32_t *)bcm2835_spi1;
+	case BCM2835_REGBASE_DMA:
+	    return (uint32_t *)bcm2835_dma;
 
     }
     return (uint32_t *)MAP_FAILED;
@@ -162,7 +183,14 @@ uint32_t* bcm2835_regbase(uint8_t regbase)
 
 void  bcm2835_set_debug(uint8_t d)
 {
+#ifdef BCM2835_NO_DEBUG
+    if (d)
+	fprintf(stderr, "bcm2835_set_debug: library built with BCM2835_NO_DEBUG, ignored\n");
+#else
     debug = d;
+    if (debug == BCM2835_DEBUG_TRACE && bcm2835_trace.ring == NULL)
+	bcm2835_trace_begin(BCM2835_TRACE_DEFAULT_ENTRIES);
+#endif
 }
 
 unsigned int bcm2835_version(void) 
@@ -170,14 +198,191 @@ unsigned int bcm2835_version(void)
     return BCM2835_VERSION;
 }
 
-/* Read with memory barriers from peripheral
- *
- */
-uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
+/* Trace recorder for BCM2835_DEBUG_TRACE.
+// Every register access goes into a power of 2 ring of bcm2835TraceEntry.
+// Reads are answered by just enough of a peripheral model that the polled
+// SPI loops terminate: SPI0 and AUX SPI transfer instantly and echo one
+// received byte for every byte written.
+*/
+static void bcm2835_trace_record(uint32_t offset, uint32_t value, uint32_t flags)
+{
+    bcm2835TraceEntry *entry;
+    uint32_t seq;
+
+    if (bcm2835_trace.ring == NULL)
+	return;
+
+    /* The stripe driver runs SPI0 and SPI1 from two threads */
+    seq = __sync_fetch_and_add(&bcm2835_trace.seq, 1);
+    entry = &bcm2835_trace.ring[seq & bcm2835_trace.mask];
+    entry->seq    = seq;
+    entry->offset = offset;
+    entry->value  = value;
+    entry->flags  = flags;
+}
+
+static uint32_t bcm2835_trace_offset(volatile uint32_t* paddr)
+{
+    return (uint32_t)((uintptr_t)paddr - (uintptr_t)bcm2835_peripherals);
+}
+
+static uint32_t bcm2835_trace_read(volatile uint32_t* paddr, uint32_t flags)
+{
+    uint32_t offset = bcm2835_trace_offset(paddr);
+    uint32_t value = 0;
+
+    if (bcm2835_trace.model.read)
+    {
+	value = bcm2835_trace.model.read(bcm2835_trace.model.self, offset, flags);
+	bcm2835_trace_record(offset, value, flags | BCM2835_TRACE_READ);
+	return value;
+    }
+
+    switch (offset)
+    {
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CS:
+	value = BCM2835_SPI0_CS_DONE | BCM2835_SPI0_CS_TXD;
+	if (bcm2835_trace.spi0_rx > 0)
+	    value |= BCM2835_SPI0_CS_RXD;
+	if (bcm2835_trace.spi0_rx >= BCM2835_SPI0_FIFO_SIZE_3_4)
+	    value |= BCM2835_SPI0_CS_RXR;
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+	if (bcm2835_trace.spi0_rx > 0)
+	    bcm2835_trace.spi0_rx--;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_STAT:
+	if (bcm2835_trace.spi1_rx == 0)
+	    value = BCM2835_AUX_SPI_STAT_RX_EMPTY;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO:
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD:
+	if (bcm2835_trace.spi1_rx > 0)
+	    bcm2835_trace.spi1_rx--;
+	break;
+    }
+
+    bcm2835_trace_record(offset, value, flags | BCM2835_TRACE_READ);
+    return value;
+}
+
+static void bcm2835_trace_write_offset(uint32_t offset, uint32_t value, uint32_t flags)
+{
+    if (bcm2835_trace.model.write)
+    {
+	bcm2835_trace.model.write(bcm2835_trace.model.self, offset, value, flags);
+	bcm2835_trace_record(offset, value, flags | BCM2835_TRACE_WRITE);
+	return;
+    }
+
+    switch (offset)
+    {
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CS:
+	if (value & BCM2835_SPI0_CS_CLEAR_RX)
+	    bcm2835_trace.spi0_rx = 0;
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+	/* DMA words are drained by the RX channel, not the CPU */
+	if (!(flags & BCM2835_TRACE_DMA) && bcm2835_trace.spi0_rx < BCM2835_SPI0_FIFO_SIZE)
+	    bcm2835_trace.spi0_rx++;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO:
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD:
+	bcm2835_trace.spi1_rx++;
+	break;
+    }
+
+    bcm2835_trace_record(offset, value, flags | BCM2835_TRACE_WRITE);
+}
+
+static void bcm2835_trace_write(volatile uint32_t* paddr, uint32_t value, uint32_t flags)
+{
+    bcm2835_trace_write_offset(bcm2835_trace_offset(paddr), value, flags);
+}
+
+void bcm2835_trace_set_model(const bcm2835PeriModel* model)
+{
+    if (model)
+	bcm2835_trace.model = *model;
+    else
+	memset(&bcm2835_trace.model, 0, sizeof(bcm2835_trace.model));
+}
+
+int bcm2835_trace_begin(uint32_t entries)
+{
+    uint32_t size = 1;
+
+    while (size < entries && size < 0x80000000)
+	size <<= 1;
+
+    bcm2835_trace_end();
+    bcm2835_trace.ring = (bcm2835TraceEntry*)calloc(size, sizeof(bcm2835TraceEntry));
+    if (bcm2835_trace.ring == NULL)
+	return 0;
+    bcm2835_trace.mask = size - 1;
+    bcm2835_trace.seq = 0;
+    bcm2835_trace.spi0_rx = 0;
+    bcm2835_trace.spi1_rx = 0;
+    return 1;
+}
+
+void bcm2835_trace_end(void)
+{
+    free(bcm2835_trace.ring);
+    bcm2835_trace.ring = NULL;
+    bcm2835_trace.mask = 0;
+}
+
+uint32_t bcm2835_trace_count(void)
+{
+    return bcm2835_trace.seq;
+}
+
+int bcm2835_trace_dump(const char* path)
+{
+    uint32_t header[2];
+    uint32_t first;
+    uint32_t count;
+    uint32_t i;
+    FILE *fp;
+    int ok;
+
+    if (bcm2835_trace.ring == NULL)
+	return 0;
+    if ((fp = fopen(path, "wb")) == NULL)
+    {
+	fprintf(stderr, "bcm2835_trace_dump: Unable to open %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+
+    count = MIN(bcm2835_trace.seq, bcm2835_trace.mask + 1);
+    first = bcm2835_trace.seq - count;
+    header[0] = BCM2835_TRACE_VERSION;
+    header[1] = count;
+
+    ok = fwrite(BCM2835_TRACE_MAGIC, 8, 1, fp) == 1
+	&& fwrite(header, sizeof(header), 1, fp) == 1;
+    for (i = 0; ok && i < count; i++)
+	ok = fwrite(&bcm2835_trace.ring[(first + i) & bcm2835_trace.mask], sizeof(bcm2835TraceEntry), 1, fp) == 1;
+
+    if (fclose(fp) != 0)
+	ok = 0;
+    return ok;
+}
+
+/* Register accessors.
+// The bodies are static inline so that the rest of this file can use them
+// without a call per register access; the exported bcm2835_peri_* functions
+// below are thin wrappers for applications and always keep a full barrier on
+// both sides of the barrier variants, in every build.
+*/
+static inline uint32_t bcm2835_peri_read_i(volatile uint32_t* paddr)
 {
     uint32_t ret;
     if (debug)
     {
+	if (debug == BCM2835_DEBUG_TRACE)
+	    return bcm2835_trace_read(paddr, BCM2835_TRACE_BARRIER);
 		printf("bcm2835_peri_read  paddr %p\n", (void *) paddr);
 		return 0;
     }
@@ -190,16 +395,12 @@ uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
     }
 }
 
-/* read from peripheral without the read barrier
- * This can only be used if more reads to THE SAME peripheral
- * will follow.  The sequence must terminate with memory barrier
- * before any read or write to another peripheral can occur.
- * The MB can be explicit, or one of the barrier read/write calls.
- */
-uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
+static inline uint32_t bcm2835_peri_read_nb_i(volatile uint32_t* paddr)
 {
     if (debug)
     {
+	if (debug == BCM2835_DEBUG_TRACE)
+	    return bcm2835_trace_read(paddr, 0);
 	printf("bcm2835_peri_read_nb  paddr %p\n", paddr);
 	return 0;
     }
@@ -209,14 +410,14 @@ uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
     }
 }
 
-/* Write with memory barriers to peripheral
- */
-
-void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
+static inline void bcm2835_peri_write_i(volatile uint32_t* paddr, uint32_t value)
 {
     if (debug)
     {
-	printf("bcm2835_peri_write paddr %p, value %08X\n", paddr, value);
+	if (debug == BCM2835_DEBUG_TRACE)
+	    bcm2835_trace_write(paddr, value, BCM2835_TRACE_BARRIER);
+	else
+	    printf("bcm2835_peri_write paddr %p, value %08X\n", paddr, value);
     }
     else
     {
@@ -226,12 +427,14 @@ void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
     }
 }
 
-/* write to peripheral without the write barrier */
-void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
+static inline void bcm2835_peri_write_nb_i(volatile uint32_t* paddr, uint32_t value)
 {
     if (debug)
     {
-	printf("bcm2835_peri_write_nb paddr %p, value %08X\n",
+	if (debug == BCM2835_DEBUG_TRACE)
+	    bcm2835_trace_write(paddr, value, 0);
+	else
+	    printf("bcm2835_peri_write_nb paddr %p, value %08X\n",
                 paddr, value);
     }
     else
@@ -240,16 +443,82 @@ void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
     }
 }
 
+/* Barrier accessors with only the barriers the BCM2835 datasheet asks for:
+// one before a write and one after a read, so there is always a barrier
+// before the first write to a peripheral and after the last read from it.
+// Accesses within one peripheral are ordered by the bus and need none.
+// Only the library's own register sequences use these, in the
+// BCM2835_NO_DEBUG build; they have no debug branch.
+*/
+static inline uint32_t bcm2835_peri_read_db(volatile uint32_t* paddr)
+{
+    uint32_t ret = *paddr;
+    __sync_synchronize();
+    return ret;
+}
+
+static inline void bcm2835_peri_write_db(volatile uint32_t* paddr, uint32_t value)
+{
+    __sync_synchronize();
+    *paddr = value;
+}
+
+/* Read with memory barriers from peripheral
+ *
+ */
+uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
+{
+    return bcm2835_peri_read_i(paddr);
+}
+
+/* read from peripheral without the read barrier
+ * This can only be used if more reads to THE SAME peripheral
+ * will follow.  The sequence must terminate with memory barrier
+ * before any read or write to another peripheral can occur.
+ * The MB can be explicit, or one of the barrier read/write calls.
+ */
+uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
+{
+    return bcm2835_peri_read_nb_i(paddr);
+}
+
+/* Write with memory barriers to peripheral
+ */
+
+void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
+{
+    bcm2835_peri_write_i(paddr, value);
+}
+
+/* write to peripheral without the write barrier */
+void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
+{
+    bcm2835_peri_write_nb_i(paddr, value);
+}
+
 /* Set/clear only the bits in value covered by the mask
  * This is not atomic - can be interrupted.
  */
 void bcm2835_peri_set_bits(volatile uint32_t* paddr, uint32_t value, uint32_t mask)
 {
-    uint32_t v = bcm2835_peri_read(paddr);
+    uint32_t v = bcm2835_peri_read_i(paddr);
     v = (v & ~mask) | (value & mask);
-    bcm2835_peri_write(paddr, v);
+    bcm2835_peri_write_i(paddr, v);
 }
 
+/* From here on the library itself uses the inline accessors, with the
+// datasheet barriers only in the BCM2835_NO_DEBUG build
+*/
+#ifdef BCM2835_NO_DEBUG
+#define bcm2835_peri_read(paddr)            bcm2835_peri_read_db(paddr)
+#define bcm2835_peri_write(paddr, value)    bcm2835_peri_write_db(paddr, value)
+#else
+#define bcm2835_peri_read(paddr)            bcm2835_peri_read_i(paddr)
+#define bcm2835_peri_write(paddr, value)    bcm2835_peri_write_i(paddr, value)
+#endif
+#define bcm2835_peri_read_nb(paddr)         bcm2835_peri_read_nb_i(paddr)
+#define bcm2835_peri_write_nb(paddr, value) bcm2835_peri_write_nb_i(paddr, value)
+
 /*
 // Low level convenience functions
 */
@@ -525,7 +794,8 @@ void bcm2835_delayMicroseconds(uint64_t micros)
     if (debug)
     {
 	/* Cant access sytem timers in debug mode */
-	printf("bcm2835_delayMicroseconds %lld\n", (long long int) micros);
+	if (debug == BCM2835_DEBUG_PRINT)
+	    printf("bcm2835_delayMicroseconds %lld\n", (long long int) micros);
 	return;
     }
 
@@ -715,10 +985,22 @@ void bcm2835_spi_setBitOrder(uint8_t order)
 // rounded down. The maximum SPI clock rate is
 // of the APB clock
 */
+/* Last divider written to SPI0, used to predict transfer times */
+static uint32_t bcm2835_spi_divider = 65536;
+
+/* Status polls that found the TX FIFO full or the transfer not yet DONE,
+// see bcm2835_spi_wait_spins() and bcm2835_aux_spi_wait_spins()
+*/
+static uint64_t bcm2835_spi_fifo_spins = 0;
+static uint64_t bcm2835_spi_done_spins = 0;
+static uint64_t bcm2835_aux_spi_fifo_spins = 0;
+static uint64_t bcm2835_aux_spi_done_spins = 0;
+
 void bcm2835_spi_setClockDivider(uint16_t divider)
 {
     volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CLK/4;
     bcm2835_peri_write(paddr, divider);
+    bcm2835_spi_divider = divider ? divider : 65536;
 }
 
 void bcm2835_spi_set_speed_hz(uint32_t speed_hz)
@@ -773,24 +1055,16 @@ uint8_t bcm2835_spi_transfer(uint8_t value)
 }
 
 /* Writes (and reads) an number of bytes to SPI */
-void bcm2835_spi_transfernb(char* tbuf, char* rbuf, uint32_t len)
+/* Full duplex FIFO loop shared by bcm2835_spi_transfernb() and
+// bcm2835_spi_transaction_transfernb(). TA must already be set.
+*/
+static void bcm2835_spi_transfer_fifo(const char* tbuf, char* rbuf, uint32_t len)
 {
     volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
     volatile uint32_t* fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
     uint32_t TXCnt=0;
     uint32_t RXCnt=0;
 
-    /* This is Polled transfer as per section 10.6.1
-    // BUG ALERT: what happens if we get interupted in this section, and someone else
-    // accesses a different peripheral? 
-    */
-
-    /* Clear TX and RX fifos */
-    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_CLEAR, BCM2835_SPI0_CS_CLEAR);
-
-    /* Set TA = 1 */
-    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_TA, BCM2835_SPI0_CS_TA);
-
     /* Use the FIFO's to reduce the interbyte times */
     while((TXCnt < len)||(RXCnt < len))
     {
@@ -809,50 +1083,163 @@ void bcm2835_spi_transfernb(char* tbuf, char* rbuf, uint32_t len)
     }
     /* Wait for DONE to be set */
     while (!(bcm2835_peri_read_nb(paddr) & BCM2835_SPI0_CS_DONE))
-	;
+	bcm2835_spi_done_spins++;
+}
+
+void bcm2835_spi_transfernb(char* tbuf, char* rbuf, uint32_t len)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+
+    /* This is Polled transfer as per section 10.6.1
+    // BUG ALERT: what happens if we get interupted in this section, and someone else
+    // accesses a different peripheral? 
+    */
+
+    /* Clear TX and RX fifos */
+    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_CLEAR, BCM2835_SPI0_CS_CLEAR);
+
+    /* Set TA = 1 */
+    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_TA, BCM2835_SPI0_CS_TA);
+
+    bcm2835_spi_transfer_fifo(tbuf, rbuf, len);
 
     /* Set TA = 0, and also set the barrier */
     bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
 }
 
-/* Writes an number of bytes to SPI */
-void bcm2835_spi_writenb(const char* tbuf, uint32_t len)
+/* Burst writes a number of bytes to SPI0, with TA already set, and returns with the bus idle.
+// Never has more than BCM2835_SPI0_FIFO_SIZE bytes in flight (written but not yet read back),
+// so neither FIFO can overflow: bytes are written in blocks without checking TXD, and the
+// RX FIFO is drained blindly BCM2835_SPI0_FIFO_SIZE_3_4 bytes at a time whenever RXR is set.
+// This costs about three register accesses per byte and no barriers, instead of five
+// with three barriers (see tests/bench_spi_writenb.c).
+// dcx is ORed into every FIFO write, and carries the D/C bit in LoSSI mode.
+*/
+static void bcm2835_spi_burst(const char* tbuf, uint32_t len, uint32_t dcx)
 {
     volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
     volatile uint32_t* fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
-    uint32_t i;
+    const uint8_t* tx = (const uint8_t*)tbuf;
+    uint8_t reverse = (bcm2835_spi_bit_order == BCM2835_SPI_BIT_ORDER_LSBFIRST);
+    uint32_t inflight = 0;
+    uint32_t i = 0;
+    uint32_t n;
+    uint32_t cs;
+
+    while (i < len)
+    {
+	/* Top up to a full FIFO, no barrier */
+	n = MIN(len - i, BCM2835_SPI0_FIFO_SIZE - inflight);
+	if (n == 0)
+	    bcm2835_spi_fifo_spins++;
+	inflight += n;
+	if (reverse)
+	{
+	    while (n--)
+		bcm2835_peri_write_nb(fifo, bcm2835_byte_reverse_table[tx[i++]] | dcx);
+	}
+	else
+	{
+	    while (n--)
+		bcm2835_peri_write_nb(fifo, tx[i++] | dcx);
+	}
+
+	/* Read from FIFO to prevent stalling */
+	cs = bcm2835_peri_read_nb(paddr);
+	if (cs & BCM2835_SPI0_CS_RXR)
+	{
+	    for (n = 0; n < BCM2835_SPI0_FIFO_SIZE_3_4; n++)
+		(void) bcm2835_peri_read_nb(fifo);
+	    inflight -= BCM2835_SPI0_FIFO_SIZE_3_4;
+	}
+	else if ((cs & (BCM2835_SPI0_CS_DONE | BCM2835_SPI0_CS_RXD)) == BCM2835_SPI0_CS_DONE)
+	{
+	    /* Everything sent and read back */
+	    inflight = 0;
+	}
+	else
+	{
+	    while ((cs & BCM2835_SPI0_CS_RXD) && inflight > 0)
+	    {
+		(void) bcm2835_peri_read_nb(fifo);
+		inflight--;
+		cs = bcm2835_peri_read_nb(paddr);
+	    }
+	}
+    }
 
+    /* Wait for DONE to be set */
+    while (!((cs = bcm2835_peri_read_nb(paddr)) & BCM2835_SPI0_CS_DONE)) {
+	bcm2835_spi_done_spins++;
+	while (cs & BCM2835_SPI0_CS_RXD)
+	{
+	    (void) bcm2835_peri_read_nb(fifo);
+	    cs = bcm2835_peri_read_nb(paddr);
+	}
+    };
+    while (bcm2835_peri_read_nb(paddr) & BCM2835_SPI0_CS_RXD)
+	(void) bcm2835_peri_read_nb(fifo);
+}
+
+/* Writes an number of bytes to SPI */
+void bcm2835_spi_writenb(const char* tbuf, uint32_t len)
+{
     /* This is Polled transfer as per section 10.6.1
     // BUG ALERT: what happens if we get interupted in this section, and someone else
     // accesses a different peripheral?
     // Answer: an ISR is required to issue the required memory barriers.
     */
+    bcm2835_spi_transaction_begin();
+    bcm2835_spi_burst(tbuf, len, 0);
+    bcm2835_spi_transaction_end();
+}
+
+/* Clears the FIFOs and sets TA, which asserts CS until bcm2835_spi_transaction_end() */
+void bcm2835_spi_transaction_begin(void)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
 
     /* Clear TX and RX fifos */
     bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_CLEAR, BCM2835_SPI0_CS_CLEAR);
 
     /* Set TA = 1 */
     bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_TA, BCM2835_SPI0_CS_TA);
+}
 
-    for (i = 0; i < len; i++)
-    {
-	/* Maybe wait for TXD */
-	while (!(bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_TXD))
-	    ;
-	
-	/* Write to FIFO, no barrier */
-	bcm2835_peri_write_nb(fifo, bcm2835_correct_order(tbuf[i]));
-	
-	/* Read from FIFO to prevent stalling */
-	while (bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_RXD)
-	    (void) bcm2835_peri_read_nb(fifo);
-    }
-    
-    /* Wait for DONE to be set */
-    while (!(bcm2835_peri_read_nb(paddr) & BCM2835_SPI0_CS_DONE)) {
-	while (bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_RXD)
-		(void) bcm2835_peri_read_nb(fifo);
-    };
+/* Writes a number of bytes inside an open transaction.
+// Returns once the FIFO has drained, so the caller may switch a D/C line
+// before the next phase. The final barrier read protects any access to
+// another peripheral (e.g. GPIO) that follows.
+*/
+void bcm2835_spi_transaction_writenb(const char* tbuf, uint32_t len)
+{
+    bcm2835_spi_burst(tbuf, len, 0);
+    (void) bcm2835_peri_read(bcm2835_spi0 + BCM2835_SPI0_CS/4);
+}
+
+/* Full duplex transfer inside an open transaction, CS stays asserted */
+void bcm2835_spi_transaction_transfernb(const char* tbuf, char* rbuf, uint32_t len)
+{
+    bcm2835_spi_transfer_fifo(tbuf, rbuf, len);
+    (void) bcm2835_peri_read(bcm2835_spi0 + BCM2835_SPI0_CS/4);
+}
+
+/* LoSSI mode: every byte goes out as a 9 bit word, D/C bit first */
+void bcm2835_spi_setLoSSI(uint8_t enable)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+    bcm2835_peri_set_bits(paddr, enable ? BCM2835_SPI0_CS_LEN : 0, BCM2835_SPI0_CS_LEN);
+}
+
+void bcm2835_spi_lossi_writenb(const char* tbuf, uint32_t len, uint8_t dc)
+{
+    bcm2835_spi_burst(tbuf, len, dc ? BCM2835_SPI0_LOSSI_DC : 0);
+    (void) bcm2835_peri_read(bcm2835_spi0 + BCM2835_SPI0_CS/4);
+}
+
+void bcm2835_spi_transaction_end(void)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
 
     /* Set TA = 0, and also set the barrier */
     bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
@@ -918,6 +1305,463 @@ void bcm2835_spi_write(uint16_t data)
 #endif
 }
 
+/* DMA driven SPI0 transmits, per 10.6.3 DMA of the BCM 2835 ARM Peripherals manual.
+// The TX channel writes one header word (DLEN in bits 31:16, CS bits 7:0) followed
+// by the data for each chunk into the FIFO, the RX channel throws away everything
+// received so the RX FIFO never stalls the transfer.
+*/
+#define BCM2835_MBOX_IOCTL            _IOWR(100, 0, char *)
+#define BCM2835_MBOX_TAG_MEM_ALLOC    0x0003000c
+#define BCM2835_MBOX_TAG_MEM_LOCK     0x0003000d
+#define BCM2835_MBOX_TAG_MEM_UNLOCK   0x0003000e
+#define BCM2835_MBOX_TAG_MEM_RELEASE  0x0003000f
+#define BCM2835_MBOX_MEM_FLAG_DIRECT  0x04 /* 0xC alias, uncached */
+#define BCM2835_MBOX_MEM_FLAG_L1_NONALLOCATING 0x0C /* 0x8 alias, for RPi 1 */
+
+#define BCM2835_SPI_DMA_MAX_CBS       8
+#define BCM2835_SPI_DMA_DUMMY         (2 * BCM2835_SPI_DMA_MAX_CBS * sizeof(bcm2835DMAControlBlock))
+#define BCM2835_SPI_DMA_DATA          (BCM2835_SPI_DMA_DUMMY + 32)
+
+static struct
+{
+    int       mbox_fd;
+    uint32_t  handle;
+    uint32_t  bus;
+    uint8_t  *virt;
+    uint8_t   tx_channel;
+    uint8_t   rx_channel;
+    uint8_t   error;
+    struct timespec deadline;   /* Predicted end of the transfer minus the polling tail */
+    uint64_t  sleep_ns;         /* Time given up to other threads in bcm2835_spi_dma_wait */
+    uint64_t  poll_ns;          /* Time spent polling the tail */
+} bcm2835_spi_dma = { -1, 0, 0, NULL, 0, 0, 0, { 0, 0 }, 0, 0 };
+
+static uint64_t bcm2835_timespec_ns(const struct timespec *t)
+{
+    return (uint64_t)t->tv_sec * 1000000000ULL + (uint64_t)t->tv_nsec;
+}
+
+/* Time for SPI0 to clock out len bytes at the current divider.
+// DMA keeps the FIFO full, so this is just 8 SCLK periods per byte.
+*/
+static uint64_t bcm2835_spi_transfer_ns(uint32_t len)
+{
+    return (uint64_t)len * 8 * bcm2835_spi_divider * 1000000000ULL / BCM2835_CORE_CLK_HZ;
+}
+
+static uint32_t bcm2835_mbox_property(int fd, uint32_t tag, uint32_t nargs,
+				      uint32_t a0, uint32_t a1, uint32_t a2)
+{
+    uint32_t p[16] __attribute__((aligned(16)));
+    uint32_t i = 1;
+
+    p[i++] = 0;          /* Process request */
+    p[i++] = tag;
+    p[i++] = 12;         /* Size of the value buffer */
+    p[i++] = nargs * 4;  /* Size of the request */
+    p[i++] = a0;
+    p[i++] = a1;
+    p[i++] = a2;
+    p[i++] = 0;          /* End tag */
+    p[0] = i * sizeof(*p);
+
+    if (ioctl(fd, BCM2835_MBOX_IOCTL, p) < 0)
+	return 0;
+    return p[5];
+}
+
+static volatile uint32_t* bcm2835_dma_channel(uint8_t channel)
+{
+    return bcm2835_dma + channel * BCM2835_DMA_CHANNEL_SIZE/4;
+}
+
+static uint32_t bcm2835_spi_dma_bus(const void *virt)
+{
+    return bcm2835_spi_dma.bus + (uint32_t)((const uint8_t*)virt - bcm2835_spi_dma.virt);
+}
+
+static void *bcm2835_spi_dma_virt(uint32_t bus)
+{
+    return bcm2835_spi_dma.virt + (bus - bcm2835_spi_dma.bus);
+}
+
+static void bcm2835_dma_reset(uint8_t channel)
+{
+    volatile uint32_t* cs = bcm2835_dma_channel(channel) + BCM2835_DMA_CS/4;
+
+    bcm2835_peri_write(cs, BCM2835_DMA_CS_ABORT);
+    bcm2835_peri_write(cs, 0);
+    bcm2835_peri_write(cs, BCM2835_DMA_CS_RESET);
+    bcm2835_peri_write(bcm2835_dma_channel(channel) + BCM2835_DMA_CONBLK_AD/4, 0);
+    bcm2835_peri_write(cs, BCM2835_DMA_CS_END);
+}
+
+/* Software model of the DMA engine and the SPI0 FIFO, used in debug mode.
+// Walks both control block chains the way the hardware would: the SPI takes the
+// first word written while it is idle as the DLEN/CS header, then DLEN bytes of data
+// packed four to a word, and produces the same number of words for the RX channel.
+*/
+static int bcm2835_spi_dma_model(uint32_t tx_cb, uint32_t rx_cb)
+{
+    uint32_t remaining = 0;
+    uint32_t tx_words = 0;
+    uint32_t rx_words = 0;
+    uint32_t sent = 0;
+    uint32_t i;
+
+    while (tx_cb)
+    {
+	bcm2835DMAControlBlock *cb = (bcm2835DMAControlBlock*)bcm2835_spi_dma_virt(tx_cb);
+	uint32_t *src = (uint32_t*)bcm2835_spi_dma_virt(cb->source_ad);
+
+	if (!(cb->ti & BCM2835_DMA_TI_DEST_DREQ) || (cb->txfr_len & 3)
+	    || (cb->ti & BCM2835_DMA_TI_PERMAP(0x1f)) != BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_TX)
+	    || cb->dest_ad != BCM2835_PERI_BUS_BASE + BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO)
+	    return 0;
+
+	for (i = 0; i < cb->txfr_len / 4; i++)
+	{
+	    if (remaining == 0)
+	    {
+		remaining = src[i] >> 16;
+		if (debug == BCM2835_DEBUG_PRINT)
+		    printf("bcm2835_spi_dma tx cb %08X dlen %u cs %02X\n", tx_cb, remaining, src[i] & 0xFF);
+		bcm2835_trace_write_offset(BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO, src[i], BCM2835_TRACE_DMA);
+		if (remaining == 0 || !(src[i] & BCM2835_SPI0_CS_TA))
+		    return 0;
+		continue;
+	    }
+	    bcm2835_trace_write_offset(BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO, src[i], BCM2835_TRACE_DMA);
+	    sent += MIN(remaining, 4);
+	    remaining -= MIN(remaining, 4);
+	    tx_words++;
+	}
+	tx_cb = cb->nextconbk;
+    }
+
+    while (rx_cb)
+    {
+	bcm2835DMAControlBlock *cb = (bcm2835DMAControlBlock*)bcm2835_spi_dma_virt(rx_cb);
+
+	if (!(cb->ti & BCM2835_DMA_TI_SRC_DREQ) || (cb->txfr_len & 3)
+	    || (cb->ti & BCM2835_DMA_TI_PERMAP(0x1f)) != BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_RX)
+	    || cb->source_ad != BCM2835_PERI_BUS_BASE + BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO)
+	    return 0;
+
+	rx_words += cb->txfr_len / 4;
+	rx_cb = cb->nextconbk;
+    }
+
+    if (debug == BCM2835_DEBUG_PRINT)
+	printf("bcm2835_spi_dma sent %u bytes, tx %u words, rx %u words\n", sent, tx_words, rx_words);
+    return remaining == 0 && tx_words == rx_words;
+}
+
+int bcm2835_spi_dma_begin(uint8_t tx_channel, uint8_t rx_channel)
+{
+    uint32_t size = BCM2835_SPI_DMA_BUFFER_SIZE;
+    uint32_t flags;
+    void *mem;
+    int memfd;
+
+    if (bcm2835_spi_dma.virt != NULL)
+	return 1;
+    if (tx_channel > 14 || rx_channel > 14 || tx_channel == rx_channel)
+	return 0;
+
+    bcm2835_spi_dma.sleep_ns = 0;
+    bcm2835_spi_dma.poll_ns = 0;
+    bcm2835_spi_dma.tx_channel = tx_channel;
+    bcm2835_spi_dma.rx_channel = rx_channel;
+
+    if (debug)
+    {
+	if (posix_memalign(&mem, BCM2835_PAGE_SIZE, size) != 0)
+	    return 0;
+	memset(mem, 0, size);
+	bcm2835_spi_dma.virt = (uint8_t*)mem;
+	bcm2835_spi_dma.bus  = 0xC0000000;
+	return 1;
+    }
+
+    if (bcm2835_dma == MAP_FAILED)
+	return 0; /* bcm2835_init() failed, or not root */
+
+    if ((bcm2835_spi_dma.mbox_fd = open("/dev/vcio", 0)) < 0)
+    {
+	fprintf(stderr, "bcm2835_spi_dma_begin: Unable to open /dev/vcio: %s\n", strerror(errno));
+	return 0;
+    }
+
+    /* The DMA engine sees memory through the L2 cache on RPi 1 only */
+    flags = (bcm2835_peripherals_base == BCM2835_PERI_BASE)
+	? BCM2835_MBOX_MEM_FLAG_L1_NONALLOCATING : BCM2835_MBOX_MEM_FLAG_DIRECT;
+    bcm2835_spi_dma.handle = bcm2835_mbox_property(bcm2835_spi_dma.mbox_fd,
+						   BCM2835_MBOX_TAG_MEM_ALLOC, 3,
+						   size, BCM2835_PAGE_SIZE, flags);
+    if (bcm2835_spi_dma.handle == 0)
+	goto fail;
+
+    bcm2835_spi_dma.bus = bcm2835_mbox_property(bcm2835_spi_dma.mbox_fd,
+						BCM2835_MBOX_TAG_MEM_LOCK, 1,
+						bcm2835_spi_dma.handle, 0, 0);
+    if (bcm2835_spi_dma.bus == 0)
+	goto fail;
+
+    if ((memfd = open("/dev/mem", O_RDWR | O_SYNC)) < 0)
+	goto fail;
+    mem = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, memfd,
+	       (off_t)(bcm2835_spi_dma.bus & ~0xC0000000));
+    close(memfd);
+    if (mem == MAP_FAILED)
+	goto fail;
+    bcm2835_spi_dma.virt = (uint8_t*)mem;
+
+    bcm2835_peri_set_bits(bcm2835_dma + BCM2835_DMA_ENABLE/4,
+			  (1 << tx_channel) | (1 << rx_channel),
+			  (1 << tx_channel) | (1 << rx_channel));
+    bcm2835_dma_reset(tx_channel);
+    bcm2835_dma_reset(rx_channel);
+
+    return 1; /* OK */
+
+fail:
+    fprintf(stderr, "bcm2835_spi_dma_begin: Unable to allocate DMA memory\n");
+    bcm2835_spi_dma_end();
+    return 0;
+}
+
+void bcm2835_spi_dma_end(void)
+{
+    if (debug)
+    {
+	free(bcm2835_spi_dma.virt);
+	bcm2835_spi_dma.virt = NULL;
+	return;
+    }
+
+    if (bcm2835_spi_dma.virt != NULL)
+    {
+	bcm2835_dma_reset(bcm2835_spi_dma.tx_channel);
+	bcm2835_dma_reset(bcm2835_spi_dma.rx_channel);
+	munmap(bcm2835_spi_dma.virt, BCM2835_SPI_DMA_BUFFER_SIZE);
+	bcm2835_spi_dma.virt = NULL;
+    }
+    if (bcm2835_spi_dma.mbox_fd >= 0)
+    {
+	if (bcm2835_spi_dma.bus)
+	    bcm2835_mbox_property(bcm2835_spi_dma.mbox_fd, BCM2835_MBOX_TAG_MEM_UNLOCK, 1,
+				  bcm2835_spi_dma.handle, 0, 0);
+	if (bcm2835_spi_dma.handle)
+	    bcm2835_mbox_property(bcm2835_spi_dma.mbox_fd, BCM2835_MBOX_TAG_MEM_RELEASE, 1,
+				  bcm2835_spi_dma.handle, 0, 0);
+	close(bcm2835_spi_dma.mbox_fd);
+    }
+    bcm2835_spi_dma.mbox_fd = -1;
+    bcm2835_spi_dma.handle = 0;
+    bcm2835_spi_dma.bus = 0;
+}
+
+uint32_t bcm2835_spi_dma_start(const char* buf, uint32_t len)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+    bcm2835DMAControlBlock *tx_cbs = (bcm2835DMAControlBlock*)bcm2835_spi_dma.virt;
+    bcm2835DMAControlBlock *rx_cbs = tx_cbs + BCM2835_SPI_DMA_MAX_CBS;
+    uint32_t offset = BCM2835_SPI_DMA_DATA;
+    uint32_t queued = 0;
+    uint32_t header;
+    uint32_t words;
+    uint32_t n, i;
+    uint8_t *data;
+    uint32_t cs;
+    int cb = 0;
+
+    if (bcm2835_spi_dma.virt == NULL || len == 0)
+	return 0;
+
+    cs = bcm2835_peri_read(paddr);
+    header = (cs & (BCM2835_SPI0_CS_CSPOL | BCM2835_SPI0_CS_CPOL | BCM2835_SPI0_CS_CPHA | BCM2835_SPI0_CS_CS))
+	| BCM2835_SPI0_CS_TA;
+
+    while (queued < len && cb < BCM2835_SPI_DMA_MAX_CBS)
+    {
+	if (offset + 8 > BCM2835_SPI_DMA_BUFFER_SIZE)
+	    break;
+	n = MIN(len - queued, BCM2835_SPI_DMA_CHUNK);
+	if (offset + 4 + ((n + 3) & ~3) > BCM2835_SPI_DMA_BUFFER_SIZE)
+	    n = (BCM2835_SPI_DMA_BUFFER_SIZE - offset - 4) & ~3;
+	if (n == 0)
+	    break;
+	words = (n + 3) / 4;
+
+	*(uint32_t*)(bcm2835_spi_dma.virt + offset) = (n << 16) | header;
+	data = bcm2835_spi_dma.virt + offset + 4;
+	if (bcm2835_spi_bit_order == BCM2835_SPI_BIT_ORDER_LSBFIRST)
+	{
+	    for (i = 0; i < n; i++)
+		data[i] = bcm2835_byte_reverse_table[(uint8_t)buf[queued + i]];
+	}
+	else
+	{
+	    memcpy(data, buf + queued, n);
+	}
+
+	tx_cbs[cb].ti = BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_TX) | BCM2835_DMA_TI_DEST_DREQ
+	    | BCM2835_DMA_TI_SRC_INC | BCM2835_DMA_TI_WAIT_RESP;
+	tx_cbs[cb].source_ad = bcm2835_spi_dma_bus(bcm2835_spi_dma.virt + offset);
+	tx_cbs[cb].dest_ad   = BCM2835_PERI_BUS_BASE + BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO;
+	tx_cbs[cb].txfr_len  = 4 + words * 4;
+	tx_cbs[cb].stride    = 0;
+	tx_cbs[cb].nextconbk = 0;
+
+	rx_cbs[cb].ti = BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_RX) | BCM2835_DMA_TI_SRC_DREQ;
+	rx_cbs[cb].source_ad = BCM2835_PERI_BUS_BASE + BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO;
+	rx_cbs[cb].dest_ad   = bcm2835_spi_dma_bus(bcm2835_spi_dma.virt + BCM2835_SPI_DMA_DUMMY);
+	rx_cbs[cb].txfr_len  = words * 4;
+	rx_cbs[cb].stride    = 0;
+	rx_cbs[cb].nextconbk = 0;
+
+	if (cb > 0)
+	{
+	    tx_cbs[cb - 1].nextconbk = bcm2835_spi_dma_bus(&tx_cbs[cb]);
+	    rx_cbs[cb - 1].nextconbk = bcm2835_spi_dma_bus(&rx_cbs[cb]);
+	}
+
+	queued += n;
+	offset += 4 + words * 4;
+	cb++;
+    }
+
+    bcm2835_spi_dma.error = 0;
+
+    /* Sleep in bcm2835_spi_dma_wait until shortly before the last byte goes out */
+    {
+	uint64_t ns = bcm2835_spi_transfer_ns(queued + 4 * cb);
+	clock_gettime(CLOCK_MONOTONIC, &bcm2835_spi_dma.deadline);
+	ns = ns > BCM2835_SPI_WAIT_TAIL_NS ? ns - BCM2835_SPI_WAIT_TAIL_NS : 0;
+	ns += bcm2835_timespec_ns(&bcm2835_spi_dma.deadline);
+	bcm2835_spi_dma.deadline.tv_sec  = (time_t)(ns / 1000000000ULL);
+	bcm2835_spi_dma.deadline.tv_nsec = (long)(ns % 1000000000ULL);
+    }
+
+    if (debug)
+    {
+	bcm2835_spi_dma.error = !bcm2835_spi_dma_model(bcm2835_spi_dma_bus(tx_cbs),
+							bcm2835_spi_dma_bus(rx_cbs));
+	return queued;
+    }
+
+    /* Clear TX and RX fifos and hand the FIFO over to the DREQs */
+    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_DMAEN | BCM2835_SPI0_CS_ADCS | BCM2835_SPI0_CS_CLEAR,
+			  BCM2835_SPI0_CS_DMAEN | BCM2835_SPI0_CS_ADCS | BCM2835_SPI0_CS_CLEAR | BCM2835_SPI0_CS_TA);
+
+    /* Start the receiver first so it is ready for the first byte */
+    bcm2835_peri_write(bcm2835_dma_channel(bcm2835_spi_dma.rx_channel) + BCM2835_DMA_CONBLK_AD/4,
+		       bcm2835_spi_dma_bus(rx_cbs));
+    bcm2835_peri_write(bcm2835_dma_channel(bcm2835_spi_dma.rx_channel) + BCM2835_DMA_CS/4,
+		       BCM2835_DMA_CS_ACTIVE | BCM2835_DMA_CS_END | BCM2835_DMA_CS_WAIT_WRITES
+		       | BCM2835_DMA_CS_PRIORITY(8) | BCM2835_DMA_CS_PANIC_PRIORITY(8));
+    bcm2835_peri_write(bcm2835_dma_channel(bcm2835_spi_dma.tx_channel) + BCM2835_DMA_CONBLK_AD/4,
+		       bcm2835_spi_dma_bus(tx_cbs));
+    bcm2835_peri_write(bcm2835_dma_channel(bcm2835_spi_dma.tx_channel) + BCM2835_DMA_CS/4,
+		       BCM2835_DMA_CS_ACTIVE | BCM2835_DMA_CS_END | BCM2835_DMA_CS_WAIT_WRITES
+		       | BCM2835_DMA_CS_PRIORITY(8) | BCM2835_DMA_CS_PANIC_PRIORITY(8));
+
+    return queued;
+}
+
+int bcm2835_spi_dma_wait(void)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+    volatile uint32_t* tx = bcm2835_dma_channel(bcm2835_spi_dma.tx_channel) + BCM2835_DMA_CS/4;
+    volatile uint32_t* rx = bcm2835_dma_channel(bcm2835_spi_dma.rx_channel) + BCM2835_DMA_CS/4;
+    uint32_t status;
+    struct timespec t0, t1;
+
+    if (debug == BCM2835_DEBUG_PRINT)
+	return !bcm2835_spi_dma.error;
+    if (debug)
+    {
+	/* Trace mode: the peripheral model drains the FIFO, wait for it like the CPU would */
+	while (!(bcm2835_peri_read_nb(paddr) & BCM2835_SPI0_CS_DONE))
+	    bcm2835_spi_done_spins++;
+	bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_DMAEN | BCM2835_SPI0_CS_ADCS | BCM2835_SPI0_CS_TA);
+	return !bcm2835_spi_dma.error;
+    }
+
+    /* Give the CPU away for the predicted bulk of the transfer */
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (bcm2835_timespec_ns(&t0) < bcm2835_timespec_ns(&bcm2835_spi_dma.deadline))
+    {
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &bcm2835_spi_dma.deadline, NULL) == EINTR)
+	    ;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	bcm2835_spi_dma.sleep_ns += bcm2835_timespec_ns(&t1) - bcm2835_timespec_ns(&t0);
+	t0 = t1;
+    }
+
+    /* The RX channel finishes last: once it has drained the final word
+    // every byte has been clocked out, so there is no need to wait for DONE
+    */
+    while ((status = bcm2835_peri_read(rx)) & BCM2835_DMA_CS_ACTIVE)
+    {
+	bcm2835_spi_done_spins++;
+	if ((status | bcm2835_peri_read(tx)) & BCM2835_DMA_CS_ERROR)
+	{
+	    bcm2835_spi_dma.error = 1;
+	    bcm2835_dma_reset(bcm2835_spi_dma.tx_channel);
+	    bcm2835_dma_reset(bcm2835_spi_dma.rx_channel);
+	    break;
+	}
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    bcm2835_spi_dma.poll_ns += bcm2835_timespec_ns(&t1) - bcm2835_timespec_ns(&t0);
+
+    bcm2835_peri_write(tx, BCM2835_DMA_CS_END);
+    bcm2835_peri_write(rx, BCM2835_DMA_CS_END);
+
+    /* Take SPI0 back out of DMA mode, and also set the barrier */
+    bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_DMAEN | BCM2835_SPI0_CS_ADCS | BCM2835_SPI0_CS_TA);
+
+    return !bcm2835_spi_dma.error;
+}
+
+void bcm2835_spi_dma_wait_time(uint64_t* sleep_ns, uint64_t* poll_ns)
+{
+    if (sleep_ns)
+	*sleep_ns = bcm2835_spi_dma.sleep_ns;
+    if (poll_ns)
+	*poll_ns = bcm2835_spi_dma.poll_ns;
+}
+
+void bcm2835_spi_wait_spins(uint64_t* fifo_spins, uint64_t* done_spins)
+{
+    if (fifo_spins)
+	*fifo_spins = bcm2835_spi_fifo_spins;
+    if (done_spins)
+	*done_spins = bcm2835_spi_done_spins;
+}
+
+void bcm2835_spi_dma_writenb(const char* buf, uint32_t len)
+{
+    uint32_t queued;
+
+    if (bcm2835_spi_dma.virt == NULL)
+    {
+	bcm2835_spi_writenb(buf, len);
+	return;
+    }
+
+    while (len > 0)
+    {
+	queued = bcm2835_spi_dma_start(buf, len);
+	if (!bcm2835_spi_dma_wait() || queued == 0)
+	    break;
+	buf += queued;
+	len -= queued;
+    }
+}
+
 int bcm2835_aux_spi_begin(void)
 {
     volatile uint32_t* enable = bcm2835_aux + BCM2835_AUX_ENABLE/4;
@@ -1053,6 +1897,81 @@ void bcm2835_aux_spi_writenb(const char *tbuf, uint32_t len) {
     }
 }
 
+/* Writes to AUX SPI keeping the TX FIFO full: one STAT read per iteration,
+   the RX FIFO is drained as it fills and only the end of the transfer waits */
+void bcm2835_aux_spi_writenb_pipelined(const char *tbuf, uint32_t len) {
+    volatile uint32_t* cntl0 = bcm2835_spi1 + BCM2835_AUX_SPI_CNTL0/4;
+    volatile uint32_t* cntl1 = bcm2835_spi1 + BCM2835_AUX_SPI_CNTL1/4;
+    volatile uint32_t* stat = bcm2835_spi1 + BCM2835_AUX_SPI_STAT/4;
+    volatile uint32_t* txhold = bcm2835_spi1 + BCM2835_AUX_SPI_TXHOLD/4;
+    volatile uint32_t* io = bcm2835_spi1 + BCM2835_AUX_SPI_IO/4;
+
+    const uint8_t *tx = (const uint8_t *) tbuf;
+    uint32_t tx_len = len;
+    uint32_t pending = 0; /* words written but not yet read back */
+    uint32_t count;
+    uint32_t data;
+    uint32_t _stat;
+
+    uint32_t _cntl0 = (spi1_speed << BCM2835_AUX_SPI_CNTL0_SPEED_SHIFT);
+    _cntl0 |= BCM2835_AUX_SPI_CNTL0_CS2_N;
+    _cntl0 |= BCM2835_AUX_SPI_CNTL0_ENABLE;
+    _cntl0 |= BCM2835_AUX_SPI_CNTL0_MSBF_OUT;
+    _cntl0 |= BCM2835_AUX_SPI_CNTL0_VAR_WIDTH;
+
+    bcm2835_peri_write(cntl0, _cntl0);
+    bcm2835_peri_write(cntl1, BCM2835_AUX_SPI_CNTL1_MSBF_IN);
+
+    while (tx_len > 0 || pending > 0) {
+	_stat = bcm2835_peri_read(stat);
+
+	/* The RX FIFO must not fill up, or the shifter stalls */
+	if (pending > 0 && !(_stat & BCM2835_AUX_SPI_STAT_RX_EMPTY)) {
+	    (void) bcm2835_peri_read_nb(io);
+	    pending--;
+	}
+
+	if (tx_len > 0 && !(_stat & BCM2835_AUX_SPI_STAT_TX_FULL)) {
+	    count = MIN(tx_len, 3);
+	    switch (count) {
+	    case 3:
+		data = ((uint32_t) tx[0] << 16) | ((uint32_t) tx[1] << 8) | tx[2];
+		break;
+	    case 2:
+		data = ((uint32_t) tx[0] << 16) | ((uint32_t) tx[1] << 8);
+		break;
+	    default:
+		data = (uint32_t) tx[0] << 16;
+		break;
+	    }
+	    data |= (count * 8) << 24;
+	    tx += count;
+	    tx_len -= count;
+
+	    /* TXHOLD keeps CE2 asserted, the last word through IO releases it */
+	    if (tx_len != 0) {
+		bcm2835_peri_write_nb(txhold, data);
+	    } else {
+		bcm2835_peri_write_nb(io, data);
+	    }
+	    pending++;
+	} else if (tx_len > 0) {
+	    bcm2835_aux_spi_fifo_spins++;
+	}
+    }
+
+    while (bcm2835_peri_read(stat) & BCM2835_AUX_SPI_STAT_BUSY)
+	bcm2835_aux_spi_done_spins++;
+}
+
+void bcm2835_aux_spi_wait_spins(uint64_t* fifo_spins, uint64_t* done_spins)
+{
+    if (fifo_spins)
+	*fifo_spins = bcm2835_aux_spi_fifo_spins;
+    if (done_spins)
+	*done_spins = bcm2835_aux_spi_done_spins;
+}
+
 void bcm2835_aux_spi_transfernb(const char *tbuf, char *rbuf, uint32_t len) {
     volatile uint32_t* cntl0 = bcm2835_spi1 + BCM2835_AUX_SPI_CNTL0/4;
     volatile uint32_t* cntl1 = bcm2835_spi1 + BCM2835_AUX_SPI_CNTL1/4;
@@ -1780,6 +2699,7 @@ int bcm2835_init(void)
 	bcm2835_st   = bcm2835_peripherals + BCM2835_ST_BASE/4;
 	bcm2835_aux  = bcm2835_peripherals + BCM2835_AUX_BASE/4;
 	bcm2835_spi1 = bcm2835_peripherals + BCM2835_SPI1_BASE/4;
+	bcm2835_dma  = bcm2835_peripherals + BCM2835_DMA_BASE/4;
 
 	return 1; /* Success */
     }
@@ -1873,6 +2793,7 @@ int bcm2835_init(void)
       bcm2835_st   = bcm2835_peripherals + BCM2835_ST_BASE/4;
       bcm2835_aux  = bcm2835_peripherals + BCM2835_AUX_BASE/4;
       bcm2835_spi1 = bcm2835_peripherals + BCM2835_SPI1_BASE/4;
+      bcm2835_dma  = bcm2835_peripherals + BCM2835_DMA_BASE/4;
 
       ok = 1;
     }
@@ -1922,6 +2843,7 @@ int bcm2835_close(void)
     bcm2835_st   = MAP_FAILED;
     bcm2835_aux  = MAP_FAILED;
     bcm2835_spi1 = MAP_FAILED;
+    bcm2835_dma  = MAP_FAILED;
     return 1; /* Success */
 }    
 
@@ -618,6 +618,8 @@
   /   Base Address of the System Timer registers
 */
 #define BCM2835_ST_BASE					0x3000
+/*! Base Address of the DMA controller registers (channels 0 to 14) */
+#define BCM2835_DMA_BASE				0x7000
 /*! Base Address of the Pads registers */
 #define BCM2835_GPIO_PADS               0x100000
 /*! Base Address of the Clock/timer registers */
@@ -701,6 +703,11 @@ extern volatile uint32_t *bcm2835_aux;
 */
 extern volatile uint32_t *bcm2835_spi1;
 
+/*! Base of the DMA controller registers.
+  Available after bcm2835_init has been called (as root)
+*/
+extern volatile uint32_t *bcm2835_dma;
+
 
 /*! \brief bcm2835RegisterBase
   Register bases for bcm2835_regbase()
@@ -716,7 +723,8 @@ typedef enum
     BCM2835_REGBASE_BSC0 = 7, /*!< Base of the BSC0 registers. */
     BCM2835_REGBASE_BSC1 = 8,  /*!< Base of the BSC1 registers. */
 	BCM2835_REGBASE_AUX  = 9,  /*!< Base of the AUX registers. */
-	BCM2835_REGBASE_SPI1 = 10  /*!< Base of the SPI1 registers. */
+	BCM2835_REGBASE_SPI1 = 10, /*!< Base of the SPI1 registers. */
+	BCM2835_REGBASE_DMA  = 11  /*!< Base of the DMA controller registers. */
 } bcm2835RegisterBase;
 
 /*! Size of memory page on RPi */
@@ -989,6 +997,11 @@ typedef enum
 #define BCM2835_SPI0_LTOH                    0x0010 /*!< SPI LOSSI mode TOH */
 #define BCM2835_SPI0_DC                      0x0014 /*!< SPI DMA DREQ Controls */
 
+/*! Depth of the SPI0 TX and RX FIFOs in polled mode, in bytes */
+#define BCM2835_SPI0_FIFO_SIZE               64
+/*! Number of bytes in the RX FIFO when BCM2835_SPI0_CS_RXR is set */
+#define BCM2835_SPI0_FIFO_SIZE_3_4           48
+
 /* Register masks for SPI0_CS */
 #define BCM2835_SPI0_CS_LEN_LONG             0x02000000 /*!< Enable Long data word in Lossi mode if DMA_LEN is set */
 #define BCM2835_SPI0_CS_DMA_LEN              0x01000000 /*!< Enable DMA mode in Lossi mode */
@@ -1017,6 +1030,118 @@ typedef enum
 #define BCM2835_SPI0_CS_CPHA                 0x00000004 /*!< Clock Phase */
 #define BCM2835_SPI0_CS_CS                   0x00000003 /*!< Chip Select */
 
+/*! D/C bit of a FIFO write in LoSSI mode: 0 for a command, 1 for a parameter */
+#define BCM2835_SPI0_LOSSI_DC                0x00000100
+
+/* Defines for DMA
+   Register offsets from BCM2835_DMA_BASE, per 4.2.1 DMA Controller Register Map.
+   Each channel has its own register block, BCM2835_DMA_CHANNEL_SIZE bytes apart.
+*/
+#define BCM2835_DMA_CHANNEL_SIZE             0x0100 /*!< Distance between channel register blocks */
+#define BCM2835_DMA_CS                       0x0000 /*!< DMA Channel Control and Status */
+#define BCM2835_DMA_CONBLK_AD                0x0004 /*!< DMA Channel Control Block Address */
+#define BCM2835_DMA_TI                       0x0008 /*!< DMA Channel Transfer Information (from CB) */
+#define BCM2835_DMA_SOURCE_AD                0x000c /*!< DMA Channel Source Address (from CB) */
+#define BCM2835_DMA_DEST_AD                  0x0010 /*!< DMA Channel Destination Address (from CB) */
+#define BCM2835_DMA_TXFR_LEN                 0x0014 /*!< DMA Channel Transfer Length (from CB) */
+#define BCM2835_DMA_NEXTCONBK                0x001c /*!< DMA Channel Next Control Block Address */
+#define BCM2835_DMA_DEBUG                    0x0020 /*!< DMA Channel Debug */
+#define BCM2835_DMA_ENABLE                   0x0ff0 /*!< Global channel enable bits */
+
+/* Register masks for DMA_CS */
+#define BCM2835_DMA_CS_RESET                 0x80000000 /*!< Reset the channel */
+#define BCM2835_DMA_CS_ABORT                 0x40000000 /*!< Abort the current control block */
+#define BCM2835_DMA_CS_WAIT_WRITES           0x10000000 /*!< Wait for outstanding writes */
+#define BCM2835_DMA_CS_PANIC_PRIORITY(x)     (((x) & 0xf) << 20) /*!< AXI panic priority */
+#define BCM2835_DMA_CS_PRIORITY(x)           (((x) & 0xf) << 16) /*!< AXI priority */
+#define BCM2835_DMA_CS_ERROR                 0x00000100 /*!< Channel has an error */
+#define BCM2835_DMA_CS_END                   0x00000002 /*!< Set when a control block completes, write 1 to clear */
+#define BCM2835_DMA_CS_ACTIVE                0x00000001 /*!< Channel is active */
+
+/* Register masks for DMA_TI */
+#define BCM2835_DMA_TI_NO_WIDE_BURSTS        0x04000000 /*!< Don't do wide writes as 2 beat bursts */
+#define BCM2835_DMA_TI_PERMAP(x)             (((x) & 0x1f) << 16) /*!< Peripheral mapping (DREQ) */
+#define BCM2835_DMA_TI_SRC_DREQ              0x00000400 /*!< Source reads paced by DREQ */
+#define BCM2835_DMA_TI_SRC_INC               0x00000100 /*!< Increment source address */
+#define BCM2835_DMA_TI_DEST_DREQ             0x00000040 /*!< Destination writes paced by DREQ */
+#define BCM2835_DMA_TI_DEST_INC              0x00000010 /*!< Increment destination address */
+#define BCM2835_DMA_TI_WAIT_RESP             0x00000008 /*!< Wait for write response */
+#define BCM2835_DMA_TI_INTEN                 0x00000001 /*!< Interrupt enable */
+
+/* DREQ peripheral numbers for DMA_TI_PERMAP, per 4.2.1.3 */
+#define BCM2835_DMA_DREQ_SPI_TX              6 /*!< SPI0 TX DREQ */
+#define BCM2835_DMA_DREQ_SPI_RX              7 /*!< SPI0 RX DREQ */
+
+/*! Peripherals as seen from the DMA engine (VideoCore bus addresses) */
+#define BCM2835_PERI_BUS_BASE                0x7E000000
+/*! Largest number of bytes SPI0 can send for one DLEN header word */
+#define BCM2835_SPI_DMA_CHUNK                0xFFFC
+/*! Size of the DMA visible memory allocated by bcm2835_spi_dma_begin() */
+#define BCM2835_SPI_DMA_BUFFER_SIZE          (256*1024)
+/*! Polling tail of bcm2835_spi_dma_wait(): it sleeps until this long before the
+  predicted end of the transfer, then polls. Covers scheduler wakeup latency. */
+#define BCM2835_SPI_WAIT_TAIL_NS             200000
+
+/*! \brief bcm2835DMAControlBlock
+  DMA control block, as read by the DMA engine. Must be 32 byte aligned in
+  memory that the VideoCore can see, and is addressed by bus address.
+*/
+typedef struct
+{
+    uint32_t ti;          /*!< Transfer information, BCM2835_DMA_TI_* */
+    uint32_t source_ad;   /*!< Source bus address */
+    uint32_t dest_ad;     /*!< Destination bus address */
+    uint32_t txfr_len;    /*!< Transfer length in bytes */
+    uint32_t stride;      /*!< 2D mode stride, unused */
+    uint32_t nextconbk;   /*!< Bus address of the next control block, 0 to stop */
+    uint32_t reserved[2];
+} bcm2835DMAControlBlock;
+
+/*! \brief bcm2835DebugMode
+  Values for bcm2835_set_debug()
+*/
+#define BCM2835_DEBUG_PRINT     1  /*!< printf every register access */
+#define BCM2835_DEBUG_TRACE     2  /*!< Record every register access in the trace ring, no output */
+
+/*! \brief bcm2835TraceFlags
+  Flags of a bcm2835TraceEntry
+*/
+#define BCM2835_TRACE_READ      0x01  /*!< Register read, value is what was returned */
+#define BCM2835_TRACE_WRITE     0x02  /*!< Register write */
+#define BCM2835_TRACE_BARRIER   0x04  /*!< Access with memory barrier (bcm2835_peri_read/write) */
+#define BCM2835_TRACE_DMA       0x08  /*!< Word moved by the DMA engine rather than the CPU */
+
+/*! Magic and version at the start of a file written by bcm2835_trace_dump() */
+#define BCM2835_TRACE_MAGIC     "BCMTRACE"
+#define BCM2835_TRACE_VERSION   1
+/*! Ring size used when bcm2835_set_debug(BCM2835_DEBUG_TRACE) is called without bcm2835_trace_begin() */
+#define BCM2835_TRACE_DEFAULT_ENTRIES  (1 << 20)
+
+/*! \brief bcm2835TraceEntry
+  One recorded register access. A trace file is the 8 byte BCM2835_TRACE_MAGIC,
+  a uint32_t version, a uint32_t entry count, then the entries oldest first,
+  all in host byte order.
+*/
+typedef struct
+{
+    uint32_t seq;         /*!< Sequence number, counts every access since bcm2835_trace_begin() */
+    uint32_t offset;      /*!< Register offset from the peripheral base, e.g. BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO */
+    uint32_t value;       /*!< Value written or returned */
+    uint32_t flags;       /*!< BCM2835_TRACE_* */
+} bcm2835TraceEntry;
+
+/*! \brief bcm2835PeriModel
+  Peripheral model that answers register accesses in BCM2835_DEBUG_TRACE mode,
+  installed with bcm2835_trace_set_model(). Offsets are as in bcm2835TraceEntry,
+  flags are BCM2835_TRACE_BARRIER and BCM2835_TRACE_DMA.
+*/
+typedef struct
+{
+    uint32_t (*read)(void* self, uint32_t offset, uint32_t flags);               /*!< Returns the register value */
+    void     (*write)(void* self, uint32_t offset, uint32_t value, uint32_t flags); /*!< Register written */
+    void*    self;                                                               /*!< Passed to read and write */
+} bcm2835PeriModel;
+
 /*! \brief bcm2835SPIBitOrder SPI Bit order
   Specifies the SPI data bit ordering for bcm2835_spi_setBitOrder()
 */
@@ -1251,10 +1376,13 @@ extern "C" {
     extern int bcm2835_close(void);
 
     /*! Sets the debug level of the library.
-      A value of 1 prevents mapping to /dev/mem, and makes the library print out
+      A value of 1 (BCM2835_DEBUG_PRINT) prevents mapping to /dev/mem, and makes the library print out
       what it would do, rather than accessing the GPIO registers.
+      A value of 2 (BCM2835_DEBUG_TRACE) also prevents mapping to /dev/mem, but records every
+      register access in an in-memory ring instead of printing it, see bcm2835_trace_begin().
       A value of 0, the default, causes normal operation.
       Call this before calling bcm2835_init();
+      Has no effect if the library was built with BCM2835_NO_DEBUG defined.
       \param[in] debug The new debug level. 1 means debug
     */
     extern void  bcm2835_set_debug(uint8_t debug);
@@ -1264,6 +1392,37 @@ extern "C" {
     */
     extern unsigned int bcm2835_version(void);
 
+    /*! Allocates the trace ring used by BCM2835_DEBUG_TRACE and resets the sequence number.
+      When the ring is full the oldest entries are overwritten.
+      In trace mode reads are answered by a minimal model of idle peripherals: SPI0 and
+      AUX SPI complete every transfer instantly and receive one byte per byte sent,
+      DMA transfers to the SPI0 FIFO are recorded word by word, other registers read 0.
+      \param[in] entries Ring size, rounded up to a power of 2
+      \return 1 if successful, 0 otherwise
+    */
+    extern int bcm2835_trace_begin(uint32_t entries);
+
+    /*! Frees the trace ring. */
+    extern void bcm2835_trace_end(void);
+
+    /*! Returns the number of accesses recorded since bcm2835_trace_begin(),
+      including any that have been overwritten.
+    */
+    extern uint32_t bcm2835_trace_count(void);
+
+    /*! Writes the entries still held in the ring to a file, oldest first.
+      Use the bcm2835_tracedump tool to decode it.
+      \param[in] path File to write
+      \return 1 if successful, 0 otherwise
+    */
+    extern int bcm2835_trace_dump(const char* path);
+
+    /*! Replaces the built in idle peripheral model used in trace mode, for example
+      with the cycle approximate simulator in bcm2835_sim.h. Accesses are still recorded.
+      \param[in] model Model to copy, or NULL to restore the idle model
+    */
+    extern void bcm2835_trace_set_model(const bcm2835PeriModel* model);
+
     /*! @} */
 
     /*! \defgroup lowlevel Low level register access
@@ -1714,6 +1873,53 @@ extern "C" {
     */
     extern void bcm2835_spi_writenb(const char* buf, uint32_t len);
 
+    /*! Starts an SPI transaction on the currently selected SPI slave.
+      Clears the FIFOs and sets TA, so the currently selected CS pins stay asserted
+      across any number of bcm2835_spi_transaction_writenb() calls until
+      bcm2835_spi_transaction_end(). Use this to send a command and its parameters
+      as one transaction, switching a D/C GPIO between the phases.
+      \sa bcm2835_spi_transaction_end()
+    */
+    extern void bcm2835_spi_transaction_begin(void);
+
+    /*! Transfers any number of bytes inside a transaction started by
+      bcm2835_spi_transaction_begin(). Returns once every byte has been clocked out,
+      so it is safe to change a D/C GPIO before the next call.
+      \param[in] buf Buffer of bytes to send.
+      \param[in] len Number of bytes in the buf buffer, and the number of bytes to send
+    */
+    extern void bcm2835_spi_transaction_writenb(const char* buf, uint32_t len);
+
+    /*! Transfers any number of bytes to and from the slave inside a transaction started
+      by bcm2835_spi_transaction_begin(), without releasing CS. Use this to read back
+      the response of a command sent with bcm2835_spi_transaction_writenb().
+      \param[in] tbuf Buffer of bytes to send.
+      \param[out] rbuf Received bytes will by put in this buffer
+      \param[in] len Number of bytes in the tbuf buffer, and the number of bytes to send/received
+      \sa bcm2835_spi_transfernb()
+    */
+    extern void bcm2835_spi_transaction_transfernb(const char* tbuf, char* rbuf, uint32_t len);
+
+    /*! Ends a transaction started by bcm2835_spi_transaction_begin(), releasing CS.
+    */
+    extern void bcm2835_spi_transaction_end(void);
+
+    /*! Enables or disables LoSSI mode on SPI0.
+      In LoSSI mode each byte is sent as a 9 bit word whose first bit tells the slave
+      whether it is a command (0) or a parameter (1), so no D/C GPIO is needed.
+      \param[in] enable 1 to enable LoSSI mode, 0 for normal 8 bit SPI
+      \sa bcm2835_spi_lossi_writenb()
+    */
+    extern void bcm2835_spi_setLoSSI(uint8_t enable);
+
+    /*! Transfers any number of bytes as LoSSI words inside a transaction started by
+      bcm2835_spi_transaction_begin(). Requires bcm2835_spi_setLoSSI(1).
+      \param[in] buf Buffer of bytes to send.
+      \param[in] len Number of bytes in the buf buffer, and the number of words to send
+      \param[in] dc D/C bit for every word: 0 for commands, 1 for parameters
+    */
+    extern void bcm2835_spi_lossi_writenb(const char* buf, uint32_t len, uint8_t dc);
+
     /*! Transfers half-word to the currently selected SPI slave.
       Asserts the currently selected CS pins (as previously set by bcm2835_spi_chipSelect)
       during the transfer.
@@ -1724,6 +1930,69 @@ extern "C" {
     */
     extern void bcm2835_spi_write(uint16_t data);
 
+    /*! Start DMA driven SPI0 transmits.
+      Allocates BCM2835_SPI_DMA_BUFFER_SIZE bytes of VideoCore memory through the mailbox
+      interface (/dev/vcio) and resets the two DMA channels. One channel feeds BCM2835_SPI0_FIFO
+      paced by the SPI TX DREQ, the other drains the RX FIFO paced by the SPI RX DREQ.
+      Call after bcm2835_spi_begin().
+      In debug mode the buffer is ordinary memory and the control block chains are run
+      by a software model of the DMA engine and SPI FIFO instead of the hardware.
+      \param[in] tx_channel DMA channel (0 to 14) used to feed the TX FIFO
+      \param[in] rx_channel DMA channel (0 to 14) used to drain the RX FIFO
+      \return 1 if successful, 0 otherwise (not root, no /dev/vcio, out of GPU memory)
+      \sa bcm2835_spi_dma_end()
+    */
+    extern int bcm2835_spi_dma_begin(uint8_t tx_channel, uint8_t rx_channel);
+
+    /*! End DMA driven SPI0 transmits.
+      Stops both DMA channels and returns the VideoCore memory.
+    */
+    extern void bcm2835_spi_dma_end(void);
+
+    /*! Queues a DMA transmit of up to one buffer worth of bytes to the currently selected SPI slave.
+      Builds one control block per BCM2835_SPI_DMA_CHUNK bytes for each channel, each TX block
+      prefixed with the DLEN/CS header word, and starts both channels. Returns immediately.
+      \param[in] buf Buffer of bytes to send.
+      \param[in] len Number of bytes in buf
+      \return the number of bytes queued, which may be less than len, or 0 if DMA is not available
+      \sa bcm2835_spi_dma_wait()
+    */
+    extern uint32_t bcm2835_spi_dma_start(const char* buf, uint32_t len);
+
+    /*! Waits for the transmit queued by bcm2835_spi_dma_start() to finish, and takes SPI0
+      back out of DMA mode. Sleeps for the predicted duration of the transfer and only
+      busy polls the last BCM2835_SPI_WAIT_TAIL_NS.
+      \return 1 if successful, 0 if a DMA channel reported an error
+    */
+    extern int bcm2835_spi_dma_wait(void);
+
+    /*! Transfers any number of bytes to the currently selected SPI slave using DMA.
+      Asserts the currently selected CS pins (as previously set by bcm2835_spi_chipSelect)
+      during the transfer. Falls back to bcm2835_spi_writenb() if bcm2835_spi_dma_begin()
+      has not succeeded.
+      \param[in] buf Buffer of bytes to send.
+      \param[in] len Number of bytes in the buf buffer, and the number of bytes to send
+      \sa bcm2835_spi_writenb()
+    */
+    extern void bcm2835_spi_dma_writenb(const char* buf, uint32_t len);
+
+    /*! Reports the time bcm2835_spi_dma_wait() has spent since bcm2835_spi_dma_begin().
+      The wait predicts the end of the transfer from the SPI0 clock divider and the
+      number of bytes queued, sleeps with clock_nanosleep() until BCM2835_SPI_WAIT_TAIL_NS
+      before it, and only busy polls the remaining tail. The sleep time is CPU time
+      handed to other threads.
+      \param[out] sleep_ns Total time slept, in ns. May be NULL.
+      \param[out] poll_ns Total time busy polling, in ns. May be NULL.
+    */
+    extern void bcm2835_spi_dma_wait_time(uint64_t* sleep_ns, uint64_t* poll_ns);
+
+    /*! Returns how often the SPI0 functions polled CS without making progress,
+      counted since the program started. Cheap enough to leave enabled.
+      \param[out] fifo_spins Polls that found the TX FIFO full. May be NULL.
+      \param[out] done_spins Polls waiting for DONE, or for the DMA to finish. May be NULL.
+    */
+    extern void bcm2835_spi_wait_spins(uint64_t* fifo_spins, uint64_t* done_spins);
+
     /*! Start AUX SPI operations.
       Forces RPi AUX SPI pins P1-38 (MOSI), P1-38 (MISO), P1-40 (CLK) and P1-36 (CE2)
       to alternate function ALT4, which enables those pins for SPI interface.
@@ -1764,6 +2033,24 @@ extern "C" {
     */
     extern void bcm2835_aux_spi_writenb(const char *buf, uint32_t len);
 
+    /*! Transfers any number of bytes to the AUX SPI slave, keeping the TX FIFO full.
+      Unlike bcm2835_aux_spi_writenb() this does not wait for each 24 bit word to be
+      shifted out before queueing the next one: the TX FIFO is refilled and the RX FIFO
+      drained as space becomes available, and only the end of the transfer is waited on.
+      Asserts the CE2 pin during the whole transfer.
+      \param[in] buf Buffer of bytes to send.
+      \param[in] len Number of bytes in the buf buffer, and the number of bytes to send
+      \sa bcm2835_aux_spi_writenb()
+    */
+    extern void bcm2835_aux_spi_writenb_pipelined(const char *buf, uint32_t len);
+
+    /*! Returns how often bcm2835_aux_spi_writenb_pipelined() polled STAT without making progress,
+      counted since the program started.
+      \param[out] fifo_spins Polls that found the TX FIFO full. May be NULL.
+      \param[out] done_spins Polls waiting for BUSY to clear. May be NULL.
+    */
+    extern void bcm2835_aux_spi_wait_spins(uint64_t* fifo_spins, uint64_t* done_spins);
+
     /*! Transfers any number of bytes to and from the AUX SPI slave
       using bcm2835_aux_spi_transfernb.
       The returned data from the slave replaces the transmitted data in the buffer.
@@ -0,0 +1,669 @@
+/* bcm2835_sim.c
+// Cycle approximate SPI0 / AUX SPI1 / GPIO model, see bcm2835_sim.h
+//
+// Time is kept in picoseconds. Words written to a TX FIFO are queued as runs
+// of equal words with the time they became available; the queue is only
+// shifted out lazily, up to the current time, when the CPU next looks at the
+// peripheral. A word that is still being shifted out already counts as
+// received, which makes RXD appear at most one word early.
+//
+// Accesses are serialised by one lock and share one clock, as if every thread
+// ran on the single core of a Pi Zero.
+*/
+
+#include <string.h>
+#include <pthread.h>
+
+#include "bcm2835.h"
+#include "bcm2835_sim.h"
+
+#define BCM2835_SIM_RUNS        256
+#define BCM2835_SIM_PS          1000000000000ULL
+
+#ifndef MAX
+#define MAX(a, b) (a > b ? a : b)
+#endif
+
+/* Run flags */
+#define BCM2835_SIM_RUN_CPU     0x01  /* Written by the CPU: takes TX FIFO space and lands in the RX FIFO */
+#define BCM2835_SIM_RUN_HOLD    0x02  /* CS stays asserted after each word */
+
+/* Polls repeating the same status are fast forwarded at most this many words */
+#define BCM2835_SIM_MAX_SKIP    (1 << 20)
+
+typedef struct
+{
+    uint64_t avail;         /* Time the words entered the FIFO */
+    uint64_t word_ps;       /* Wire time of one word */
+    uint32_t count;
+    uint8_t  bytes;         /* Bytes per word, for the statistics */
+    uint8_t  flags;
+} bcm2835SimRun;
+
+typedef struct
+{
+    bcm2835SimRun run[BCM2835_SIM_RUNS];
+    uint32_t head;
+    uint32_t runs;
+    uint32_t queued;        /* Words waiting to be shifted */
+    uint32_t queued_cpu;    /* ... of which occupy the TX FIFO */
+    uint32_t rx;            /* Words in the RX FIFO, including the one being shifted */
+    uint32_t fifo_size;
+    uint8_t  last_rx;       /* The word being shifted goes to the RX FIFO */
+    uint8_t  open;          /* CS is still asserted after the last word */
+    uint8_t  polled;        /* The last access to this controller was a status read ... */
+    uint32_t poll_value;    /* ... which returned this */
+    uint64_t shift_end;     /* End of the last word started */
+    uint64_t resume;        /* RX FIFO space was freed, a stalled shifter may restart */
+    uint64_t busy_ps;
+    uint64_t gap_ps;
+    uint64_t max_gap_ps;
+    uint64_t gaps;
+    uint64_t bytes;
+} bcm2835SimBus;
+
+static struct bcm2835_sim
+{
+    bcm2835SimTiming timing;
+    uint64_t now;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t barriers;
+
+    bcm2835SimBus spi0;
+    uint32_t spi0_cs;
+    uint32_t spi0_clk;
+    uint32_t spi0_dlen;
+    uint32_t spi0_dma_left; /* Bytes still expected after a DMA header word */
+
+    bcm2835SimBus spi1;
+    uint32_t spi1_cntl0;
+    uint32_t spi1_cntl1;
+    uint32_t aux_enable;
+
+    uint32_t gpio[BCM2835_BLOCK_SIZE / 4];
+
+    uint32_t te_pin;
+    uint8_t  te_polled;     /* The last access was a GPEDS read that found no TE edge */
+    uint64_t te_period_ps;  /* 0: no TE signal */
+    uint64_t te_high_ps;
+    uint64_t te_edge;       /* Index of the last rising edge accounted for */
+} bcm2835_sim;
+
+static pthread_mutex_t bcm2835_sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t bcm2835_sim_ns(uint64_t ps)
+{
+    return ps / 1000;
+}
+
+/* The model only runs in trace mode, which BCM2835_NO_DEBUG compiles out */
+#ifndef BCM2835_NO_DEBUG
+
+static const bcm2835SimTiming bcm2835_sim_default_timing =
+{
+    BCM2835_CORE_CLK_HZ, 120, 40, 40
+};
+
+static void bcm2835_sim_bus_reset(bcm2835SimBus* bus, uint32_t fifo_size)
+{
+    memset(bus, 0, sizeof(*bus));
+    bus->fifo_size = fifo_size;
+}
+
+/* Drops every word not yet on the wire */
+static void bcm2835_sim_bus_clear_tx(bcm2835SimBus* bus)
+{
+    bus->head = 0;
+    bus->runs = 0;
+    bus->queued = 0;
+    bus->queued_cpu = 0;
+}
+
+static void bcm2835_sim_bus_push(bcm2835SimBus* bus, uint32_t count, uint64_t word_ps, uint8_t bytes, uint8_t flags)
+{
+    bcm2835SimRun* tail;
+
+    if (bus->runs > 0)
+    {
+	tail = &bus->run[(bus->head + bus->runs - 1) % BCM2835_SIM_RUNS];
+	/* Merge into the last run if it is identical, or if the queue is full */
+	if ((tail->avail == bcm2835_sim.now && tail->word_ps == word_ps
+	     && tail->bytes == bytes && tail->flags == flags)
+	    || bus->runs == BCM2835_SIM_RUNS)
+	{
+	    tail->count += count;
+	    goto queued;
+	}
+    }
+
+    tail = &bus->run[(bus->head + bus->runs) % BCM2835_SIM_RUNS];
+    tail->avail = bcm2835_sim.now;
+    tail->word_ps = word_ps;
+    tail->count = count;
+    tail->bytes = bytes;
+    tail->flags = flags;
+    bus->runs++;
+
+queued:
+    bus->queued += count;
+    if (flags & BCM2835_SIM_RUN_CPU)
+	bus->queued_cpu += count;
+}
+
+/* Shifts out every word that starts before t */
+static void bcm2835_sim_bus_advance(bcm2835SimBus* bus, uint64_t t)
+{
+    bcm2835SimRun* r;
+    uint64_t start, gap;
+    uint32_t n;
+
+    while (bus->runs > 0)
+    {
+	r = &bus->run[bus->head];
+
+	/* A full RX FIFO stalls the shifter until the CPU reads it */
+	if ((r->flags & BCM2835_SIM_RUN_CPU) && bus->rx >= bus->fifo_size)
+	    break;
+
+	start = MAX(bus->shift_end, MAX(r->avail, bus->resume));
+	if (start >= t)
+	    break;
+
+	n = (uint32_t)MIN((uint64_t)r->count, (t - start + r->word_ps - 1) / r->word_ps);
+	if (r->flags & BCM2835_SIM_RUN_CPU)
+	    n = MIN(n, bus->fifo_size - bus->rx);
+
+	if (bus->open && start > bus->shift_end)
+	{
+	    gap = start - bus->shift_end;
+	    bus->gaps++;
+	    bus->gap_ps += gap;
+	    if (gap > bus->max_gap_ps)
+		bus->max_gap_ps = gap;
+	}
+
+	bus->shift_end = start + n * r->word_ps;
+	bus->busy_ps += n * r->word_ps;
+	bus->bytes += (uint64_t)n * r->bytes;
+	bus->queued -= n;
+	bus->last_rx = (r->flags & BCM2835_SIM_RUN_CPU) != 0;
+	if (bus->last_rx)
+	{
+	    bus->queued_cpu -= n;
+	    bus->rx += n;
+	}
+	bus->open = (r->flags & BCM2835_SIM_RUN_HOLD) != 0;
+
+	r->count -= n;
+	if (r->count == 0)
+	{
+	    bus->head = (bus->head + 1) % BCM2835_SIM_RUNS;
+	    bus->runs--;
+	}
+    }
+}
+
+/* Words the CPU can read at time t */
+static uint32_t bcm2835_sim_bus_rx(const bcm2835SimBus* bus, uint64_t t)
+{
+    if (bus->last_rx && bus->shift_end > t && bus->rx > 0)
+	return bus->rx - 1;
+    return bus->rx;
+}
+
+static int bcm2835_sim_bus_busy(const bcm2835SimBus* bus, uint64_t t)
+{
+    return bus->queued > 0 || bus->shift_end > t;
+}
+
+static void bcm2835_sim_bus_pop(bcm2835SimBus* bus, uint64_t t)
+{
+    if (bcm2835_sim_bus_rx(bus, t) == 0)
+	return;
+    if (bus->rx >= bus->fifo_size)
+	bus->resume = t;
+    bus->rx--;
+}
+
+/* Moves time forward one word at a time until status() changes.
+// Used when the CPU polls the same status twice in a row: the real loop would
+// have spun until then, only the number of iterations is lost.
+*/
+static void bcm2835_sim_bus_skip(bcm2835SimBus* bus, uint32_t (*status)(void), uint32_t value)
+{
+    uint32_t i;
+
+    for (i = 0; i < BCM2835_SIM_MAX_SKIP; i++)
+    {
+	/* Start the next word if one is ready */
+	bcm2835_sim_bus_advance(bus, bcm2835_sim.now + 1);
+	if (bus->shift_end <= bcm2835_sim.now)
+	    return;     /* Idle or stalled, only the CPU can change anything */
+	bcm2835_sim.now = bus->shift_end;
+	bcm2835_sim_bus_advance(bus, bcm2835_sim.now);
+	if (status() != value)
+	    return;
+    }
+}
+
+/* SPI0 */
+
+static uint64_t bcm2835_sim_spi0_byte_ps(void)
+{
+    uint64_t divider = bcm2835_sim.spi0_clk & 0xFFFF;
+    uint64_t bits = (bcm2835_sim.spi0_cs & BCM2835_SPI0_CS_LEN) ? 9 : 8;
+
+    if (divider == 0)
+	divider = 65536;
+    return bits * divider * BCM2835_SIM_PS / bcm2835_sim.timing.core_clk_hz;
+}
+
+static uint32_t bcm2835_sim_spi0_status(void)
+{
+    bcm2835SimBus* bus = &bcm2835_sim.spi0;
+    uint32_t rx = bcm2835_sim_bus_rx(bus, bcm2835_sim.now);
+    uint32_t cs = bcm2835_sim.spi0_cs;
+
+    if (!bcm2835_sim_bus_busy(bus, bcm2835_sim.now))
+	cs |= BCM2835_SPI0_CS_DONE;
+    if (bus->queued_cpu < BCM2835_SPI0_FIFO_SIZE)
+	cs |= BCM2835_SPI0_CS_TXD;
+    if (rx > 0)
+	cs |= BCM2835_SPI0_CS_RXD;
+    if (rx >= BCM2835_SPI0_FIFO_SIZE_3_4)
+	cs |= BCM2835_SPI0_CS_RXR;
+    if (rx >= BCM2835_SPI0_FIFO_SIZE)
+	cs |= BCM2835_SPI0_CS_RXF;
+    return cs;
+}
+
+static void bcm2835_sim_spi0_cs(uint32_t value)
+{
+    bcm2835SimBus* bus = &bcm2835_sim.spi0;
+
+    if (value & BCM2835_SPI0_CS_CLEAR_TX)
+	bcm2835_sim_bus_clear_tx(bus);
+    if (value & BCM2835_SPI0_CS_CLEAR_RX)
+    {
+	if (bus->rx >= bus->fifo_size)
+	    bus->resume = bcm2835_sim.now;
+	bus->rx = 0;
+	bus->last_rx = 0;
+    }
+    /* Dropping TA releases CS, the next word starts a new transfer */
+    if (!(value & BCM2835_SPI0_CS_TA))
+	bus->open = 0;
+
+    bcm2835_sim.spi0_cs = value & ~(BCM2835_SPI0_CS_CLEAR | BCM2835_SPI0_CS_RXF | BCM2835_SPI0_CS_RXR
+				    | BCM2835_SPI0_CS_TXD | BCM2835_SPI0_CS_RXD | BCM2835_SPI0_CS_DONE);
+}
+
+static void bcm2835_sim_spi0_fifo(uint32_t value, uint32_t flags)
+{
+    uint32_t n;
+
+    if (!(flags & BCM2835_TRACE_DMA))
+    {
+	bcm2835_sim_bus_push(&bcm2835_sim.spi0, 1, bcm2835_sim_spi0_byte_ps(), 1,
+			     BCM2835_SIM_RUN_CPU | BCM2835_SIM_RUN_HOLD);
+	return;
+    }
+
+    /* DMA: a header word sets DLEN and the low CS byte, then DLEN bytes follow packed 4 to a word */
+    if (bcm2835_sim.spi0_dma_left == 0)
+    {
+	bcm2835_sim.spi0_dma_left = value >> 16;
+	bcm2835_sim.spi0_dlen = value >> 16;
+	bcm2835_sim.spi0_cs = (bcm2835_sim.spi0_cs & ~0xFFu) | (value & 0xFF);
+	return;
+    }
+    n = MIN(bcm2835_sim.spi0_dma_left, 4);
+    bcm2835_sim.spi0_dma_left -= n;
+    bcm2835_sim_bus_push(&bcm2835_sim.spi0, n, bcm2835_sim_spi0_byte_ps(), 1, BCM2835_SIM_RUN_HOLD);
+}
+
+/* AUX SPI1 */
+
+static uint32_t bcm2835_sim_spi1_status(void)
+{
+    bcm2835SimBus* bus = &bcm2835_sim.spi1;
+    uint32_t rx = bcm2835_sim_bus_rx(bus, bcm2835_sim.now);
+    uint32_t stat = 0;
+
+    if (rx == 0)
+	stat |= BCM2835_AUX_SPI_STAT_RX_EMPTY;
+    if (rx >= bus->fifo_size)
+	stat |= BCM2835_AUX_SPI_STAT_RX_FULL;
+    if (bus->queued_cpu == 0)
+	stat |= BCM2835_AUX_SPI_STAT_TX_EMPTY;
+    if (bus->queued_cpu >= bus->fifo_size)
+	stat |= BCM2835_AUX_SPI_STAT_TX_FULL;
+    if (bcm2835_sim_bus_busy(bus, bcm2835_sim.now))
+	stat |= BCM2835_AUX_SPI_STAT_BUSY;
+    stat |= (bus->queued_cpu << 24) & BCM2835_AUX_SPI_STAT_TX_LVL;
+    stat |= (rx << 16) & BCM2835_AUX_SPI_STAT_RX_LVL;
+    return stat;
+}
+
+static void bcm2835_sim_spi1_write(uint32_t value, uint8_t hold)
+{
+    uint64_t speed = (bcm2835_sim.spi1_cntl0 & BCM2835_AUX_SPI_CNTL0_SPEED) >> BCM2835_AUX_SPI_CNTL0_SPEED_SHIFT;
+    uint64_t bits;
+
+    if (bcm2835_sim.spi1_cntl0 & BCM2835_AUX_SPI_CNTL0_VAR_WIDTH)
+	bits = (value >> 24) & 0x1F;
+    else
+	bits = bcm2835_sim.spi1_cntl0 & BCM2835_AUX_SPI_CNTL0_SHIFTLEN;
+    if (bits == 0)
+	return;
+
+    /* SPI clk = system_clock / (2 * (speed + 1)) */
+    bcm2835_sim_bus_push(&bcm2835_sim.spi1, 1,
+			 bits * 2 * (speed + 1) * BCM2835_SIM_PS / bcm2835_sim.timing.core_clk_hz,
+			 (uint8_t)(bits / 8), BCM2835_SIM_RUN_CPU | (hold ? BCM2835_SIM_RUN_HOLD : 0));
+}
+
+/* System timer, 1 MHz */
+
+static uint64_t bcm2835_sim_st(void)
+{
+    return bcm2835_sim.now / 1000000;
+}
+
+/* Tearing effect input: high for te_high_ps at the start of every period */
+
+static uint32_t bcm2835_sim_te_bit(void)
+{
+    return 1u << (bcm2835_sim.te_pin % 32);
+}
+
+static void bcm2835_sim_te_update(void)
+{
+    uint32_t bank = bcm2835_sim.te_pin / 32;
+    uint32_t* lev = &bcm2835_sim.gpio[BCM2835_GPLEV0 / 4 + bank];
+    uint64_t edge;
+
+    if (bcm2835_sim.te_period_ps == 0)
+	return;
+
+    edge = bcm2835_sim.now / bcm2835_sim.te_period_ps;
+    if (edge > bcm2835_sim.te_edge)
+    {
+	bcm2835_sim.te_edge = edge;
+	if (bcm2835_sim.gpio[BCM2835_GPREN0 / 4 + bank] & bcm2835_sim_te_bit())
+	    bcm2835_sim.gpio[BCM2835_GPEDS0 / 4 + bank] |= bcm2835_sim_te_bit();
+    }
+    if (bcm2835_sim.now % bcm2835_sim.te_period_ps < bcm2835_sim.te_high_ps)
+	*lev |= bcm2835_sim_te_bit();
+    else
+	*lev &= ~bcm2835_sim_te_bit();
+}
+
+/* Register file */
+
+static uint32_t bcm2835_sim_read(void* self, uint32_t offset, uint32_t flags)
+{
+    uint32_t value = 0;
+    uint32_t (*status)(void) = NULL;
+    bcm2835SimBus* bus = NULL;
+
+    (void)self;
+    pthread_mutex_lock(&bcm2835_sim_lock);
+    bcm2835_sim.now += (uint64_t)(bcm2835_sim.timing.read_ns
+				  + ((flags & BCM2835_TRACE_BARRIER) ? bcm2835_sim.timing.barrier_ns : 0)) * 1000;
+    bcm2835_sim.reads++;
+    if (flags & BCM2835_TRACE_BARRIER)
+	bcm2835_sim.barriers++;
+    bcm2835_sim_bus_advance(&bcm2835_sim.spi0, bcm2835_sim.now);
+    bcm2835_sim_bus_advance(&bcm2835_sim.spi1, bcm2835_sim.now);
+    bcm2835_sim_te_update();
+
+    /* A second GPEDS poll without an edge spins until the next one. Timer
+    // reads in between are the poll loop checking its timeout.
+    */
+    if (bcm2835_sim.te_polled && bcm2835_sim.te_period_ps
+	&& offset == BCM2835_GPIO_BASE + BCM2835_GPEDS0 + bcm2835_sim.te_pin / 32 * 4
+	&& (bcm2835_sim.gpio[BCM2835_GPREN0 / 4 + bcm2835_sim.te_pin / 32] & bcm2835_sim_te_bit()))
+    {
+	bcm2835_sim.now = (bcm2835_sim.te_edge + 1) * bcm2835_sim.te_period_ps;
+	bcm2835_sim_bus_advance(&bcm2835_sim.spi0, bcm2835_sim.now);
+	bcm2835_sim_bus_advance(&bcm2835_sim.spi1, bcm2835_sim.now);
+	bcm2835_sim_te_update();
+    }
+    if (offset < BCM2835_ST_BASE || offset >= BCM2835_ST_BASE + BCM2835_BLOCK_SIZE)
+	bcm2835_sim.te_polled = 0;
+
+    switch (offset)
+    {
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CS:
+	bus = &bcm2835_sim.spi0;
+	status = &bcm2835_sim_spi0_status;
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+	bus = &bcm2835_sim.spi0;
+	bcm2835_sim_bus_pop(bus, bcm2835_sim.now);
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CLK:
+	value = bcm2835_sim.spi0_clk;
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_DLEN:
+	value = bcm2835_sim.spi0_dlen;
+	break;
+    case BCM2835_AUX_BASE + BCM2835_AUX_ENABLE:
+	value = bcm2835_sim.aux_enable;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL0:
+	value = bcm2835_sim.spi1_cntl0;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL1:
+	value = bcm2835_sim.spi1_cntl1;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_STAT:
+	bus = &bcm2835_sim.spi1;
+	status = &bcm2835_sim_spi1_status;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO:
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD:
+	bus = &bcm2835_sim.spi1;
+	bcm2835_sim_bus_pop(bus, bcm2835_sim.now);
+	break;
+    case BCM2835_ST_BASE + BCM2835_ST_CLO:
+	value = (uint32_t)bcm2835_sim_st();
+	break;
+    case BCM2835_ST_BASE + BCM2835_ST_CHI:
+	value = (uint32_t)(bcm2835_sim_st() >> 32);
+	break;
+    default:
+	if (offset >= BCM2835_GPIO_BASE && offset < BCM2835_GPIO_BASE + BCM2835_BLOCK_SIZE)
+	    value = bcm2835_sim.gpio[(offset - BCM2835_GPIO_BASE) / 4];
+	if (offset == BCM2835_GPIO_BASE + BCM2835_GPEDS0 + bcm2835_sim.te_pin / 32 * 4)
+	    bcm2835_sim.te_polled = !(value & bcm2835_sim_te_bit());
+	break;
+    }
+
+    if (status)
+    {
+	value = status();
+	if (bus->polled && value == bus->poll_value)
+	{
+	    bcm2835_sim_bus_skip(bus, status, value);
+	    value = status();
+	}
+	bus->polled = 1;
+	bus->poll_value = value;
+    }
+    else if (bus)
+	bus->polled = 0;
+
+    pthread_mutex_unlock(&bcm2835_sim_lock);
+    return value;
+}
+
+static void bcm2835_sim_write(void* self, uint32_t offset, uint32_t value, uint32_t flags)
+{
+    uint32_t gpio;
+
+    (void)self;
+    pthread_mutex_lock(&bcm2835_sim_lock);
+    /* DMA words cost the CPU nothing */
+    if (!(flags & BCM2835_TRACE_DMA))
+    {
+	bcm2835_sim.now += (uint64_t)(bcm2835_sim.timing.write_ns
+				      + ((flags & BCM2835_TRACE_BARRIER) ? bcm2835_sim.timing.barrier_ns : 0)) * 1000;
+	bcm2835_sim.writes++;
+	if (flags & BCM2835_TRACE_BARRIER)
+	    bcm2835_sim.barriers++;
+    }
+    bcm2835_sim_bus_advance(&bcm2835_sim.spi0, bcm2835_sim.now);
+    bcm2835_sim_bus_advance(&bcm2835_sim.spi1, bcm2835_sim.now);
+    bcm2835_sim_te_update();
+    bcm2835_sim.te_polled = 0;
+    if (offset >= BCM2835_SPI0_BASE && offset < BCM2835_SPI0_BASE + BCM2835_BLOCK_SIZE)
+	bcm2835_sim.spi0.polled = 0;
+    else if (offset >= BCM2835_SPI1_BASE && offset < BCM2835_SPI1_BASE + 0x40)
+	bcm2835_sim.spi1.polled = 0;
+
+    switch (offset)
+    {
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CS:
+	bcm2835_sim_spi0_cs(value);
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO:
+	bcm2835_sim_spi0_fifo(value, flags);
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_CLK:
+	bcm2835_sim.spi0_clk = value;
+	break;
+    case BCM2835_SPI0_BASE + BCM2835_SPI0_DLEN:
+	bcm2835_sim.spi0_dlen = value;
+	break;
+    case BCM2835_AUX_BASE + BCM2835_AUX_ENABLE:
+	bcm2835_sim.aux_enable = value;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL0:
+	if (value & BCM2835_AUX_SPI_CNTL0_CLEARFIFO)
+	{
+	    bcm2835_sim_bus_clear_tx(&bcm2835_sim.spi1);
+	    bcm2835_sim.spi1.rx = 0;
+	    bcm2835_sim.spi1.last_rx = 0;
+	}
+	bcm2835_sim.spi1_cntl0 = value & ~BCM2835_AUX_SPI_CNTL0_CLEARFIFO;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL1:
+	bcm2835_sim.spi1_cntl1 = value;
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO:
+	bcm2835_sim_spi1_write(value, 0);
+	break;
+    case BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD:
+	bcm2835_sim_spi1_write(value, 1);
+	break;
+    default:
+	if (offset < BCM2835_GPIO_BASE || offset >= BCM2835_GPIO_BASE + BCM2835_BLOCK_SIZE)
+	    break;
+	gpio = (offset - BCM2835_GPIO_BASE) / 4;
+	/* SET and CLR act on the level register, they read back as 0 */
+	if (offset >= BCM2835_GPIO_BASE + BCM2835_GPSET0 && offset < BCM2835_GPIO_BASE + BCM2835_GPSET0 + 8)
+	    bcm2835_sim.gpio[BCM2835_GPLEV0 / 4 + gpio - BCM2835_GPSET0 / 4] |= value;
+	else if (offset >= BCM2835_GPIO_BASE + BCM2835_GPCLR0 && offset < BCM2835_GPIO_BASE + BCM2835_GPCLR0 + 8)
+	    bcm2835_sim.gpio[BCM2835_GPLEV0 / 4 + gpio - BCM2835_GPCLR0 / 4] &= ~value;
+	/* Event detect status bits are cleared by writing 1 */
+	else if (offset >= BCM2835_GPIO_BASE + BCM2835_GPEDS0 && offset < BCM2835_GPIO_BASE + BCM2835_GPEDS0 + 8)
+	    bcm2835_sim.gpio[gpio] &= ~value;
+	else
+	    bcm2835_sim.gpio[gpio] = value;
+	break;
+    }
+    pthread_mutex_unlock(&bcm2835_sim_lock);
+}
+
+#endif
+
+int bcm2835_sim_begin(const bcm2835SimTiming* timing)
+{
+#ifdef BCM2835_NO_DEBUG
+    (void)timing;
+    fprintf(stderr, "bcm2835_sim_begin: library built with BCM2835_NO_DEBUG\n");
+    return 0;
+#else
+    bcm2835PeriModel model;
+
+    memset(&bcm2835_sim, 0, sizeof(bcm2835_sim));
+    bcm2835_sim.timing = timing ? *timing : bcm2835_sim_default_timing;
+    if (bcm2835_sim.timing.core_clk_hz == 0)
+	bcm2835_sim.timing.core_clk_hz = BCM2835_CORE_CLK_HZ;
+    bcm2835_sim_bus_reset(&bcm2835_sim.spi0, BCM2835_SPI0_FIFO_SIZE);
+    bcm2835_sim_bus_reset(&bcm2835_sim.spi1, 4);
+
+    model.read = &bcm2835_sim_read;
+    model.write = &bcm2835_sim_write;
+    model.self = &bcm2835_sim;
+    bcm2835_set_debug(BCM2835_DEBUG_TRACE);
+    bcm2835_trace_set_model(&model);
+    return 1;
+#endif
+}
+
+void bcm2835_sim_te(uint8_t pin, uint32_t period_us, uint32_t vblank_us)
+{
+    pthread_mutex_lock(&bcm2835_sim_lock);
+    bcm2835_sim.te_pin = pin;
+    bcm2835_sim.te_period_ps = (uint64_t)period_us * 1000000;
+    bcm2835_sim.te_high_ps = (uint64_t)MIN(vblank_us, period_us) * 1000000;
+    bcm2835_sim.te_edge = bcm2835_sim.te_period_ps ? bcm2835_sim.now / bcm2835_sim.te_period_ps : 0;
+    bcm2835_sim.te_polled = 0;
+    pthread_mutex_unlock(&bcm2835_sim_lock);
+}
+
+void bcm2835_sim_end(void)
+{
+    bcm2835_trace_set_model(NULL);
+}
+
+static void bcm2835_sim_bus_stats(const bcm2835SimBus* bus, bcm2835SimBusStats* stats)
+{
+    stats->bytes = bus->bytes;
+    stats->busy_ns = bcm2835_sim_ns(bus->busy_ps);
+    stats->gaps = bus->gaps;
+    stats->gap_ns = bcm2835_sim_ns(bus->gap_ps);
+    stats->max_gap_ns = bcm2835_sim_ns(bus->max_gap_ps);
+}
+
+void bcm2835_sim_stats(bcm2835SimStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_lock(&bcm2835_sim_lock);
+    stats->elapsed_ns = bcm2835_sim_ns(bcm2835_sim.now);
+    stats->reads = bcm2835_sim.reads;
+    stats->writes = bcm2835_sim.writes;
+    stats->barriers = bcm2835_sim.barriers;
+    bcm2835_sim_bus_stats(&bcm2835_sim.spi0, &stats->spi0);
+    bcm2835_sim_bus_stats(&bcm2835_sim.spi1, &stats->spi1);
+    pthread_mutex_unlock(&bcm2835_sim_lock);
+}
+
+static void bcm2835_sim_report_bus(FILE* fp, const char* name, const bcm2835SimBusStats* bus, uint64_t elapsed_ns)
+{
+    if (bus->bytes == 0)
+	return;
+    fprintf(fp, "%s: %llu bytes, busy %.3f ms (%.1f%%), %.2f MB/s\n", name,
+	    (unsigned long long)bus->bytes, bus->busy_ns / 1e6,
+	    elapsed_ns ? 100.0 * bus->busy_ns / elapsed_ns : 0.0,
+	    elapsed_ns ? bus->bytes * 1e3 / elapsed_ns : 0.0);
+    fprintf(fp, "%s: %llu gaps, total %.3f ms, mean %.0f ns, max %llu ns\n", name,
+	    (unsigned long long)bus->gaps, bus->gap_ns / 1e6,
+	    bus->gaps ? (double)bus->gap_ns / bus->gaps : 0.0,
+	    (unsigned long long)bus->max_gap_ns);
+}
+
+void bcm2835_sim_report(FILE* fp)
+{
+    bcm2835SimStats stats;
+
+    bcm2835_sim_stats(&stats);
+    fprintf(fp, "bcm2835 sim: %.3f ms simulated, %llu reads, %llu writes\n",
+	    stats.elapsed_ns / 1e6, (unsigned long long)stats.reads, (unsigned long long)stats.writes);
+    bcm2835_sim_report_bus(fp, "spi0", &stats.spi0, stats.elapsed_ns);
+    bcm2835_sim_report_bus(fp, "spi1", &stats.spi1, stats.elapsed_ns);
+}
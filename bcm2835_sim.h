@@ -0,0 +1,100 @@
+/* bcm2835_sim.h
+// Cycle approximate model of the SPI0, AUX SPI1 and GPIO blocks, for running
+// and timing the SPI code on a host without the peripherals.
+//
+// The model plugs into BCM2835_DEBUG_TRACE mode through bcm2835_trace_set_model(),
+// so the code under test is the unmodified library: every register access costs
+// simulated CPU time, the FIFOs fill and drain at the rate set by the clock
+// divider, and status polls see DONE/TXD/RXD/RXR (SPI0) and TX_FULL/RX_EMPTY/BUSY
+// (SPI1) change when the hardware would change them.
+//
+// The system timer counts simulated time, and bcm2835_sim_te() drives a GPIO
+// input like the tearing effect output of a display panel.
+//
+// Only register access time is simulated: host computation between accesses,
+// sleeps and delays do not advance the clock.
+*/
+
+#ifndef BCM2835_SIM_H
+#define BCM2835_SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! \brief bcm2835SimTiming
+  Costs used by the simulator. Pass NULL to bcm2835_sim_begin() for the defaults
+  below, which are typical of a Pi Zero / Pi 1 at 700 MHz.
+*/
+typedef struct
+{
+    uint32_t core_clk_hz;   /*!< Clock feeding the SPI dividers, default BCM2835_CORE_CLK_HZ */
+    uint32_t read_ns;       /*!< CPU cost of a peripheral read, default 120 */
+    uint32_t write_ns;      /*!< CPU cost of a posted peripheral write, default 40 */
+    uint32_t barrier_ns;    /*!< Extra cost of the barrier in bcm2835_peri_read/write, default 40 */
+} bcm2835SimTiming;
+
+/*! \brief bcm2835SimBusStats
+  Wire statistics for one SPI controller. A gap is idle wire time between two
+  words of the same transfer, i.e. while CS stays asserted.
+*/
+typedef struct
+{
+    uint64_t bytes;         /*!< Bytes shifted out */
+    uint64_t busy_ns;       /*!< Time the shifter was running */
+    uint64_t gaps;          /*!< Number of gaps between consecutive words */
+    uint64_t gap_ns;        /*!< Total gap time */
+    uint64_t max_gap_ns;    /*!< Longest single gap */
+} bcm2835SimBusStats;
+
+/*! \brief bcm2835SimStats
+  Totals since bcm2835_sim_begin()
+*/
+typedef struct
+{
+    uint64_t elapsed_ns;    /*!< Simulated time */
+    uint64_t reads;         /*!< CPU register reads */
+    uint64_t writes;        /*!< CPU register writes */
+    uint64_t barriers;      /*!< Reads and writes made with a memory barrier */
+    bcm2835SimBusStats spi0;
+    bcm2835SimBusStats spi1;
+} bcm2835SimStats;
+
+/*! Switches the library to BCM2835_DEBUG_TRACE and installs the simulator.
+  Call before bcm2835_init().
+  \param[in] timing Costs to use, or NULL for the defaults
+  \return 1 if successful, 0 if the library was built with BCM2835_NO_DEBUG
+*/
+extern int bcm2835_sim_begin(const bcm2835SimTiming* timing);
+
+/*! Generates a tearing effect signal on a GPIO input, the way an ST7789 drives
+  TE after TEON with M=0: high for the vertical blanking at the start of every
+  refresh period. Each rising edge sets the pin's GPEDS bit if GPREN is enabled.
+  Polling GPEDS twice in a row without seeing the edge skips to the next edge.
+  \param[in] pin GPIO number, 0 to 53
+  \param[in] period_us Refresh period, e.g. 16667 for 60 Hz, or 0 to stop the signal
+  \param[in] vblank_us Time the signal stays high in each period
+*/
+extern void bcm2835_sim_te(uint8_t pin, uint32_t period_us, uint32_t vblank_us);
+
+/*! Restores the idle trace model. The statistics remain readable. */
+extern void bcm2835_sim_end(void);
+
+/*! Returns the statistics collected so far.
+  \param[out] stats Filled in
+*/
+extern void bcm2835_sim_stats(bcm2835SimStats* stats);
+
+/*! Prints bus utilization and gap statistics.
+  \param[in] fp Stream to print to
+*/
+extern void bcm2835_sim_report(FILE* fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,221 @@
+/* bcm2835_tracedump.c
+// Decodes a register trace written by bcm2835_trace_dump().
+//
+// Usage: bcm2835_tracedump [-s] <trace_file>
+//   default  one line per access: seq, direction, register, value
+//   -s       per register access counts and the number of bytes sent on each SPI
+//
+// The default output is stable text, so two traces can be compared with diff.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bcm2835.h"
+
+
+typedef struct
+{
+    uint32_t offset;
+    const char *name;
+} Register;
+
+static const Register registers[] =
+{
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0,          "GPFSEL0" },
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + 0x04,   "GPFSEL1" },
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + 0x08,   "GPFSEL2" },
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + 0x0c,   "GPFSEL3" },
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + 0x10,   "GPFSEL4" },
+    { BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + 0x14,   "GPFSEL5" },
+    { BCM2835_GPIO_BASE + BCM2835_GPSET0,           "GPSET0" },
+    { BCM2835_GPIO_BASE + BCM2835_GPSET0 + 0x04,    "GPSET1" },
+    { BCM2835_GPIO_BASE + BCM2835_GPCLR0,           "GPCLR0" },
+    { BCM2835_GPIO_BASE + BCM2835_GPCLR0 + 0x04,    "GPCLR1" },
+    { BCM2835_GPIO_BASE + BCM2835_GPLEV0,           "GPLEV0" },
+    { BCM2835_GPIO_BASE + BCM2835_GPEDS0,           "GPEDS0" },
+    { BCM2835_GPIO_BASE + BCM2835_GPREN0,           "GPREN0" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_CS,          "SPI0_CS" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO,        "SPI0_FIFO" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_CLK,         "SPI0_CLK" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_DLEN,        "SPI0_DLEN" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_LTOH,        "SPI0_LTOH" },
+    { BCM2835_SPI0_BASE + BCM2835_SPI0_DC,          "SPI0_DC" },
+    { BCM2835_AUX_BASE + BCM2835_AUX_IRQ,           "AUX_IRQ" },
+    { BCM2835_AUX_BASE + BCM2835_AUX_ENABLE,        "AUX_ENABLE" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL0,    "SPI1_CNTL0" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_CNTL1,    "SPI1_CNTL1" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_STAT,     "SPI1_STAT" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_PEEK,     "SPI1_PEEK" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO,       "SPI1_IO" },
+    { BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD,   "SPI1_TXHOLD" },
+    { BCM2835_DMA_BASE + BCM2835_DMA_ENABLE,        "DMA_ENABLE" },
+};
+
+#define REGISTERS (sizeof(registers) / sizeof(registers[0]))
+
+static const char *dma_registers[] =
+{
+    "CS", "CONBLK_AD", "TI", "SOURCE_AD", "DEST_AD", "TXFR_LEN", "STRIDE", "NEXTCONBK", "DEBUG"
+};
+
+/* Prints the register name for offset into buf */
+static const char *register_name(uint32_t offset, char *buf, size_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < REGISTERS; i++)
+	if (registers[i].offset == offset)
+	    return registers[i].name;
+
+    if (offset >= BCM2835_DMA_BASE && offset < BCM2835_DMA_BASE + 15 * BCM2835_DMA_CHANNEL_SIZE)
+    {
+	uint32_t channel = (offset - BCM2835_DMA_BASE) / BCM2835_DMA_CHANNEL_SIZE;
+	uint32_t reg = (offset - BCM2835_DMA_BASE) % BCM2835_DMA_CHANNEL_SIZE / 4;
+	if (reg < sizeof(dma_registers) / sizeof(dma_registers[0]))
+	{
+	    snprintf(buf, size, "DMA%u_%s", channel, dma_registers[reg]);
+	    return buf;
+	}
+    }
+
+    snprintf(buf, size, "+0x%06X", offset);
+    return buf;
+}
+
+static int register_index(uint32_t offset)
+{
+    uint32_t i;
+    for (i = 0; i < REGISTERS; i++)
+	if (registers[i].offset == offset)
+	    return (int)i;
+    return -1;
+}
+
+static void summary(const bcm2835TraceEntry *entries, uint32_t count)
+{
+    uint32_t reads[REGISTERS + 1];
+    uint32_t writes[REGISTERS + 1];
+    uint64_t spi0_bytes = 0;
+    uint64_t spi0_dma_bytes = 0;
+    uint64_t spi1_bytes = 0;
+    uint32_t dlen = 0;
+    uint32_t i;
+    int idx;
+    char name[32];
+
+    memset(reads, 0, sizeof(reads));
+    memset(writes, 0, sizeof(writes));
+
+    for (i = 0; i < count; i++)
+    {
+	const bcm2835TraceEntry *e = &entries[i];
+
+	idx = register_index(e->offset);
+	if (idx < 0)
+	    idx = REGISTERS;
+	if (e->flags & BCM2835_TRACE_READ)
+	    reads[idx]++;
+	else
+	    writes[idx]++;
+
+	if (!(e->flags & BCM2835_TRACE_WRITE))
+	    continue;
+
+	if (e->offset == BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO)
+	{
+	    if (!(e->flags & BCM2835_TRACE_DMA))
+		spi0_bytes++;
+	    else if (dlen == 0)
+		dlen = e->value >> 16;  /* DMA header word */
+	    else
+	    {
+		spi0_dma_bytes += MIN(dlen, 4);
+		dlen -= MIN(dlen, 4);
+	    }
+	}
+	else if (e->offset == BCM2835_SPI1_BASE + BCM2835_AUX_SPI_IO
+		 || e->offset == BCM2835_SPI1_BASE + BCM2835_AUX_SPI_TXHOLD)
+	{
+	    spi1_bytes += (e->value >> 24) / 8;
+	}
+    }
+
+    printf("%-14s %10s %10s\n", "register", "reads", "writes");
+    for (i = 0; i <= REGISTERS; i++)
+    {
+	if (reads[i] == 0 && writes[i] == 0)
+	    continue;
+	printf("%-14s %10u %10u\n", i < REGISTERS ? register_name(registers[i].offset, name, sizeof(name)) : "other",
+	       reads[i], writes[i]);
+    }
+    printf("\n");
+    printf("accesses       %10u\n", count);
+    printf("spi0 bytes     %10llu (polled %llu, dma %llu)\n",
+	   (unsigned long long)(spi0_bytes + spi0_dma_bytes),
+	   (unsigned long long)spi0_bytes, (unsigned long long)spi0_dma_bytes);
+    printf("spi1 bytes     %10llu\n", (unsigned long long)spi1_bytes);
+}
+
+int main(int argc, char **argv)
+{
+    bcm2835TraceEntry *entries;
+    const char *path;
+    uint32_t header[2];
+    char magic[8];
+    char name[32];
+    int stats = 0;
+    uint32_t i;
+    FILE *fp;
+
+    if (argc == 3 && strcmp(argv[1], "-s") == 0)
+	stats = 1;
+    else if (argc != 2)
+    {
+	fprintf(stderr, "Usage: %s [-s] <trace_file>\n", argv[0]);
+	return 1;
+    }
+    path = argv[argc - 1];
+
+    if ((fp = fopen(path, "rb")) == NULL)
+    {
+	perror(path);
+	return 1;
+    }
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, BCM2835_TRACE_MAGIC, sizeof(magic)) != 0
+	|| fread(header, sizeof(header), 1, fp) != 1 || header[0] != BCM2835_TRACE_VERSION)
+    {
+	fprintf(stderr, "%s: not a bcm2835 trace file\n", path);
+	fclose(fp);
+	return 1;
+    }
+
+    entries = (bcm2835TraceEntry*)malloc((size_t)header[1] * sizeof(bcm2835TraceEntry) + 1);
+    if (entries == NULL || fread(entries, sizeof(bcm2835TraceEntry), header[1], fp) != header[1])
+    {
+	fprintf(stderr, "%s: truncated trace\n", path);
+	free(entries);
+	fclose(fp);
+	return 1;
+    }
+    fclose(fp);
+
+    if (stats)
+	summary(entries, header[1]);
+    else
+    {
+	for (i = 0; i < header[1]; i++)
+	{
+	    const bcm2835TraceEntry *e = &entries[i];
+	    printf("%10u %c%c%c %-14s %08X\n", e->seq,
+		   (e->flags & BCM2835_TRACE_READ) ? 'R' : 'W',
+		   (e->flags & BCM2835_TRACE_BARRIER) ? 'b' : '-',
+		   (e->flags & BCM2835_TRACE_DMA) ? 'd' : '-',
+		   register_name(e->offset, name, sizeof(name)), e->value);
+	}
+    }
+
+    free(entries);
+    return 0;
+}
@@ -6,15 +6,26 @@
 #include <signal.h>
 
 #include "st7789.h"
+#include "st7789_transport.h"
+#include "bcm2835_sim.h"
 #include "slicer.h"
 
 
 #define LCD_WIDTH  240
 #define LCD_HEIGHT 320
 
+#define STRIPE_WIDTH  (LCD_WIDTH * 2)
+#define STRIPE_HEIGHT LCD_HEIGHT
+
+#define LCD_CLOCK_FILE "st7789.clock"   // SPI 时钟校准结果, 删除后重新校准
+
+#define SIM_TE_PERIOD_US  16667         // 模拟的 TE 信号: 60Hz, vblank 约 1ms
+#define SIM_TE_VBLANK_US  1000
+
 typedef struct {
     LCD_ST7789_DRI *driver;
     Slicer         *slicer;
+    int            emulate;
     int        scale_width;
     int       scale_height;
 } Memory;
@@ -24,14 +35,14 @@ typedef struct {
 int display_frame(void *pointer, uint8_t *buffer, int linesize){
     Memory *refs = (Memory*)pointer;
 
-    int i;
     int ret = 0;
 
-    ret |= refs->driver->output(refs->driver, NULL, 0, 0);
+    //整帧按解码器的行距一次写入
+    ret |= refs->driver->output_image(refs->driver, buffer, linesize, refs->scale_width, refs->scale_height);
 
-    uint32_t flinesize = refs->scale_height * 2;
-    for(i = 0; i < refs->scale_width - 2; i++){
-        ret |= refs->driver->output(refs->driver, buffer + linesize * i, flinesize, 1);
+    //模拟面板按解码帧统计命令和字节数
+    if(refs->emulate){
+        ret |= lcd_st7789_emulator_frame(refs->driver);
     }
 
     if(ret != 0){
@@ -42,24 +53,169 @@ int display_frame(void *pointer, uint8_t *buffer, int linesize){
     return 0;
 }
 
+/**[拼接模式: 两块面板横向组成 480x320, 不需要旋转, 整帧逐行拷入驱动的后台缓冲后提交]*/
+int display_stripe(void *pointer, uint8_t *buffer, int linesize){
+    Memory *refs = (Memory*)pointer;
+
+    int i;
+    int ret = 0;
+
+    uint8_t *frame = refs->driver->begin_frame(refs->driver);
+    if(frame == NULL){
+        fprintf(stderr, "LCD display_stripe Failed!\n");
+        return -1;
+    }
+
+    uint32_t flinesize = refs->scale_width * 2;
+    for(i = 0; i < refs->scale_height; i++){
+        memcpy(frame + flinesize * i, buffer + linesize * i, flinesize);
+    }
+    ret |= refs->driver->commit(refs->driver);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD display_stripe Failed!\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**[校准写时钟, 输出使用的时钟]*/
+void display_calibrate(LCD_ST7789_DRI *driver){
+    LCD_ST7789_STATS stats;
+
+    if(driver->calibrate(driver, LCD_CLOCK_FILE) == 0 && driver->stats(driver, &stats) == 0){
+        fprintf(stderr, "lcd: SPI clock %u Hz\n", stats.speed_hz);
+    }
+}
+
+void display_refresh(LCD_ST7789_DRI *driver, uint32_t num, uint32_t den){
+    LCD_ST7789_STATS stats;
+
+    if(driver->refresh(driver, num, den) != 0 || driver->stats(driver, &stats) != 0){
+        return;
+    }
+    if(num == 0 || den == 0){
+        fprintf(stderr, "lcd: refresh %u Hz for static content\n", stats.refresh_hz);
+    }else{
+        fprintf(stderr, "lcd: refresh %u Hz for %.3f fps\n", stats.refresh_hz, (double)num / den);
+    }
+}
+
 
 int main(int argc, char **argv) {
 
-    if(argc != 2){
-        fprintf(stderr, "Usage: %s <video_file>\n", argv[0]);
+    int stripe = 0;
+    int sim = 0;
+    int emulate = 0;
+    int vsync = 0;
+    int match = 0;
+    uint8_t color = LCD_ST7789_COLOR_RGB565;
+    uint8_t startup = LCD_ST7789_START_FAST;
+    const char *snapshot = NULL;
+    int i;
+    for(i = 1; i < argc - 1; i++){
+        if(strcmp(argv[i], "--stripe") == 0){
+            stripe = 1;
+        }else if(strcmp(argv[i], "--sim") == 0){
+            sim = 1;
+        }else if(strcmp(argv[i], "--emulate") == 0){
+            emulate = 1;
+        }else if(strcmp(argv[i], "--vsync") == 0){
+            vsync = 1;
+        }else if(strcmp(argv[i], "--match-fps") == 0){
+            match = 1;
+        }else if(strcmp(argv[i], "--color=444") == 0){
+            color = LCD_ST7789_COLOR_RGB444;
+        }else if(strcmp(argv[i], "--color=auto") == 0){
+            color = LCD_ST7789_COLOR_AUTO;
+        }else if(strcmp(argv[i], "--warm") == 0){
+            startup = LCD_ST7789_START_WARM;
+        }else if(strcmp(argv[i], "--safe-start") == 0){
+            startup = LCD_ST7789_START_SAFE;
+        }else if(strncmp(argv[i], "--snapshot=", 11) == 0){
+            emulate = 1;
+            snapshot = argv[i] + 11;
+        }else{
+            break;
+        }
+    }
+    if(argc < 2 || i != argc - 1){
+        fprintf(stderr, "Usage: %s [--stripe] [--sim] [--emulate] [--vsync] [--match-fps] [--color=444|auto] [--warm|--safe-start] [--snapshot=frame%%04u.ppm] <video_file>\n", argv[0]);
+        return 1;
+    }
+
+    //--sim: 不访问硬件, 在模拟的 SPI 外设上运行并统计总线利用率
+    if(sim && bcm2835_sim_begin(NULL) == 0){
         return 1;
     }
+    //--vsync: 每帧等面板 TE 之后再写; 模拟器只在 SPI0 面板的 TE 引脚上产生信号
+    if(sim && vsync){
+        bcm2835_sim_te(LCD_ST7789_GPIO_SPI_PIN_TE, SIM_TE_PERIOD_US, SIM_TE_VBLANK_US);
+    }
 
     Memory *refs = (Memory*)malloc(sizeof (Memory));
-    refs->driver = lcd_st7789_init();
+    memset(refs, 0, sizeof (Memory));
+    refs->emulate = emulate && !stripe;
+    //--emulate: 命令级模拟面板, 不需要树莓派; 拼接模式只统计总量, 不分帧也不保存快照
+    if(emulate && stripe){
+        refs->driver = lcd_st7789_init_stripe(lcd_st7789_init_emulator(NULL),
+                                              lcd_st7789_init_emulator(NULL));
+    }else if(emulate){
+        refs->driver = lcd_st7789_init_emulator(snapshot);
+    }else if(stripe){
+        refs->driver = lcd_st7789_init_stripe(lcd_st7789_init_bcm2835(0),
+                                              lcd_st7789_init_bcm2835(LCD_ST7789_FLAG_SPI1));
+    }else{
+        refs->driver = lcd_st7789_init();
+    }
     refs->slicer = slicer_new();
+    //--color: 12bit 输出, auto 在总线跟不上帧率时才切换
+    refs->driver->color(refs->driver, color);
+    //--warm: 面板已经初始化过时跳过复位; --safe-start: 按 100ms 的延时初始化
+    refs->driver->startup(refs->driver, startup);
 
     //读取视频基本信息
-    if(refs->slicer->init(refs->slicer, argv[1]) != 0){
+    if(refs->slicer->init(refs->slicer, argv[argc - 1]) != 0){
         fprintf(stderr, "Slicer init Failed!\n");
         goto END;
     }
 
+    if(stripe){
+        //等比缩放到拼接后的显示面并居中
+        if((double)refs->slicer->width / refs->slicer->height >= (double)STRIPE_WIDTH / STRIPE_HEIGHT){
+            refs->scale_width  = STRIPE_WIDTH;
+            refs->scale_height = refs->slicer->height * STRIPE_WIDTH / refs->slicer->width;
+        }else{
+            refs->scale_width  = refs->slicer->width * STRIPE_HEIGHT / refs->slicer->height;
+            refs->scale_height = STRIPE_HEIGHT;
+        }
+        snprintf(refs->slicer->command, sizeof(refs->slicer->command),
+                 "scale=%d:%d", refs->scale_width, refs->scale_height);
+
+        int16_t left = (STRIPE_WIDTH - refs->scale_width) / 2;
+        int16_t top  = (STRIPE_HEIGHT - refs->scale_height) / 2;
+        if(refs->driver->config(refs->driver, left, top,
+                                left + refs->scale_width - 1, top + refs->scale_height - 1) != 0){
+            fprintf(stderr, "LCD config Failed\n");
+            goto END;
+        }
+        if(!sim && !emulate){
+            display_calibrate(refs->driver);
+        }
+        if(match){
+            display_refresh(refs->driver, refs->slicer->fps_num, refs->slicer->fps_den);
+        }
+        if(vsync){
+            refs->driver->vsync(refs->driver, 1);
+        }
+
+        if(refs->slicer->loop(refs->slicer, &display_stripe, refs) != 0){
+            fprintf(stderr, "Slicer parse video Failed!\n");
+        }
+        goto END;
+    }
+
     //计算缩放比例
     double scales[3];
     scales[0] = (double)LCD_WIDTH / LCD_HEIGHT;
@@ -74,22 +230,34 @@ int main(int argc, char **argv) {
         refs->scale_height = LCD_WIDTH;
     }
 
-    //缩放后顺时针旋转90度
+    //面板顺时针旋转90度显示, 不需要 transpose
     snprintf(refs->slicer->command, sizeof(refs->slicer->command),
-             "scale=%d:%d,transpose=clock",
+             "scale=%d:%d",
              refs->scale_width, refs->scale_height);
 
-    //计算LCD边缘偏移
-    int16_t left   = (LCD_WIDTH - refs->scale_height) / 2;
-    int16_t top    = (LCD_HEIGHT - refs->scale_width) / 2;
-    int16_t right  = left + refs->scale_height - 1;
-    int16_t bottom = top + refs->scale_width - 1;
+    //计算LCD边缘偏移, 旋转后显示面为 320x240
+    int16_t left   = (LCD_HEIGHT - refs->scale_width) / 2;
+    int16_t top    = (LCD_WIDTH - refs->scale_height) / 2;
+    int16_t right  = left + refs->scale_width - 1;
+    int16_t bottom = top + refs->scale_height - 1;
     fprintf(stderr, "size: [%d, %d, %d, %d]\n", left, top, right, bottom);
 
-    if(refs->driver->config(refs->driver, left, top, right, bottom) != 0){
+    if(refs->driver->rotate(refs->driver, LCD_ST7789_ROTATE_90) != 0
+       || refs->driver->config(refs->driver, left, top, right, bottom) != 0){
         fprintf(stderr, "LCD config Failed\n");
         goto END;
     }
+    //模拟器没有面板可以读回, 跳过校准; 模拟面板的校准结果对真实面板无意义
+    if(!sim && !emulate){
+        display_calibrate(refs->driver);
+    }
+    //--match-fps: 面板刷新率取视频帧率的整数倍, 配合 --vsync 每帧占相同的刷新周期数
+    if(match){
+        display_refresh(refs->driver, refs->slicer->fps_num, refs->slicer->fps_den);
+    }
+    if(vsync){
+        refs->driver->vsync(refs->driver, 1);
+    }
 
     //循环解码
     if(refs->slicer->loop(refs->slicer, &display_frame, refs) != 0){
@@ -103,10 +271,39 @@ END:
     }
 
     if(refs->driver != NULL){
+        //总线计数: spins 高说明在空等轮询, 耗时接近字节数对应的线上时间说明总线已满
+        LCD_ST7789_STATS stats;
+        if(refs->driver->stats(refs->driver, &stats) == 0 && stats.transactions > 0){
+            fprintf(stderr, "lcd: %llu bytes, %llu transactions, avg %llu us, max %u us\n",
+                    (unsigned long long)stats.bytes, (unsigned long long)stats.transactions,
+                    (unsigned long long)(stats.busy_us / stats.transactions), stats.max_us);
+            fprintf(stderr, "lcd: fifo spins %llu, done spins %llu, dc toggles %llu\n",
+                    (unsigned long long)stats.fifo_spins, (unsigned long long)stats.done_spins,
+                    (unsigned long long)stats.dc_toggles);
+            if(stats.frames > 0){
+                fprintf(stderr, "lcd: %llu frames, saved %llu bytes per frame, last frame %u bytes\n",
+                        (unsigned long long)stats.frames, (unsigned long long)(stats.saved_bytes / stats.frames),
+                        stats.last_bytes);
+            }
+            if(stats.first_pixel_us > 0){
+                fprintf(stderr, "lcd: first frame %u us after config\n", stats.first_pixel_us);
+            }
+            if(stats.reduced_frames > 0){
+                fprintf(stderr, "lcd: %llu frames sent as RGB444\n", (unsigned long long)stats.reduced_frames);
+            }
+            if(stats.vsyncs + stats.vsync_misses > 0){
+                fprintf(stderr, "lcd: %llu frames started at vblank, %llu missed TE\n",
+                        (unsigned long long)stats.vsyncs, (unsigned long long)stats.vsync_misses);
+            }
+        }
         refs->driver->clean((void**)&refs->driver);
     }
 
     free(refs);
 
+    if(sim){
+        bcm2835_sim_report(stderr);
+    }
+
     return 0;
 }
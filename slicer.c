@@ -291,6 +291,11 @@ int slicer_init(void *self, const char *filename){
 
     slicer->width  = mem->codec_ctx->width;
     slicer->height = mem->codec_ctx->height;
+    {
+        AVRational fps = av_guess_frame_rate(mem->ifmt_ctx, mem->ifmt_ctx->streams[mem->stream_index], NULL);
+        slicer->fps_num = fps.num;
+        slicer->fps_den = fps.den;
+    }
 
     return 0;
 }
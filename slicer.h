@@ -18,6 +18,8 @@ typedef struct {
     char command[128];
     int width;
     int height;
+    int fps_num;    // 视频帧率 fps_num/fps_den, 未知时 fps_num 为 0
+    int fps_den;
 
     void *priv;
 } Slicer;
@@ -1,213 +1,835 @@
 #include "st7789.h"
-#include "bcm2835.h"
+#include "st7789_transport.h"
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 
 #define LCD_ST7789_WIDTH  240
 #define LCD_ST7789_HEIGHT 320
 
-#define LCD_ST7789_GPIO_SPI_PIN_RES   24
-#define LCD_ST7789_GPIO_SPI_PIN_DC    25
+#define LCD_ST7789_CALIBRATE_WIDTH   16     // 校准测试窗口 16x4, 位于左上角
+#define LCD_ST7789_CALIBRATE_HEIGHT  4
+#define LCD_ST7789_CALIBRATE_PIXELS  (LCD_ST7789_CALIBRATE_WIDTH * LCD_ST7789_CALIBRATE_HEIGHT)
+#define LCD_ST7789_CALIBRATE_ROUNDS  2
+#define LCD_ST7789_CALIBRATE_DUMMY   16     // 最多跳过的 dummy 位
+
+#define LCD_ST7789_QUEUE_SIZE        16     // 异步发送队列长度
+
+#define LCD_ST7789_TILE              16     // 变化检测分块边长
+#define LCD_ST7789_TILES             ((LCD_ST7789_WIDTH / LCD_ST7789_TILE + 1) * (LCD_ST7789_HEIGHT / LCD_ST7789_TILE + 1))
+#define LCD_ST7789_WINDOW_BYTES      11     // 每个窗口的 CASET/RASET/RAMWR 命令和参数
+#define LCD_ST7789_WINDOW_SETUP_NS   6000   // 每个窗口切换6次DC, 每次等总线排空, 折合的线上时间
+
+#define LCD_ST7789_COLMOD_565        0x05
+#define LCD_ST7789_COLMOD_444        0x03
+
+#define LCD_ST7789_TE_TIMEOUT_US     50000  // 等待 TE 的上限, 大于最低刷新率 (FRCTRL2 0x1F, 39Hz) 的周期
+
+
+// FRCTRL2 的 RTNA 档位, 正常模式下 porch 为 0x0C/0x0C 时的刷新率
+const uint8_t lcd_st7789_frame_rates[32] = {
+    119, 111, 105, 99, 94, 90, 86, 82, 78, 75, 72, 69, 67, 64, 62, 60,
+    58, 57, 55, 53, 52, 50, 49, 48, 46, 45, 44, 43, 42, 41, 40, 39
+};
+
+// 初始化序列: 命令, 参数个数, 参数... ; MADCTL/COLMOD/FRCTRL2 等随配置变化的寄存器另外写入
+#define LCD_ST7789_TABLE_END  0x00
+static const uint8_t lcd_st7789_init_table[] = {
+    0xB2, 5, 0x0C, 0x0C, 0x00, 0x33, 0x33,  //设置门控制? 默认值
+    0xB7, 1, 0x35,                          //设置闸门控制? （高位: 13.26, 低位: -10.43)
+    0xBB, 1, 0x19,                          //设置VCOM? (0x37对应值为 1.475)
+    0xC0, 1, 0x2C,                          //设置LCM控制? 默认值
+    0xC2, 1, 0x01,                          //cmd 0xC2 0x01 0xFF 设置VDV和VRH开启 默认值
+    0xC3, 1, 0x12,                          //设置VRH (0x12对应值为 4.45+( vcom+vcom offset+vdv))
+    0xC4, 1, 0x20,                          //设置VDV (0x20对应值为 0)
+    0xD0, 2, 0xA4, 0xA1,                    //设置电源控制? 默认值
+    0xE0, 14, 0xD0, 0x04, 0x0D, 0x11, 0x13, 0x2B, 0x3F, 0x54, 0x4C, 0x18, 0x0D, 0x0B, 0x1F, 0x23,  //设置正电压伽马控制？ (有默认值)
+    0xE1, 14, 0xD0, 0x04, 0x0C, 0x11, 0x13, 0x2C, 0x3F, 0x44, 0x51, 0x2F, 0x1F, 0x1F, 0x20, 0x23,  //设置负电压伽马控制? (有默认值)
+    0x21, 0,                                //cmd 0x21 设置显示反色打开
+    LCD_ST7789_TABLE_END
+};
+
+// 校准候选时钟, 对应 SPI0 分频 16, 12, 10, 8, 6, 4, 2
+static const uint32_t lcd_st7789_clocks[] = {
+    15625000, 20833333, 25000000, 31250000, 41666667, 62500000, 125000000
+};
+
+
+typedef struct{
+    int16_t left;
+    int16_t top;
+    int16_t right;
+    int16_t bottom;
+} LCD_ST7789_RECT;
+
+// 发送队列中的一项: submit 的窗口任务, 或 commit 的整帧
+typedef struct{
+    LCD_ST7789_JOB job;
+    uint8_t present;            // 1: job.data 是 config 窗口的一帧, 按 output 的方式只发送变化的部分
+} LCD_ST7789_TASK;
 
 
 typedef struct {
+    LCD_ST7789_TRANSPORT *transport;
     uint8_t region[8];
+    LCD_ST7789_RECT window;     // config 的窗口
+    uint8_t madctl;             // 扫描方向, 由旋转决定
+    uint8_t frctrl2;            // 刷新率档位, 见 lcd_st7789_refresh
+    uint8_t colmod;             // 面板当前的 COLMOD
+    int16_t width;              // 旋转后的显示面尺寸, 窗口和影子都按这个坐标系
+    int16_t height;
+
+    // 垂直滚动区 (GRAM 行), scroll_height 为 0 表示没有设置
+    int16_t scroll_top;
+    int16_t scroll_height;
+    int16_t scroll_start;       // VSCSAD, 滚动区第一行显示的 GRAM 行
+
+    // GRAM 影子: output 收满一帧后和影子比较, 只发送变化的矩形
+    uint8_t *shadow;            // 240x320 RGB565, 所有写显存的路径都同步更新
+    uint8_t *frame;             // 正在接收的一帧, 大小为窗口
+    uint32_t received;          // frame 中已收到的字节数
+    uint32_t speed_hz;          // 当前写时钟, 用于估算窗口开销
+
+    // 窗口按 16x16 分块, tile_hash 是影子中对应内容的哈希
+    uint64_t *tile_hash;
+    uint8_t *tile_valid;        // 0: 影子被其他路径改写过, 需要从影子重新计算
+    uint32_t tile_columns;
+    uint32_t tile_rows;
+
+    // output 的帧计数, 见 LCD_ST7789_STATS
+    uint64_t frames;
+    uint64_t saved_bytes;
+    uint32_t last_bytes;
+    uint32_t last_saved;
+    uint64_t vsyncs;
+    uint64_t vsync_misses;
+    uint8_t vsync;              // output 每帧等 TE 之后再写
+
+    // output 的像素格式, LCD_ST7789_COLOR_AUTO 时按总线耗时 (传输层计时) 和帧间隔 (单调时钟) 切换
+    uint8_t color;
+    uint8_t reduced;            // 当前帧以 RGB444 发送
+    uint8_t *packed;            // RGB444 打包缓冲, 一个窗口大小
+    uint64_t arrival_us;        // 上一帧开始发送的时间
+    uint32_t interval_us;       // 帧间隔的滑动平均
+    uint32_t send_us;           // 每帧总线耗时的滑动平均
+    uint64_t reduced_frames;
+
+    // 初始化方式, 以及 config 开始到第一帧写完的时间 (单调时钟)
+    uint8_t startup;
+    uint64_t config_us;
+    uint32_t first_pixel_us;
+
+    // 异步发送队列, 发送线程在第一次 submit 时启动
+    pthread_t thread;
+    uint8_t running;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_mutex_t bus;        // 发送线程和 output/calibrate 互斥访问传输层
+    LCD_ST7789_TASK queue[LCD_ST7789_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint32_t submitted;         // 最后提交的任务序号, 即最新的 fence
+    uint32_t completed;         // 已写出的任务序号
+    int error;
+
+    // begin_frame/commit 的双缓冲, 大小为窗口; fences 是每块缓冲最后一次 commit 的任务序号
+    uint8_t *buffers[2];
+    uint32_t fences[2];
+    uint8_t back;
+    uint8_t begun;              // begin_frame 之后还没有 commit
 } LCD_ST7798_MT;
 
 
-int lcd_st7789_write_command(uint8_t cmd){
-    bcm2835_gpio_clr(LCD_ST7789_GPIO_SPI_PIN_DC);
-    bcm2835_spi_writenb((const char*)&cmd, 1);
-    return 0;
+void lcd_st7789_counters_begin(LCD_ST7789_COUNTERS *counters, uint64_t now_us, uint64_t fifo_spins, uint64_t done_spins){
+    if(!counters->active){
+        counters->active = 1;
+        counters->start_us = now_us;
+        counters->fifo_spins = fifo_spins;
+        counters->done_spins = done_spins;
+    }
 }
 
-int lcd_st7789_write_data(uint8_t *data, uint32_t size){
-    bcm2835_gpio_set(LCD_ST7789_GPIO_SPI_PIN_DC);
-    bcm2835_spi_writenb((const char*)data, size);
-    return 0;
+void lcd_st7789_counters_end(LCD_ST7789_COUNTERS *counters, uint64_t now_us, uint64_t fifo_spins, uint64_t done_spins){
+    LCD_ST7789_STATS *total = &counters->total;
+    uint32_t us;
+
+    if(!counters->active){
+        return;
+    }
+    counters->active = 0;
+
+    us = (uint32_t)(now_us - counters->start_us);
+    total->transactions++;
+    total->fifo_spins += fifo_spins - counters->fifo_spins;
+    total->done_spins += done_spins - counters->done_spins;
+    total->busy_us += us;
+    total->last_us = us;
+    if(us > total->max_us){
+        total->max_us = us;
+    }
 }
 
-int lcd_st7789_write_unwrap(uint8_t *data, uint32_t size){
-    bcm2835_spi_writenb((const char*)data, size);
-    return 0;
+
+int lcd_st7789_write_command(LCD_ST7798_MT *mem, uint8_t cmd){
+    return mem->transport->command(mem->transport, cmd);
+}
+
+int lcd_st7789_write_data(LCD_ST7798_MT *mem, uint8_t *data, uint32_t size){
+    return mem->transport->data(mem->transport, data, size);
 }
 
-int lcd_st7789_clear(void){
+int lcd_st7789_flush(LCD_ST7798_MT *mem){
+    return mem->transport->flush(mem->transport);
+}
+
+/**[设置写入窗口并开始写显存, region 为 CASET/RASET 参数]*/
+int lcd_st7789_write_window(LCD_ST7798_MT *mem, uint8_t *region){
     int ret = 0;
-    {
-        uint8_t region[8] ={
-            0x00, 0x00, 0x00, 0xF0,
-            0x00, 0x00, 0x01, 0x40
-        };
 
-        ret |= lcd_st7789_write_command(0x2A);
-        ret |= lcd_st7789_write_data(region, 4);
-        ret |= lcd_st7789_write_command(0x2B);
-        ret |= lcd_st7789_write_data(region + 4, 4);
-        ret |= lcd_st7789_write_command(0x2C);
+    ret |= lcd_st7789_write_command(mem, 0x2A);
+    ret |= lcd_st7789_write_data(mem, region, 4);
+    ret |= lcd_st7789_write_command(mem, 0x2B);
+    ret |= lcd_st7789_write_data(mem, region + 4, 4);
+    ret |= lcd_st7789_write_command(mem, 0x2C);
+
+    return ret;
+}
+
+static void lcd_st7789_set_region(uint8_t *region, int16_t left, int16_t top, int16_t right, int16_t bottom){
+    region[0]  = (left >> 8) & 0xFF;
+    region[1]  = left & 0xFF;
+    region[2]  = (right >> 8) & 0xFF;
+    region[3]  = right & 0xFF;
+    region[4]  = (top >> 8) & 0xFF;
+    region[5]  = top & 0xFF;
+    region[6]  = (bottom >> 8) & 0xFF;
+    region[7]  = bottom & 0xFF;
+}
+
+/**[写入面板的像素同步到影子, stride 为 data 的行字节数; 覆盖到的分块哈希失效]*/
+static void lcd_st7789_shadow_store(LCD_ST7798_MT *mem, const LCD_ST7789_RECT *rect, const uint8_t *data, uint32_t stride){
+    uint32_t width = (uint32_t)(rect->right - rect->left + 1) * 2;
+    int16_t left, top, right, bottom;
+    int16_t x, y;
+
+    for(y = rect->top; y <= rect->bottom; y++){
+        memcpy(mem->shadow + ((uint32_t)y * mem->width + rect->left) * 2, data, width);
+        data += stride;
     }
 
-    {
-        int i;
-        uint32_t linesize = LCD_ST7789_WIDTH * 2;
-        uint8_t *blanks = (uint8_t*)malloc(linesize);
-        memset(blanks, 0, linesize);
-        for(i = 0; i < LCD_ST7789_HEIGHT; i++){
-            ret |= lcd_st7789_write_data(blanks, linesize);
+    if(mem->tile_valid == NULL){
+        return;
+    }
+    left   = rect->left > mem->window.left ? rect->left : mem->window.left;
+    top    = rect->top > mem->window.top ? rect->top : mem->window.top;
+    right  = rect->right < mem->window.right ? rect->right : mem->window.right;
+    bottom = rect->bottom < mem->window.bottom ? rect->bottom : mem->window.bottom;
+    if(left > right || top > bottom){
+        return;
+    }
+    for(y = (top - mem->window.top) / LCD_ST7789_TILE; y <= (bottom - mem->window.top) / LCD_ST7789_TILE; y++){
+        for(x = (left - mem->window.left) / LCD_ST7789_TILE; x <= (right - mem->window.left) / LCD_ST7789_TILE; x++){
+            mem->tile_valid[y * mem->tile_columns + x] = 0;
         }
-        free(blanks);
     }
+}
 
-    if(ret != 0) {
-        perror("[Error] - lcd st7789 clear Failed");
-        return -1;
+/**[一块像素的 64bit 哈希, 每次读入 8 字节]*/
+static uint64_t lcd_st7789_tile_hash(const uint8_t *data, uint32_t stride, uint32_t size, uint32_t rows){
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    uint64_t w;
+    uint32_t i, y;
+
+    for(y = 0; y < rows; y++){
+        for(i = 0; i < size; i += 8){
+            w = 0;
+            memcpy(&w, data + i, size - i < 8 ? size - i : 8);
+            h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+            h ^= h >> 32;
+        }
+        data += stride;
     }
+    return h;
+}
 
-    return 0;
+/**[分块矩形 (单位为块) 换算为窗口内的像素矩形, 裁掉窗口边缘和还没收到的行]*/
+static void lcd_st7789_tile_pixels(LCD_ST7798_MT *mem, const LCD_ST7789_RECT *tiles, uint32_t rows, LCD_ST7789_RECT *pixels){
+    int16_t width = mem->window.right - mem->window.left + 1;
+
+    pixels->left   = tiles->left * LCD_ST7789_TILE;
+    pixels->top    = tiles->top * LCD_ST7789_TILE;
+    pixels->right  = (tiles->right + 1) * LCD_ST7789_TILE - 1;
+    pixels->bottom = (tiles->bottom + 1) * LCD_ST7789_TILE - 1;
+    if(pixels->right >= width){
+        pixels->right = width - 1;
+    }
+    if(pixels->bottom >= (int16_t)rows){
+        pixels->bottom = (int16_t)rows - 1;
+    }
+}
+
+/**[一个窗口的发送代价, 单位为线上字节: 像素 (按当前帧的像素格式) + 命令 + 按当前时钟折算的窗口切换时间]*/
+static uint32_t lcd_st7789_window_cost(LCD_ST7798_MT *mem, const LCD_ST7789_RECT *rect){
+    uint32_t pixels = (uint32_t)(rect->right - rect->left + 1) * (rect->bottom - rect->top + 1);
+
+    return (mem->reduced ? (pixels + 1) / 2 * 3 : pixels * 2) + LCD_ST7789_WINDOW_BYTES
+         + (uint32_t)((uint64_t)LCD_ST7789_WINDOW_SETUP_NS * mem->speed_hz / 8000000000ull);
+}
+
+static uint32_t lcd_st7789_tile_cost(LCD_ST7798_MT *mem, const LCD_ST7789_RECT *tiles, uint32_t rows){
+    LCD_ST7789_RECT pixels;
+
+    lcd_st7789_tile_pixels(mem, tiles, rows, &pixels);
+    return lcd_st7789_window_cost(mem, &pixels);
+}
+
+// RGB565 分量到 4bit 的有序抖动表, 第一维是 4x4 Bayer 矩阵中的位置
+static uint8_t lcd_st7789_dither_rb[16][32];
+static uint8_t lcd_st7789_dither_g[16][64];
+static pthread_once_t lcd_st7789_dither_once = PTHREAD_ONCE_INIT;
+
+static void lcd_st7789_dither_init(void){
+    static const uint8_t bayer[16] = {
+        0, 8, 2, 10,  12, 4, 14, 6,  3, 11, 1, 9,  15, 7, 13, 5
+    };
+    uint32_t i, c, q;
+
+    // q = floor(c / max * 15 + (2b + 1) / 32)
+    for(i = 0; i < 16; i++){
+        for(c = 0; c < 32; c++){
+            q = (c * 15 * 32 + (2 * bayer[i] + 1) * 31) / (32 * 31);
+            lcd_st7789_dither_rb[i][c] = (uint8_t)(q > 15 ? 15 : q);
+        }
+        for(c = 0; c < 64; c++){
+            q = (c * 15 * 32 + (2 * bayer[i] + 1) * 63) / (32 * 63);
+            lcd_st7789_dither_g[i][c] = (uint8_t)(q > 15 ? 15 : q);
+        }
+    }
+}
+
+/**[一个 RGB565 (大端) 像素抖动为 12bit RGB444, d 为 Bayer 位置]*/
+static inline uint16_t lcd_st7789_dither(const uint8_t *src, uint32_t d){
+    uint16_t v = (uint16_t)(src[0] << 8 | src[1]);
+
+    return (uint16_t)(lcd_st7789_dither_rb[d][v >> 11] << 8
+                    | lcd_st7789_dither_g[d][(v >> 5) & 0x3F] << 4
+                    | lcd_st7789_dither_rb[d][v & 0x1F]);
+}
+
+/**
+ * 把 src 中 width x height 的 RGB565 窗口转换为连续的 RGB444 像素流, 3 字节 2 个像素, 行与行之间不对齐.
+ * (x, y) 是窗口左上角的面板坐标, 抖动按面板坐标取值, 同一位置每帧的结果相同.
+ * 像素数为奇数时在末尾补上窗口的第一个像素: 面板写满窗口后回到起点, 重写的还是同一个值.
+ * 返回输出字节数.
+ */
+static uint32_t lcd_st7789_pack444(const uint8_t *src, uint32_t stride, int16_t x, int16_t y,
+                                   uint32_t width, uint32_t height, uint8_t *out){
+    const uint8_t *row;
+    uint8_t *start = out;
+    uint32_t i, j, d;
+    uint16_t a, b;
+    uint8_t half = 0;       // 上一个像素只写了前 12bit 中的 1.5 字节
+
+    for(j = 0; j < height; j++){
+        row = src + j * stride;
+        d = ((uint32_t)(y + j) & 3) * 4;
+        i = 0;
+        if(half){
+            b = lcd_st7789_dither(row, d + ((uint32_t)x & 3));
+            out[1] |= (uint8_t)(b >> 8);
+            out[2]  = (uint8_t)b;
+            out += 3;
+            half = 0;
+            i = 1;
+        }
+        // 每次两个像素三个字节
+        for(; i + 2 <= width; i += 2){
+            a = lcd_st7789_dither(row + i * 2, d + ((x + i) & 3));
+            b = lcd_st7789_dither(row + i * 2 + 2, d + ((x + i + 1) & 3));
+            out[0] = (uint8_t)(a >> 4);
+            out[1] = (uint8_t)(a << 4 | b >> 8);
+            out[2] = (uint8_t)b;
+            out += 3;
+        }
+        if(i < width){
+            a = lcd_st7789_dither(row + i * 2, d + ((x + i) & 3));
+            out[0] = (uint8_t)(a >> 4);
+            out[1] = (uint8_t)(a << 4);
+            half = 1;
+        }
+    }
+    if(half){
+        b = lcd_st7789_dither(src, ((uint32_t)y & 3) * 4 + ((uint32_t)x & 3));
+        out[1] |= (uint8_t)(b >> 8);
+        out[2]  = (uint8_t)b;
+        out += 3;
+    }
+
+    return (uint32_t)(out - start);
 }
 
-/**[显示重置]*/
-int lcd_st7789_reset(){
+/**[切换面板的 COLMOD, 没有变化时不发送]*/
+static int lcd_st7789_set_colmod(LCD_ST7798_MT *mem, uint8_t colmod){
     int ret = 0;
-    uint8_t param[16];
 
-    {// 重置引脚
-        bcm2835_gpio_set(LCD_ST7789_GPIO_SPI_PIN_RES);
-        usleep(100000);
-        bcm2835_gpio_clr(LCD_ST7789_GPIO_SPI_PIN_RES);
-        usleep(100000);
-        bcm2835_gpio_set(LCD_ST7789_GPIO_SPI_PIN_RES);
-        usleep(100000);
+    if(mem->colmod != colmod){
+        ret |= lcd_st7789_write_command(mem, 0x3A);
+        ret |= lcd_st7789_write_data(mem, &colmod, 1);
+        mem->colmod = colmod;
     }
-
-
-    {//设置显示扫描方向 默认值
-        ret |= lcd_st7789_write_command(0x36);
-        param[0] = 0x00;
-        ret |= lcd_st7789_write_data(param, 1);
-    }
-    {//设置像素格式rgb 16bit/pixel 65K
-        ret |= lcd_st7789_write_command(0x3A);
-        param[0] = 0x05;
-        ret |= lcd_st7789_write_data(param, 1);
-    }
-
-    {//设置门控制? 默认值
-        ret |= lcd_st7789_write_command(0xB2);
-        param[0] = 0x0C;
-        param[1] = 0x0C;
-        param[2] = 0x00;
-        param[3] = 0x33;
-        param[4] = 0x33;
-        ret |= lcd_st7789_write_data(param, 5);
+    return ret;
+}
+
+/**
+ * 把变化的分块分组成发送窗口, 逐行处理, 每行只和上一行结束的窗口比较, 计算量为 行数 x 列数^2.
+ * 一行里连续的变化块组成一段, 中间的空隙比多开一个窗口便宜时两段连起来;
+ * 上一行结束的窗口在列范围不变的情况下向下延伸一行, 吸收这一行和它相交的段 (这些段必须都在列范围内),
+ * 延伸的代价不超过分开发送时才延伸. 窗口之间不重叠, 没有像素发送两次.
+ * 总代价不低于发送全部收到的行时改为一个窗口. 返回窗口数.
+ */
+static uint32_t lcd_st7789_plan(LCD_ST7798_MT *mem, const uint8_t *dirty, uint32_t bands, uint32_t rows, LCD_ST7789_RECT *rects){
+    LCD_ST7789_RECT runs[LCD_ST7789_HEIGHT / LCD_ST7789_TILE + 1];
+    uint32_t open[LCD_ST7789_HEIGHT / LCD_ST7789_TILE + 1];    // 上一行结束的窗口, 互不重叠所以不超过列数
+    uint32_t next[LCD_ST7789_HEIGHT / LCD_ST7789_TILE + 1];
+    LCD_ST7789_RECT merged, all;
+    uint32_t count = 0, cost = 0, opened = 0, reached;
+    uint32_t n, x, y, i, j, k;
+    uint8_t inside, touched;
+    int64_t saving;
+
+    for(y = 0; y < bands; y++){
+        n = 0;
+        for(x = 0; x < mem->tile_columns; x++){
+            if(!dirty[y * mem->tile_columns + x]){
+                continue;
+            }
+            if(n > 0 && runs[n - 1].right == (int16_t)x - 1){
+                runs[n - 1].right = (int16_t)x;
+                continue;
+            }
+            runs[n].left   = (int16_t)x;
+            runs[n].right  = (int16_t)x;
+            runs[n].top    = (int16_t)y;
+            runs[n].bottom = (int16_t)y;
+            if(n > 0){
+                merged = runs[n - 1];
+                merged.right = (int16_t)x;
+                if(lcd_st7789_tile_cost(mem, &merged, rows)
+                   <= lcd_st7789_tile_cost(mem, &runs[n - 1], rows) + lcd_st7789_tile_cost(mem, &runs[n], rows)){
+                    runs[n - 1] = merged;
+                    continue;
+                }
+            }
+            n++;
+        }
+
+        reached = 0;
+        for(j = 0; j < opened && n > 0; j++){
+            i = open[j];
+            merged = rects[i];
+            merged.bottom = (int16_t)y;
+            saving = (int64_t)lcd_st7789_tile_cost(mem, &rects[i], rows) - lcd_st7789_tile_cost(mem, &merged, rows);
+            inside = 1;
+            touched = 0;
+            for(k = 0; k < n; k++){
+                if(runs[k].right < merged.left || runs[k].left > merged.right){
+                    continue;
+                }
+                inside = inside && runs[k].left >= merged.left && runs[k].right <= merged.right;
+                saving += lcd_st7789_tile_cost(mem, &runs[k], rows);
+                touched = 1;
+            }
+            if(!touched || !inside || saving < 0){
+                continue;
+            }
+            rects[i] = merged;
+            next[reached++] = i;
+            for(k = 0, x = 0; k < n; k++){
+                if(runs[k].right < merged.left || runs[k].left > merged.right){
+                    runs[x++] = runs[k];
+                }
+            }
+            n = x;
+        }
+
+        for(k = 0; k < n; k++){
+            next[reached++] = count;
+            rects[count++] = runs[k];
+        }
+        memcpy(open, next, reached * sizeof (open[0]));
+        opened = reached;
     }
 
-    {//设置闸门控制? （高位: 13.26, 低位: -10.43)
-        ret |= lcd_st7789_write_command(0xB7);
-        param[0] = 0x35;
-        ret |= lcd_st7789_write_data(param, 1);
+    for(i = 0; i < count; i++){
+        cost += lcd_st7789_tile_cost(mem, &rects[i], rows);
     }
+    all.left   = 0;
+    all.top    = 0;
+    all.right  = (int16_t)mem->tile_columns - 1;
+    all.bottom = (int16_t)bands - 1;
+    if(count > 1 && cost >= lcd_st7789_tile_cost(mem, &all, rows)){
+        rects[0] = all;
+        count = 1;
+    }
+
+    return count;
+}
+
+/**[FRCTRL2 对应的名义刷新周期, 传输层用它预测 TE 边沿]*/
+static uint32_t lcd_st7789_te_period_us(LCD_ST7798_MT *mem){
+    return 1000000 / lcd_st7789_frame_rates[mem->frctrl2];
+}
 
-    {//设置VCOM? (0x37对应值为 1.475)
-        ret |= lcd_st7789_write_command(0xBB);
-        param[0] = 0x19;
-        ret |= lcd_st7789_write_data(param, 1);
+/**[开启 vsync 时等到面板进入 vblank, 等不到时直接写]*/
+static void lcd_st7789_wait_vsync(LCD_ST7798_MT *mem){
+    if(!mem->vsync){
+        return;
     }
+    if(mem->transport->vsync(mem->transport, lcd_st7789_te_period_us(mem), LCD_ST7789_TE_TIMEOUT_US) == 0){
+        mem->vsyncs++;
+    }else{
+        mem->vsync_misses++;
+    }
+}
+
+static uint64_t lcd_st7789_now_us(void){
+    struct timespec ts;
 
-    {//设置LCM控制? 默认值
-        ret |= lcd_st7789_write_command(0xC0);
-        param[0] = 0x2C;
-        ret |= lcd_st7789_write_data(param, 1);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * LCD_ST7789_COLOR_AUTO: 用这一帧的总线耗时和到上一帧的间隔更新滑动平均 (1/8), 决定之后的像素格式.
+ * 总线耗时超过帧间隔的 90% 时改发 RGB444; RGB444 的耗时折算回 RGB565 后低于帧间隔的 70% 时恢复.
+ */
+static void lcd_st7789_color_update(LCD_ST7798_MT *mem, uint64_t arrival_us, uint32_t busy_us){
+    uint32_t interval;
+
+    if(mem->arrival_us == 0){
+        mem->arrival_us = arrival_us;
+        mem->send_us = busy_us;
+        return;
     }
+    interval = (uint32_t)(arrival_us - mem->arrival_us);
+    mem->arrival_us = arrival_us;
+    mem->interval_us = mem->interval_us == 0 ? interval : (mem->interval_us * 7 + interval) / 8;
+    mem->send_us = (mem->send_us * 7 + busy_us) / 8;
 
-    {//cmd 0xC2 0x01 0xFF 设置VDV和VRH开启 默认值
-        ret |= lcd_st7789_write_command(0xC2);
-        param[0] = 0x01;
-        ret |= lcd_st7789_write_data(param, 1);
+    if(!mem->reduced && (uint64_t)mem->send_us * 10 > (uint64_t)mem->interval_us * 9){
+        mem->reduced = 1;
+    }else if(mem->reduced && (uint64_t)mem->send_us * 40 < (uint64_t)mem->interval_us * 21){
+        mem->reduced = 0;
     }
+}
 
-    {//设置VRH (0x12对应值为 4.45+( vcom+vcom offset+vdv))
-        ret |= lcd_st7789_write_command(0xC3);
-        param[0] = 0x12;
-        ret |= lcd_st7789_write_data(param, 1);
+/**[config 窗口一行的字节数]*/
+static uint32_t lcd_st7789_linesize(LCD_ST7798_MT *mem){
+    return (uint32_t)(mem->window.right - mem->window.left + 1) * 2;
+}
+
+/**
+ * 发送 frame 中收到的 size 字节 (按窗口宽度计, frame 每行相隔 stride 字节) 里变化的部分, 并更新影子和分块哈希.
+ * 完整收到的块比较哈希, 只收到一部分行的块直接和影子比较; 不完整的最后一行有变化时单独发送.
+ * RGB444 时每个窗口先转换到 packed 再一次写出, 影子仍保存收到的 RGB565.
+ */
+static int lcd_st7789_present(LCD_ST7798_MT *mem, const uint8_t *frame, uint32_t stride, uint32_t size){
+    LCD_ST7789_RECT rects[LCD_ST7789_TILES];
+    LCD_ST7789_RECT tile, cur;
+    uint64_t hashes[LCD_ST7789_TILES];
+    uint8_t dirty[LCD_ST7789_TILES];
+    uint8_t hashed[LCD_ST7789_TILES];
+    uint32_t width = (uint32_t)(mem->window.right - mem->window.left + 1);
+    uint32_t linesize = width * 2;
+    uint32_t rows = size / linesize;
+    uint32_t bands = (rows + LCD_ST7789_TILE - 1) / LCD_ST7789_TILE;
+    uint32_t full = size + LCD_ST7789_WINDOW_BYTES;
+    uint32_t sent = 0;
+    uint32_t count, tail, x, y, t, i, n;
+    uint8_t region[8];
+    uint8_t tail_dirty;
+    const uint8_t *shadow;
+    LCD_ST7789_STATS before, after;
+    uint64_t arrival_us = 0;
+    int ret = 0;
+
+    if(mem->color == LCD_ST7789_COLOR_AUTO){
+        arrival_us = lcd_st7789_now_us();
+        if(mem->transport->stats(mem->transport, &before) != 0){
+            memset(&before, 0, sizeof (before));
+        }
+    }else{
+        mem->reduced = mem->color == LCD_ST7789_COLOR_RGB444;
     }
 
-    {//设置VDV (0x20对应值为 0)
-        ret |= lcd_st7789_write_command(0xC4);
-        param[0] = 0x20;
-        ret |= lcd_st7789_write_data(param, 1);
+    for(y = 0; y < bands; y++){
+        for(x = 0; x < mem->tile_columns; x++){
+            t = y * mem->tile_columns + x;
+            tile.left = tile.right = (int16_t)x;
+            tile.top = tile.bottom = (int16_t)y;
+            lcd_st7789_tile_pixels(mem, &tile, rows, &cur);
+            shadow = mem->shadow + ((mem->window.top + cur.top) * mem->width + mem->window.left + cur.left) * 2;
+            hashed[t] = (uint32_t)(cur.bottom - cur.top + 1) == LCD_ST7789_TILE
+                     || (uint32_t)(mem->window.top + cur.bottom) == (uint32_t)mem->window.bottom;
+            if(!hashed[t]){
+                // 这一块只收到了部分行
+                dirty[t] = 0;
+                for(i = (uint32_t)cur.top; i <= (uint32_t)cur.bottom && !dirty[t]; i++){
+                    dirty[t] = memcmp(frame + i * stride + cur.left * 2, shadow + (i - cur.top) * mem->width * 2,
+                                      (uint32_t)(cur.right - cur.left + 1) * 2) != 0;
+                }
+                continue;
+            }
+            if(!mem->tile_valid[t]){
+                mem->tile_hash[t] = lcd_st7789_tile_hash(shadow, (uint32_t)mem->width * 2, (uint32_t)(cur.right - cur.left + 1) * 2,
+                                                         (uint32_t)(cur.bottom - cur.top + 1));
+                mem->tile_valid[t] = 1;
+            }
+            hashes[t] = lcd_st7789_tile_hash(frame + cur.top * stride + cur.left * 2, stride,
+                                             (uint32_t)(cur.right - cur.left + 1) * 2, (uint32_t)(cur.bottom - cur.top + 1));
+            dirty[t] = hashes[t] != mem->tile_hash[t];
+        }
     }
 
-    {//设置刷新率 默认值 (0x0F对应值为 60Hz)
-        ret |= lcd_st7789_write_command(0xC6);
-        param[0] = 0x0F;
-        ret |= lcd_st7789_write_data(param, 1);
+    // 不完整的最后一行不在任何窗口里, 先比较, 有东西要写时才等 TE
+    tail = size % linesize;
+    shadow = mem->shadow + ((mem->window.top + rows) * mem->width + mem->window.left) * 2;
+    tail_dirty = tail >= 2 && memcmp(frame + rows * stride, shadow, tail / 2 * 2) != 0;
+
+    count = lcd_st7789_plan(mem, dirty, bands, rows, rects);
+    if(count > 0 || tail_dirty){
+        ret |= lcd_st7789_set_colmod(mem, mem->reduced ? LCD_ST7789_COLMOD_444 : LCD_ST7789_COLMOD_565);
+        lcd_st7789_wait_vsync(mem);
+    }
+    for(i = 0; i < count; i++){
+        lcd_st7789_tile_pixels(mem, &rects[i], rows, &tile);
+        cur.left   = (int16_t)(mem->window.left + tile.left);
+        cur.right  = (int16_t)(mem->window.left + tile.right);
+        cur.top    = (int16_t)(mem->window.top + tile.top);
+        cur.bottom = (int16_t)(mem->window.top + tile.bottom);
+        lcd_st7789_set_region(region, cur.left, cur.top, cur.right, cur.bottom);
+        ret |= lcd_st7789_write_window(mem, region);
+        if(mem->reduced){
+            n = lcd_st7789_pack444(frame + tile.top * stride + tile.left * 2, stride, cur.left, cur.top,
+                                   (uint32_t)(tile.right - tile.left + 1), (uint32_t)(tile.bottom - tile.top + 1), mem->packed);
+            ret |= lcd_st7789_write_data(mem, mem->packed, n);
+        }else if(tile.left == 0 && (uint32_t)tile.right == width - 1 && stride == linesize){
+            // 整行宽的窗口在 frame 中是连续的
+            n = (uint32_t)(tile.bottom - tile.top + 1) * linesize;
+            ret |= lcd_st7789_write_data(mem, (uint8_t*)frame + tile.top * linesize, n);
+        }else{
+            n = (uint32_t)(tile.right - tile.left + 1) * 2;
+            for(y = (uint32_t)tile.top; y <= (uint32_t)tile.bottom; y++){
+                ret |= lcd_st7789_write_data(mem, (uint8_t*)frame + y * stride + tile.left * 2, n);
+            }
+            n *= (uint32_t)(tile.bottom - tile.top + 1);
+        }
+        lcd_st7789_shadow_store(mem, &cur, frame + tile.top * stride + tile.left * 2, stride);
+        sent += n + LCD_ST7789_WINDOW_BYTES;
     }
 
-    {//设置电源控制? 默认值
-        ret |= lcd_st7789_write_command(0xD0);
-        param[0] = 0xA4;
-        param[1] = 0xA1;
-        ret |= lcd_st7789_write_data(param, 2);
+    if(tail_dirty){
+        cur.left   = mem->window.left;
+        cur.right  = (int16_t)(mem->window.left + tail / 2 - 1);
+        cur.top    = (int16_t)(mem->window.top + rows);
+        cur.bottom = cur.top;
+        lcd_st7789_set_region(region, cur.left, cur.top, cur.right, cur.bottom);
+        ret |= lcd_st7789_write_window(mem, region);
+        if(mem->reduced){
+            n = lcd_st7789_pack444(frame + rows * stride, stride, cur.left, cur.top, tail / 2, 1, mem->packed);
+            ret |= lcd_st7789_write_data(mem, mem->packed, n);
+        }else{
+            n = tail / 2 * 2;
+            ret |= lcd_st7789_write_data(mem, (uint8_t*)frame + rows * stride, n);
+        }
+        lcd_st7789_shadow_store(mem, &cur, frame + rows * stride, stride);
+        sent += n + LCD_ST7789_WINDOW_BYTES;
+        count++;
     }
 
-    {//设置正电压伽马控制？ (有默认值)
-        ret |= lcd_st7789_write_command(0xE0);
-        param[0]  = 0xD0;
-        param[1]  = 0x04;
-        param[2]  = 0x0D;
-        param[3]  = 0x11;
-        param[4]  = 0x13;
-        param[5]  = 0x2B;
-        param[6]  = 0x3F;
-        param[7]  = 0x54;
-        param[8]  = 0x4C;
-        param[9]  = 0x18;
-        param[10] = 0x0D;
-        param[11] = 0x0B;
-        param[12] = 0x1F;
-        param[13] = 0x23;
-        ret |= lcd_st7789_write_data(param, 14);
+    // 影子已经是这一帧的内容, 完整收到的块直接用这一帧的哈希
+    for(t = 0; t < bands * mem->tile_columns; t++){
+        if(hashed[t]){
+            mem->tile_hash[t] = hashes[t];
+            mem->tile_valid[t] = 1;
+        }
     }
 
-    {//设置负电压伽马控制? (有默认值)
-        ret |= lcd_st7789_write_command(0xE1);
-        param[0]  = 0xD0;
-        param[1]  = 0x04;
-        param[2]  = 0x0C;
-        param[3]  = 0x11;
-        param[4]  = 0x13;
-        param[5]  = 0x2C;
-        param[6]  = 0x3F;
-        param[7]  = 0x44;
-        param[8]  = 0x51;
-        param[9]  = 0x2F;
-        param[10] = 0x1F;
-        param[11] = 0x1F;
-        param[12] = 0x20;
-        param[13] = 0x23;
-        ret |= lcd_st7789_write_data(param, 14);
+    mem->frames++;
+    mem->last_bytes = sent;
+    mem->last_saved = full > sent ? full - sent : 0;
+    mem->saved_bytes += mem->last_saved;
+    if(count > 0 && mem->reduced){
+        mem->reduced_frames++;
     }
 
-    {//cmd 0x21 设置显示反色打开
-        ret |= lcd_st7789_write_command(0x21);
+    if(count > 0){
+        ret |= lcd_st7789_flush(mem);
+    }
+    if(mem->color == LCD_ST7789_COLOR_AUTO){
+        if(mem->transport->stats(mem->transport, &after) != 0){
+            after = before;
+        }
+        lcd_st7789_color_update(mem, arrival_us, (uint32_t)(after.busy_us - before.busy_us));
     }
+    if(count > 0 && mem->config_us != 0){
+        mem->first_pixel_us = (uint32_t)(lcd_st7789_now_us() - mem->config_us);
+        mem->config_us = 0;
+    }
+    return ret;
+}
+
+/**[整个显示面清成黑色: 一个窗口一次写出; 全 0 在 12bit 下也是黑色, 用 RGB444 少发 25%]*/
+int lcd_st7789_clear(LCD_ST7798_MT *mem){
+    uint32_t size = (uint32_t)mem->width * mem->height / 2 * 3;
+    uint8_t region[8];
+    uint8_t *blanks;
+    int ret = 0;
+
+    blanks = (uint8_t*)calloc(size, 1);
+    if(blanks == NULL){
+        return -1;
+    }
+    lcd_st7789_set_region(region, 0, 0, mem->width - 1, mem->height - 1);
+    ret |= lcd_st7789_set_colmod(mem, LCD_ST7789_COLMOD_444);
+    ret |= lcd_st7789_write_window(mem, region);
+    ret |= lcd_st7789_write_data(mem, blanks, size);
+    ret |= lcd_st7789_flush(mem);
+    free(blanks);
+
+    memset(mem->shadow, 0, LCD_ST7789_WIDTH * LCD_ST7789_HEIGHT * 2);
+    if(mem->tile_valid != NULL){
+        memset(mem->tile_valid, 0, mem->tile_columns * mem->tile_rows);
+    }
+
+    if(ret != 0) {
+        perror("[Error] - lcd st7789 clear Failed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**[按表写入命令和参数, 中间不 flush, 由传输层合并成尽量少的传输]*/
+static int lcd_st7789_write_table(LCD_ST7798_MT *mem, const uint8_t *table){
+    int ret = 0;
+
+    while(table[0] != LCD_ST7789_TABLE_END){
+        ret |= lcd_st7789_write_command(mem, table[0]);
+        if(table[1] > 0){
+            ret |= lcd_st7789_write_data(mem, (uint8_t*)table + 2, table[1]);
+        }
+        table += 2 + table[1];
+    }
+    return ret;
+}
+
+/**[面板运行时可能被改过的状态: 刷新率, 扫描方向, 滚动区, TE]*/
+static int lcd_st7789_write_state(LCD_ST7798_MT *mem){
+    static const uint8_t table[] = {
+        0x13, 0,                                        // NORON, 退出局部显示
+        0x33, 6, 0x00, 0x00, 0x01, 0x40, 0x00, 0x00,    // VSCRDEF, 整屏都不滚动
+        0x37, 2, 0x00, 0x00,                            // VSCSAD
+        0x34, 0,                                        // TEOFF, 见 lcd_st7789_vsync
+        LCD_ST7789_TABLE_END
+    };
+    int ret = 0;
+
+    ret |= lcd_st7789_write_command(mem, 0x36);
+    ret |= lcd_st7789_write_data(mem, &mem->madctl, 1);
+    ret |= lcd_st7789_write_command(mem, 0xC6);
+    ret |= lcd_st7789_write_data(mem, &mem->frctrl2, 1);
+    ret |= lcd_st7789_write_table(mem, table);
+    return ret;
+}
+
+/**
+ * 热启动: 用 RDDST 读回面板状态, 已经退出睡眠、打开显示、扫描方向和反色与本次配置相同,
+ * 说明上次按同样的方式初始化过, 只重写运行时可能改变的状态. 不能读回或状态不符时返回 -1.
+ */
+static int lcd_st7789_warm(LCD_ST7798_MT *mem){
+    uint8_t raw[5];
+    uint8_t status[4];
+    uint8_t ifpf;
+    int i;
+
+    if(mem->transport->read(mem->transport, 0x09, raw, sizeof (raw)) != 0){
+        return -1;
+    }
+    // RDDST 前面有 1 个 dummy 周期
+    for(i = 0; i < 4; i++){
+        status[i] = (uint8_t)(raw[i] << 1 | raw[i + 1] >> 7);
+    }
+    ifpf = (status[1] >> 4) & 0x07;
+    if(!(status[0] & 0x80)                                  // 升压电路
+       || (status[0] & 0x7E) != ((mem->madctl >> 1) & 0x7E) // MADCTL
+       || (ifpf != LCD_ST7789_COLMOD_565 && ifpf != LCD_ST7789_COLMOD_444)
+       || !(status[1] & 0x02)                               // 退出睡眠
+       || !(status[2] & 0x20)                               // 反色
+       || !(status[2] & 0x04)){                             // 显示打开
+        return -1;
+    }
+
+    mem->colmod = ifpf;
+    if(lcd_st7789_write_state(mem) != 0 || lcd_st7789_flush(mem) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+/**[毫秒级延时: SAFE 模式使用原来的 100ms]*/
+static void lcd_st7789_delay(LCD_ST7798_MT *mem, uint32_t us){
+    usleep(mem->startup == LCD_ST7789_START_SAFE ? 100000 : us);
+}
+
+/**
+ * 显示重置. 延时取数据手册的最小值:
+ * 复位脉冲至少 10us; 复位后 5ms 内不能发命令, 睡眠退出状态下复位要 120ms,
+ * 所以复位前先发 SLPIN (之后 5ms 才能发下一条命令); SLPOUT 之后 5ms 才能发下一条命令.
+ */
+int lcd_st7789_reset(LCD_ST7798_MT *mem){
+    int ret = 0;
+
+    if(mem->startup == LCD_ST7789_START_WARM && lcd_st7789_warm(mem) == 0){
+        return lcd_st7789_clear(mem);
+    }
+
+    {// 重置引脚
+        ret |= mem->transport->reset(mem->transport, 1);
+        ret |= lcd_st7789_write_command(mem, 0x10);
+        ret |= lcd_st7789_flush(mem);
+        lcd_st7789_delay(mem, 5000);
+        ret |= mem->transport->reset(mem->transport, 0);
+        lcd_st7789_delay(mem, 20);
+        ret |= mem->transport->reset(mem->transport, 1);
+        lcd_st7789_delay(mem, 5000);
+    }
+
+    {//设置像素格式rgb 16bit/pixel 65K, output 需要时再切换到 12bit
+        mem->colmod = 0x00;
+        ret |= lcd_st7789_set_colmod(mem, LCD_ST7789_COLMOD_565);
+    }
+    ret |= lcd_st7789_write_table(mem, lcd_st7789_init_table);
+    ret |= lcd_st7789_write_state(mem);
 
     {//cmd 0x11 唤醒
-        ret |= lcd_st7789_write_command(0x11);
+        ret |= lcd_st7789_write_command(mem, 0x11);
+        ret |= lcd_st7789_flush(mem);
+        lcd_st7789_delay(mem, 5000);
     }
 
     {//cmd 0x29 设置显示打开
-        ret |= lcd_st7789_write_command(0x29);
+        ret |= lcd_st7789_write_command(mem, 0x29);
     }
 
     {// 清空像素
-        ret |= lcd_st7789_clear();
+        ret |= lcd_st7789_clear(mem);
     }
 
     if(ret != 0) {
@@ -219,38 +841,299 @@ int lcd_st7789_reset(){
 }
 
 
-int lcd_st7789_config(void *self, int16_t left, int16_t top, int16_t right, int16_t bottom){
+/**[任务序号加一, 跳过保留给 "没有任务" 的 0]*/
+static uint32_t lcd_st7789_fence_next(uint32_t fence){
+    return fence + 1 != 0 ? fence + 1 : 1;
+}
+
+/**[等待已提交的异步任务全部写出]*/
+static void lcd_st7789_drain(LCD_ST7798_MT *mem){
+    pthread_mutex_lock(&mem->lock);
+    while(mem->completed != mem->submitted){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    pthread_mutex_unlock(&mem->lock);
+}
+
+static void* lcd_st7789_worker(void *arg){
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)arg;
+    LCD_ST7789_TASK task;
+    LCD_ST7789_JOB job;
+    LCD_ST7789_RECT rect;
+    uint8_t region[8];
+    int ret;
+
+    pthread_mutex_lock(&mem->lock);
+    while(1){
+        while(mem->running && mem->count == 0){
+            pthread_cond_wait(&mem->cond, &mem->lock);
+        }
+        // 退出前写完队列中剩余的任务
+        if(mem->count == 0){
+            break;
+        }
+        task = mem->queue[mem->head];
+        job = task.job;
+        pthread_mutex_unlock(&mem->lock);
+
+        pthread_mutex_lock(&mem->bus);
+        if(task.present){
+            // commit 的整帧: 和影子比较, 只发送变化的部分
+            ret = lcd_st7789_present(mem, job.data, lcd_st7789_linesize(mem), job.size);
+        }else{
+            lcd_st7789_set_region(region, job.left, job.top, job.right, job.bottom);
+            ret  = lcd_st7789_set_colmod(mem, LCD_ST7789_COLMOD_565);
+            ret |= lcd_st7789_write_window(mem, region);
+            ret |= lcd_st7789_write_data(mem, (uint8_t*)job.data, job.size);
+            ret |= lcd_st7789_flush(mem);
+            rect.left   = job.left;
+            rect.top    = job.top;
+            rect.right  = job.right;
+            rect.bottom = job.bottom;
+            lcd_st7789_shadow_store(mem, &rect, job.data, (uint32_t)(job.right - job.left + 1) * 2);
+        }
+        pthread_mutex_unlock(&mem->bus);
+
+        pthread_mutex_lock(&mem->lock);
+        mem->head = (mem->head + 1) % LCD_ST7789_QUEUE_SIZE;
+        mem->count--;
+        mem->completed = lcd_st7789_fence_next(mem->completed);
+        mem->error |= ret;
+        pthread_cond_broadcast(&mem->cond);
+    }
+    pthread_mutex_unlock(&mem->lock);
+
+    return NULL;
+}
+
+/**[排入发送队列, 需要时启动发送线程; 返回最后一项的 fence, 失败返回 0]*/
+static uint32_t lcd_st7789_enqueue(LCD_ST7798_MT *mem, const LCD_ST7789_JOB *jobs, uint32_t count, uint8_t present){
+    uint32_t fence;
+    uint32_t i;
+    LCD_ST7789_TASK *task;
+
+    pthread_mutex_lock(&mem->lock);
+    if(!mem->running){
+        mem->running = 1;
+        if(pthread_create(&mem->thread, NULL, &lcd_st7789_worker, mem) != 0){
+            perror("[Error] - lcd st7789 worker thread");
+            mem->running = 0;
+            pthread_mutex_unlock(&mem->lock);
+            return 0;
+        }
+    }
+    for(i = 0; i < count; i++){
+        while(mem->count == LCD_ST7789_QUEUE_SIZE){
+            pthread_cond_wait(&mem->cond, &mem->lock);
+        }
+        task = &mem->queue[(mem->head + mem->count) % LCD_ST7789_QUEUE_SIZE];
+        task->job = jobs[i];
+        task->present = present;
+        mem->count++;
+        mem->submitted = lcd_st7789_fence_next(mem->submitted);
+        pthread_cond_broadcast(&mem->cond);
+    }
+    fence = mem->submitted;
+    pthread_mutex_unlock(&mem->lock);
+
+    return fence;
+}
+
+uint32_t lcd_st7789_submit(void *self, const LCD_ST7789_JOB *jobs, uint32_t count){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    const LCD_ST7789_JOB *job;
+    uint32_t i;
+
+    for(i = 0; i < count; i++){
+        job = &jobs[i];
+        if(job->left < 0 || job->top < 0 || job->left > job->right || job->top > job->bottom
+           || job->right >= mem->width || job->bottom >= mem->height
+           || job->size != (uint32_t)(job->right - job->left + 1) * (job->bottom - job->top + 1) * 2){
+            fprintf(stderr, "LCD_ST7789 submit invalid job\n");
+            return 0;
+        }
+    }
+
+    return lcd_st7789_enqueue(mem, jobs, count, 0);
+}
+
+int lcd_st7789_wait(void *self, uint32_t fence){
     LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
     LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    int ret;
+
+    pthread_mutex_lock(&mem->lock);
+    // 序号回绕后按差值比较
+    while(fence != 0 && (int32_t)(mem->completed - fence) < 0){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    ret = mem->error;
+    mem->error = 0;
+    pthread_mutex_unlock(&mem->lock);
 
-    if(bcm2835_init() == 0){
-        fprintf(stderr, "bcm2835_init failed. \n");
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 async output Failed\n");
         return -1;
-    }else{
-        bcm2835_gpio_fsel(LCD_ST7789_GPIO_SPI_PIN_RES, BCM2835_GPIO_FSEL_OUTP);
-        bcm2835_gpio_fsel(LCD_ST7789_GPIO_SPI_PIN_DC,  BCM2835_GPIO_FSEL_OUTP);
     }
-    if(bcm2835_spi_begin() == 0){
-        printf("bcm2835_spi_begin failed.\n");
+    return 0;
+}
+
+
+uint8_t* lcd_st7789_begin_frame(void *self){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    uint32_t fence;
+
+    if(mem->buffers[0] == NULL){
+        return NULL;
+    }
+
+    // 后台缓冲上一次 commit 的帧还在发送时等它写完, 错误留给 commit 返回
+    fence = mem->fences[mem->back];
+    pthread_mutex_lock(&mem->lock);
+    while(fence != 0 && (int32_t)(mem->completed - fence) < 0){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    pthread_mutex_unlock(&mem->lock);
+
+    mem->begun = 1;
+    return mem->buffers[mem->back];
+}
+
+int lcd_st7789_commit(void *self){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    LCD_ST7789_JOB job;
+    uint32_t fence;
+    int ret;
+
+    if(!mem->begun){
+        return -1;
+    }
+
+    job.left   = mem->window.left;
+    job.top    = mem->window.top;
+    job.right  = mem->window.right;
+    job.bottom = mem->window.bottom;
+    job.data   = mem->buffers[mem->back];
+    job.size   = (uint32_t)(job.right - job.left + 1) * (job.bottom - job.top + 1) * 2;
+    fence = lcd_st7789_enqueue(mem, &job, 1, 1);
+    if(fence == 0){
+        return -1;
+    }
+    mem->fences[mem->back] = fence;
+    mem->back ^= 1;
+    mem->begun = 0;
+
+    // 发送是异步的, 之前的帧出错时在这里返回
+    pthread_mutex_lock(&mem->lock);
+    ret = mem->error;
+    mem->error = 0;
+    pthread_mutex_unlock(&mem->lock);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 commit Failed\n");
         return -1;
+    }
+    return 0;
+}
+
+
+int lcd_st7789_rotate(void *self, uint8_t rotation){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    // MADCTL: 90 = MX|MV, 180 = MX|MY, 270 = MY|MV
+    static const uint8_t madctl[] = {0x00, 0x60, 0xC0, 0xA0};
+
+    // config 已按旋转前的宽高分配了帧、分块和影子缓冲, 并发送了 MADCTL, 之后不能再改
+    if(mem->frame != NULL || rotation > LCD_ST7789_ROTATE_270){
+        return -1;
+    }
+    mem->madctl = madctl[rotation];
+    if(rotation == LCD_ST7789_ROTATE_90 || rotation == LCD_ST7789_ROTATE_270){
+        mem->width  = LCD_ST7789_HEIGHT;
+        mem->height = LCD_ST7789_WIDTH;
     }else{
-        bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
-        bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
-        bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_8);
-        bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
-        bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, 0);
-    }
-
-    mem->region[0]  = (left >> 8) & 0xFF;
-    mem->region[1]  = left & 0xFF;
-    mem->region[2]  = (right >> 8) & 0xFF;
-    mem->region[3]  = right & 0xFF;
-    mem->region[4]  = (top >> 8) & 0xFF;
-    mem->region[5]  = top & 0xFF;
-    mem->region[6]  = (bottom >> 8) & 0xFF;
-    mem->region[7]  = bottom & 0xFF;
-
-    if(lcd_st7789_reset() != 0){
+        mem->width  = LCD_ST7789_WIDTH;
+        mem->height = LCD_ST7789_HEIGHT;
+    }
+    return 0;
+}
+
+/**[释放 config 分配的缓冲, 回到没有 config 的状态]*/
+static void lcd_st7789_release(LCD_ST7798_MT *mem){
+    int i;
+
+    free(mem->frame);
+    free(mem->packed);
+    mem->frame  = NULL;
+    mem->packed = NULL;
+    for(i = 0; i < 2; i++){
+        free(mem->buffers[i]);
+        mem->buffers[i] = NULL;
+    }
+    free(mem->tile_hash);
+    free(mem->tile_valid);
+    mem->tile_hash  = NULL;
+    mem->tile_valid = NULL;
+}
+
+int lcd_st7789_config(void *self, int16_t left, int16_t top, int16_t right, int16_t bottom){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    int i;
+
+    // 重新分配缓冲之前写完排队中的任务
+    lcd_st7789_drain(mem);
+
+    // 窗口无效时不打开总线
+    if(left < 0 || top < 0 || left > right || top > bottom || right >= mem->width || bottom >= mem->height){
+        fprintf(stderr, "LCD_ST7789 invalid window\n");
+        return -1;
+    }
+
+    mem->config_us = lcd_st7789_now_us();
+    mem->first_pixel_us = 0;
+    if(mem->transport->open(mem->transport) != 0){
+        fprintf(stderr, "LCD_ST7789 transport open Failed\n");
+        return -1;
+    }
+
+    lcd_st7789_set_region(mem->region, left, top, right, bottom);
+    mem->window.left   = left;
+    mem->window.top    = top;
+    mem->window.right  = right;
+    mem->window.bottom = bottom;
+    lcd_st7789_release(mem);
+    mem->frame  = (uint8_t*)malloc((size_t)(right - left + 1) * (bottom - top + 1) * 2);
+    mem->packed = (uint8_t*)malloc(((size_t)(right - left + 1) * (bottom - top + 1) + 1) / 2 * 3);
+    for(i = 0; i < 2; i++){
+        mem->buffers[i] = (uint8_t*)calloc((size_t)(right - left + 1) * (bottom - top + 1), 2);
+        mem->fences[i] = 0;
+    }
+    mem->back  = 0;
+    mem->begun = 0;
+    mem->received = 0;
+    mem->scroll_top    = 0;
+    mem->scroll_height = 0;
+    mem->scroll_start  = 0;
+    mem->vsync = 0;
+    mem->tile_columns = (uint32_t)(right - left + LCD_ST7789_TILE) / LCD_ST7789_TILE;
+    mem->tile_rows    = (uint32_t)(bottom - top + LCD_ST7789_TILE) / LCD_ST7789_TILE;
+    mem->tile_hash  = (uint64_t*)malloc(mem->tile_columns * mem->tile_rows * sizeof (uint64_t));
+    mem->tile_valid = (uint8_t*)malloc(mem->tile_columns * mem->tile_rows);
+
+    // 任何一块分配失败都回到没有 config 的状态, 其他入口返回 -1
+    if(mem->frame == NULL || mem->packed == NULL || mem->buffers[0] == NULL || mem->buffers[1] == NULL
+       || mem->tile_hash == NULL || mem->tile_valid == NULL){
+        fprintf(stderr, "LCD_ST7789 out of memory\n");
+        lcd_st7789_release(mem);
+        return -1;
+    }
+    memset(mem->tile_valid, 0, mem->tile_columns * mem->tile_rows);
+
+    if(lcd_st7789_reset(mem) != 0){
         fprintf(stderr, "LCD_ST7789 reset Failed\n");
         return -1;
     }
@@ -262,20 +1145,42 @@ int lcd_st7789_output(void* self, uint8_t* data, uint32_t size, uint8_t append){
     LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
     LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
 
+    uint32_t framesize;
+    uint32_t n;
     int ret = 0;
 
+    if(mem->frame == NULL){
+        return -1;
+    }
+    framesize = (uint32_t)(mem->window.right - mem->window.left + 1) * (mem->window.bottom - mem->window.top + 1) * 2;
+
+    // 同步写入排在已提交的异步任务之后
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    // 数据先收进 frame, 收满窗口时和影子比较后发送; 新的一帧开始时先发送上一帧收到的部分
     if(append == 0x00){
-        ret |= lcd_st7789_write_command(0x2A);
-        ret |= lcd_st7789_write_data(mem->region, 4);
-        ret |= lcd_st7789_write_command(0x2B);
-        ret |= lcd_st7789_write_data(mem->region + 4, 4);
-        ret |= lcd_st7789_write_command(0x2C);
+        if(mem->received > 0){
+            ret |= lcd_st7789_present(mem, mem->frame, lcd_st7789_linesize(mem), mem->received);
+        }
+        mem->received = 0;
     }
 
-    if(size > 0){
-        ret |= lcd_st7789_write_data(data, size);
+    while(size > 0){
+        n = framesize - mem->received;
+        n = size < n ? size : n;
+        memcpy(mem->frame + mem->received, data, n);
+        mem->received += n;
+        data += n;
+        size -= n;
+        if(mem->received == framesize){
+            ret |= lcd_st7789_present(mem, mem->frame, lcd_st7789_linesize(mem), framesize);
+            mem->received = 0;
+        }
     }
 
+    pthread_mutex_unlock(&mem->bus);
+
     if(ret != 0){
         fprintf(stderr, "LCD_ST7789 output Failed\n");
         return -1;
@@ -284,17 +1189,454 @@ int lcd_st7789_output(void* self, uint8_t* data, uint32_t size, uint8_t append){
     return 0;
 }
 
+int lcd_st7789_output_image(void* self, const uint8_t* data, uint32_t stride, uint16_t width, uint16_t height){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    int ret = 0;
+
+    if(mem->frame == NULL){
+        return -1;
+    }
+    if(width != mem->window.right - mem->window.left + 1 || height != mem->window.bottom - mem->window.top + 1
+       || stride < (uint32_t)width * 2){
+        fprintf(stderr, "LCD_ST7789 output_image size mismatch\n");
+        return -1;
+    }
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    // 先结束 output 还没收满的一帧, 然后直接从调用方的缓冲按 stride 发送, 不经过 frame
+    if(mem->received > 0){
+        ret |= lcd_st7789_present(mem, mem->frame, lcd_st7789_linesize(mem), mem->received);
+        mem->received = 0;
+    }
+    ret |= lcd_st7789_present(mem, data, stride, (uint32_t)width * height * 2);
+
+    pthread_mutex_unlock(&mem->bus);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 output_image Failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**[写入校准测试窗口]*/
+static int lcd_st7789_calibrate_write(LCD_ST7798_MT *mem, uint8_t *pattern){
+    int ret = 0;
+    uint8_t region[8] ={
+        0x00, 0x00, 0x00, LCD_ST7789_CALIBRATE_WIDTH - 1,
+        0x00, 0x00, 0x00, LCD_ST7789_CALIBRATE_HEIGHT - 1
+    };
+    LCD_ST7789_RECT rect = {0, 0, LCD_ST7789_CALIBRATE_WIDTH - 1, LCD_ST7789_CALIBRATE_HEIGHT - 1};
+
+    ret |= lcd_st7789_set_colmod(mem, LCD_ST7789_COLMOD_565);
+    ret |= lcd_st7789_write_window(mem, region);
+    ret |= lcd_st7789_write_data(mem, pattern, LCD_ST7789_CALIBRATE_PIXELS * 2);
+    ret |= lcd_st7789_flush(mem);
+    lcd_st7789_shadow_store(mem, &rect, pattern, LCD_ST7789_CALIBRATE_WIDTH * 2);
+
+    return ret;
+}
+
+/**[读回的比特流中从第 bit 位开始取一个字节]*/
+static uint8_t lcd_st7789_calibrate_byte(const uint8_t *raw, uint32_t bit){
+    uint32_t shift = bit % 8;
+
+    raw += bit / 8;
+    if(shift == 0){
+        return raw[0];
+    }
+    return (uint8_t)((raw[0] << shift) | (raw[1] >> (8 - shift)));
+}
+
+/**[当前时钟下写入测试图案并用 RAMRD 读回比较, 0 通过]*/
+static int lcd_st7789_calibrate_verify(LCD_ST7798_MT *mem, uint32_t seed){
+    uint8_t pattern[LCD_ST7789_CALIBRATE_PIXELS * 2];
+    uint8_t raw[LCD_ST7789_CALIBRATE_PIXELS * 3 + LCD_ST7789_CALIBRATE_DUMMY / 8 + 1];
+    uint32_t state = 0x2545F491 + seed * 0x9E3779B9;
+    uint32_t i, skip, bit;
+    uint16_t pixel;
+
+    for(i = 0; i < LCD_ST7789_CALIBRATE_PIXELS; i++){
+        // xorshift, 相邻像素的比特变化尽量多
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        pattern[i * 2]     = (uint8_t)(state >> 8);
+        pattern[i * 2 + 1] = (uint8_t)state;
+    }
+
+    if(lcd_st7789_calibrate_write(mem, pattern) != 0
+       || mem->transport->read(mem->transport, 0x2E, raw, sizeof (raw)) != 0){
+        return -1;
+    }
+
+    // 读回为每像素3字节 (RGB 各6bit左对齐), 前面有 dummy 周期, 逐位对齐后只比较写入的有效位
+    for(skip = 0; skip <= LCD_ST7789_CALIBRATE_DUMMY; skip++){
+        for(i = 0; i < LCD_ST7789_CALIBRATE_PIXELS; i++){
+            pixel = (uint16_t)(pattern[i * 2] << 8 | pattern[i * 2 + 1]);
+            bit = skip + i * 24;
+            if((lcd_st7789_calibrate_byte(raw, bit) >> 3) != (pixel >> 11)
+               || (lcd_st7789_calibrate_byte(raw, bit + 8) >> 2) != ((pixel >> 5) & 0x3F)
+               || (lcd_st7789_calibrate_byte(raw, bit + 16) >> 3) != (pixel & 0x1F)){
+                break;
+            }
+        }
+        if(i == LCD_ST7789_CALIBRATE_PIXELS){
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int lcd_st7789_scroll_area(void *self, int16_t top, int16_t height){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    uint8_t param[6];
+    int ret = 0;
+
+    // 没有 config 时总线还没有打开
+    // VSCRDEF 沿 GRAM 的行方向滚动, 只有不旋转时和显示的行一致
+    if(mem->frame == NULL || mem->madctl != 0x00 || top < 0 || height <= 0 || top + height > LCD_ST7789_HEIGHT){
+        return -1;
+    }
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    mem->scroll_top    = top;
+    mem->scroll_height = height;
+    mem->scroll_start  = top;
+
+    // TFA, VSA, BFA 之和必须是 320
+    param[0] = (uint8_t)(top >> 8);
+    param[1] = (uint8_t)top;
+    param[2] = (uint8_t)(height >> 8);
+    param[3] = (uint8_t)height;
+    param[4] = (uint8_t)((LCD_ST7789_HEIGHT - top - height) >> 8);
+    param[5] = (uint8_t)(LCD_ST7789_HEIGHT - top - height);
+    ret |= lcd_st7789_write_command(mem, 0x33);
+    ret |= lcd_st7789_write_data(mem, param, 6);
+    param[0] = (uint8_t)(top >> 8);
+    param[1] = (uint8_t)top;
+    ret |= lcd_st7789_write_command(mem, 0x37);
+    ret |= lcd_st7789_write_data(mem, param, 2);
+    ret |= lcd_st7789_flush(mem);
+
+    pthread_mutex_unlock(&mem->bus);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 scroll area Failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lcd_st7789_scroll(void *self, int16_t lines, const uint8_t *data){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    uint32_t linesize = LCD_ST7789_WIDTH * 2;
+    int16_t count = lines < 0 ? -lines : lines;
+    int16_t first, row, n, i;
+    LCD_ST7789_RECT rect;
+    uint8_t region[8];
+    uint8_t param[2];
+    int ret = 0;
+
+    if(mem->frame == NULL || mem->scroll_height == 0 || count == 0 || count > mem->scroll_height){
+        return -1;
+    }
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    // 先移动起始行, 新露出的行对应的正是刚移出显示的 GRAM 行
+    mem->scroll_start = (int16_t)(mem->scroll_top
+        + (mem->scroll_start - mem->scroll_top + lines + mem->scroll_height) % mem->scroll_height);
+    param[0] = (uint8_t)(mem->scroll_start >> 8);
+    param[1] = (uint8_t)mem->scroll_start;
+    ret |= lcd_st7789_write_command(mem, 0x37);
+    ret |= lcd_st7789_write_data(mem, param, 2);
+
+    // 上移时新行在滚动区底部, 下移时在顶部; 在 GRAM 中最多分成两段
+    ret |= lcd_st7789_set_colmod(mem, LCD_ST7789_COLMOD_565);
+    first = lines > 0 ? mem->scroll_height - count : 0;
+    for(i = 0; i < count; i += n){
+        row = (int16_t)(mem->scroll_top + (mem->scroll_start - mem->scroll_top + first + i) % mem->scroll_height);
+        n = mem->scroll_top + mem->scroll_height - row;
+        n = n < count - i ? n : count - i;
+
+        rect.left   = 0;
+        rect.right  = LCD_ST7789_WIDTH - 1;
+        rect.top    = row;
+        rect.bottom = (int16_t)(row + n - 1);
+        lcd_st7789_set_region(region, rect.left, rect.top, rect.right, rect.bottom);
+        ret |= lcd_st7789_write_window(mem, region);
+        ret |= lcd_st7789_write_data(mem, (uint8_t*)data + i * linesize, n * linesize);
+        lcd_st7789_shadow_store(mem, &rect, data + i * linesize, linesize);
+    }
+    ret |= lcd_st7789_flush(mem);
+
+    pthread_mutex_unlock(&mem->bus);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 scroll Failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lcd_st7789_vsync(void *self, uint8_t enable){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    uint8_t param = 0x00;
+    int ret = 0;
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    mem->vsync = 0;
+    if(enable){
+        // TEON, M=0: TE 只在 vblank 期间为高
+        ret |= lcd_st7789_write_command(mem, 0x35);
+        ret |= lcd_st7789_write_data(mem, &param, 1);
+        ret |= lcd_st7789_flush(mem);
+        if(ret == 0 && mem->transport->vsync(mem->transport, lcd_st7789_te_period_us(mem), LCD_ST7789_TE_TIMEOUT_US) == 0){
+            mem->vsync = 1;
+        }else{
+            ret = -1;
+        }
+    }
+    if(!mem->vsync){
+        ret |= lcd_st7789_write_command(mem, 0x34);
+        ret |= lcd_st7789_flush(mem);
+    }
+
+    pthread_mutex_unlock(&mem->bus);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 vsync: no tearing effect signal\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lcd_st7789_color(void *self, uint8_t mode){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+
+    if(mode > LCD_ST7789_COLOR_AUTO){
+        return -1;
+    }
+
+    pthread_mutex_lock(&mem->bus);
+    mem->color = mode;
+    // AUTO 从 RGB565 开始重新测量
+    mem->reduced = mode == LCD_ST7789_COLOR_RGB444;
+    mem->arrival_us  = 0;
+    mem->interval_us = 0;
+    mem->send_us     = 0;
+    pthread_mutex_unlock(&mem->bus);
+    return 0;
+}
+
+int lcd_st7789_startup(void *self, uint8_t mode){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+
+    if(mode > LCD_ST7789_START_WARM){
+        return -1;
+    }
+    mem->startup = mode;
+    return 0;
+}
+
+/**[误差最小的档位, 相同时取刷新率低的; num 为 0 时取最低档]*/
+static uint8_t lcd_st7789_frame_rate_select(uint32_t num, uint32_t den){
+    uint64_t best = UINT64_MAX, error, multiple;
+    uint8_t rtna = sizeof (lcd_st7789_frame_rates) - 1;
+    uint8_t i;
+
+    if(num == 0 || den == 0){
+        return rtna;
+    }
+    for(i = 0; i < sizeof (lcd_st7789_frame_rates); i++){
+        // rate 与最接近的 k * num/den 的相对误差, 放大 den*num 倍后比较
+        multiple = ((uint64_t)lcd_st7789_frame_rates[i] * den + num / 2) / num;
+        if(multiple == 0){
+            multiple = 1;
+        }
+        error = (uint64_t)lcd_st7789_frame_rates[i] * den > multiple * num
+              ? (uint64_t)lcd_st7789_frame_rates[i] * den - multiple * num
+              : multiple * num - (uint64_t)lcd_st7789_frame_rates[i] * den;
+        error = error * 1000000 / (multiple * num);
+        if(error <= best){
+            best = error;
+            rtna = i;
+        }
+    }
+    return rtna;
+}
+
+int lcd_st7789_refresh(void *self, uint32_t num, uint32_t den){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    int ret = 0;
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+
+    mem->frctrl2 = lcd_st7789_frame_rate_select(num, den);
+    if(mem->frame != NULL){
+        ret |= lcd_st7789_write_command(mem, 0xC6);
+        ret |= lcd_st7789_write_data(mem, &mem->frctrl2, 1);
+        ret |= lcd_st7789_flush(mem);
+    }
+
+    pthread_mutex_unlock(&mem->bus);
+
+    if(ret != 0){
+        fprintf(stderr, "LCD_ST7789 refresh Failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**[切换写时钟, 记下来给窗口开销估算用]*/
+static int lcd_st7789_speed(LCD_ST7798_MT *mem, uint32_t hz){
+    if(mem->transport->speed(mem->transport, hz) != 0){
+        return -1;
+    }
+    mem->speed_hz = hz;
+    return 0;
+}
+
+static int lcd_st7789_calibrate_clock(LCD_ST7798_MT *mem, const char *path){
+    uint8_t blanks[LCD_ST7789_CALIBRATE_PIXELS * 2];
+    uint32_t hz = 0;
+    uint32_t best = 0;
+    uint32_t round;
+    size_t i;
+    FILE *fp;
+
+    if(path != NULL && (fp = fopen(path, "r")) != NULL){
+        if(fscanf(fp, "%u", &hz) != 1){
+            hz = 0;
+        }
+        fclose(fp);
+        if(hz > 0){
+            return lcd_st7789_speed(mem, hz);
+        }
+    }
+
+    // 从慢到快, 第一个失败的档位停止
+    for(i = 0; i < sizeof (lcd_st7789_clocks) / sizeof (lcd_st7789_clocks[0]); i++){
+        if(lcd_st7789_speed(mem, lcd_st7789_clocks[i]) != 0){
+            break;
+        }
+        for(round = 0; round < LCD_ST7789_CALIBRATE_ROUNDS; round++){
+            if(lcd_st7789_calibrate_verify(mem, round) != 0){
+                break;
+            }
+        }
+        if(round < LCD_ST7789_CALIBRATE_ROUNDS){
+            break;
+        }
+        best = lcd_st7789_clocks[i];
+    }
+
+    lcd_st7789_speed(mem, best > 0 ? best : LCD_ST7789_SPEED_HZ);
+    memset(blanks, 0, sizeof (blanks));
+    lcd_st7789_calibrate_write(mem, blanks);
+
+    if(best == 0){
+        fprintf(stderr, "LCD_ST7789 calibrate: readback failed, keeping %u Hz\n", LCD_ST7789_SPEED_HZ);
+        return -1;
+    }
+
+    if(path != NULL){
+        if((fp = fopen(path, "w")) == NULL){
+            fprintf(stderr, "LCD_ST7789 calibrate: unable to save %s\n", path);
+        }else{
+            fprintf(fp, "%u\n", best);
+            fclose(fp);
+        }
+    }
+
+    return 0;
+}
+
+int lcd_st7789_calibrate(void *self, const char *path){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+    int ret;
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+    ret = lcd_st7789_calibrate_clock(mem, path);
+    pthread_mutex_unlock(&mem->bus);
+
+    return ret;
+}
+
+int lcd_st7789_stats(void *self, LCD_ST7789_STATS *stats){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
+
+    if(mem->transport->stats(mem->transport, stats) != 0){
+        return -1;
+    }
+    pthread_mutex_lock(&mem->bus);
+    stats->frames      = mem->frames;
+    stats->saved_bytes = mem->saved_bytes;
+    stats->last_bytes  = mem->last_bytes;
+    stats->last_saved  = mem->last_saved;
+    stats->vsyncs       = mem->vsyncs;
+    stats->vsync_misses = mem->vsync_misses;
+    stats->reduced_frames = mem->reduced_frames;
+    stats->first_pixel_us = mem->first_pixel_us;
+    stats->speed_hz       = mem->speed_hz;
+    stats->refresh_hz     = lcd_st7789_frame_rates[mem->frctrl2];
+    pthread_mutex_unlock(&mem->bus);
+    return 0;
+}
+
 int lcd_st7789_clean(void** self){
     LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)(*self);
     LCD_ST7798_MT *mem = (LCD_ST7798_MT*)drive->priv;
 
-    {//关闭 gpio 使能
-        bcm2835_gpio_fsel(LCD_ST7789_GPIO_SPI_PIN_RES, BCM2835_GPIO_FSEL_INPT);
-        bcm2835_gpio_fsel(LCD_ST7789_GPIO_SPI_PIN_DC,  BCM2835_GPIO_FSEL_INPT);
-        bcm2835_spi_end();
-        bcm2835_close();
+    // output 收到的最后一帧不满窗口时, 关闭之前发送出去
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+    if(mem->frame != NULL && mem->received > 0){
+        lcd_st7789_present(mem, mem->frame, lcd_st7789_linesize(mem), mem->received);
+        mem->received = 0;
+    }
+    pthread_mutex_unlock(&mem->bus);
+
+    pthread_mutex_lock(&mem->lock);
+    if(mem->running){
+        mem->running = 0;
+        pthread_cond_broadcast(&mem->cond);
+        pthread_mutex_unlock(&mem->lock);
+        pthread_join(mem->thread, NULL);
+    }else{
+        pthread_mutex_unlock(&mem->lock);
+    }
+
+    if(mem->transport != NULL){
+        mem->transport->close((void**)&mem->transport);
     }
 
+    pthread_cond_destroy(&mem->cond);
+    pthread_mutex_destroy(&mem->lock);
+    pthread_mutex_destroy(&mem->bus);
+    lcd_st7789_release(mem);
+    free(mem->shadow);
     free(mem);
     free(drive);
 
@@ -304,18 +1646,127 @@ int lcd_st7789_clean(void** self){
 }
 
 
-LCD_ST7789_DRI* lcd_st7789_init(void){
+static LCD_ST7789_DRI* lcd_st7789_new(LCD_ST7789_TRANSPORT *transport){
     LCD_ST7789_DRI *drive = NULL;
+    LCD_ST7798_MT *mem = NULL;
 
     drive = (LCD_ST7789_DRI*)malloc(sizeof (LCD_ST7789_DRI));
     memset(drive, 0, sizeof (LCD_ST7789_DRI));
 
-    drive->priv = (LCD_ST7798_MT*)malloc(sizeof (LCD_ST7798_MT));
-    memset(drive->priv, 0, sizeof (LCD_ST7798_MT));
+    mem = (LCD_ST7798_MT*)malloc(sizeof (LCD_ST7798_MT));
+    memset(mem, 0, sizeof (LCD_ST7798_MT));
+    mem->transport = transport;
+    mem->speed_hz  = LCD_ST7789_SPEED_HZ;
+    mem->frctrl2   = LCD_ST7789_FRCTRL2_DEFAULT;
+    mem->width     = LCD_ST7789_WIDTH;
+    mem->height    = LCD_ST7789_HEIGHT;
+    mem->shadow = (uint8_t*)malloc(LCD_ST7789_WIDTH * LCD_ST7789_HEIGHT * 2);
+    memset(mem->shadow, 0, LCD_ST7789_WIDTH * LCD_ST7789_HEIGHT * 2);
+    pthread_mutex_init(&mem->lock, NULL);
+    pthread_cond_init(&mem->cond, NULL);
+    pthread_mutex_init(&mem->bus, NULL);
+    pthread_once(&lcd_st7789_dither_once, &lcd_st7789_dither_init);
 
+    drive->priv   = mem;
     drive->config = &lcd_st7789_config;
     drive->output = &lcd_st7789_output;
+    drive->output_image = &lcd_st7789_output_image;
     drive->clean  = &lcd_st7789_clean;
+    drive->rotate = &lcd_st7789_rotate;
+    drive->scroll_area = &lcd_st7789_scroll_area;
+    drive->scroll = &lcd_st7789_scroll;
+    drive->vsync  = &lcd_st7789_vsync;
+    drive->refresh = &lcd_st7789_refresh;
+    drive->color  = &lcd_st7789_color;
+    drive->startup = &lcd_st7789_startup;
+    drive->calibrate = &lcd_st7789_calibrate;
+    drive->stats  = &lcd_st7789_stats;
+    drive->submit = &lcd_st7789_submit;
+    drive->wait   = &lcd_st7789_wait;
+    drive->begin_frame = &lcd_st7789_begin_frame;
+    drive->commit = &lcd_st7789_commit;
 
     return drive;
 }
+
+LCD_ST7789_DRI* lcd_st7789_init(void){
+    return lcd_st7789_init_bcm2835(0);
+}
+
+LCD_ST7789_DRI* lcd_st7789_init_bcm2835(uint8_t flags){
+    return lcd_st7789_new(lcd_st7789_transport_bcm2835(flags));
+}
+
+LCD_ST7789_DRI* lcd_st7789_init_spidev(const char *device, const char *gpiochip, uint8_t flags){
+    return lcd_st7789_new(lcd_st7789_transport_spidev(device, gpiochip, flags));
+}
+
+LCD_ST7789_DRI* lcd_st7789_init_emulator(const char *snapshot){
+    return lcd_st7789_new(lcd_st7789_transport_emulator(snapshot));
+}
+
+/**[单面板驱动的传输层, 其他驱动返回 NULL]*/
+static LCD_ST7789_TRANSPORT* lcd_st7789_transport_of(LCD_ST7789_DRI *drive){
+    if(drive == NULL || drive->config != &lcd_st7789_config){
+        return NULL;
+    }
+    return ((LCD_ST7798_MT*)drive->priv)->transport;
+}
+
+int lcd_st7789_emulator_frame(LCD_ST7789_DRI *drive){
+    LCD_ST7789_TRANSPORT *transport = lcd_st7789_transport_of(drive);
+    LCD_ST7798_MT *mem;
+    int ret = 0;
+
+    if(transport == NULL){
+        return -1;
+    }
+    mem = (LCD_ST7798_MT*)drive->priv;
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+    // 帧结束时发送 output 已经收到的部分
+    if(mem->received > 0){
+        ret |= lcd_st7789_present(mem, mem->frame, lcd_st7789_linesize(mem), mem->received);
+        mem->received = 0;
+    }
+    ret |= lcd_st7789_transport_emulator_frame(transport);
+    pthread_mutex_unlock(&mem->bus);
+
+    return ret;
+}
+
+int lcd_st7789_emulator_panel(LCD_ST7789_DRI *drive, LCD_ST7789_PANEL *panel){
+    LCD_ST7789_TRANSPORT *transport = lcd_st7789_transport_of(drive);
+    LCD_ST7798_MT *mem;
+    int ret;
+
+    if(transport == NULL){
+        return -1;
+    }
+    mem = (LCD_ST7798_MT*)drive->priv;
+
+    pthread_mutex_lock(&mem->bus);
+    ret = lcd_st7789_transport_emulator_panel(transport, panel);
+    pthread_mutex_unlock(&mem->bus);
+
+    return ret;
+}
+
+int lcd_st7789_emulator_corrupt(LCD_ST7789_DRI *drive, uint32_t hz){
+    LCD_ST7789_TRANSPORT *transport = lcd_st7789_transport_of(drive);
+    LCD_ST7798_MT *mem;
+    int ret;
+
+    if(transport == NULL){
+        return -1;
+    }
+    mem = (LCD_ST7798_MT*)drive->priv;
+
+    lcd_st7789_drain(mem);
+    pthread_mutex_lock(&mem->bus);
+    ret = lcd_st7789_transport_emulator_corrupt(transport, hz);
+    pthread_mutex_unlock(&mem->bus);
+
+    return ret;
+}
@@ -8,16 +8,245 @@ extern "C" {
 #endif
 
 
+/**
+ * 传输层累计计数, 从打开总线开始. 两次查询相减得到区间内的值.
+ * 一次事务从第一次写入到 flush 为止; spins 是轮询状态寄存器却没有进展的次数,
+ * spins 高说明 CPU 在空等总线, 耗时接近 bytes*8/时钟 说明总线已经跑满.
+ * spidev 的等待在内核中完成, spins 始终为 0.
+ */
+typedef struct{
+    uint64_t bytes;         // 发送的命令和数据字节数
+    uint64_t transactions;  // 事务数
+    uint64_t fifo_spins;    // TX FIFO 满的轮询次数
+    uint64_t done_spins;    // 等待发送完成 (DONE/BUSY/DMA) 的轮询次数
+    uint64_t dc_toggles;    // DC 引脚切换次数
+    uint64_t busy_us;       // 事务耗时总和
+    uint32_t last_us;       // 最近一次事务耗时
+    uint32_t max_us;        // 最长事务耗时
+
+    // output 按帧的发送量, 字节数包括每个窗口的命令
+    uint64_t frames;        // 发送的帧数
+    uint64_t saved_bytes;   // 和整窗口发送相比少发的字节数
+    uint32_t last_bytes;    // 最近一帧发送的字节数
+    uint32_t last_saved;    // 最近一帧少发的字节数
+    uint64_t vsyncs;        // 等到 TE 之后才开始写的帧数
+    uint64_t vsync_misses;  // 开启 vsync 却没有等到 TE 的帧数
+    uint64_t reduced_frames;// 以 RGB444 发送的帧数
+    uint32_t first_pixel_us;// 最近一次 config 开始到第一帧 output 写完的时间, 还没有写出时为 0
+    uint32_t speed_hz;      // 当前写时钟, calibrate 之后为校准的结果
+    uint32_t refresh_hz;    // 当前刷新率 (FRCTRL2), refresh 之后为选中的档位
+} LCD_ST7789_STATS;
+
+
+/**
+ * 异步写入任务: 把 data 写入面板坐标 [left, right] x [top, bottom] 的窗口.
+ * data 按行连续存放, size 必须等于 窗口宽 * 高 * 2.
+ * data 在任务的 fence 完成之前归驱动所有, 调用方不能修改或释放.
+ */
+typedef struct{
+    int16_t left;
+    int16_t top;
+    int16_t right;
+    int16_t bottom;
+    const uint8_t *data;
+    uint32_t size;
+} LCD_ST7789_JOB;
+
+
 typedef struct{
     int (*config)(void* self, int16_t left, int16_t top, int16_t right, int16_t bottom);
+
+    /**
+     * 在 config 之前调用. 通过 MADCTL 让面板旋转显示, rotation 为 LCD_ST7789_ROTATE_*.
+     * 旋转 90/270 度后显示面为 320x240, config 的窗口和之后写入的行都按旋转后的坐标.
+     * 不支持的旋转, 或者已经 config 过, 返回 -1.
+     */
+    int (*rotate)(void* self, uint8_t rotation);
+
+    /**
+     * 按行连续写入 config 的窗口, append 为 0 时从窗口起点开始新的一帧.
+     * 数据收满窗口后按 16x16 分块和面板 GRAM 影子的哈希比较, 变化的块按当前时钟下代价最小的方式分组成窗口发送;
+     * 新的一帧开始时先发送上一帧收到的部分.
+     */
     int (*output)(void* self, uint8_t* data, uint32_t size, uint8_t append);
+
+    /**
+     * 一次写入 config 窗口的一整帧, width/height 必须等于窗口大小, 每行 width * 2 字节, 行首相隔 stride 字节 (stride >= width * 2).
+     * 不拷贝数据, 直接按行从 data 发送, 发送方式和 output 收满一帧时相同; output 还没收满的一帧先发送.
+     */
+    int (*output_image)(void* self, const uint8_t* data, uint32_t stride, uint16_t width, uint16_t height);
     int (*clean)(void** self);
+
+    /**
+     * 在 config 之后调用. path 文件中有上次校准的时钟时直接使用;
+     * 否则从低到高逐档写入测试图案并用 RAMRD 读回校验, 取最快的通过档位并保存到 path.
+     * 总线不支持读回或所有档位都失败时保持默认时钟, 返回 -1. 使用的时钟见 stats 的 speed_hz.
+     */
+    int (*calibrate)(void* self, const char* path);
+
+    /**
+     * 在 config 之后调用, 仅支持 LCD_ST7789_ROTATE_0. 把面板第 top 行开始的 height 行设为垂直滚动区 (VSCRDEF/VSCSAD),
+     * 滚动区回到未滚动的位置.
+     */
+    int (*scroll_area)(void* self, int16_t top, int16_t height);
+
+    /**
+     * 滚动区内容上移 lines 行 (负数下移), 只通过 VSCSAD 改变起始行, 然后写入新露出的 |lines| 行.
+     * data 按显示顺序存放 |lines| 整行 (240 像素). |lines| 不能超过滚动区高度.
+     * 滚动之后 output 仍按 GRAM 的行写入, 滚动区内的内容显示时带着滚动偏移.
+     */
+    int (*scroll)(void* self, int16_t lines, const uint8_t* data);
+
+    /**
+     * 在 config 之后调用. enable 时发送 TEON (只在 vblank 输出 TE), 之后 output 的每一帧都等到 TE 上升沿才开始写显存,
+     * 写入从面板扫描的起点开始; 一帧的写入时间 (字节数 * 8 / 时钟) 不超过刷新周期时扫描不会追上写入, 画面不撕裂.
+     * 等不到 TE 的帧照常写入并计入 vsync_misses. 总线没有 TE 引脚或开启后等不到 TE 时发送 TEOFF 并返回 -1.
+     */
+    int (*vsync)(void* self, uint8_t enable);
+
+    /**
+     * 按内容帧率 num/den 设置面板刷新率 (FRCTRL2), 取 39-119Hz 中最接近帧率整数倍的档位, 24/25/30fps 分别为 48/50/60Hz;
+     * num 为 0 表示静态画面, 使用最低的 39Hz. 之后 vsync 的每个内容帧占整数个刷新周期.
+     * config 之前调用时在初始化序列中生效. 选中的刷新率见 stats 的 refresh_hz.
+     */
+    int (*refresh)(void* self, uint32_t num, uint32_t den);
+
+    /**
+     * output 发送的像素格式, mode 为 LCD_ST7789_COLOR_*, 一般在 config 之前调用.
+     * RGB444 (COLMOD 0x03) 每像素 12bit, 比 RGB565 少发 25%, 转换时按面板坐标做 4x4 有序抖动.
+     * AUTO 按实测的每帧总线耗时和帧间隔切换: 总线跟不上帧率时改发 RGB444, 余量足够时回到 RGB565.
+     * 其他写显存的路径 (submit/scroll/calibrate) 始终使用 RGB565.
+     */
+    int (*color)(void* self, uint8_t mode);
+
+    /**
+     * config 的初始化方式, mode 为 LCD_ST7789_START_*, 在 config 之前调用, 默认 FAST.
+     * FAST 按数据手册的最小延时复位, 初始化序列从静态表批量发出, 清屏是一次窗口写入;
+     * WARM 先用 RDDST 读回面板状态, 面板已经按同样的方向初始化并打开显示时跳过复位, 否则按 FAST 初始化.
+     * 总线不支持读回时 WARM 等同于 FAST.
+     */
+    int (*startup)(void* self, uint8_t mode);
+
+    /**[读取传输层计数, 见 LCD_ST7789_STATS]*/
+    int (*stats)(void* self, LCD_ST7789_STATS* stats);
+
+    /**
+     * 在 config 之后调用. 把 count 个任务排入发送队列后立即返回 fence, 失败返回 0.
+     * 任务由驱动内部的发送线程按提交顺序写出, 调用方可以同时准备下一帧.
+     * 队列满时阻塞到有空位. output 和 calibrate 会先等待已提交的任务完成.
+     */
+    uint32_t (*submit)(void* self, const LCD_ST7789_JOB* jobs, uint32_t count);
+
+    /**
+     * 阻塞到 fence 及之前的任务全部写出, 之后这些任务的 data 交还调用方.
+     * 自上次 wait 以来有任务失败时返回 -1. fence 为 0 时立即返回.
+     */
+    int (*wait)(void* self, uint32_t fence);
+
+    /**
+     * 在 config 之后调用. 返回驱动内部的后台缓冲, 可以直接写入一帧: 按行连续的 RGB565, 大小为 config 窗口宽 * 高 * 2.
+     * 缓冲中是两次 commit 之前的内容 (第一次为全黑). 这块缓冲上一次提交的帧还在发送时阻塞到写完.
+     * 没有 config 时返回 NULL.
+     */
+    uint8_t* (*begin_frame)(void* self);
+
+    /**
+     * 交换前后台缓冲, 把刚写好的一帧交给发送线程后立即返回, 调用方可以接着 begin_frame 准备下一帧.
+     * 发送方式和 output 收满一帧时相同 (分块比较、vsync、RGB444). 发送是异步的, 之前的帧出错时返回 -1.
+     * 没有先调用 begin_frame 时返回 -1.
+     */
+    int (*commit)(void* self);
     void *priv;
 } LCD_ST7789_DRI;
 
 
+#define LCD_ST7789_ROTATE_0     0
+#define LCD_ST7789_ROTATE_90    1      // 顺时针 90 度, 与 ffmpeg transpose=clock 相同
+#define LCD_ST7789_ROTATE_180   2
+#define LCD_ST7789_ROTATE_270   3
+
+#define LCD_ST7789_COLOR_RGB565 0
+#define LCD_ST7789_COLOR_RGB444 1      // 12bit, 有序抖动
+#define LCD_ST7789_COLOR_AUTO   2      // 总线跟不上帧率时使用 RGB444
+
+#define LCD_ST7789_START_FAST   0      // 数据手册的最小延时
+#define LCD_ST7789_START_SAFE   1      // 每个延时 100ms, 用于时序不达标的模块
+#define LCD_ST7789_START_WARM   2      // 面板已初始化时跳过复位
+
+#define LCD_ST7789_FLAG_3WIRE   0x01   // 9bit LoSSI, 命令/数据位随SPI字发送, 不使用DC引脚
+#define LCD_ST7789_FLAG_SPI1    0x02   // 使用 AUX SPI1 (MOSI=20, SCLK=21, CE2=16, RES=22, DC=23), 仅 bcm2835, 不支持3线
+
+
 LCD_ST7789_DRI* lcd_st7789_init(void);
 
+/**
+ * 通过 bcm2835 寄存器直接驱动 (需要 root).
+ * flags: LCD_ST7789_FLAG_*
+ */
+LCD_ST7789_DRI* lcd_st7789_init_bcm2835(uint8_t flags);
+
+/**
+ * 通过内核 spidev + gpiochip 驱动, 不需要 root 和 /dev/mem.
+ * device/gpiochip 为 NULL 时使用 /dev/spidev0.0 和 /dev/gpiochip0.
+ */
+LCD_ST7789_DRI* lcd_st7789_init_spidev(const char *device, const char *gpiochip, uint8_t flags);
+
+/**
+ * 两块面板左右拼接成一个 480x320 的显示面, 每块面板由独立线程在各自的总线上刷新.
+ * config 的坐标以拼接后的显示面为准, output 按整帧累积, 收满一帧后两个线程同时推送.
+ * 两块面板完成同一帧之后才会开始下一帧. 只支持 LCD_ST7789_ROTATE_0, 不支持滚动.
+ * left/right 的所有权转移给返回的驱动, clean 时一并释放.
+ */
+LCD_ST7789_DRI* lcd_st7789_init_stripe(LCD_ST7789_DRI *left, LCD_ST7789_DRI *right);
+
+
+/**
+ * 模拟面板的状态, 见 lcd_st7789_init_emulator.
+ * 计数从创建开始累计, frame_* 是上一次 lcd_st7789_emulator_frame 结束的那一帧的计数.
+ */
+typedef struct{
+    uint32_t frames;            // 已结束的帧数
+    uint64_t commands;          // 命令数
+    uint64_t bytes;             // 写入的命令、参数和像素字节数
+    uint64_t pixels;            // 写入 GRAM 的像素数
+    uint32_t resets;            // RES 引脚拉低 (硬件复位) 的次数
+    uint32_t frame_commands;
+    uint32_t frame_bytes;
+    uint32_t frame_pixels;
+    uint32_t frame_rewrites;    // 本帧内再次写入同一 GRAM 单元的像素数, 窗口重叠时不为 0
+    uint8_t madctl;             // 当前 MADCTL (0x36)
+    uint8_t colmod;             // 当前 COLMOD (0x3A)
+    uint8_t frctrl2;            // 当前 FRCTRL2 (0xC6), 决定 TE 的周期
+    uint16_t tfa;               // 垂直滚动 VSCRDEF (0x33) / VSCSAD (0x37)
+    uint16_t vsa;
+    uint16_t bfa;
+    uint16_t vsp;
+    const uint8_t *gram;        // 320行 x 240列 x RGB, 每个分量 6bit 左对齐 (与 RAMRD 读回相同), clean 之前有效
+} LCD_ST7789_PANEL;
+
+/**
+ * 命令级面板模拟, 不访问任何硬件, 可以在 x86 上运行.
+ * 解析实际发出的命令流 (CASET/RASET/RAMWR/RAMWRC/MADCTL/COLMOD/VSCRDEF/VSCSAD 等) 写入 240x320 的 GRAM 模型,
+ * 支持 RAMRD 等读命令, 事务耗时按写时钟折算.
+ * snapshot 不为 NULL 时每帧结束写出一张 PPM, snapshot 是文件名格式, 参数为帧号, 例如 "frame%04u.ppm".
+ */
+LCD_ST7789_DRI* lcd_st7789_init_emulator(const char *snapshot);
+
+/**
+ * 结束模拟面板的当前帧: 记录本帧的命令/字节数, 需要时写出快照.
+ * 先等待已提交的异步任务写出. drive 不是模拟面板时返回 -1.
+ */
+int lcd_st7789_emulator_frame(LCD_ST7789_DRI *drive);
+
+/**[读取模拟面板的状态和 GRAM, drive 不是模拟面板时返回 -1]*/
+int lcd_st7789_emulator_panel(LCD_ST7789_DRI *drive, LCD_ST7789_PANEL *panel);
+
+/**
+ * 模拟写时钟的上限: 写时钟高于 hz 时每7个像素有一个写错, 用于测试 calibrate.
+ * hz 为 0 时不出错 (默认). drive 不是模拟面板时返回 -1.
+ */
+int lcd_st7789_emulator_corrupt(LCD_ST7789_DRI *drive, uint32_t hz);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,432 @@
+#include "st7789_transport.h"
+#include "bcm2835.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define LCD_ST7789_DMA_CHANNEL_TX     5
+#define LCD_ST7789_DMA_CHANNEL_RX     4
+#define LCD_ST7789_DMA_THRESHOLD      256
+#define LCD_ST7789_TE_SPIN_US         200    // 睡眠之后忙等的最后一段, 覆盖调度的唤醒延迟
+#define LCD_ST7789_TE_MARGIN          8      // 每推算一个周期提前 1/8 周期醒来, 容纳面板振荡器的误差
+
+
+typedef struct {
+    uint8_t flags;          // LCD_ST7789_FLAG_*
+    uint8_t pin_res;
+    uint8_t pin_dc;
+    uint8_t pin_te;
+    uint8_t te;             // TE引脚已配置为上升沿检测
+    uint8_t dc;             // DC引脚当前电平, 0xFF 未知
+    uint8_t dma;            // DMA是否可用
+    uint8_t transaction;    // SPI事务是否打开(CS保持有效)
+    uint8_t opened;         // 已打开, 持有一份映射引用
+    uint64_t te_us;         // 最近一次轮询到 TE 上升沿的系统定时器时间, 0 表示没有可用的相位
+    uint16_t divider;       // SPI0 写时钟分频
+    LCD_ST7789_COUNTERS counters;
+} LCD_ST7789_BCM2835_MT;
+
+
+// SPI0 和 SPI1 面板共用一份 /dev/mem 映射
+static int lcd_st7789_bcm2835_refs = 0;
+
+
+/**[DC引脚切换, 电平不变时不访问GPIO]*/
+static void lcd_st7789_bcm2835_set_dc(LCD_ST7789_BCM2835_MT *mem, uint8_t level){
+    if(mem->dc != level){
+        if(level){
+            bcm2835_gpio_set(mem->pin_dc);
+        }else{
+            bcm2835_gpio_clr(mem->pin_dc);
+        }
+        mem->dc = level;
+        mem->counters.total.dc_toggles++;
+    }
+}
+
+/**[事务计数: 第一次写入时开始, flush 时结束; 时间取自系统定时器]*/
+static void lcd_st7789_bcm2835_count(LCD_ST7789_BCM2835_MT *mem, uint32_t size){
+    uint64_t fifo, done;
+
+    if(!mem->counters.active){
+        if(mem->flags & LCD_ST7789_FLAG_SPI1){
+            bcm2835_aux_spi_wait_spins(&fifo, &done);
+        }else{
+            bcm2835_spi_wait_spins(&fifo, &done);
+        }
+        lcd_st7789_counters_begin(&mem->counters, bcm2835_st_read(), fifo, done);
+    }
+    mem->counters.total.bytes += size;
+}
+
+static void lcd_st7789_bcm2835_count_end(LCD_ST7789_BCM2835_MT *mem){
+    uint64_t fifo, done;
+
+    if(mem->counters.active){
+        if(mem->flags & LCD_ST7789_FLAG_SPI1){
+            bcm2835_aux_spi_wait_spins(&fifo, &done);
+        }else{
+            bcm2835_spi_wait_spins(&fifo, &done);
+        }
+        lcd_st7789_counters_end(&mem->counters, bcm2835_st_read(), fifo, done);
+    }
+}
+
+static void lcd_st7789_bcm2835_begin(LCD_ST7789_BCM2835_MT *mem){
+    if(!mem->transaction){
+        bcm2835_spi_transaction_begin();
+        mem->transaction = 1;
+    }
+}
+
+/**[打开失败: 引脚恢复为输入, 放回 open 取得的映射引用]*/
+static int lcd_st7789_bcm2835_open_fail(LCD_ST7789_BCM2835_MT *mem){
+    bcm2835_gpio_fsel(mem->pin_res, BCM2835_GPIO_FSEL_INPT);
+    if(!(mem->flags & LCD_ST7789_FLAG_3WIRE)){
+        bcm2835_gpio_fsel(mem->pin_dc,  BCM2835_GPIO_FSEL_INPT);
+    }
+    if(--lcd_st7789_bcm2835_refs == 0){
+        bcm2835_close();
+    }
+    return -1;
+}
+
+int lcd_st7789_bcm2835_open(void *self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    // 每次 config 都会 open, 已经打开时保持原状, 引用只计一次
+    if(mem->opened){
+        return 0;
+    }
+
+    if(lcd_st7789_bcm2835_refs == 0 && bcm2835_init() == 0){
+        fprintf(stderr, "bcm2835_init failed. \n");
+        return -1;
+    }else{
+        lcd_st7789_bcm2835_refs++;
+        bcm2835_gpio_fsel(mem->pin_res, BCM2835_GPIO_FSEL_OUTP);
+        if(!(mem->flags & LCD_ST7789_FLAG_3WIRE)){
+            bcm2835_gpio_fsel(mem->pin_dc,  BCM2835_GPIO_FSEL_OUTP);
+        }
+    }
+    if(mem->flags & LCD_ST7789_FLAG_SPI1){
+        // AUX SPI1 没有 LoSSI 和 DMA, 每个字最多 24bit
+        if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+            fprintf(stderr, "3-wire mode is not supported on SPI1.\n");
+            return lcd_st7789_bcm2835_open_fail(mem);
+        }
+        if(bcm2835_aux_spi_begin() == 0){
+            printf("bcm2835_aux_spi_begin failed.\n");
+            return lcd_st7789_bcm2835_open_fail(mem);
+        }
+        bcm2835_aux_spi_setClockDivider(bcm2835_aux_spi_CalcClockDivider(LCD_ST7789_SPEED_HZ));
+        mem->dc  = 0xFF;
+        mem->dma = 0;
+        mem->opened = 1;
+        return 0;
+    }
+    if(bcm2835_spi_begin() == 0){
+        printf("bcm2835_spi_begin failed.\n");
+        return lcd_st7789_bcm2835_open_fail(mem);
+    }else{
+        bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+        bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+        mem->divider = BCM2835_SPI_CLOCK_DIVIDER_8;
+        bcm2835_spi_setClockDivider(mem->divider);
+        bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
+        bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, 0);
+    }
+
+    mem->dc  = 0xFF;
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        // LoSSI: D/C 位随 9bit 字发送, DMA 只支持 8bit 字
+        bcm2835_spi_setLoSSI(1);
+        mem->dma = 0;
+    }else{
+        mem->dma = bcm2835_spi_dma_begin(LCD_ST7789_DMA_CHANNEL_TX, LCD_ST7789_DMA_CHANNEL_RX);
+        if(mem->dma == 0){
+            fprintf(stderr, "bcm2835_spi_dma_begin failed, using polled spi.\n");
+        }
+    }
+
+    mem->opened = 1;
+    return 0;
+}
+
+int lcd_st7789_bcm2835_reset(void *self, uint8_t level){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    if(level){
+        bcm2835_gpio_set(mem->pin_res);
+    }else{
+        bcm2835_gpio_clr(mem->pin_res);
+    }
+    return 0;
+}
+
+int lcd_st7789_bcm2835_command(void *self, uint8_t cmd){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    lcd_st7789_bcm2835_count(mem, 1);
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        lcd_st7789_bcm2835_begin(mem);
+        bcm2835_spi_lossi_writenb((const char*)&cmd, 1, 0);
+        return 0;
+    }
+    if(mem->flags & LCD_ST7789_FLAG_SPI1){
+        // 写入函数返回时已经发送完毕, 可以直接切换DC
+        lcd_st7789_bcm2835_set_dc(mem, 0);
+        bcm2835_aux_spi_writenb_pipelined((const char*)&cmd, 1);
+        return 0;
+    }
+
+    lcd_st7789_bcm2835_set_dc(mem, 0);
+    lcd_st7789_bcm2835_begin(mem);
+    bcm2835_spi_transaction_writenb((const char*)&cmd, 1);
+    return 0;
+}
+
+int lcd_st7789_bcm2835_data(void *self, const uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    lcd_st7789_bcm2835_count(mem, size);
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        lcd_st7789_bcm2835_begin(mem);
+        bcm2835_spi_lossi_writenb((const char*)data, size, 1);
+        return 0;
+    }
+    if(mem->flags & LCD_ST7789_FLAG_SPI1){
+        lcd_st7789_bcm2835_set_dc(mem, 1);
+        bcm2835_aux_spi_writenb_pipelined((const char*)data, size);
+        return 0;
+    }
+
+    lcd_st7789_bcm2835_set_dc(mem, 1);
+    if(mem->dma && size >= LCD_ST7789_DMA_THRESHOLD){
+        // 大块数据走DMA, DMA自行控制CS
+        if(mem->transaction){
+            bcm2835_spi_transaction_end();
+            mem->transaction = 0;
+        }
+        bcm2835_spi_dma_writenb((const char*)data, size);
+    }else{
+        lcd_st7789_bcm2835_begin(mem);
+        bcm2835_spi_transaction_writenb((const char*)data, size);
+    }
+    return 0;
+}
+
+int lcd_st7789_bcm2835_flush(void *self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    if(mem->transaction){
+        bcm2835_spi_transaction_end();
+        mem->transaction = 0;
+    }
+    lcd_st7789_bcm2835_count_end(mem);
+    return 0;
+}
+
+/**[SPI0 分频: 250MHz 核心时钟, 取最接近的偶数分频]*/
+static uint16_t lcd_st7789_bcm2835_divider(uint32_t hz){
+    uint32_t divider = (BCM2835_CORE_CLK_HZ + hz / 2) / hz;
+    divider = (divider + 1) & ~1u;
+    if(divider < 2){
+        divider = 2;
+    }
+    return divider > 0xFFFE ? 0xFFFE : (uint16_t)divider;
+}
+
+int lcd_st7789_bcm2835_read(void *self, uint8_t cmd, uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    // 3线模式的 SDA 是双向的, AUX SPI1 面板不接 MISO, 都不支持读回
+    if(mem->flags & (LCD_ST7789_FLAG_3WIRE | LCD_ST7789_FLAG_SPI1)){
+        return -1;
+    }
+
+    lcd_st7789_bcm2835_flush(self);
+    bcm2835_spi_setClockDivider(lcd_st7789_bcm2835_divider(LCD_ST7789_READ_SPEED_HZ));
+
+    // 命令和读回在同一个事务里, CS 拉高会终止读命令
+    lcd_st7789_bcm2835_count(mem, 1 + size);
+    lcd_st7789_bcm2835_set_dc(mem, 0);
+    bcm2835_spi_transaction_begin();
+    bcm2835_spi_transaction_writenb((const char*)&cmd, 1);
+    lcd_st7789_bcm2835_set_dc(mem, 1);
+    memset(data, 0, size);
+    bcm2835_spi_transaction_transfernb((const char*)data, (char*)data, size);
+    bcm2835_spi_transaction_end();
+    lcd_st7789_bcm2835_count_end(mem);
+
+    bcm2835_spi_setClockDivider(mem->divider);
+    return 0;
+}
+
+int lcd_st7789_bcm2835_speed(void *self, uint32_t hz){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    if(hz == 0){
+        return -1;
+    }
+
+    if(mem->flags & LCD_ST7789_FLAG_SPI1){
+        bcm2835_aux_spi_setClockDivider(bcm2835_aux_spi_CalcClockDivider(hz));
+        return 0;
+    }
+
+    lcd_st7789_bcm2835_flush(self);
+    mem->divider = lcd_st7789_bcm2835_divider(hz);
+    bcm2835_spi_setClockDivider(mem->divider);
+    return 0;
+}
+
+/**[睡到系统定时器的 wake_us, 最后 LCD_ST7789_TE_SPIN_US 忙等, 与 bcm2835_delayMicroseconds 相同]*/
+static void lcd_st7789_bcm2835_sleep_until(uint64_t wake_us){
+    uint64_t now = bcm2835_st_read();
+    struct timespec ts;
+
+    if(wake_us <= now){
+        return;
+    }
+    if(wake_us - now > LCD_ST7789_TE_SPIN_US){
+        ts.tv_sec  = (time_t)((wake_us - now - LCD_ST7789_TE_SPIN_US) / 1000000);
+        ts.tv_nsec = (long)((wake_us - now - LCD_ST7789_TE_SPIN_US) % 1000000 * 1000);
+        nanosleep(&ts, NULL);
+    }
+    bcm2835_st_delay(now, wake_us - now);
+}
+
+int lcd_st7789_bcm2835_vsync(void *self, uint32_t period_us, uint32_t timeout_us){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+    uint64_t start, periods, wake;
+
+    if(!mem->te){
+        bcm2835_gpio_fsel(mem->pin_te, BCM2835_GPIO_FSEL_INPT);
+        bcm2835_gpio_set_pud(mem->pin_te, BCM2835_GPIO_PUD_DOWN);
+        bcm2835_gpio_ren(mem->pin_te);
+        mem->te = 1;
+    }
+
+    // 清掉之前留下的边沿, 只认等待开始之后的上升沿
+    bcm2835_gpio_set_eds(mem->pin_te);
+    start = bcm2835_st_read();
+    if(start == 0){
+        return -1;  // 没有系统定时器, 无法超时
+    }
+
+    // 上一个边沿之后两个周期以内: 按名义周期推算下一个边沿, 先让出 CPU 到它之前,
+    // 和 bcm2835_spi_dma_wait 一样只轮询最后一段. 相位更旧时误差会累积, 直接轮询
+    if(period_us != 0 && mem->te_us != 0 && start - mem->te_us < 2 * (uint64_t)period_us){
+        periods = (start - mem->te_us) / period_us + 1;
+        wake = mem->te_us + periods * period_us - periods * period_us / LCD_ST7789_TE_MARGIN;
+        if(wake > start && wake - start < timeout_us){
+            lcd_st7789_bcm2835_sleep_until(wake);
+            if(bcm2835_gpio_eds(mem->pin_te)){
+                // 边沿在睡眠中已经过去, 不知道 vblank 还剩多少: 丢掉相位, 等下一个边沿
+                bcm2835_gpio_set_eds(mem->pin_te);
+                mem->te_us = 0;
+            }
+        }
+    }
+
+    while(!bcm2835_gpio_eds(mem->pin_te)){
+        if(bcm2835_st_read() - start >= timeout_us){
+            mem->te_us = 0;
+            return -1;
+        }
+    }
+    mem->te_us = bcm2835_st_read();
+    bcm2835_gpio_set_eds(mem->pin_te);
+    return 0;
+}
+
+int lcd_st7789_bcm2835_stats(void *self, LCD_ST7789_STATS *stats){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    *stats = mem->counters.total;
+    return 0;
+}
+
+int lcd_st7789_bcm2835_close(void **self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)(*self);
+    LCD_ST7789_BCM2835_MT *mem = (LCD_ST7789_BCM2835_MT*)transport->priv;
+
+    if(mem->opened){//关闭 gpio 使能
+        bcm2835_gpio_fsel(mem->pin_res, BCM2835_GPIO_FSEL_INPT);
+        if(mem->te){
+            bcm2835_gpio_clr_ren(mem->pin_te);
+            bcm2835_gpio_set_eds(mem->pin_te);
+        }
+        if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+            bcm2835_spi_setLoSSI(0);
+        }else{
+            bcm2835_gpio_fsel(mem->pin_dc,  BCM2835_GPIO_FSEL_INPT);
+        }
+        if(mem->flags & LCD_ST7789_FLAG_SPI1){
+            bcm2835_aux_spi_end();
+        }else{
+            bcm2835_spi_dma_end();
+            bcm2835_spi_end();
+        }
+        if(--lcd_st7789_bcm2835_refs == 0){
+            bcm2835_close();
+        }
+    }
+
+    free(mem);
+    free(transport);
+
+    *self = NULL;
+
+    return 0;
+}
+
+
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_bcm2835(uint8_t flags){
+    LCD_ST7789_TRANSPORT *transport = NULL;
+    LCD_ST7789_BCM2835_MT *mem = NULL;
+
+    transport = (LCD_ST7789_TRANSPORT*)malloc(sizeof (LCD_ST7789_TRANSPORT));
+    memset(transport, 0, sizeof (LCD_ST7789_TRANSPORT));
+
+    mem = (LCD_ST7789_BCM2835_MT*)malloc(sizeof (LCD_ST7789_BCM2835_MT));
+    memset(mem, 0, sizeof (LCD_ST7789_BCM2835_MT));
+    mem->flags = flags;
+    if(flags & LCD_ST7789_FLAG_SPI1){
+        mem->pin_res = LCD_ST7789_GPIO_SPI1_PIN_RES;
+        mem->pin_dc  = LCD_ST7789_GPIO_SPI1_PIN_DC;
+        mem->pin_te  = LCD_ST7789_GPIO_SPI1_PIN_TE;
+    }else{
+        mem->pin_res = LCD_ST7789_GPIO_SPI_PIN_RES;
+        mem->pin_dc  = LCD_ST7789_GPIO_SPI_PIN_DC;
+        mem->pin_te  = LCD_ST7789_GPIO_SPI_PIN_TE;
+    }
+
+    transport->priv    = mem;
+    transport->open    = &lcd_st7789_bcm2835_open;
+    transport->reset   = &lcd_st7789_bcm2835_reset;
+    transport->command = &lcd_st7789_bcm2835_command;
+    transport->data    = &lcd_st7789_bcm2835_data;
+    transport->flush   = &lcd_st7789_bcm2835_flush;
+    transport->read    = &lcd_st7789_bcm2835_read;
+    transport->speed   = &lcd_st7789_bcm2835_speed;
+    transport->vsync   = &lcd_st7789_bcm2835_vsync;
+    transport->stats   = &lcd_st7789_bcm2835_stats;
+    transport->close   = &lcd_st7789_bcm2835_close;
+
+    return transport;
+}
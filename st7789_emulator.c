@@ -0,0 +1,630 @@
+#include "st7789_transport.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define LCD_ST7789_EMULATOR_WIDTH     240    // GRAM 列数
+#define LCD_ST7789_EMULATOR_HEIGHT    320    // GRAM 行数
+#define LCD_ST7789_EMULATOR_PARAMS    16     // 每条命令保存的参数个数
+#define LCD_ST7789_EMULATOR_PATH      256
+
+// MADCTL 位
+#define LCD_ST7789_MADCTL_MY          0x80
+#define LCD_ST7789_MADCTL_MX          0x40
+#define LCD_ST7789_MADCTL_MV          0x20
+#define LCD_ST7789_MADCTL_ML          0x10
+#define LCD_ST7789_MADCTL_BGR         0x08
+#define LCD_ST7789_MADCTL_MH          0x04
+
+
+typedef struct {
+    char snapshot[LCD_ST7789_EMULATOR_PATH];   // PPM 文件名格式, 空串不保存
+    uint32_t speed_hz;
+    uint32_t corrupt_hz;    // 写时钟高于此值时部分像素写错, 0 不出错
+    uint64_t wire_ns;       // 按写时钟累计的线上时间, 作为事务计数的时钟
+
+    // 面板状态
+    uint8_t cmd;            // 当前命令, 后续数据都是它的参数
+    uint8_t params[LCD_ST7789_EMULATOR_PARAMS];
+    uint32_t nparams;
+    uint8_t madctl;
+    uint8_t colmod;
+    uint8_t sleep;
+    uint8_t display;
+    uint8_t inversion;
+    uint8_t tearing;
+    uint8_t frctrl2;
+    uint16_t caset[2];
+    uint16_t raset[2];
+    uint16_t vscrdef[3];    // TFA, VSA, BFA
+    uint16_t vscsad;
+
+    // 写显存: 窗口内的逻辑坐标, 像素按 COLMOD 从字节流中拼出
+    uint8_t writing;
+    uint16_t x;
+    uint16_t y;
+    uint8_t partial[3];
+    uint32_t npartial;
+
+    // 行 x 列 x RGB, 每个分量 6bit 左对齐, 与 RAMRD 读回格式相同
+    uint8_t gram[LCD_ST7789_EMULATOR_HEIGHT][LCD_ST7789_EMULATOR_WIDTH][3];
+    // 每个单元最后一次写入时的帧号 + 1, 用来发现同一帧内重复写入的像素
+    uint32_t written[LCD_ST7789_EMULATOR_HEIGHT][LCD_ST7789_EMULATOR_WIDTH];
+    uint32_t rewrites;
+
+    LCD_ST7789_PANEL panel;
+    uint64_t frame_commands;    // 当前帧开始时的累计值
+    uint64_t frame_bytes;
+    uint64_t frame_pixels;
+    LCD_ST7789_COUNTERS counters;
+} LCD_ST7789_EMULATOR_MT;
+
+
+/**[上电/复位后的寄存器默认值, GRAM 内容保持不变]*/
+static void lcd_st7789_emulator_defaults(LCD_ST7789_EMULATOR_MT *mem){
+    mem->cmd       = 0x00;
+    mem->nparams   = 0;
+    mem->madctl    = 0x00;
+    mem->colmod    = 0x66;
+    mem->sleep     = 1;
+    mem->display   = 0;
+    mem->inversion = 0;
+    mem->tearing   = 0;
+    mem->frctrl2   = LCD_ST7789_FRCTRL2_DEFAULT;
+    mem->caset[0]  = 0;
+    mem->caset[1]  = LCD_ST7789_EMULATOR_WIDTH - 1;
+    mem->raset[0]  = 0;
+    mem->raset[1]  = LCD_ST7789_EMULATOR_HEIGHT - 1;
+    mem->vscrdef[0] = 0;
+    mem->vscrdef[1] = LCD_ST7789_EMULATOR_HEIGHT;
+    mem->vscrdef[2] = 0;
+    mem->vscsad    = 0;
+    mem->writing   = 0;
+    mem->npartial  = 0;
+}
+
+/**[按写时钟推进线上时间, 返回微秒]*/
+static uint64_t lcd_st7789_emulator_now_us(LCD_ST7789_EMULATOR_MT *mem){
+    return mem->wire_ns / 1000;
+}
+
+static void lcd_st7789_emulator_count(LCD_ST7789_EMULATOR_MT *mem, uint32_t size){
+    if(!mem->counters.active){
+        lcd_st7789_counters_begin(&mem->counters, lcd_st7789_emulator_now_us(mem), 0, 0);
+    }
+    mem->counters.total.bytes += size;
+    mem->panel.bytes += size;
+    mem->wire_ns += (uint64_t)size * 8 * 1000000000 / mem->speed_hz;
+}
+
+/**[逻辑坐标 (列x, 行y) 映射到 GRAM, 超出范围返回 NULL]*/
+static uint8_t* lcd_st7789_emulator_cell(LCD_ST7789_EMULATOR_MT *mem, uint16_t x, uint16_t y){
+    uint32_t column = x, row = y, t;
+
+    // MV 交换行列, MX/MY 在交换之后镜像 GRAM 的列/行
+    if(mem->madctl & LCD_ST7789_MADCTL_MV){
+        t = column;
+        column = row;
+        row = t;
+    }
+    if(column >= LCD_ST7789_EMULATOR_WIDTH || row >= LCD_ST7789_EMULATOR_HEIGHT){
+        return NULL;
+    }
+    if(mem->madctl & LCD_ST7789_MADCTL_MX){
+        column = LCD_ST7789_EMULATOR_WIDTH - 1 - column;
+    }
+    if(mem->madctl & LCD_ST7789_MADCTL_MY){
+        row = LCD_ST7789_EMULATOR_HEIGHT - 1 - row;
+    }
+    return mem->gram[row][column];
+}
+
+/**[写一个像素并推进地址计数器, 写满窗口后回到窗口起点]*/
+static void lcd_st7789_emulator_pixel(LCD_ST7789_EMULATOR_MT *mem, uint8_t r, uint8_t g, uint8_t b){
+    uint8_t *cell = lcd_st7789_emulator_cell(mem, mem->x, mem->y);
+    uint32_t *written;
+
+    // 时钟超过面板和线缆的极限: 每7个像素有一个 G 的最高位采样错误
+    if(mem->corrupt_hz != 0 && mem->speed_hz > mem->corrupt_hz && mem->panel.pixels % 7 == 0){
+        g ^= 0x80;
+    }
+    if(cell != NULL){
+        cell[0] = r;
+        cell[1] = g;
+        cell[2] = b;
+        written = &mem->written[0][0] + (cell - &mem->gram[0][0][0]) / 3;
+        if(*written == mem->panel.frames + 1){
+            mem->rewrites++;
+        }
+        *written = mem->panel.frames + 1;
+    }
+    mem->panel.pixels++;
+
+    if(mem->x < mem->caset[1]){
+        mem->x++;
+    }else{
+        mem->x = mem->caset[0];
+        mem->y = mem->y < mem->raset[1] ? mem->y + 1 : mem->raset[0];
+    }
+}
+
+/**[4bit 分量扩展为左对齐的 6bit, 低位复制最高两位]*/
+static uint8_t lcd_st7789_emulator_expand4(uint8_t v){
+    v &= 0x0F;
+    return (uint8_t)((v << 4) | ((v >> 2) << 2));
+}
+
+/**[RAMWR/RAMWRC 的数据按 COLMOD 解码, 不满一个像素的字节留到下一次]*/
+static void lcd_st7789_emulator_write_pixels(LCD_ST7789_EMULATOR_MT *mem, const uint8_t *data, uint32_t size){
+    uint32_t need;
+    uint16_t p;
+
+    switch(mem->colmod & 0x07){
+    case 0x03:  // 12bit, 3字节2个像素
+        need = 3;
+        break;
+    case 0x05:  // 16bit
+        need = 2;
+        break;
+    default:    // 18bit, 每分量一个字节
+        need = 3;
+        break;
+    }
+
+    while(size > 0){
+        mem->partial[mem->npartial++] = *data++;
+        size--;
+        if(mem->npartial < need){
+            continue;
+        }
+        mem->npartial = 0;
+
+        switch(mem->colmod & 0x07){
+        case 0x03:
+            lcd_st7789_emulator_pixel(mem, lcd_st7789_emulator_expand4(mem->partial[0] >> 4),
+                                      lcd_st7789_emulator_expand4(mem->partial[0]),
+                                      lcd_st7789_emulator_expand4(mem->partial[1] >> 4));
+            lcd_st7789_emulator_pixel(mem, lcd_st7789_emulator_expand4(mem->partial[1]),
+                                      lcd_st7789_emulator_expand4(mem->partial[2] >> 4),
+                                      lcd_st7789_emulator_expand4(mem->partial[2]));
+            break;
+        case 0x05:
+            // R/B 5bit 扩展到 6bit 时最低位复制最高位
+            p = (uint16_t)(mem->partial[0] << 8 | mem->partial[1]);
+            lcd_st7789_emulator_pixel(mem, (uint8_t)(((p >> 11) << 3) | ((p >> 13) & 0x04)),
+                                      (uint8_t)(((p >> 5) & 0x3F) << 2),
+                                      (uint8_t)(((p & 0x1F) << 3) | ((p >> 2) & 0x04)));
+            break;
+        default:
+            lcd_st7789_emulator_pixel(mem, mem->partial[0] & 0xFC, mem->partial[1] & 0xFC, mem->partial[2] & 0xFC);
+            break;
+        }
+    }
+}
+
+/**[参数收齐后生效; 参数不足的命令保持原值]*/
+static void lcd_st7789_emulator_param(LCD_ST7789_EMULATOR_MT *mem, uint8_t value){
+    uint8_t *p = mem->params;
+
+    if(mem->nparams >= LCD_ST7789_EMULATOR_PARAMS){
+        return;
+    }
+    p[mem->nparams++] = value;
+
+    switch(mem->cmd){
+    case 0x2A:
+        if(mem->nparams == 4){
+            mem->caset[0] = (uint16_t)(p[0] << 8 | p[1]);
+            mem->caset[1] = (uint16_t)(p[2] << 8 | p[3]);
+        }
+        break;
+    case 0x2B:
+        if(mem->nparams == 4){
+            mem->raset[0] = (uint16_t)(p[0] << 8 | p[1]);
+            mem->raset[1] = (uint16_t)(p[2] << 8 | p[3]);
+        }
+        break;
+    case 0x33:
+        if(mem->nparams == 6){
+            mem->vscrdef[0] = (uint16_t)(p[0] << 8 | p[1]);
+            mem->vscrdef[1] = (uint16_t)(p[2] << 8 | p[3]);
+            mem->vscrdef[2] = (uint16_t)(p[4] << 8 | p[5]);
+        }
+        break;
+    case 0x36:
+        mem->madctl = p[0];
+        break;
+    case 0x37:
+        if(mem->nparams == 2){
+            mem->vscsad = (uint16_t)(p[0] << 8 | p[1]);
+        }
+        break;
+    case 0x3A:
+        mem->colmod = p[0];
+        break;
+    case 0xC6:
+        mem->frctrl2 = p[0] & 0x1F;
+        break;
+    default:
+        break;
+    }
+}
+
+static void lcd_st7789_emulator_command_apply(LCD_ST7789_EMULATOR_MT *mem, uint8_t cmd){
+    mem->cmd = cmd;
+    mem->nparams = 0;
+    mem->writing = 0;
+    mem->panel.commands++;
+
+    switch(cmd){
+    case 0x01:  // SWRESET
+        lcd_st7789_emulator_defaults(mem);
+        break;
+    case 0x10:
+        mem->sleep = 1;
+        break;
+    case 0x11:
+        mem->sleep = 0;
+        break;
+    case 0x20:
+    case 0x21:
+        mem->inversion = cmd & 0x01;
+        break;
+    case 0x28:
+    case 0x29:
+        mem->display = cmd & 0x01;
+        break;
+    case 0x34:
+        mem->tearing = 0;
+        break;
+    case 0x35:
+        mem->tearing = 1;
+        break;
+    case 0x2C:  // RAMWR 从窗口起点开始
+        mem->x = mem->caset[0];
+        mem->y = mem->raset[0];
+        mem->npartial = 0;
+        mem->writing = 1;
+        break;
+    case 0x3C:  // RAMWRC 从上次停下的位置继续
+        mem->npartial = 0;
+        mem->writing = 1;
+        break;
+    default:
+        break;
+    }
+}
+
+/**[读命令返回的比特流: 先是 dummy 周期, 之后是数据, 与 bcm2835/spidev 的 read 一致返回原始字节]*/
+static void lcd_st7789_emulator_reply(const uint8_t *reply, uint32_t count, uint32_t dummy, uint8_t *data, uint32_t size){
+    uint32_t i, bit, byte;
+
+    memset(data, 0, size);
+    for(i = 0; i < count * 8; i++){
+        bit = dummy + i;
+        byte = bit / 8;
+        if(byte >= size){
+            break;
+        }
+        if(reply[i / 8] & (0x80 >> (i % 8))){
+            data[byte] |= (uint8_t)(0x80 >> (bit % 8));
+        }
+    }
+}
+
+/**[写出 PPM, 按扫描顺序取 GRAM 并应用垂直滚动; 反色不计, 这里驱动的 IPS 面板需要 INVON 才显示正常颜色]*/
+static int lcd_st7789_emulator_ppm(LCD_ST7789_EMULATOR_MT *mem, const char *path){
+    uint8_t line[LCD_ST7789_EMULATOR_WIDTH * 3];
+    uint32_t tfa = mem->vscrdef[0], vsa = mem->vscrdef[1];
+    uint32_t row, y, x;
+    const uint8_t *cell;
+    FILE *fp;
+
+    if((fp = fopen(path, "wb")) == NULL){
+        fprintf(stderr, "LCD_ST7789 emulator: unable to write %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", LCD_ST7789_EMULATOR_WIDTH, LCD_ST7789_EMULATOR_HEIGHT);
+
+    for(y = 0; y < LCD_ST7789_EMULATOR_HEIGHT; y++){
+        row = y;
+        if(vsa > 0 && tfa + vsa <= LCD_ST7789_EMULATOR_HEIGHT && y >= tfa && y < tfa + vsa
+           && mem->vscsad >= tfa && mem->vscsad < tfa + vsa){
+            row = tfa + (y - tfa + mem->vscsad - tfa) % vsa;
+        }
+        for(x = 0; x < LCD_ST7789_EMULATOR_WIDTH; x++){
+            cell = mem->gram[row][x];
+            if(!mem->display || mem->sleep){
+                line[x * 3] = line[x * 3 + 1] = line[x * 3 + 2] = 0;
+            }else if(mem->madctl & LCD_ST7789_MADCTL_BGR){
+                line[x * 3]     = (uint8_t)(cell[2] | cell[2] >> 6);
+                line[x * 3 + 1] = (uint8_t)(cell[1] | cell[1] >> 6);
+                line[x * 3 + 2] = (uint8_t)(cell[0] | cell[0] >> 6);
+            }else{
+                line[x * 3]     = (uint8_t)(cell[0] | cell[0] >> 6);
+                line[x * 3 + 1] = (uint8_t)(cell[1] | cell[1] >> 6);
+                line[x * 3 + 2] = (uint8_t)(cell[2] | cell[2] >> 6);
+            }
+        }
+        fwrite(line, 1, sizeof (line), fp);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+
+int lcd_st7789_emulator_open(void *self){
+    (void)self;
+    return 0;
+}
+
+int lcd_st7789_emulator_reset(void *self, uint8_t level){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    if(level == 0){
+        lcd_st7789_emulator_defaults(mem);
+        mem->panel.resets++;
+    }
+    return 0;
+}
+
+int lcd_st7789_emulator_command(void *self, uint8_t cmd){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    lcd_st7789_emulator_count(mem, 1);
+    lcd_st7789_emulator_command_apply(mem, cmd);
+    return 0;
+}
+
+int lcd_st7789_emulator_data(void *self, const uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+    uint32_t i;
+
+    lcd_st7789_emulator_count(mem, size);
+    if(mem->writing){
+        lcd_st7789_emulator_write_pixels(mem, data, size);
+        return 0;
+    }
+    for(i = 0; i < size; i++){
+        lcd_st7789_emulator_param(mem, data[i]);
+    }
+    return 0;
+}
+
+int lcd_st7789_emulator_flush(void *self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    // CS 释放: 不完整的像素被丢弃, 地址计数器保留给 RAMWRC
+    mem->npartial = 0;
+    lcd_st7789_counters_end(&mem->counters, lcd_st7789_emulator_now_us(mem), 0, 0);
+    return 0;
+}
+
+int lcd_st7789_emulator_read(void *self, uint8_t cmd, uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+    uint8_t reply[4];
+    uint8_t *raw;
+    uint8_t *cell;
+    uint32_t i, pixels;
+    uint16_t x, y;
+
+    lcd_st7789_emulator_flush(transport);
+    lcd_st7789_emulator_count(mem, 1 + size);
+    lcd_st7789_emulator_command_apply(mem, cmd);
+    mem->panel.bytes -= size;   // 读回的字节不计入写入
+
+    switch(cmd){
+    case 0x04:  // RDDID, 1个 dummy 周期
+        reply[0] = 0x85;
+        reply[1] = 0x85;
+        reply[2] = 0x52;
+        lcd_st7789_emulator_reply(reply, 3, 1, data, size);
+        break;
+    case 0x09:  // RDDST, 1个 dummy 周期
+        reply[0] = (uint8_t)((mem->sleep ? 0x00 : 0x80) | ((mem->madctl >> 1) & 0x7E));
+        reply[1] = (uint8_t)(((mem->colmod & 0x07) << 4) | (mem->sleep ? 0x00 : 0x02) | 0x01);
+        reply[2] = (uint8_t)((mem->inversion ? 0x20 : 0x00) | (mem->display ? 0x04 : 0x00) | (mem->tearing ? 0x02 : 0x00));
+        reply[3] = 0x00;
+        lcd_st7789_emulator_reply(reply, 4, 1, data, size);
+        break;
+    case 0x0A:  // RDDPM
+        reply[0] = (uint8_t)((mem->sleep ? 0x00 : 0x90) | (mem->display ? 0x04 : 0x00) | 0x08);
+        lcd_st7789_emulator_reply(reply, 1, 1, data, size);
+        break;
+    case 0x0B:  // RDDMADCTL
+        reply[0] = mem->madctl;
+        lcd_st7789_emulator_reply(reply, 1, 1, data, size);
+        break;
+    case 0x0C:  // RDDCOLMOD
+        reply[0] = mem->colmod;
+        lcd_st7789_emulator_reply(reply, 1, 1, data, size);
+        break;
+    case 0x2E:  // RAMRD, 8个 dummy 周期后每像素3字节
+        pixels = size > 1 ? (size - 1) / 3 : 0;
+        raw = (uint8_t*)malloc(pixels * 3 + 1);
+        x = mem->caset[0];
+        y = mem->raset[0];
+        for(i = 0; i < pixels; i++){
+            cell = lcd_st7789_emulator_cell(mem, x, y);
+            if(cell != NULL){
+                memcpy(raw + i * 3, cell, 3);
+            }else{
+                memset(raw + i * 3, 0, 3);
+            }
+            if(x < mem->caset[1]){
+                x++;
+            }else{
+                x = mem->caset[0];
+                y = y < mem->raset[1] ? y + 1 : mem->raset[0];
+            }
+        }
+        lcd_st7789_emulator_reply(raw, pixels * 3, 8, data, size);
+        free(raw);
+        break;
+    default:
+        memset(data, 0, size);
+        break;
+    }
+
+    lcd_st7789_emulator_flush(transport);
+    return 0;
+}
+
+int lcd_st7789_emulator_speed(void *self, uint32_t hz){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    if(hz == 0){
+        return -1;
+    }
+    mem->speed_hz = hz;
+    return 0;
+}
+
+/**[TE: 开启后每个刷新周期 (FRCTRL2) 开始时一个上升沿, 等待时线上时间推进到下一个周期]*/
+int lcd_st7789_emulator_vsync(void *self, uint32_t period_us, uint32_t timeout_us){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+    uint64_t period = 1000000000ull / lcd_st7789_frame_rates[mem->frctrl2];
+    uint64_t next;
+
+    (void)period_us;    // 周期取自模拟面板收到的 FRCTRL2
+
+    if(!mem->tearing || mem->sleep){
+        return -1;  // TEOFF 或睡眠时 TE 引脚保持低电平
+    }
+    next = (mem->wire_ns / period + 1) * period;
+    if(next - mem->wire_ns > (uint64_t)timeout_us * 1000){
+        return -1;
+    }
+    mem->wire_ns = next;
+    return 0;
+}
+
+int lcd_st7789_emulator_stats(void *self, LCD_ST7789_STATS *stats){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    *stats = mem->counters.total;
+    return 0;
+}
+
+int lcd_st7789_emulator_close(void **self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)(*self);
+    LCD_ST7789_EMULATOR_MT *mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    if(mem->panel.frames > 0){
+        fprintf(stderr, "LCD_ST7789 emulator: %u frames, avg %llu bytes %llu commands %llu pixels per frame\n",
+                mem->panel.frames,
+                (unsigned long long)(mem->frame_bytes / mem->panel.frames),
+                (unsigned long long)(mem->frame_commands / mem->panel.frames),
+                (unsigned long long)(mem->frame_pixels / mem->panel.frames));
+    }
+
+    free(mem);
+    free(transport);
+
+    *self = NULL;
+
+    return 0;
+}
+
+
+int lcd_st7789_transport_emulator_frame(LCD_ST7789_TRANSPORT *transport){
+    LCD_ST7789_EMULATOR_MT *mem;
+    LCD_ST7789_PANEL *panel;
+    char path[LCD_ST7789_EMULATOR_PATH + 16];
+    int ret = 0;
+
+    if(transport->open != &lcd_st7789_emulator_open){
+        return -1;
+    }
+    mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+    panel = &mem->panel;
+
+    if(mem->snapshot[0] != '\0'){
+        snprintf(path, sizeof (path), mem->snapshot, panel->frames);
+        ret = lcd_st7789_emulator_ppm(mem, path);
+    }
+
+    // frame_* 保存到上一帧结束为止的累计值, 差值就是本帧的计数
+    panel->frame_bytes    = (uint32_t)(panel->bytes - mem->frame_bytes);
+    panel->frame_commands = (uint32_t)(panel->commands - mem->frame_commands);
+    panel->frame_pixels   = (uint32_t)(panel->pixels - mem->frame_pixels);
+    mem->frame_bytes    = panel->bytes;
+    mem->frame_commands = panel->commands;
+    mem->frame_pixels   = panel->pixels;
+    panel->frame_rewrites = mem->rewrites;
+    mem->rewrites = 0;
+    panel->frames++;
+
+    return ret;
+}
+
+int lcd_st7789_transport_emulator_panel(LCD_ST7789_TRANSPORT *transport, LCD_ST7789_PANEL *panel){
+    LCD_ST7789_EMULATOR_MT *mem;
+
+    if(transport->open != &lcd_st7789_emulator_open){
+        return -1;
+    }
+    mem = (LCD_ST7789_EMULATOR_MT*)transport->priv;
+
+    *panel = mem->panel;
+    panel->madctl  = mem->madctl;
+    panel->colmod  = mem->colmod;
+    panel->frctrl2 = mem->frctrl2;
+    panel->tfa     = mem->vscrdef[0];
+    panel->vsa     = mem->vscrdef[1];
+    panel->bfa     = mem->vscrdef[2];
+    panel->vsp     = mem->vscsad;
+    panel->gram    = &mem->gram[0][0][0];
+    return 0;
+}
+
+int lcd_st7789_transport_emulator_corrupt(LCD_ST7789_TRANSPORT *transport, uint32_t hz){
+    if(transport->open != &lcd_st7789_emulator_open){
+        return -1;
+    }
+    ((LCD_ST7789_EMULATOR_MT*)transport->priv)->corrupt_hz = hz;
+    return 0;
+}
+
+
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_emulator(const char *snapshot){
+    LCD_ST7789_TRANSPORT *transport = NULL;
+    LCD_ST7789_EMULATOR_MT *mem = NULL;
+
+    transport = (LCD_ST7789_TRANSPORT*)malloc(sizeof (LCD_ST7789_TRANSPORT));
+    memset(transport, 0, sizeof (LCD_ST7789_TRANSPORT));
+
+    mem = (LCD_ST7789_EMULATOR_MT*)malloc(sizeof (LCD_ST7789_EMULATOR_MT));
+    memset(mem, 0, sizeof (LCD_ST7789_EMULATOR_MT));
+    if(snapshot != NULL){
+        snprintf(mem->snapshot, sizeof (mem->snapshot), "%s", snapshot);
+    }
+    mem->speed_hz = LCD_ST7789_SPEED_HZ;
+    lcd_st7789_emulator_defaults(mem);
+
+    transport->priv    = mem;
+    transport->open    = &lcd_st7789_emulator_open;
+    transport->reset   = &lcd_st7789_emulator_reset;
+    transport->command = &lcd_st7789_emulator_command;
+    transport->data    = &lcd_st7789_emulator_data;
+    transport->flush   = &lcd_st7789_emulator_flush;
+    transport->read    = &lcd_st7789_emulator_read;
+    transport->speed   = &lcd_st7789_emulator_speed;
+    transport->vsync   = &lcd_st7789_emulator_vsync;
+    transport->stats   = &lcd_st7789_emulator_stats;
+    transport->close   = &lcd_st7789_emulator_close;
+
+    return transport;
+}
@@ -0,0 +1,609 @@
+#include "st7789_transport.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+
+#define LCD_ST7789_SPIDEV_DEVICE      "/dev/spidev0.0"
+#define LCD_ST7789_SPIDEV_GPIOCHIP    "/dev/gpiochip0"
+#define LCD_ST7789_SPIDEV_BUFSIZ_FILE "/sys/module/spidev/parameters/bufsiz"
+#define LCD_ST7789_SPIDEV_BUFSIZ      4096   // spidev 默认 bufsiz
+#define LCD_ST7789_SPIDEV_BATCH       64     // 单次 SPI_IOC_MESSAGE 最多传输段数
+#define LCD_ST7789_SPIDEV_STAGING     512    // 小块写入拷贝到内部缓冲合并
+#define LCD_ST7789_SPIDEV_SMALL       64
+
+
+typedef struct {
+    char device[64];
+    char gpiochip[64];
+    int spi_fd;
+    int gpio_fd;
+    int te_fd;              // TE 引脚上升沿事件, 第一次 vsync 时申请
+    uint32_t bufsiz;
+    uint32_t speed_hz;
+    uint8_t flags;
+    uint8_t dc;
+    uint8_t res;
+
+    // 待提交的传输段: 总长度不超过 bufsiz, DC 电平相同
+    struct spi_ioc_transfer batch[LCD_ST7789_SPIDEV_BATCH];
+    uint32_t count;
+    uint32_t total;
+    uint8_t staging[LCD_ST7789_SPIDEV_STAGING];
+    uint32_t staged;
+
+    // 3线模式: 9bit 字打包后的发送缓冲, 8个字一组
+    uint8_t *packed;
+    uint32_t npacked;
+    uint16_t pending[8];
+    uint32_t npending;
+
+    LCD_ST7789_COUNTERS counters;
+} LCD_ST7789_SPIDEV_MT;
+
+
+uint32_t lcd_st7789_lossi_pack(const uint8_t *data, uint32_t size, uint8_t dc, uint8_t *out){
+    uint64_t flag = dc ? 1 : 0;
+    uint64_t hi, lo;
+    uint32_t i;
+
+    // 每4个字 36bit 放进一个 64bit 整数, 两个拼成 72bit = 9字节
+    for(i = 0; i + 8 <= size; i += 8){
+        hi = (flag << 35) | ((uint64_t)data[i + 0] << 27)
+           | (flag << 26) | ((uint64_t)data[i + 1] << 18)
+           | (flag << 17) | ((uint64_t)data[i + 2] << 9)
+           | (flag << 8)  | ((uint64_t)data[i + 3]);
+        lo = (flag << 35) | ((uint64_t)data[i + 4] << 27)
+           | (flag << 26) | ((uint64_t)data[i + 5] << 18)
+           | (flag << 17) | ((uint64_t)data[i + 6] << 9)
+           | (flag << 8)  | ((uint64_t)data[i + 7]);
+
+        out[0] = (uint8_t)(hi >> 28);
+        out[1] = (uint8_t)(hi >> 20);
+        out[2] = (uint8_t)(hi >> 12);
+        out[3] = (uint8_t)(hi >> 4);
+        out[4] = (uint8_t)((hi << 4) | (lo >> 32));
+        out[5] = (uint8_t)(lo >> 24);
+        out[6] = (uint8_t)(lo >> 16);
+        out[7] = (uint8_t)(lo >> 8);
+        out[8] = (uint8_t)(lo);
+        out += 9;
+    }
+
+    return size / 8 * 9;
+}
+
+uint32_t lcd_st7789_lossi_pack_words(const uint16_t *words, uint32_t count, uint8_t *out){
+    uint32_t acc = 0;
+    uint32_t bits = 0;
+    uint32_t n = 0;
+    uint32_t i;
+
+    for(i = 0; i < count; i++){
+        acc = (acc << 9) | (words[i] & 0x1FF);
+        bits += 9;
+        while(bits >= 8){
+            bits -= 8;
+            out[n++] = (uint8_t)(acc >> bits);
+        }
+        acc &= (1u << bits) - 1;
+    }
+    if(bits > 0){
+        // 末尾补0, CS 拉高时面板丢弃不完整的字
+        out[n++] = (uint8_t)(acc << (8 - bits));
+    }
+
+    return n;
+}
+
+
+static uint64_t lcd_st7789_spidev_now_us(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/**[事务计数: 第一次写入时开始, flush 时结束; 等待在内核里完成, 没有 spins]*/
+static void lcd_st7789_spidev_count(LCD_ST7789_SPIDEV_MT *mem, uint32_t size){
+    if(!mem->counters.active){
+        lcd_st7789_counters_begin(&mem->counters, lcd_st7789_spidev_now_us(), 0, 0);
+    }
+    mem->counters.total.bytes += size;
+}
+
+static int lcd_st7789_spidev_gpio(LCD_ST7789_SPIDEV_MT *mem){
+    struct gpiohandle_data values;
+
+    memset(&values, 0, sizeof (values));
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        values.values[0] = mem->res;
+    }else{
+        values.values[0] = mem->dc;
+        values.values[1] = mem->res;
+    }
+    if(ioctl(mem->gpio_fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &values) < 0){
+        perror("[Error] - spidev set gpio");
+        return -1;
+    }
+    return 0;
+}
+
+/**[提交已排队的传输段, 一次 ioctl]*/
+static int lcd_st7789_spidev_submit(LCD_ST7789_SPIDEV_MT *mem){
+    int ret = 0;
+
+    if(mem->count > 0){
+        if(ioctl(mem->spi_fd, SPI_IOC_MESSAGE(mem->count), mem->batch) < 0){
+            perror("[Error] - spidev message");
+            ret = -1;
+        }
+    }
+
+    mem->count  = 0;
+    mem->total  = 0;
+    mem->staged = 0;
+
+    return ret;
+}
+
+/**
+ * 排队一段写入. 小块拷贝到 staging 合并 (staging 满时先提交), 调用方的缓冲返回后可能失效,
+ * 所以大块直接引用调用方的缓冲时在返回前提交.
+ */
+static int lcd_st7789_spidev_queue(LCD_ST7789_SPIDEV_MT *mem, const uint8_t *data, uint32_t size, uint8_t dc){
+    int ret = 0;
+    uint32_t n;
+    uint8_t borrowed = 0;
+    struct spi_ioc_transfer *last;
+
+    if(mem->dc != dc){
+        ret |= lcd_st7789_spidev_submit(mem);
+        mem->dc = dc;
+        mem->counters.total.dc_toggles++;
+        ret |= lcd_st7789_spidev_gpio(mem);
+    }
+
+    while(size > 0){
+        if(mem->total >= mem->bufsiz || mem->count >= LCD_ST7789_SPIDEV_BATCH){
+            ret |= lcd_st7789_spidev_submit(mem);
+        }
+
+        // 单条消息总长不能超过内核 bufsiz, 超出部分拆到下一条消息
+        n = mem->bufsiz - mem->total;
+        n = size < n ? size : n;
+
+        if(n <= LCD_ST7789_SPIDEV_SMALL){
+            if(mem->staged + n > LCD_ST7789_SPIDEV_STAGING){
+                ret |= lcd_st7789_spidev_submit(mem);
+                continue;
+            }
+            last = mem->count > 0 ? &mem->batch[mem->count - 1] : NULL;
+            memcpy(mem->staging + mem->staged, data, n);
+            if(last != NULL && last->tx_buf + last->len == (uintptr_t)(mem->staging + mem->staged)){
+                last->len += n;
+            }else{
+                last = &mem->batch[mem->count++];
+                memset(last, 0, sizeof (*last));
+                last->tx_buf = (uintptr_t)(mem->staging + mem->staged);
+                last->len = n;
+                last->speed_hz = mem->speed_hz;
+                last->bits_per_word = 8;
+            }
+            mem->staged += n;
+        }else{
+            last = &mem->batch[mem->count++];
+            memset(last, 0, sizeof (*last));
+            last->tx_buf = (uintptr_t)data;
+            last->len = n;
+            last->speed_hz = mem->speed_hz;
+            last->bits_per_word = 8;
+            borrowed = 1;
+        }
+
+        mem->total += n;
+        data += n;
+        size -= n;
+    }
+
+    if(borrowed){
+        ret |= lcd_st7789_spidev_submit(mem);
+    }
+
+    return ret;
+}
+
+/**[3线模式: 发送打包缓冲, 缓冲中总是完整的字组]*/
+static int lcd_st7789_spidev_submit_packed(LCD_ST7789_SPIDEV_MT *mem){
+    int ret = 0;
+    struct spi_ioc_transfer transfer;
+
+    if(mem->npacked > 0){
+        memset(&transfer, 0, sizeof (transfer));
+        transfer.tx_buf = (uintptr_t)mem->packed;
+        transfer.len = mem->npacked;
+        transfer.speed_hz = mem->speed_hz;
+        transfer.bits_per_word = 8;
+        if(ioctl(mem->spi_fd, SPI_IOC_MESSAGE(1), &transfer) < 0){
+            perror("[Error] - spidev message");
+            ret = -1;
+        }
+    }
+    mem->npacked = 0;
+
+    return ret;
+}
+
+static int lcd_st7789_spidev_queue_packed(LCD_ST7789_SPIDEV_MT *mem, const uint8_t *data, uint32_t size, uint8_t dc){
+    int ret = 0;
+    uint32_t n;
+
+    while(size > 0){
+        if(mem->npending > 0 || size < 8){
+            // 凑满一组8个字
+            n = 8 - mem->npending;
+            n = size < n ? size : n;
+            size -= n;
+            while(n--){
+                mem->pending[mem->npending++] = (uint16_t)((dc ? 0x100 : 0) | *data++);
+            }
+            if(mem->npending == 8){
+                if(mem->npacked + 9 > mem->bufsiz){
+                    ret |= lcd_st7789_spidev_submit_packed(mem);
+                }
+                mem->npacked += lcd_st7789_lossi_pack_words(mem->pending, 8, mem->packed + mem->npacked);
+                mem->npending = 0;
+            }
+            continue;
+        }
+
+        // 整组直接打包进发送缓冲
+        n = (mem->bufsiz - mem->npacked) / 9;
+        n = size / 8 < n ? size / 8 : n;
+        if(n == 0){
+            ret |= lcd_st7789_spidev_submit_packed(mem);
+            continue;
+        }
+        mem->npacked += lcd_st7789_lossi_pack(data, n * 8, dc, mem->packed + mem->npacked);
+        data += n * 8;
+        size -= n * 8;
+    }
+
+    return ret;
+}
+
+static int lcd_st7789_spidev_flush_packed(LCD_ST7789_SPIDEV_MT *mem){
+    int ret = 0;
+
+    if(mem->npending > 0){
+        if(mem->npacked + 9 > mem->bufsiz){
+            ret |= lcd_st7789_spidev_submit_packed(mem);
+        }
+        mem->npacked += lcd_st7789_lossi_pack_words(mem->pending, mem->npending, mem->packed + mem->npacked);
+        mem->npending = 0;
+    }
+
+    return ret | lcd_st7789_spidev_submit_packed(mem);
+}
+
+/**[open 失败时关闭已经打开的设备, 之后可以重新 open]*/
+static int lcd_st7789_spidev_open_fail(LCD_ST7789_SPIDEV_MT *mem){
+    if(mem->spi_fd >= 0){
+        close(mem->spi_fd);
+        mem->spi_fd = -1;
+    }
+    free(mem->packed);
+    mem->packed = NULL;
+    return -1;
+}
+
+int lcd_st7789_spidev_open(void *self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    FILE *fp;
+
+    if(mem->spi_fd >= 0){
+        return 0;
+    }
+    if((mem->spi_fd = open(mem->device, O_RDWR)) < 0){
+        fprintf(stderr, "Unable to open %s: %s\n", mem->device, strerror(errno));
+        return -1;
+    }
+    if(ioctl(mem->spi_fd, SPI_IOC_WR_MODE, &mode) < 0
+       || ioctl(mem->spi_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0
+       || ioctl(mem->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &mem->speed_hz) < 0){
+        perror("[Error] - spidev setup");
+        return lcd_st7789_spidev_open_fail(mem);
+    }
+
+    mem->bufsiz = LCD_ST7789_SPIDEV_BUFSIZ;
+    if((fp = fopen(LCD_ST7789_SPIDEV_BUFSIZ_FILE, "r")) != NULL){
+        if(fscanf(fp, "%u", &mem->bufsiz) != 1 || mem->bufsiz == 0){
+            mem->bufsiz = LCD_ST7789_SPIDEV_BUFSIZ;
+        }
+        fclose(fp);
+    }
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        mem->packed = (uint8_t*)malloc(mem->bufsiz);
+        if(mem->packed == NULL || mem->bufsiz < 9){
+            fprintf(stderr, "spidev bufsiz %u too small\n", mem->bufsiz);
+            return lcd_st7789_spidev_open_fail(mem);
+        }
+    }
+
+    {// DC / RES 引脚
+        struct gpiohandle_request request;
+        int fd;
+
+        if((fd = open(mem->gpiochip, O_RDWR)) < 0){
+            fprintf(stderr, "Unable to open %s: %s\n", mem->gpiochip, strerror(errno));
+            return lcd_st7789_spidev_open_fail(mem);
+        }
+
+        memset(&request, 0, sizeof (request));
+        if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+            // 3线模式不占用 DC 引脚
+            request.lineoffsets[0] = LCD_ST7789_GPIO_SPI_PIN_RES;
+            request.default_values[0] = 1;
+            request.lines = 1;
+        }else{
+            request.lineoffsets[0] = LCD_ST7789_GPIO_SPI_PIN_DC;
+            request.lineoffsets[1] = LCD_ST7789_GPIO_SPI_PIN_RES;
+            request.default_values[0] = 0;
+            request.default_values[1] = 1;
+            request.lines = 2;
+        }
+        request.flags = GPIOHANDLE_REQUEST_OUTPUT;
+        snprintf(request.consumer_label, sizeof (request.consumer_label), "st7789");
+
+        if(ioctl(fd, GPIO_GET_LINEHANDLE_IOCTL, &request) < 0){
+            perror("[Error] - gpiochip line request");
+            close(fd);
+            return lcd_st7789_spidev_open_fail(mem);
+        }
+        close(fd);
+
+        mem->gpio_fd = request.fd;
+        mem->dc  = 0;
+        mem->res = 1;
+    }
+
+    return 0;
+}
+
+int lcd_st7789_spidev_reset(void *self, uint8_t level){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    mem->res = level ? 1 : 0;
+    return lcd_st7789_spidev_gpio(mem);
+}
+
+int lcd_st7789_spidev_command(void *self, uint8_t cmd){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    lcd_st7789_spidev_count(mem, 1);
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        return lcd_st7789_spidev_queue_packed(mem, &cmd, 1, 0);
+    }
+    return lcd_st7789_spidev_queue(mem, &cmd, 1, 0);
+}
+
+int lcd_st7789_spidev_data(void *self, const uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    lcd_st7789_spidev_count(mem, size);
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        return lcd_st7789_spidev_queue_packed(mem, data, size, 1);
+    }
+    return lcd_st7789_spidev_queue(mem, data, size, 1);
+}
+
+int lcd_st7789_spidev_flush(void *self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+    int ret;
+
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        ret = lcd_st7789_spidev_flush_packed(mem);
+    }else{
+        ret = lcd_st7789_spidev_submit(mem);
+    }
+    if(mem->counters.active){
+        lcd_st7789_counters_end(&mem->counters, lcd_st7789_spidev_now_us(), 0, 0);
+    }
+    return ret;
+}
+
+int lcd_st7789_spidev_read(void *self, uint8_t cmd, uint8_t *data, uint32_t size){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+    struct spi_ioc_transfer transfer;
+    int ret = 0;
+
+    if(mem->flags & LCD_ST7789_FLAG_3WIRE){
+        return -1;
+    }
+    ret |= lcd_st7789_spidev_flush(transport);
+
+    // 命令段最后一个传输设置 cs_change, 消息结束后 CS 保持有效, 切换DC后再读
+    memset(&transfer, 0, sizeof (transfer));
+    transfer.tx_buf = (uintptr_t)&cmd;
+    transfer.len = 1;
+    transfer.speed_hz = LCD_ST7789_READ_SPEED_HZ;
+    transfer.bits_per_word = 8;
+    transfer.cs_change = 1;
+    lcd_st7789_spidev_count(mem, 1 + size);
+    mem->counters.total.dc_toggles += mem->dc != 0;
+    mem->dc = 0;
+    ret |= lcd_st7789_spidev_gpio(mem);
+    if(ioctl(mem->spi_fd, SPI_IOC_MESSAGE(1), &transfer) < 0){
+        perror("[Error] - spidev read command");
+        return -1;
+    }
+
+    memset(data, 0, size);
+    memset(&transfer, 0, sizeof (transfer));
+    transfer.tx_buf = (uintptr_t)data;
+    transfer.rx_buf = (uintptr_t)data;
+    transfer.len = size;
+    transfer.speed_hz = LCD_ST7789_READ_SPEED_HZ;
+    transfer.bits_per_word = 8;
+    mem->dc = 1;
+    mem->counters.total.dc_toggles++;
+    ret |= lcd_st7789_spidev_gpio(mem);
+    if(ioctl(mem->spi_fd, SPI_IOC_MESSAGE(1), &transfer) < 0){
+        perror("[Error] - spidev read data");
+        return -1;
+    }
+    lcd_st7789_counters_end(&mem->counters, lcd_st7789_spidev_now_us(), 0, 0);
+
+    return ret;
+}
+
+int lcd_st7789_spidev_speed(void *self, uint32_t hz){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+    int ret = 0;
+
+    // 已排队的传输段带着各自的 speed_hz, 先全部发出
+    ret |= lcd_st7789_spidev_flush(transport);
+    mem->speed_hz = hz;
+    if(ioctl(mem->spi_fd, SPI_IOC_WR_MAX_SPEED_HZ, &mem->speed_hz) < 0){
+        perror("[Error] - spidev speed");
+        return -1;
+    }
+
+    return ret;
+}
+
+/**[等待 TE 上升沿: 先读掉积压的事件, 再等下一个]*/
+int lcd_st7789_spidev_vsync(void *self, uint32_t period_us, uint32_t timeout_us){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+    struct gpioevent_data event;
+    struct pollfd pfd;
+
+    (void)period_us;    // poll 在内核中睡眠到边沿, 不需要预测
+
+    if(mem->te_fd < 0){
+        struct gpioevent_request request;
+        int fd;
+
+        if((fd = open(mem->gpiochip, O_RDWR)) < 0){
+            fprintf(stderr, "Unable to open %s: %s\n", mem->gpiochip, strerror(errno));
+            return -1;
+        }
+        memset(&request, 0, sizeof (request));
+        request.lineoffset = LCD_ST7789_GPIO_SPI_PIN_TE;
+        request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+        request.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+        snprintf(request.consumer_label, sizeof (request.consumer_label), "st7789-te");
+        if(ioctl(fd, GPIO_GET_LINEEVENT_IOCTL, &request) < 0){
+            perror("[Error] - gpiochip te request");
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        mem->te_fd = request.fd;
+    }
+
+    pfd.fd = mem->te_fd;
+    pfd.events = POLLIN;
+    while(poll(&pfd, 1, 0) > 0){
+        if(read(mem->te_fd, &event, sizeof (event)) != sizeof (event)){
+            return -1;
+        }
+    }
+    if(poll(&pfd, 1, (int)((timeout_us + 999) / 1000)) <= 0){
+        return -1;
+    }
+    if(read(mem->te_fd, &event, sizeof (event)) != sizeof (event)){
+        return -1;
+    }
+    return 0;
+}
+
+int lcd_st7789_spidev_stats(void *self, LCD_ST7789_STATS *stats){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)self;
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    *stats = mem->counters.total;
+    return 0;
+}
+
+int lcd_st7789_spidev_close(void **self){
+    LCD_ST7789_TRANSPORT *transport = (LCD_ST7789_TRANSPORT*)(*self);
+    LCD_ST7789_SPIDEV_MT *mem = (LCD_ST7789_SPIDEV_MT*)transport->priv;
+
+    if(mem->spi_fd >= 0){
+        lcd_st7789_spidev_flush(transport);
+        close(mem->spi_fd);
+    }
+    if(mem->gpio_fd >= 0){
+        close(mem->gpio_fd);
+    }
+    if(mem->te_fd >= 0){
+        close(mem->te_fd);
+    }
+
+    free(mem->packed);
+    free(mem);
+    free(transport);
+
+    *self = NULL;
+
+    return 0;
+}
+
+
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_spidev(const char *device, const char *gpiochip, uint8_t flags){
+    LCD_ST7789_TRANSPORT *transport = NULL;
+    LCD_ST7789_SPIDEV_MT *mem = NULL;
+
+    transport = (LCD_ST7789_TRANSPORT*)malloc(sizeof (LCD_ST7789_TRANSPORT));
+    memset(transport, 0, sizeof (LCD_ST7789_TRANSPORT));
+
+    mem = (LCD_ST7789_SPIDEV_MT*)malloc(sizeof (LCD_ST7789_SPIDEV_MT));
+    memset(mem, 0, sizeof (LCD_ST7789_SPIDEV_MT));
+    snprintf(mem->device, sizeof (mem->device), "%s",
+             device != NULL ? device : LCD_ST7789_SPIDEV_DEVICE);
+    snprintf(mem->gpiochip, sizeof (mem->gpiochip), "%s",
+             gpiochip != NULL ? gpiochip : LCD_ST7789_SPIDEV_GPIOCHIP);
+    mem->flags    = flags;
+    mem->spi_fd   = -1;
+    mem->gpio_fd  = -1;
+    mem->te_fd    = -1;
+    mem->speed_hz = LCD_ST7789_SPEED_HZ;
+    mem->bufsiz   = LCD_ST7789_SPIDEV_BUFSIZ;
+
+    transport->priv    = mem;
+    transport->open    = &lcd_st7789_spidev_open;
+    transport->reset   = &lcd_st7789_spidev_reset;
+    transport->command = &lcd_st7789_spidev_command;
+    transport->data    = &lcd_st7789_spidev_data;
+    transport->flush   = &lcd_st7789_spidev_flush;
+    transport->read    = &lcd_st7789_spidev_read;
+    transport->speed   = &lcd_st7789_spidev_speed;
+    transport->vsync   = &lcd_st7789_spidev_vsync;
+    transport->stats   = &lcd_st7789_spidev_stats;
+    transport->close   = &lcd_st7789_spidev_close;
+
+    return transport;
+}
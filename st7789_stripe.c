@@ -0,0 +1,673 @@
+#include "st7789.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#define LCD_ST7789_STRIPE_PANELS       2
+#define LCD_ST7789_STRIPE_PANEL_WIDTH  240
+#define LCD_ST7789_STRIPE_PANEL_HEIGHT 320
+#define LCD_ST7789_STRIPE_FENCES       16     // 未完成的 submit 批次上限
+#define LCD_ST7789_STRIPE_BATCH        16     // 每批转发给一块面板的任务数上限
+
+
+typedef struct LCD_ST7789_STRIPE_MT LCD_ST7789_STRIPE_MT;
+
+// 一次 submit: 两块面板各自的 fence, 以及跨接缝任务拆开后的拷贝
+typedef struct {
+    uint32_t fence[LCD_ST7789_STRIPE_PANELS];
+    uint8_t *staging;
+} LCD_ST7789_STRIPE_FENCE;
+
+typedef struct {
+    LCD_ST7789_STRIPE_MT *parent;
+    LCD_ST7789_DRI *driver;
+    pthread_t thread;
+    uint8_t started;        // 推送线程已启动
+    uint8_t active;         // 显示区域是否落在这块面板上
+    uint32_t offset;        // 在整行中的起始字节
+    uint32_t linesize;      // 本面板每行字节数
+    uint8_t *staging;       // 本面板的半帧, 连续存放后一次推送
+    uint32_t done;          // 已完成的帧序号
+    int error;
+} LCD_ST7789_STRIPE_PANEL;
+
+struct LCD_ST7789_STRIPE_MT {
+    LCD_ST7789_STRIPE_PANEL panel[LCD_ST7789_STRIPE_PANELS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t running;
+    uint32_t frame;         // 已提交的帧序号
+
+    // 双缓冲: 线程推送 front 的同时 output 填充另一块
+    uint8_t *buffer[2];
+    uint8_t back;
+    const uint8_t *front;
+    uint32_t filled;
+    uint32_t size;
+    uint32_t linesize;
+    uint32_t lines;
+
+    // 异步任务转发给两块面板, fence 为批次序号
+    pthread_mutex_t async;
+    LCD_ST7789_STRIPE_FENCE fences[LCD_ST7789_STRIPE_FENCES];
+    uint32_t submitted;
+    uint32_t retired;           // 已等待完成并释放拷贝的批次
+    int error;
+};
+
+
+static void* lcd_st7789_stripe_worker(void *arg){
+    LCD_ST7789_STRIPE_PANEL *panel = (LCD_ST7789_STRIPE_PANEL*)arg;
+    LCD_ST7789_STRIPE_MT *mem = panel->parent;
+    const uint8_t *frame;
+    uint32_t sequence;
+    uint32_t i;
+    int ret;
+
+    pthread_mutex_lock(&mem->lock);
+    while(1){
+        while(mem->running && panel->done == mem->frame){
+            pthread_cond_wait(&mem->cond, &mem->lock);
+        }
+        if(!mem->running){
+            break;
+        }
+        sequence = mem->frame;
+        frame = mem->front;
+        pthread_mutex_unlock(&mem->lock);
+
+        for(i = 0; i < mem->lines; i++){
+            memcpy(panel->staging + i * panel->linesize, frame + i * mem->linesize + panel->offset, panel->linesize);
+        }
+        ret = panel->driver->output(panel->driver, panel->staging, panel->linesize * mem->lines, 0);
+
+        pthread_mutex_lock(&mem->lock);
+        panel->error |= ret;
+        panel->done = sequence;
+        pthread_cond_broadcast(&mem->cond);
+    }
+    pthread_mutex_unlock(&mem->lock);
+
+    return NULL;
+}
+
+/**[两块面板都完成上一帧, 调用时持有锁]*/
+static int lcd_st7789_stripe_idle(LCD_ST7789_STRIPE_MT *mem){
+    int i;
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        if(mem->panel[i].active && mem->panel[i].done != mem->frame){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**[帧屏障: 等上一帧两半都推送完成后再切换缓冲, 保证两块面板显示同一帧]*/
+static int lcd_st7789_stripe_submit(LCD_ST7789_STRIPE_MT *mem){
+    int ret = 0;
+    int i;
+
+    pthread_mutex_lock(&mem->lock);
+    while(!lcd_st7789_stripe_idle(mem)){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        // 推送是异步的, 错误在下一帧提交时返回
+        ret |= mem->panel[i].error;
+        mem->panel[i].error = 0;
+    }
+    mem->front = mem->buffer[mem->back];
+    mem->back ^= 1;
+    mem->frame++;
+    pthread_cond_broadcast(&mem->cond);
+    pthread_mutex_unlock(&mem->lock);
+
+    mem->filled = 0;
+
+    return ret;
+}
+
+
+/**[拼接的两块面板按未旋转的方向排列]*/
+int lcd_st7789_stripe_rotate(void *self, uint8_t rotation){
+    (void)self;
+    return rotation == LCD_ST7789_ROTATE_0 ? 0 : -1;
+}
+
+int lcd_st7789_stripe_scroll_area(void *self, int16_t top, int16_t height){
+    (void)self;
+    (void)top;
+    (void)height;
+    return -1;
+}
+
+int lcd_st7789_stripe_scroll(void *self, int16_t lines, const uint8_t *data){
+    (void)self;
+    (void)lines;
+    (void)data;
+    return -1;
+}
+
+/**[两块面板各自等自己的 TE, 各自的推送线程在自己的 vblank 开始写]*/
+int lcd_st7789_stripe_vsync(void *self, uint8_t enable){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    int ret = 0;
+    int i;
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        if(mem->panel[i].active){
+            panel = mem->panel[i].driver;
+            ret |= panel->vsync(panel, enable);
+        }
+    }
+    return ret;
+}
+
+int lcd_st7789_stripe_refresh(void *self, uint32_t num, uint32_t den){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    int ret = 0;
+    int i;
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        ret |= panel->refresh(panel, num, den);
+    }
+    return ret;
+}
+
+int lcd_st7789_stripe_color(void *self, uint8_t mode){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    int ret = 0;
+    int i;
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        ret |= panel->color(panel, mode);
+    }
+    return ret;
+}
+
+int lcd_st7789_stripe_startup(void *self, uint8_t mode){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    int ret = 0;
+    int i;
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        ret |= panel->startup(panel, mode);
+    }
+    return ret;
+}
+
+/**[config 失败时撤销已完成的部分: 停止已启动的推送线程, 释放缓冲, 之后可以重新 config]*/
+static void lcd_st7789_stripe_unwind(LCD_ST7789_STRIPE_MT *mem){
+    LCD_ST7789_STRIPE_PANEL *panel;
+    int i;
+
+    pthread_mutex_lock(&mem->lock);
+    mem->running = 0;
+    pthread_cond_broadcast(&mem->cond);
+    pthread_mutex_unlock(&mem->lock);
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = &mem->panel[i];
+        if(panel->started){
+            pthread_join(panel->thread, NULL);
+            panel->started = 0;
+        }
+        free(panel->staging);
+        panel->staging  = NULL;
+        panel->active   = 0;
+        panel->offset   = 0;
+        panel->linesize = 0;
+        panel->done     = mem->frame;
+        panel->error    = 0;
+    }
+
+    for(i = 0; i < 2; i++){
+        free(mem->buffer[i]);
+        mem->buffer[i] = NULL;
+    }
+    mem->front    = NULL;
+    mem->back     = 0;
+    mem->filled   = 0;
+    mem->size     = 0;
+    mem->linesize = 0;
+    mem->lines    = 0;
+}
+
+int lcd_st7789_stripe_config(void *self, int16_t left, int16_t top, int16_t right, int16_t bottom){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_STRIPE_PANEL *panel;
+    int16_t base, l, r;
+    int i;
+
+    if(mem->running){
+        fprintf(stderr, "LCD_ST7789 stripe already configured\n");
+        return -1;
+    }
+    if(left < 0 || top < 0 || left > right || top > bottom
+       || right >= LCD_ST7789_STRIPE_PANELS * LCD_ST7789_STRIPE_PANEL_WIDTH || bottom >= LCD_ST7789_STRIPE_PANEL_HEIGHT){
+        fprintf(stderr, "LCD_ST7789 stripe invalid region\n");
+        return -1;
+    }
+
+    mem->linesize = (uint32_t)(right - left + 1) * 2;
+    mem->lines    = (uint32_t)(bottom - top + 1);
+    mem->size     = mem->linesize * mem->lines;
+    mem->buffer[0] = (uint8_t*)calloc(mem->size, 1);
+    mem->buffer[1] = (uint8_t*)calloc(mem->size, 1);
+    if(mem->buffer[0] == NULL || mem->buffer[1] == NULL){
+        fprintf(stderr, "LCD_ST7789 stripe out of memory\n");
+        lcd_st7789_stripe_unwind(mem);
+        return -1;
+    }
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = &mem->panel[i];
+        base = i * LCD_ST7789_STRIPE_PANEL_WIDTH;
+        l = left > base ? left : base;
+        r = right < base + LCD_ST7789_STRIPE_PANEL_WIDTH - 1 ? right : base + LCD_ST7789_STRIPE_PANEL_WIDTH - 1;
+
+        // 没有显示内容的面板也要初始化, 保证清屏
+        if(l > r){
+            if(panel->driver->config(panel->driver, 0, top, 0, bottom) != 0){
+                lcd_st7789_stripe_unwind(mem);
+                return -1;
+            }
+            continue;
+        }
+        if(panel->driver->config(panel->driver, l - base, top, r - base, bottom) != 0){
+            lcd_st7789_stripe_unwind(mem);
+            return -1;
+        }
+        panel->active   = 1;
+        panel->offset   = (uint32_t)(l - left) * 2;
+        panel->linesize = (uint32_t)(r - l + 1) * 2;
+        panel->staging  = (uint8_t*)malloc(panel->linesize * mem->lines);
+        if(panel->staging == NULL){
+            fprintf(stderr, "LCD_ST7789 stripe out of memory\n");
+            lcd_st7789_stripe_unwind(mem);
+            return -1;
+        }
+    }
+
+    mem->running = 1;
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = &mem->panel[i];
+        if(panel->active){
+            if(pthread_create(&panel->thread, NULL, &lcd_st7789_stripe_worker, panel) != 0){
+                perror("[Error] - lcd st7789 stripe thread");
+                lcd_st7789_stripe_unwind(mem);
+                return -1;
+            }
+            panel->started = 1;
+        }
+    }
+
+    return 0;
+}
+
+int lcd_st7789_stripe_output(void* self, uint8_t* data, uint32_t size, uint8_t append){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    uint32_t n;
+
+    if(!mem->running){
+        fprintf(stderr, "LCD_ST7789 stripe not configured\n");
+        return -1;
+    }
+
+    if(append == 0x00){
+        mem->filled = 0;
+    }
+
+    n = mem->size - mem->filled;
+    n = size < n ? size : n;
+    if(n > 0){
+        memcpy(mem->buffer[mem->back] + mem->filled, data, n);
+        mem->filled += n;
+    }
+
+    if(mem->filled == mem->size){
+        if(lcd_st7789_stripe_submit(mem) != 0){
+            fprintf(stderr, "LCD_ST7789 stripe output Failed\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int lcd_st7789_stripe_output_image(void* self, const uint8_t* data, uint32_t stride, uint16_t width, uint16_t height){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    uint32_t i;
+
+    if(!mem->running){
+        fprintf(stderr, "LCD_ST7789 stripe not configured\n");
+        return -1;
+    }
+    if((uint32_t)width * 2 != mem->linesize || height != mem->lines || stride < mem->linesize){
+        fprintf(stderr, "LCD_ST7789 stripe output_image size mismatch\n");
+        return -1;
+    }
+
+    for(i = 0; i < mem->lines; i++){
+        memcpy(mem->buffer[mem->back] + i * mem->linesize, data + i * stride, mem->linesize);
+    }
+    if(lcd_st7789_stripe_submit(mem) != 0){
+        fprintf(stderr, "LCD_ST7789 stripe output Failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**[直接返回下一帧要填充的缓冲, commit 时和 output 收满一帧一样提交]*/
+uint8_t* lcd_st7789_stripe_begin_frame(void *self){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+
+    if(!mem->running){
+        return NULL;
+    }
+    mem->filled = 0;
+    return mem->buffer[mem->back];
+}
+
+int lcd_st7789_stripe_commit(void *self){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+
+    if(!mem->running){
+        return -1;
+    }
+    if(lcd_st7789_stripe_submit(mem) != 0){
+        fprintf(stderr, "LCD_ST7789 stripe commit Failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int lcd_st7789_stripe_calibrate(void *self, const char *path){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    char name[256];
+    int ret = 0;
+    int i;
+
+    // 两条总线分别校准, 结果存在 path.0 / path.1
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        if(path != NULL){
+            snprintf(name, sizeof (name), "%s.%d", path, i);
+        }
+        ret |= panel->calibrate(panel, path != NULL ? name : NULL);
+    }
+
+    return ret;
+}
+
+int lcd_st7789_stripe_stats(void *self, LCD_ST7789_STATS *stats){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_DRI *panel;
+    LCD_ST7789_STATS part;
+    int ret = 0;
+    int i;
+
+    memset(stats, 0, sizeof (*stats));
+
+    // 计数在推送线程中更新, 等两块面板空闲后再读
+    pthread_mutex_lock(&mem->lock);
+    while(mem->running && !lcd_st7789_stripe_idle(mem)){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        if(panel->stats(panel, &part) != 0){
+            ret = -1;
+            continue;
+        }
+        stats->bytes        += part.bytes;
+        stats->transactions += part.transactions;
+        stats->fifo_spins   += part.fifo_spins;
+        stats->done_spins   += part.done_spins;
+        stats->dc_toggles   += part.dc_toggles;
+        stats->busy_us      += part.busy_us;
+        stats->last_us = part.last_us > stats->last_us ? part.last_us : stats->last_us;
+        stats->max_us  = part.max_us > stats->max_us ? part.max_us : stats->max_us;
+        // 两块面板收到同样的帧
+        stats->frames  = part.frames > stats->frames ? part.frames : stats->frames;
+        stats->saved_bytes += part.saved_bytes;
+        stats->last_bytes  += part.last_bytes;
+        stats->last_saved  += part.last_saved;
+        stats->vsyncs       += part.vsyncs;
+        stats->vsync_misses += part.vsync_misses;
+        stats->reduced_frames = part.reduced_frames > stats->reduced_frames ? part.reduced_frames : stats->reduced_frames;
+        stats->first_pixel_us = part.first_pixel_us > stats->first_pixel_us ? part.first_pixel_us : stats->first_pixel_us;
+        // 两条总线各自校准, 帧率受慢的一条限制
+        stats->speed_hz = (i == 0 || part.speed_hz < stats->speed_hz) ? part.speed_hz : stats->speed_hz;
+        // 两块面板按同一帧率选档, 取低的一块以防单独设置过
+        stats->refresh_hz = (i == 0 || part.refresh_hz < stats->refresh_hz) ? part.refresh_hz : stats->refresh_hz;
+    }
+    pthread_mutex_unlock(&mem->lock);
+
+    return ret;
+}
+
+/**[等待最早的一批完成并释放拷贝, 调用时持有 async 锁]*/
+static void lcd_st7789_stripe_retire(LCD_ST7789_STRIPE_MT *mem){
+    LCD_ST7789_STRIPE_FENCE *record;
+    LCD_ST7789_DRI *panel;
+    int i;
+
+    mem->retired++;
+    record = &mem->fences[mem->retired % LCD_ST7789_STRIPE_FENCES];
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = mem->panel[i].driver;
+        mem->error |= panel->wait(panel, record->fence[i]);
+    }
+    free(record->staging);
+    record->staging = NULL;
+}
+
+uint32_t lcd_st7789_stripe_submit_jobs(void *self, const LCD_ST7789_JOB *jobs, uint32_t count){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_STRIPE_FENCE *record;
+    LCD_ST7789_JOB split[LCD_ST7789_STRIPE_PANELS][LCD_ST7789_STRIPE_BATCH];
+    LCD_ST7789_DRI *panel;
+    const LCD_ST7789_JOB *job;
+    uint32_t n[LCD_ST7789_STRIPE_PANELS];
+    uint32_t copied = 0;
+    uint32_t linesize, width, lines, row;
+    int16_t base, l, r;
+    uint8_t *dst;
+    uint32_t i;
+    int p;
+
+    if(count > LCD_ST7789_STRIPE_BATCH){
+        fprintf(stderr, "LCD_ST7789 stripe submit: at most %d jobs\n", LCD_ST7789_STRIPE_BATCH);
+        return 0;
+    }
+    for(i = 0; i < count; i++){
+        job = &jobs[i];
+        if(job->left < 0 || job->top < 0 || job->left > job->right || job->top > job->bottom
+           || job->right >= LCD_ST7789_STRIPE_PANELS * LCD_ST7789_STRIPE_PANEL_WIDTH
+           || job->bottom >= LCD_ST7789_STRIPE_PANEL_HEIGHT
+           || job->size != (uint32_t)(job->right - job->left + 1) * (job->bottom - job->top + 1) * 2){
+            fprintf(stderr, "LCD_ST7789 stripe submit invalid job\n");
+            return 0;
+        }
+        // 跨接缝的任务两半都要拷贝成连续的行
+        if(job->left / LCD_ST7789_STRIPE_PANEL_WIDTH != job->right / LCD_ST7789_STRIPE_PANEL_WIDTH){
+            copied += job->size;
+        }
+    }
+
+    pthread_mutex_lock(&mem->async);
+    while(mem->submitted - mem->retired >= LCD_ST7789_STRIPE_FENCES - 1){
+        lcd_st7789_stripe_retire(mem);
+    }
+    mem->submitted++;
+    record = &mem->fences[mem->submitted % LCD_ST7789_STRIPE_FENCES];
+    record->staging = copied > 0 ? (uint8_t*)malloc(copied) : NULL;
+    dst = record->staging;
+
+    memset(n, 0, sizeof (n));
+    for(i = 0; i < count; i++){
+        job = &jobs[i];
+        linesize = (uint32_t)(job->right - job->left + 1) * 2;
+        lines = (uint32_t)(job->bottom - job->top + 1);
+        for(p = 0; p < LCD_ST7789_STRIPE_PANELS; p++){
+            base = p * LCD_ST7789_STRIPE_PANEL_WIDTH;
+            l = job->left > base ? job->left : base;
+            r = job->right < base + LCD_ST7789_STRIPE_PANEL_WIDTH - 1 ? job->right : base + LCD_ST7789_STRIPE_PANEL_WIDTH - 1;
+            if(l > r){
+                continue;
+            }
+            split[p][n[p]] = *job;
+            split[p][n[p]].left  = l - base;
+            split[p][n[p]].right = r - base;
+            if(l != job->left || r != job->right){
+                width = (uint32_t)(r - l + 1) * 2;
+                for(row = 0; row < lines; row++){
+                    memcpy(dst + row * width, job->data + row * linesize + (uint32_t)(l - job->left) * 2, width);
+                }
+                split[p][n[p]].data = dst;
+                split[p][n[p]].size = width * lines;
+                dst += width * lines;
+            }
+            n[p]++;
+        }
+    }
+
+    for(p = 0; p < LCD_ST7789_STRIPE_PANELS; p++){
+        record->fence[p] = 0;
+        if(n[p] > 0){
+            panel = mem->panel[p].driver;
+            if((record->fence[p] = panel->submit(panel, split[p], n[p])) == 0){
+                mem->error = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mem->async);
+
+    return mem->submitted;
+}
+
+int lcd_st7789_stripe_wait(void *self, uint32_t fence){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)self;
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    int ret;
+
+    pthread_mutex_lock(&mem->async);
+    while(fence != 0 && mem->retired != mem->submitted && (int32_t)(mem->retired - fence) < 0){
+        lcd_st7789_stripe_retire(mem);
+    }
+    ret = mem->error;
+    mem->error = 0;
+    pthread_mutex_unlock(&mem->async);
+
+    return ret != 0 ? -1 : 0;
+}
+
+int lcd_st7789_stripe_clean(void** self){
+    LCD_ST7789_DRI *drive = (LCD_ST7789_DRI*)(*self);
+    LCD_ST7789_STRIPE_MT *mem = (LCD_ST7789_STRIPE_MT*)drive->priv;
+    LCD_ST7789_STRIPE_PANEL *panel;
+    int i;
+
+    pthread_mutex_lock(&mem->lock);
+    while(mem->running && !lcd_st7789_stripe_idle(mem)){
+        pthread_cond_wait(&mem->cond, &mem->lock);
+    }
+    mem->running = 0;
+    pthread_cond_broadcast(&mem->cond);
+    pthread_mutex_unlock(&mem->lock);
+
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        panel = &mem->panel[i];
+        if(panel->started){
+            pthread_join(panel->thread, NULL);
+        }
+        if(panel->driver != NULL){
+            panel->driver->clean((void**)&panel->driver);
+        }
+        free(panel->staging);
+    }
+
+    // 面板的 clean 已经写完剩余任务, 这里只释放拷贝
+    for(i = 0; i < LCD_ST7789_STRIPE_FENCES; i++){
+        free(mem->fences[i].staging);
+    }
+
+    pthread_mutex_destroy(&mem->async);
+    pthread_cond_destroy(&mem->cond);
+    pthread_mutex_destroy(&mem->lock);
+    free(mem->buffer[0]);
+    free(mem->buffer[1]);
+    free(mem);
+    free(drive);
+
+    *self = NULL;
+
+    return 0;
+}
+
+
+LCD_ST7789_DRI* lcd_st7789_init_stripe(LCD_ST7789_DRI *left, LCD_ST7789_DRI *right){
+    LCD_ST7789_DRI *drive = NULL;
+    LCD_ST7789_STRIPE_MT *mem = NULL;
+    int i;
+
+    drive = (LCD_ST7789_DRI*)malloc(sizeof (LCD_ST7789_DRI));
+    memset(drive, 0, sizeof (LCD_ST7789_DRI));
+
+    mem = (LCD_ST7789_STRIPE_MT*)malloc(sizeof (LCD_ST7789_STRIPE_MT));
+    memset(mem, 0, sizeof (LCD_ST7789_STRIPE_MT));
+    pthread_mutex_init(&mem->lock, NULL);
+    pthread_cond_init(&mem->cond, NULL);
+    pthread_mutex_init(&mem->async, NULL);
+    mem->panel[0].driver = left;
+    mem->panel[1].driver = right;
+    for(i = 0; i < LCD_ST7789_STRIPE_PANELS; i++){
+        mem->panel[i].parent = mem;
+    }
+
+    drive->priv   = mem;
+    drive->config = &lcd_st7789_stripe_config;
+    drive->rotate = &lcd_st7789_stripe_rotate;
+    drive->scroll_area = &lcd_st7789_stripe_scroll_area;
+    drive->scroll = &lcd_st7789_stripe_scroll;
+    drive->vsync  = &lcd_st7789_stripe_vsync;
+    drive->refresh = &lcd_st7789_stripe_refresh;
+    drive->color  = &lcd_st7789_stripe_color;
+    drive->startup = &lcd_st7789_stripe_startup;
+    drive->output = &lcd_st7789_stripe_output;
+    drive->output_image = &lcd_st7789_stripe_output_image;
+    drive->clean  = &lcd_st7789_stripe_clean;
+    drive->calibrate = &lcd_st7789_stripe_calibrate;
+    drive->stats  = &lcd_st7789_stripe_stats;
+    drive->submit = &lcd_st7789_stripe_submit_jobs;
+    drive->wait   = &lcd_st7789_stripe_wait;
+    drive->begin_frame = &lcd_st7789_stripe_begin_frame;
+    drive->commit = &lcd_st7789_stripe_commit;
+
+    return drive;
+}
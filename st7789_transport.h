@@ -0,0 +1,97 @@
+#ifndef LCD_ST7789_TRANSPORT_H
+#define LCD_ST7789_TRANSPORT_H
+
+#include <stdint.h>
+
+#include "st7789.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define LCD_ST7789_GPIO_SPI_PIN_RES   24
+#define LCD_ST7789_GPIO_SPI_PIN_DC    25
+#define LCD_ST7789_GPIO_SPI_PIN_TE    27
+
+// SPI1 面板使用独立的 RES/DC, 可以和 SPI0 面板同时工作
+#define LCD_ST7789_GPIO_SPI1_PIN_RES  22
+#define LCD_ST7789_GPIO_SPI1_PIN_DC   23
+#define LCD_ST7789_GPIO_SPI1_PIN_TE   26
+
+#define LCD_ST7789_SPEED_HZ           31250000  // 默认写时钟
+#define LCD_ST7789_READ_SPEED_HZ      4000000   // 读时钟, 面板读周期最短约150ns
+
+
+/**
+ * 面板总线抽象: 命令/数据写入, RES引脚, 事务提交.
+ * command/data 可以缓存在传输层内部, flush 时必须全部发出并释放CS.
+ * read 先发出缓存的写入, 以读时钟发送命令后读回 size 个原始字节 (包含面板的 dummy 周期),
+ * 不支持读回的总线返回 -1. speed 设置之后写入使用的时钟. stats 返回累计计数.
+ * vsync 等待 TE 引脚的下一个上升沿 (面板进入 vblank), 第一次调用时配置引脚;
+ * period_us 为面板的名义刷新周期, 用来预测边沿, 0 表示未知. 没有 TE 引脚或 timeout_us 内没有等到时返回 -1.
+ */
+typedef struct{
+    int (*open)(void* self);
+    int (*reset)(void* self, uint8_t level);
+    int (*command)(void* self, uint8_t cmd);
+    int (*data)(void* self, const uint8_t* data, uint32_t size);
+    int (*flush)(void* self);
+    int (*read)(void* self, uint8_t cmd, uint8_t* data, uint32_t size);
+    int (*speed)(void* self, uint32_t hz);
+    int (*vsync)(void* self, uint32_t period_us, uint32_t timeout_us);
+    int (*stats)(void* self, LCD_ST7789_STATS* stats);
+    int (*close)(void** self);
+    void *priv;
+} LCD_ST7789_TRANSPORT;
+
+
+/**[FRCTRL2 (0xC6) RTNA 0x00-0x1F 对应的刷新率 (Hz), 默认 porch 下的数据手册值]*/
+#define LCD_ST7789_FRCTRL2_DEFAULT    0x0F   // 60Hz
+extern const uint8_t lcd_st7789_frame_rates[32];
+
+
+/**
+ * 传输层共用的事务计数. 事务开始时记下时间和轮询计数, 结束时累加差值.
+ */
+typedef struct{
+    LCD_ST7789_STATS total;
+    uint8_t active;         // 事务进行中
+    uint64_t start_us;
+    uint64_t fifo_spins;    // 事务开始时总线的轮询计数
+    uint64_t done_spins;
+} LCD_ST7789_COUNTERS;
+
+void lcd_st7789_counters_begin(LCD_ST7789_COUNTERS *counters, uint64_t now_us, uint64_t fifo_spins, uint64_t done_spins);
+void lcd_st7789_counters_end(LCD_ST7789_COUNTERS *counters, uint64_t now_us, uint64_t fifo_spins, uint64_t done_spins);
+
+
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_bcm2835(uint8_t flags);
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_spidev(const char *device, const char *gpiochip, uint8_t flags);
+LCD_ST7789_TRANSPORT* lcd_st7789_transport_emulator(const char *snapshot);
+
+/**[模拟面板: 结束当前帧 / 读取状态, transport 不是模拟面板时返回 -1]*/
+int lcd_st7789_transport_emulator_frame(LCD_ST7789_TRANSPORT *transport);
+int lcd_st7789_transport_emulator_panel(LCD_ST7789_TRANSPORT *transport, LCD_ST7789_PANEL *panel);
+int lcd_st7789_transport_emulator_corrupt(LCD_ST7789_TRANSPORT *transport, uint32_t hz);
+
+
+/**
+ * 3线 9bit 编码: 每个字节前加 D/C 位, 8个字节打包成9个字节 (高位先发).
+ * size 必须是 8 的倍数, 返回输出字节数.
+ */
+uint32_t lcd_st7789_lossi_pack(const uint8_t *data, uint32_t size, uint8_t dc, uint8_t *out);
+
+/**
+ * 打包任意个 9bit 字 (bit8 为 D/C), 末尾不足一字节的位补0.
+ * 返回输出字节数.
+ */
+uint32_t lcd_st7789_lossi_pack_words(const uint16_t *words, uint32_t count, uint8_t *out);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // LCD_ST7789_TRANSPORT_H
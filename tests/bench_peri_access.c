@@ -0,0 +1,131 @@
+/* bench_peri_access.c
+// CPU cost of bcm2835_spi_writenb() per byte and of bcm2835_gpio_set() per call
+// in the two builds of bcm2835.c: the default one, with the debug branch in
+// every register access and full barriers (before), and the BCM2835_NO_DEBUG
+// one, with inline accessors and only the datasheet barriers (after).
+//
+// The same source is linked against each build of the library. The register
+// blocks are plain memory, with SPI0 CS reading DONE, so writenb never waits on
+// the wire and only the CPU side of every access is timed. Run without
+// arguments it prints its own figures; given the path of the other build's
+// executable, it runs that too and prints both side by side.
+//
+// Host timings are only indicative of the ARM core, where barriers and
+// uncached peripheral accesses cost much more.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bcm2835.h"
+#include "check.h"
+
+#define BENCH_BYTES     4096
+#define BENCH_CALLS     4096
+#define BENCH_LOOPS     200
+#define BENCH_RUNS      7
+
+/* Memory standing in for the SPI0 and GPIO register blocks */
+static uint32_t spi0_regs[BCM2835_BLOCK_SIZE / 4];
+static uint32_t gpio_regs[BCM2835_BLOCK_SIZE / 4];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Best of BENCH_RUNS: the least disturbed run is the closest to the CPU cost */
+static double writenb_ns(void)
+{
+    static char buf[BENCH_BYTES];
+    double best = 0.0, t;
+    int run, loop;
+
+    for (loop = 0; loop < BENCH_BYTES; loop++)
+	buf[loop] = (char)(loop * 37);
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+	t = now_ns();
+	for (loop = 0; loop < BENCH_LOOPS; loop++)
+	    bcm2835_spi_writenb(buf, BENCH_BYTES);
+	t = (now_ns() - t) / ((double)BENCH_LOOPS * BENCH_BYTES);
+	if (run == 0 || t < best)
+	    best = t;
+    }
+    return best;
+}
+
+static double gpio_set_ns(void)
+{
+    double best = 0.0, t;
+    int run, loop, i;
+
+    for (run = 0; run < BENCH_RUNS; run++)
+    {
+	t = now_ns();
+	for (loop = 0; loop < BENCH_LOOPS; loop++)
+	    for (i = 0; i < BENCH_CALLS; i++)
+		bcm2835_gpio_set(RPI_V2_GPIO_P1_22);
+	t = (now_ns() - t) / ((double)BENCH_LOOPS * BENCH_CALLS);
+	if (run == 0 || t < best)
+	    best = t;
+    }
+    return best;
+}
+
+/* Figures of the other build, from its output */
+static int run_other(const char* path, char* build, double* writenb, double* gpio_set)
+{
+    FILE* fp = popen(path, "r");
+    int ok;
+
+    if (fp == NULL)
+	return 0;
+    ok = fscanf(fp, "%15s writenb %lf gpio_set %lf", build, writenb, gpio_set) == 3;
+    return pclose(fp) == 0 && ok;
+}
+
+int main(int argc, char** argv)
+{
+#ifdef BCM2835_NO_DEBUG
+    const char* build = "no_debug";
+#else
+    const char* build = "debug";
+#endif
+    double writenb, gpio_set, other_writenb, other_gpio_set;
+    char other[16];
+
+    bcm2835_spi0 = spi0_regs;
+    bcm2835_gpio = gpio_regs;
+    spi0_regs[BCM2835_SPI0_CS / 4] = BCM2835_SPI0_CS_DONE;
+
+    writenb = writenb_ns();
+    gpio_set = gpio_set_ns();
+
+    /* Both builds leave the same register contents */
+    CHECK_EQ(spi0_regs[BCM2835_SPI0_FIFO / 4], (uint8_t)((BENCH_BYTES - 1) * 37));
+    CHECK_EQ(spi0_regs[BCM2835_SPI0_CS / 4] & BCM2835_SPI0_CS_TA, 0);
+    CHECK_EQ(gpio_regs[BCM2835_GPSET0 / 4], 1u << RPI_V2_GPIO_P1_22);
+
+    if (argc < 2)
+    {
+	printf("%s writenb %.3f gpio_set %.3f\n", build, writenb, gpio_set);
+	return CHECK_RESULT;
+    }
+
+    if (!run_other(argv[1], other, &other_writenb, &other_gpio_set))
+    {
+	CHECK(!"the other build did not run");
+	return CHECK_RESULT;
+    }
+    printf("host ns per byte or call:\n");
+    printf("%-26s %9s %9s\n", "", other, build);
+    printf("%-26s %9.3f %9.3f\n", "bcm2835_spi_writenb/byte", other_writenb, writenb);
+    printf("%-26s %9.3f %9.3f\n", "bcm2835_gpio_set/call", other_gpio_set, gpio_set);
+
+    return CHECK_RESULT;
+}
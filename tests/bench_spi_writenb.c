@@ -0,0 +1,122 @@
+/* bench_spi_writenb.c
+// Register accesses per transmitted byte of bcm2835_spi_writenb(), against the
+// per-byte polled loop it replaced, on the bcm2835_sim register model.
+//
+// Both writers send the same buffer through the simulated SPI0; the simulator
+// counts CPU register reads, writes and barriers and the simulated time, so the
+// numbers do not depend on the host. Fails if the burst writer is not clearly
+// cheaper than the old loop, or if a byte goes missing.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bcm2835.h"
+#include "bcm2835_sim.h"
+#include "check.h"
+
+#define BENCH_BYTES  4096
+
+/* bcm2835_spi_writenb() as it was before the burst writer: wait for TXD with a
+// barrier read, write one byte, drain RX with barrier reads, for every byte.
+*/
+static void writenb_polled(const char* tbuf, uint32_t len)
+{
+    volatile uint32_t* paddr = bcm2835_spi0 + BCM2835_SPI0_CS/4;
+    volatile uint32_t* fifo = bcm2835_spi0 + BCM2835_SPI0_FIFO/4;
+    uint32_t i;
+
+    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_CLEAR, BCM2835_SPI0_CS_CLEAR);
+    bcm2835_peri_set_bits(paddr, BCM2835_SPI0_CS_TA, BCM2835_SPI0_CS_TA);
+
+    for (i = 0; i < len; i++)
+    {
+	while (!(bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_TXD))
+	    ;
+	bcm2835_peri_write_nb(fifo, (uint8_t)tbuf[i]);
+	while (bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_RXD)
+	    (void) bcm2835_peri_read_nb(fifo);
+    }
+
+    while (!(bcm2835_peri_read_nb(paddr) & BCM2835_SPI0_CS_DONE)) {
+	while (bcm2835_peri_read(paddr) & BCM2835_SPI0_CS_RXD)
+	    (void) bcm2835_peri_read_nb(fifo);
+    };
+
+    bcm2835_peri_set_bits(paddr, 0, BCM2835_SPI0_CS_TA);
+}
+
+typedef struct
+{
+    double reads;
+    double writes;
+    double barriers;
+    double ns;
+    double busy;
+} bench_result;
+
+static bench_result run(void (*writer)(const char*, uint32_t), const char* buf, uint32_t len)
+{
+    bcm2835SimStats before, after;
+    bench_result r;
+
+    bcm2835_sim_stats(&before);
+    writer(buf, len);
+    bcm2835_sim_stats(&after);
+
+    CHECK_EQ(after.spi0.bytes - before.spi0.bytes, len);
+    r.reads    = (double)(after.reads - before.reads) / len;
+    r.writes   = (double)(after.writes - before.writes) / len;
+    r.barriers = (double)(after.barriers - before.barriers) / len;
+    r.ns       = (double)(after.elapsed_ns - before.elapsed_ns) / len;
+    r.busy     = 100.0 * (after.spi0.busy_ns - before.spi0.busy_ns) / (after.elapsed_ns - before.elapsed_ns);
+    return r;
+}
+
+static void print(const char* name, const bench_result* r)
+{
+    printf("%-22s %6.2f %6.2f %6.2f %8.2f %8.1f %6.1f%%\n", name,
+	   r->reads, r->writes, r->reads + r->writes, r->barriers, r->ns, r->busy);
+}
+
+int main(void)
+{
+    static char buf[BENCH_BYTES];
+    bench_result polled, burst, burst_lsb;
+    uint32_t i;
+
+    for (i = 0; i < BENCH_BYTES; i++)
+	buf[i] = (char)(i * 37);
+
+    if (!bcm2835_sim_begin(NULL))
+	return 77;
+    CHECK(bcm2835_init());
+    CHECK(bcm2835_spi_begin());
+    bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_8);
+
+    polled = run(writenb_polled, buf, BENCH_BYTES);
+    burst = run(bcm2835_spi_writenb, buf, BENCH_BYTES);
+    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_LSBFIRST);
+    burst_lsb = run(bcm2835_spi_writenb, buf, BENCH_BYTES);
+    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+
+    printf("bcm2835_spi_writenb, %u bytes at 31.25 MHz, per byte:\n", BENCH_BYTES);
+    printf("%-22s %6s %6s %6s %8s %8s %7s\n", "", "reads", "writes", "total", "barriers", "ns", "wire");
+    print("polled (before)", &polled);
+    print("burst", &burst);
+    print("burst, LSB first", &burst_lsb);
+
+    /* One FIFO write and one FIFO read per byte are unavoidable, the status polls
+    // and the barriers are what the burst writer removes
+    */
+    CHECK(burst.reads + burst.writes < polled.reads + polled.writes - 1.5);
+    CHECK(burst.barriers < 0.01);
+    CHECK(burst.ns < polled.ns / 2);
+    CHECK(burst_lsb.reads + burst_lsb.writes < polled.reads + polled.writes - 1.5);
+
+    bcm2835_spi_end();
+    bcm2835_close();
+    bcm2835_sim_end();
+
+    return CHECK_RESULT;
+}
@@ -0,0 +1,177 @@
+/* fake_spidev.c
+// Fake spidev and gpiochip behind the wrapped open/close/ioctl/fopen, see fake_spidev.h
+*/
+
+#include "fake_spidev.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#define FAKE_FD_BASE    900
+#define FAKE_FD_MAX     32
+#define FAKE_BUFSIZ_FILE "/sys/module/spidev/parameters/bufsiz"
+
+int __real_open(const char* path, int flags, ...);
+int __real_close(int fd);
+int __real_ioctl(int fd, unsigned long request, ...);
+FILE* __real_fopen(const char* path, const char* mode);
+
+fake_spidev_state fake_spidev;
+
+static uint8_t fake_fds[FAKE_FD_MAX];
+static char fake_bufsiz[32];
+
+void fake_spidev_reset(uint32_t bufsiz)
+{
+    fake_spidev.bufsiz = bufsiz;
+    fake_spidev.fail_ioctl = 0;
+    fake_spidev.fail_open = NULL;
+    fake_spidev.count = 0;
+    fake_spidev.messages = 0;
+    fake_spidev.max_len = 0;
+    fake_spidev.max_transfers = 0;
+}
+
+static int fake_fd(int fd)
+{
+    return fd >= FAKE_FD_BASE && fd < FAKE_FD_BASE + FAKE_FD_MAX && fake_fds[fd - FAKE_FD_BASE];
+}
+
+static int fake_new_fd(void)
+{
+    int i;
+
+    for (i = 0; i < FAKE_FD_MAX; i++)
+    {
+	if (!fake_fds[i])
+	{
+	    fake_fds[i] = 1;
+	    fake_spidev.open_fds++;
+	    return FAKE_FD_BASE + i;
+	}
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+int __wrap_open(const char* path, int flags, ...)
+{
+    va_list ap;
+    int mode;
+
+    if (strncmp(path, "/fake/", 6) == 0)
+    {
+	if (fake_spidev.fail_open != NULL && strcmp(path, fake_spidev.fail_open) == 0)
+	{
+	    errno = ENOENT;
+	    return -1;
+	}
+	return fake_new_fd();
+    }
+
+    va_start(ap, flags);
+    mode = va_arg(ap, int);
+    va_end(ap);
+    return __real_open(path, flags, mode);
+}
+
+int __wrap_close(int fd)
+{
+    if (fake_fd(fd))
+    {
+	fake_fds[fd - FAKE_FD_BASE] = 0;
+	fake_spidev.open_fds--;
+	return 0;
+    }
+    return __real_close(fd);
+}
+
+/* Records one SPI_IOC_MESSAGE: the bytes are copied now, from the caller's buffers */
+static int fake_message(const struct spi_ioc_transfer* transfers, uint32_t n)
+{
+    uint32_t len = 0;
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+	if (transfers[i].tx_buf != 0 && fake_spidev.count + transfers[i].len <= FAKE_SPIDEV_MAX_BYTES)
+	{
+	    memcpy(fake_spidev.bytes + fake_spidev.count, (const void*)(uintptr_t)transfers[i].tx_buf, transfers[i].len);
+	    memset(fake_spidev.dc + fake_spidev.count, fake_spidev.dc_level, transfers[i].len);
+	    fake_spidev.count += transfers[i].len;
+	}
+	if (transfers[i].rx_buf != 0)
+	    memset((void*)(uintptr_t)transfers[i].rx_buf, 0, transfers[i].len);
+	len += transfers[i].len;
+    }
+
+    fake_spidev.messages++;
+    if (len > fake_spidev.max_len)
+	fake_spidev.max_len = len;
+    if (n > fake_spidev.max_transfers)
+	fake_spidev.max_transfers = n;
+    return (int)len;
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...)
+{
+    va_list ap;
+    void* arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void*);
+    va_end(ap);
+
+    if (!fake_fd(fd))
+	return __real_ioctl(fd, request, arg);
+
+    if (fake_spidev.fail_ioctl != 0 && request == fake_spidev.fail_ioctl)
+    {
+	errno = EIO;
+	return -1;
+    }
+
+    if (_IOC_TYPE(request) == SPI_IOC_MAGIC && _IOC_NR(request) == 0 && _IOC_DIR(request) == _IOC_WRITE)
+	return fake_message((const struct spi_ioc_transfer*)arg, _IOC_SIZE(request) / sizeof (struct spi_ioc_transfer));
+
+    if (request == GPIO_GET_LINEHANDLE_IOCTL)
+    {
+	struct gpiohandle_request* line = (struct gpiohandle_request*)arg;
+	if ((line->fd = fake_new_fd()) < 0)
+	    return -1;
+	fake_spidev.lines = (uint8_t)line->lines;
+	fake_spidev.dc_level = line->lines == 2 ? line->default_values[0] : 0;
+	return 0;
+    }
+
+    if (request == GPIOHANDLE_SET_LINE_VALUES_IOCTL)
+    {
+	const struct gpiohandle_data* values = (const struct gpiohandle_data*)arg;
+	if (fake_spidev.lines == 2)
+	    fake_spidev.dc_level = values->values[0];
+	return 0;
+    }
+
+    /* Mode, word size and clock setup */
+    return 0;
+}
+
+FILE* __wrap_fopen(const char* path, const char* mode)
+{
+    if (strcmp(path, FAKE_BUFSIZ_FILE) == 0)
+    {
+	if (fake_spidev.bufsiz == 0)
+	{
+	    errno = ENOENT;
+	    return NULL;
+	}
+	snprintf(fake_bufsiz, sizeof (fake_bufsiz), "%u\n", fake_spidev.bufsiz);
+	return fmemopen(fake_bufsiz, strlen(fake_bufsiz), mode);
+    }
+    return __real_fopen(path, mode);
+}
@@ -0,0 +1,50 @@
+/* fake_spidev.h
+// A fake spidev and gpiochip for the spidev transport tests. The test is linked
+// with -Wl,--wrap=open,--wrap=close,--wrap=ioctl,--wrap=fopen; paths under
+// /fake/ get fake descriptors, everything else goes to the real calls.
+//
+// Every SPI_IOC_MESSAGE copies the transmitted bytes out of the caller's
+// buffers at submit time, together with the DC line level of the moment, so a
+// buffer that was freed or reused before the submit shows up as wrong data.
+*/
+
+#ifndef TESTS_FAKE_SPIDEV_H
+#define TESTS_FAKE_SPIDEV_H
+
+#include <stdint.h>
+
+#define FAKE_SPIDEV_DEVICE      "/fake/spidev0.0"
+#define FAKE_SPIDEV_GPIOCHIP    "/fake/gpiochip0"
+#define FAKE_SPIDEV_MAX_BYTES   (1 << 20)
+
+typedef struct
+{
+    /* Configuration: spidev bufsiz parameter (0: the file is missing), an ioctl
+    // request to fail, and a path whose open fails
+    */
+    uint32_t bufsiz;
+    unsigned long fail_ioctl;
+    const char* fail_open;
+
+    /* Transmitted bytes with the DC level they were sent with */
+    uint8_t bytes[FAKE_SPIDEV_MAX_BYTES];
+    uint8_t dc[FAKE_SPIDEV_MAX_BYTES];
+    uint32_t count;
+
+    /* SPI_IOC_MESSAGE calls, their largest size and transfer count */
+    uint32_t messages;
+    uint32_t max_len;
+    uint32_t max_transfers;
+
+    /* Open fake descriptors, and the DC line level */
+    int open_fds;
+    uint8_t lines;
+    uint8_t dc_level;
+} fake_spidev_state;
+
+extern fake_spidev_state fake_spidev;
+
+/* Clears the recording and the failures, sets the bufsiz parameter */
+void fake_spidev_reset(uint32_t bufsiz);
+
+#endif
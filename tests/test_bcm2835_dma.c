@@ -0,0 +1,221 @@
+/* test_bcm2835_dma.c
+// Checks the SPI0 DMA control block chains built by bcm2835_spi_dma_start() and
+// the completion handling, on the debug mode DMA model.
+//
+// bcm2835.c is included so the test can walk the chains in the DMA buffer; the
+// register accesses go to a small SPI0 model installed with bcm2835_trace_set_model().
+*/
+
+#include "bcm2835.c"
+
+#include "check.h"
+
+#define FRAME_BYTES     (240 * 320 * 2)
+#define FIFO_BUS        (BCM2835_PERI_BUS_BASE + BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO)
+#define MAX_WORDS       (FRAME_BYTES / 4 + 64)
+
+/* SPI0 as seen by the CPU: CS keeps what was written and always reports DONE,
+// every word the DMA engine pushes into the FIFO is recorded.
+*/
+static struct
+{
+    uint32_t cs;
+    uint32_t words[MAX_WORDS];
+    uint32_t count;
+} spi;
+
+static uint32_t model_read(void* self, uint32_t offset, uint32_t flags)
+{
+    (void)self;
+    (void)flags;
+    if (offset == BCM2835_SPI0_BASE + BCM2835_SPI0_CS)
+	return spi.cs | BCM2835_SPI0_CS_DONE | BCM2835_SPI0_CS_TXD;
+    return 0;
+}
+
+static void model_write(void* self, uint32_t offset, uint32_t value, uint32_t flags)
+{
+    (void)self;
+    if (offset == BCM2835_SPI0_BASE + BCM2835_SPI0_CS)
+	spi.cs = value & ~(BCM2835_SPI0_CS_CLEAR | BCM2835_SPI0_CS_DONE);
+    else if (offset == BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO && (flags & BCM2835_TRACE_DMA) && spi.count < MAX_WORDS)
+	spi.words[spi.count++] = value;
+}
+
+/* Walks both chains of the last bcm2835_spi_dma_start() and checks every block
+// against the chunking of len bytes of buf sent with chip select bits cs.
+*/
+static void check_chains(const uint8_t* buf, uint32_t len, uint32_t cs, int lsb_first)
+{
+    uint32_t tx = bcm2835_spi_dma_bus(bcm2835_spi_dma.virt);
+    uint32_t rx = bcm2835_spi_dma_bus((bcm2835DMAControlBlock*)bcm2835_spi_dma.virt + BCM2835_SPI_DMA_MAX_CBS);
+    uint32_t queued = 0;
+    uint32_t blocks = 0;
+    uint32_t n, i;
+
+    while (tx && rx)
+    {
+	bcm2835DMAControlBlock* tcb = (bcm2835DMAControlBlock*)bcm2835_spi_dma_virt(tx);
+	bcm2835DMAControlBlock* rcb = (bcm2835DMAControlBlock*)bcm2835_spi_dma_virt(rx);
+	const uint32_t* src = (const uint32_t*)bcm2835_spi_dma_virt(tcb->source_ad);
+	const uint8_t* data = (const uint8_t*)(src + 1);
+
+	n = MIN(len - queued, BCM2835_SPI_DMA_CHUNK);
+
+	/* Control blocks are 32 byte aligned */
+	CHECK((tx & 31) == 0);
+	CHECK((rx & 31) == 0);
+
+	/* TX: memory to the FIFO, paced by the SPI TX DREQ */
+	CHECK_EQ(tcb->ti & BCM2835_DMA_TI_PERMAP(0x1f), BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_TX));
+	CHECK(tcb->ti & BCM2835_DMA_TI_DEST_DREQ);
+	CHECK(tcb->ti & BCM2835_DMA_TI_SRC_INC);
+	CHECK(!(tcb->ti & BCM2835_DMA_TI_DEST_INC));
+	CHECK_EQ(tcb->dest_ad, FIFO_BUS);
+	CHECK_EQ(tcb->txfr_len, 4 + (n + 3) / 4 * 4);
+
+	/* Header word: DLEN in 31:16, CS bits with TA in 7:0 */
+	CHECK_EQ(src[0] >> 16, n);
+	CHECK_EQ(src[0] & 0xFF, cs | BCM2835_SPI0_CS_TA);
+	for (i = 0; i < n; i++)
+	{
+	    uint8_t expect = lsb_first ? bcm2835_byte_reverse_table[buf[queued + i]] : buf[queued + i];
+	    if (data[i] != expect)
+	    {
+		CHECK_EQ(data[i], expect);
+		break;
+	    }
+	}
+
+	/* RX: the FIFO to the dummy word, paced by the SPI RX DREQ, one word per data word */
+	CHECK_EQ(rcb->ti & BCM2835_DMA_TI_PERMAP(0x1f), BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_RX));
+	CHECK(rcb->ti & BCM2835_DMA_TI_SRC_DREQ);
+	CHECK(!(rcb->ti & BCM2835_DMA_TI_SRC_INC));
+	CHECK(!(rcb->ti & BCM2835_DMA_TI_DEST_INC));
+	CHECK_EQ(rcb->source_ad, FIFO_BUS);
+	CHECK_EQ(rcb->dest_ad, bcm2835_spi_dma_bus(bcm2835_spi_dma.virt + BCM2835_SPI_DMA_DUMMY));
+	CHECK_EQ(rcb->txfr_len, (n + 3) / 4 * 4);
+
+	queued += n;
+	blocks++;
+	tx = tcb->nextconbk;
+	rx = rcb->nextconbk;
+    }
+
+    /* Both chains end together after the last chunk */
+    CHECK_EQ(tx, 0);
+    CHECK_EQ(rx, 0);
+    CHECK_EQ(queued, len);
+    CHECK_EQ(blocks, (len + BCM2835_SPI_DMA_CHUNK - 1) / BCM2835_SPI_DMA_CHUNK);
+}
+
+/* The words the model pushed into the FIFO: a header, then the data, per chunk */
+static void check_fifo(const uint8_t* buf, uint32_t len)
+{
+    uint32_t queued = 0;
+    uint32_t w = 0;
+    uint32_t n, i;
+    uint8_t bytes[4];
+
+    while (queued < len && w < spi.count)
+    {
+	n = spi.words[w++] >> 16;
+	CHECK_EQ(n, MIN(len - queued, BCM2835_SPI_DMA_CHUNK));
+	for (i = 0; i < n; i += 4)
+	{
+	    memcpy(bytes, &spi.words[w++], 4);
+	    if (memcmp(bytes, buf + queued + i, MIN(n - i, 4)) != 0)
+	    {
+		CHECK(!"FIFO data differs from the buffer");
+		return;
+	    }
+	}
+	queued += n;
+    }
+    CHECK_EQ(queued, len);
+    CHECK_EQ(w, spi.count);
+}
+
+int main(void)
+{
+    static uint8_t frame[FRAME_BYTES];
+    bcm2835PeriModel model = { model_read, model_write, NULL };
+    bcm2835DMAControlBlock* tx_cbs;
+    bcm2835DMAControlBlock* rx_cbs;
+    uint32_t i;
+
+    for (i = 0; i < FRAME_BYTES; i++)
+	frame[i] = (uint8_t)(i * 131 + (i >> 9));
+
+    bcm2835_set_debug(BCM2835_DEBUG_TRACE);
+    bcm2835_trace_set_model(&model);
+    CHECK(bcm2835_init());
+    CHECK(bcm2835_spi_begin());
+    bcm2835_spi_setDataMode(BCM2835_SPI_MODE3);
+    bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
+
+    /* Same TX and RX channel is refused */
+    CHECK(!bcm2835_spi_dma_begin(5, 5));
+    CHECK(bcm2835_spi_dma_begin(4, 5));
+    tx_cbs = (bcm2835DMAControlBlock*)bcm2835_spi_dma.virt;
+    rx_cbs = tx_cbs + BCM2835_SPI_DMA_MAX_CBS;
+
+    /* A full RGB565 frame: three chunks, the last one partial */
+    spi.count = 0;
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, FRAME_BYTES), FRAME_BYTES);
+    check_chains(frame, FRAME_BYTES, BCM2835_SPI0_CS_CPOL | BCM2835_SPI0_CS_CPHA | 1, 0);
+    CHECK(bcm2835_spi_dma_wait());
+    check_fifo(frame, FRAME_BYTES);
+    /* wait hands SPI0 back to the CPU */
+    CHECK(!(spi.cs & (BCM2835_SPI0_CS_DMAEN | BCM2835_SPI0_CS_ADCS | BCM2835_SPI0_CS_TA)));
+
+    /* Lengths that are not a multiple of the word size, and a single byte */
+    spi.count = 0;
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, BCM2835_SPI_DMA_CHUNK + 3), BCM2835_SPI_DMA_CHUNK + 3);
+    check_chains(frame, BCM2835_SPI_DMA_CHUNK + 3, BCM2835_SPI0_CS_CPOL | BCM2835_SPI0_CS_CPHA | 1, 0);
+    CHECK(bcm2835_spi_dma_wait());
+    check_fifo(frame, BCM2835_SPI_DMA_CHUNK + 3);
+
+    spi.count = 0;
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame + 7, 1), 1);
+    check_chains(frame + 7, 1, BCM2835_SPI0_CS_CPOL | BCM2835_SPI0_CS_CPHA | 1, 0);
+    CHECK(bcm2835_spi_dma_wait());
+    check_fifo(frame + 7, 1);
+
+    /* Nothing to send */
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, 0), 0);
+
+    /* LSB first is bit reversed while copying into the DMA buffer */
+    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_LSBFIRST);
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, 1000), 1000);
+    check_chains(frame, 1000, BCM2835_SPI0_CS_CPOL | BCM2835_SPI0_CS_CPHA | 1, 1);
+    CHECK(bcm2835_spi_dma_wait());
+    bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+
+    /* The model rejects broken chains and wait reports the failure */
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, 4096), 4096);
+    rx_cbs[0].ti = BCM2835_DMA_TI_PERMAP(BCM2835_DMA_DREQ_SPI_TX) | BCM2835_DMA_TI_SRC_DREQ;
+    CHECK(!bcm2835_spi_dma_model(bcm2835_spi_dma_bus(tx_cbs), bcm2835_spi_dma_bus(rx_cbs)));
+
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, 4096), 4096);
+    tx_cbs[0].ti &= ~BCM2835_DMA_TI_DEST_DREQ;
+    CHECK(!bcm2835_spi_dma_model(bcm2835_spi_dma_bus(tx_cbs), bcm2835_spi_dma_bus(rx_cbs)));
+
+    CHECK_EQ(bcm2835_spi_dma_start((const char*)frame, 4096), 4096);
+    rx_cbs[0].txfr_len -= 4;
+    CHECK(!bcm2835_spi_dma_model(bcm2835_spi_dma_bus(tx_cbs), bcm2835_spi_dma_bus(rx_cbs)));
+
+    /* A header without TA is not a valid transfer */
+    *(uint32_t*)bcm2835_spi_dma_virt(tx_cbs[0].source_ad) &= ~BCM2835_SPI0_CS_TA;
+    rx_cbs[0].txfr_len += 4;
+    CHECK(!bcm2835_spi_dma_model(bcm2835_spi_dma_bus(tx_cbs), bcm2835_spi_dma_bus(rx_cbs)));
+    bcm2835_spi_dma.error = 1;
+    CHECK(!bcm2835_spi_dma_wait());
+
+    bcm2835_spi_dma_end();
+    bcm2835_spi_end();
+    bcm2835_close();
+    bcm2835_trace_set_model(NULL);
+
+    return CHECK_RESULT;
+}
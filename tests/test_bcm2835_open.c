@@ -0,0 +1,75 @@
+/* test_bcm2835_open.c
+// The bcm2835 transports share one bcm2835_init() mapping: every transport holds
+// one reference while it is open, however many times config() reopens it, an
+// open() that fails gives its reference back, and the mapping is closed with
+// the last open transport. Runs on the simulator, bcm2835_init/bcm2835_close
+// are counted through -Wl,--wrap.
+*/
+
+#include "st7789.h"
+#include "st7789_transport.h"
+#include "bcm2835.h"
+#include "bcm2835_sim.h"
+#include "check.h"
+
+static int inits;
+static int closes;
+
+int __real_bcm2835_init(void);
+int __real_bcm2835_close(void);
+
+int __wrap_bcm2835_init(void)
+{
+    inits++;
+    return __real_bcm2835_init();
+}
+
+int __wrap_bcm2835_close(void)
+{
+    closes++;
+    return __real_bcm2835_close();
+}
+
+int main(void)
+{
+    LCD_ST7789_TRANSPORT* spi0;
+    LCD_ST7789_TRANSPORT* spi1;
+
+    if (!bcm2835_sim_begin(NULL))
+	return 77;
+
+    /* Reopening keeps the one reference; a second transport shares the mapping */
+    spi0 = lcd_st7789_transport_bcm2835(0);
+    spi1 = lcd_st7789_transport_bcm2835(LCD_ST7789_FLAG_SPI1);
+    CHECK_EQ(spi0->open(spi0), 0);
+    CHECK_EQ(spi0->open(spi0), 0);
+    CHECK_EQ(spi0->open(spi0), 0);
+    CHECK_EQ(spi1->open(spi1), 0);
+    CHECK_EQ(spi1->open(spi1), 0);
+    CHECK_EQ(inits, 1);
+    CHECK_EQ(spi0->close((void**)&spi0), 0);
+    CHECK_EQ(closes, 0);
+    CHECK_EQ(spi1->close((void**)&spi1), 0);
+    CHECK_EQ(closes, 1);
+
+    /* 3-wire is refused on SPI1 after the mapping was taken: it is released */
+    spi1 = lcd_st7789_transport_bcm2835(LCD_ST7789_FLAG_SPI1 | LCD_ST7789_FLAG_3WIRE);
+    CHECK_EQ(spi1->open(spi1), -1);
+    CHECK_EQ(inits, 2);
+    CHECK_EQ(closes, 2);
+    CHECK_EQ(spi1->close((void**)&spi1), 0);
+    CHECK_EQ(closes, 2);
+
+    /* A transport that never opened does not release the mapping of another */
+    spi0 = lcd_st7789_transport_bcm2835(0);
+    spi1 = lcd_st7789_transport_bcm2835(LCD_ST7789_FLAG_SPI1);
+    CHECK_EQ(spi0->open(spi0), 0);
+    CHECK_EQ(inits, 3);
+    CHECK_EQ(spi1->close((void**)&spi1), 0);
+    CHECK_EQ(closes, 2);
+    CHECK_EQ(spi0->close((void**)&spi0), 0);
+    CHECK_EQ(closes, 3);
+
+    bcm2835_sim_end();
+    return CHECK_RESULT;
+}
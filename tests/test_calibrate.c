@@ -0,0 +1,146 @@
+/* test_calibrate.c
+// SPI write clock calibration against emulated panels that write pixels wrong
+// above a given clock: calibrate must settle on the fastest candidate clock at
+// or below that limit, save it, report it in the stats, and use the saved
+// clock on the next start.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "st7789.h"
+#include "check.h"
+
+#define CLOCK_FILE      "test_calibrate.clock"
+
+/* The candidate clocks of lcd_st7789_calibrate */
+#define HZ_20M          20833333
+#define HZ_25M          25000000
+#define HZ_31M          31250000
+#define HZ_125M         125000000
+
+static uint32_t saved_clock(const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    uint32_t hz = 0;
+
+    if (fp == NULL)
+	return 0;
+    if (fscanf(fp, "%u", &hz) != 1)
+	hz = 0;
+    fclose(fp);
+    return hz;
+}
+
+/* After calibration a full frame reaches the GRAM intact */
+static void check_frame(LCD_ST7789_DRI* lcd)
+{
+    static uint8_t frame[240 * 320 * 2];
+    LCD_ST7789_PANEL panel;
+    uint16_t p;
+    uint32_t i;
+
+    for (i = 0; i < 240 * 320; i++)
+    {
+	p = (uint16_t)(i * 2654435761u >> 16);
+	frame[i * 2] = (uint8_t)(p >> 8);
+	frame[i * 2 + 1] = (uint8_t)p;
+    }
+    CHECK_EQ(lcd->output(lcd, frame, sizeof (frame), 0), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    for (i = 0; i < 240 * 320; i++)
+    {
+	p = (uint16_t)(frame[i * 2] << 8 | frame[i * 2 + 1]);
+	if (panel.gram[i * 3] >> 3 != p >> 11 || panel.gram[i * 3 + 1] >> 2 != ((p >> 5) & 0x3F)
+	    || panel.gram[i * 3 + 2] >> 3 != (p & 0x1F))
+	{
+	    fprintf(stderr, "pixel %u written wrong after calibration\n", i);
+	    CHECK(!"frame corrupted at the calibrated clock");
+	    return;
+	}
+    }
+}
+
+/* One panel that corrupts above limit_hz: the calibrated clock is expect_hz */
+static void calibrate(uint32_t limit_hz, uint32_t expect_hz)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_STATS stats;
+
+    unlink(CLOCK_FILE);
+    CHECK_EQ(lcd_st7789_emulator_corrupt(lcd, limit_hz), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, 239, 319), 0);
+    CHECK_EQ(lcd->calibrate(lcd, CLOCK_FILE), 0);
+    CHECK_EQ(saved_clock(CLOCK_FILE), expect_hz);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.speed_hz, expect_hz);
+    check_frame(lcd);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+}
+
+int main(void)
+{
+    LCD_ST7789_DRI* lcd;
+    LCD_ST7789_DRI* stripe;
+    LCD_ST7789_DRI* left;
+    LCD_ST7789_DRI* right;
+    LCD_ST7789_STATS stats;
+
+    /* Limits between, on and above the candidates; no limit reaches the fastest */
+    calibrate(30000000, HZ_25M);
+    calibrate(HZ_31M, HZ_31M);
+    calibrate(HZ_31M - 1, HZ_25M);
+    calibrate(0, HZ_125M);
+
+    /* Nothing verifies: calibrate fails, saves nothing, and the default clock
+    // is kept (the panel would still be wrong at it, so no frame check)
+    */
+    unlink(CLOCK_FILE);
+    lcd = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd_st7789_emulator_corrupt(lcd, 10000000), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, 239, 319), 0);
+    CHECK_EQ(lcd->calibrate(lcd, CLOCK_FILE), -1);
+    CHECK(access(CLOCK_FILE, F_OK) != 0);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.speed_hz, HZ_31M);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    /* A saved clock is used without calibrating again: a slow saved clock works
+    // on a panel that fails every candidate above it
+    */
+    calibrate(HZ_20M + 1, HZ_20M);
+    lcd = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd_st7789_emulator_corrupt(lcd, HZ_20M + 1), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, 239, 319), 0);
+    CHECK_EQ(lcd->calibrate(lcd, CLOCK_FILE), 0);
+    CHECK_EQ(saved_clock(CLOCK_FILE), HZ_20M);
+    check_frame(lcd);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    unlink(CLOCK_FILE);
+
+    /* The stripe calibrates each bus on its own */
+    left = lcd_st7789_init_emulator(NULL);
+    right = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd_st7789_emulator_corrupt(left, 40000000), 0);
+    CHECK_EQ(lcd_st7789_emulator_corrupt(right, 21000000), 0);
+    stripe = lcd_st7789_init_stripe(left, right);
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 319), 0);
+    CHECK_EQ(stripe->calibrate(stripe, CLOCK_FILE), 0);
+    CHECK_EQ(saved_clock(CLOCK_FILE ".0"), HZ_31M);
+    CHECK_EQ(saved_clock(CLOCK_FILE ".1"), HZ_20M);
+    CHECK_EQ(stripe->stats(stripe, &stats), 0);
+    CHECK_EQ(stats.speed_hz, HZ_20M);
+    CHECK_EQ(stripe->clean((void**)&stripe), 0);
+    unlink(CLOCK_FILE ".0");
+    unlink(CLOCK_FILE ".1");
+
+    /* Only the emulator has a clock limit */
+    lcd = lcd_st7789_init_stripe(lcd_st7789_init_emulator(NULL), lcd_st7789_init_emulator(NULL));
+    CHECK_EQ(lcd_st7789_emulator_corrupt(lcd, HZ_25M), -1);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    return CHECK_RESULT;
+}
@@ -0,0 +1,266 @@
+/* test_color.c
+// RGB444 output with ordered dithering, on the emulator, checked pixel by pixel
+// against an independent model of the dither in panel coordinates:
+//  - a window with an odd pixel count, padded with its first pixel;
+//  - dirty updates of rectangles that do not line up with the tiles, in a
+//    window at an offset that does not line up with the 4x4 matrix;
+//  - a frame that ends in a partial row;
+//  - AUTO moving to RGB444 when the bus cannot keep up and back to RGB565
+//    on near-static content.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "st7789.h"
+#include "check.h"
+
+#define PANEL_WIDTH     240
+#define PANEL_HEIGHT    320
+
+#define MODE_565        1
+#define MODE_444        2
+#define MODE_EITHER     (MODE_565 | MODE_444)
+
+/* The frame sent, and what the window should show, both RGB565 big endian */
+static uint8_t frame[PANEL_WIDTH * PANEL_HEIGHT * 2];
+static uint8_t shown[PANEL_WIDTH * PANEL_HEIGHT * 2];
+static uint32_t seed = 1;
+
+static uint16_t random16(void)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (uint16_t)(seed >> 8);
+}
+
+/* 4x4 Bayer thresholds, by panel row and column */
+static const uint8_t bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+/* The 4 bit level of component c of range 0..max at threshold b: the largest
+// q with q <= c * 15 / max + (2b + 1) / 32
+*/
+static uint8_t level(uint32_t c, uint32_t max, uint32_t b)
+{
+    uint8_t q = 0;
+
+    while (q < 15 && (q + 1) * 32 * max <= c * 15 * 32 + (2 * b + 1) * max)
+	q++;
+    return q;
+}
+
+/* A 4 bit level as the panel stores it: 6 bits, left aligned */
+static uint8_t stored4(uint8_t q)
+{
+    return (uint8_t)((q << 2 | q >> 2) << 2);
+}
+
+/* A 5 bit level stored in 6 bits, the low bit copying the top one */
+static uint8_t stored5(uint8_t c)
+{
+    return (uint8_t)((c << 1 | c >> 4) << 2);
+}
+
+static int matches(const uint8_t* cell, uint16_t p, uint32_t x, uint32_t y, int modes)
+{
+    uint32_t b = bayer[y & 3][x & 3];
+
+    if ((modes & MODE_444) && cell[0] == stored4(level(p >> 11, 31, b))
+	&& cell[1] == stored4(level((p >> 5) & 0x3F, 63, b)) && cell[2] == stored4(level(p & 0x1F, 31, b)))
+	return 1;
+    if ((modes & MODE_565) && cell[0] == stored5((uint8_t)(p >> 11))
+	&& cell[1] == (uint8_t)(((p >> 5) & 0x3F) << 2) && cell[2] == stored5((uint8_t)(p & 0x1F)))
+	return 1;
+    return 0;
+}
+
+/* The window left..right x top..bottom against shown, the rest of the panel black */
+static void check_gram(LCD_ST7789_DRI* lcd, uint32_t left, uint32_t top, uint32_t right, uint32_t bottom, int modes)
+{
+    static const uint8_t black[3] = { 0, 0, 0 };
+    LCD_ST7789_PANEL panel;
+    const uint8_t* cell;
+    uint32_t width = right - left + 1;
+    uint32_t x, y, i;
+    uint16_t p;
+
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    for (y = 0; y < PANEL_HEIGHT; y++)
+	for (x = 0; x < PANEL_WIDTH; x++)
+	{
+	    cell = panel.gram + (y * PANEL_WIDTH + x) * 3;
+	    if (x < left || x > right || y < top || y > bottom)
+	    {
+		if (memcmp(cell, black, 3) != 0)
+		{
+		    fprintf(stderr, "pixel %u,%u outside the window was written\n", x, y);
+		    CHECK(!"GRAM outside the window");
+		    return;
+		}
+		continue;
+	    }
+	    i = ((y - top) * width + x - left) * 2;
+	    p = (uint16_t)(shown[i] << 8 | shown[i + 1]);
+	    if (!matches(cell, p, x, y, modes))
+	    {
+		fprintf(stderr, "pixel %u,%u: %02x %02x %02x for %04x\n", x, y, cell[0], cell[1], cell[2], p);
+		CHECK(!"GRAM differs from the dither model");
+		return;
+	    }
+	}
+}
+
+/* Random content in the rectangle x..x+w-1 x y..y+h-1 of a frame width pixels wide */
+static void paint(uint32_t width, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    uint32_t i, j, k;
+    uint16_t p;
+
+    for (j = y; j < y + h; j++)
+	for (i = x; i < x + w; i++)
+	{
+	    p = random16();
+	    k = (j * width + i) * 2;
+	    frame[k] = (uint8_t)(p >> 8);
+	    frame[k + 1] = (uint8_t)p;
+	}
+}
+
+/* 7 x 9 = 63 pixels: the packed stream ends in half a pair, completed with the
+// window's first pixel, which the panel rewrites with the same value
+*/
+static void test_odd_window(void)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_PANEL panel;
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB444), 0);
+    CHECK_EQ(lcd->config(lcd, 3, 5, 9, 13), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+
+    paint(7, 0, 0, 7, 9);
+    CHECK_EQ(lcd->output_image(lcd, frame, 7 * 2, 7, 9), 0);
+    memcpy(shown, frame, 7 * 9 * 2);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(panel.colmod & 0x07, 0x03);
+    CHECK_EQ(panel.frame_pixels, 64);
+    CHECK_EQ(panel.frame_rewrites, 1);
+    check_gram(lcd, 3, 5, 9, 13, MODE_444);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+}
+
+/* Rectangles of any size and position change between frames; only they are
+// sent, and they dither as the same pixels did in the full frame
+*/
+static void test_dirty(void)
+{
+    const uint32_t left = 5, top = 3, right = 234, bottom = 316;
+    const uint32_t width = right - left + 1, height = bottom - top + 1;
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_PANEL panel;
+    LCD_ST7789_STATS stats;
+    uint32_t k, x, y, w, h, rows, tail;
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB444), 0);
+    CHECK_EQ(lcd->config(lcd, (int16_t)left, (int16_t)top, (int16_t)right, (int16_t)bottom), 0);
+
+    paint(width, 0, 0, width, height);
+    CHECK_EQ(lcd->output_image(lcd, frame, width * 2, (uint16_t)width, (uint16_t)height), 0);
+    memcpy(shown, frame, width * height * 2);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    check_gram(lcd, left, top, right, bottom, MODE_444);
+
+    for (k = 0; k < 8; k++)
+    {
+	w = random16() % 40 + 1;
+	h = random16() % 40 + 1;
+	x = random16() % (width - w + 1);
+	y = random16() % (height - h + 1);
+	paint(width, x, y, w, h);
+	CHECK_EQ(lcd->output_image(lcd, frame, width * 2, (uint16_t)width, (uint16_t)height), 0);
+	memcpy(shown, frame, width * height * 2);
+	CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+	CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+	CHECK(panel.frame_pixels < width * height / 4);
+	check_gram(lcd, left, top, right, bottom, MODE_444);
+    }
+
+    /* A frame that stops 7 pixels into a row: everything changes, the whole
+    // rows and the 7 pixels are written when the next frame starts, the rest
+    // of that row and the rows below keep the previous frame
+    */
+    rows = height / 2;
+    tail = 7;
+    paint(width, 0, 0, width, height);
+    CHECK_EQ(lcd->output(lcd, frame, (rows * width + tail) * 2, 0), 0);
+    memcpy(shown, frame, (rows * width + tail) * 2);
+    CHECK_EQ(lcd->output(lcd, frame, 2, 0), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    check_gram(lcd, left, top, right, bottom, MODE_444);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.reduced_frames, 10);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+}
+
+/* AUTO: full new frames back to back need more bus time than the frame
+// interval, so it moves to RGB444; one changed tile every 20 ms brings it back
+*/
+static void test_auto(void)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_PANEL panel;
+    LCD_ST7789_STATS stats;
+    uint32_t k;
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_AUTO), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1), 0);
+
+    for (k = 0; k < 20; k++)
+    {
+	paint(PANEL_WIDTH, 0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+	CHECK_EQ(lcd->output_image(lcd, frame, PANEL_WIDTH * 2, PANEL_WIDTH, PANEL_HEIGHT), 0);
+	memcpy(shown, frame, sizeof (shown));
+	CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+	CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+	/* Every pixel changed, so all of them went out in this frame's format */
+	check_gram(lcd, 0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1, (panel.colmod & 0x07) == 0x03 ? MODE_444 : MODE_565);
+	if ((panel.colmod & 0x07) == 0x03)
+	    break;
+    }
+    CHECK_EQ(panel.colmod & 0x07, 0x03);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.reduced_frames, 1);
+
+    for (k = 0; k < 60; k++)
+    {
+	usleep(20000);
+	paint(PANEL_WIDTH, (k % 15) * 16, 16, 16, 16);
+	CHECK_EQ(lcd->output_image(lcd, frame, PANEL_WIDTH * 2, PANEL_WIDTH, PANEL_HEIGHT), 0);
+	memcpy(shown, frame, sizeof (shown));
+	CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+	CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+	if ((panel.colmod & 0x07) == 0x05)
+	    break;
+    }
+    CHECK_EQ(panel.colmod & 0x07, 0x05);
+    /* Tiles from either phase keep the format they were last sent in */
+    check_gram(lcd, 0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1, MODE_EITHER);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+}
+
+int main(void)
+{
+    test_odd_window();
+    test_dirty();
+    test_auto();
+    return CHECK_RESULT;
+}
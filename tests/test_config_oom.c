@@ -0,0 +1,79 @@
+/* test_config_oom.c
+// config() with each of its buffer allocations failing in turn, on the emulator:
+// config returns -1, the driver is left unconfigured so every output path
+// refuses, and a later config works. malloc and calloc are wrapped through
+// -Wl,--wrap; only the allocations made inside config can fail.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "st7789.h"
+#include "check.h"
+
+/* config allocates the frame, the RGB444 packing buffer, two begin_frame
+// buffers and the tile hashes and flags, in that order
+*/
+#define CONFIG_ALLOCATIONS  6
+
+static int armed;
+static int allocations;
+static int fail_at;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    if (armed && ++allocations == fail_at)
+	return NULL;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+    if (armed && ++allocations == fail_at)
+	return NULL;
+    return __real_calloc(count, size);
+}
+
+static int config(LCD_ST7789_DRI* lcd, int fail)
+{
+    int ret;
+
+    allocations = 0;
+    fail_at = fail;
+    armed = 1;
+    ret = lcd->config(lcd, 0, 0, 99, 49);
+    armed = 0;
+    return ret;
+}
+
+int main(void)
+{
+    static uint8_t frame[100 * 50 * 2];
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    int fail;
+
+    CHECK_EQ(config(lcd, 0), 0);
+    CHECK_EQ(lcd->output_image(lcd, frame, 200, 100, 50), 0);
+
+    for (fail = 1; fail <= CONFIG_ALLOCATIONS; fail++)
+    {
+	CHECK_EQ(config(lcd, fail), -1);
+	CHECK(allocations >= fail);
+	CHECK_EQ(lcd->output(lcd, frame, sizeof (frame), 0), -1);
+	CHECK_EQ(lcd->output_image(lcd, frame, 200, 100, 50), -1);
+	CHECK(lcd->begin_frame(lcd) == NULL);
+	CHECK_EQ(lcd->scroll_area(lcd, 0, 10), -1);
+
+	CHECK_EQ(config(lcd, 0), 0);
+	memset(frame, fail, sizeof (frame));
+	CHECK_EQ(lcd->output_image(lcd, frame, 200, 100, 50), 0);
+	CHECK(lcd->begin_frame(lcd) != NULL);
+	CHECK_EQ(lcd->commit(lcd), 0);
+    }
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    return CHECK_RESULT;
+}
@@ -0,0 +1,126 @@
+/* test_lossi.c
+// The 3-wire 9-bit LoSSI encoders against known vectors and a bit by bit
+// reference: D/C in bit 8 of every word, MSB first, 8 words in 9 bytes, and
+// the zero padding of a partial tail.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "st7789_transport.h"
+#include "check.h"
+
+#define CHECK_BYTES(out, expect, n) \
+    do { \
+        if (memcmp((out), (expect), (n)) != 0) \
+            CHECK(!"packed bytes differ from " #expect); \
+    } while (0)
+
+/* Reference encoder: appends the 9 bits of every word one by one */
+static uint32_t reference(const uint16_t* words, uint32_t count, uint8_t* out)
+{
+    uint32_t bit = 0;
+    uint32_t i;
+    int b;
+
+    for (i = 0; i < count; i++)
+    {
+	for (b = 8; b >= 0; b--, bit++)
+	{
+	    if (bit % 8 == 0)
+		out[bit / 8] = 0;
+	    if (words[i] & (1u << b))
+		out[bit / 8] |= 0x80 >> (bit % 8);
+	}
+    }
+    return (bit + 7) / 8;
+}
+
+static void test_vectors(void)
+{
+    static const uint8_t zeros[8] = { 0 };
+    static const uint8_t ones[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+    static const uint8_t data_zeros[9] = { 0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00 };
+    static const uint8_t cmd_ones[9] = { 0x7F, 0xBF, 0xDF, 0xEF, 0xF7, 0xFB, 0xFD, 0xFE, 0xFF };
+    static const uint8_t caset[9] = { 0x15, 0x40, 0x20, 0x10, 0x19, 0xF8, 0x00, 0x00, 0x00 };
+    static const uint16_t one_word[1] = { 0x12C };
+    static const uint8_t one_word_packed[2] = { 0x96, 0x00 };
+    static const uint16_t three_words[3] = { 0x02A, 0x100, 0x1FF };
+    static const uint8_t three_words_packed[4] = { 0x15, 0x40, 0x3F, 0xE0 };
+    uint16_t words[8];
+    uint8_t out[16];
+
+    /* Data words: only the D/C bit of every word is set */
+    CHECK_EQ(lcd_st7789_lossi_pack(zeros, 8, 1, out), 9);
+    CHECK_BYTES(out, data_zeros, 9);
+
+    /* Command words: every bit but D/C is set */
+    CHECK_EQ(lcd_st7789_lossi_pack(ones, 8, 0, out), 9);
+    CHECK_BYTES(out, cmd_ones, 9);
+
+    /* CASET 0..319: the command, its four parameters and three NOPs */
+    words[0] = 0x02A; words[1] = 0x100; words[2] = 0x100; words[3] = 0x101;
+    words[4] = 0x13F; words[5] = 0x000; words[6] = 0x000; words[7] = 0x000;
+    CHECK_EQ(lcd_st7789_lossi_pack_words(words, 8, out), 9);
+    CHECK_BYTES(out, caset, 9);
+
+    /* Partial tails are padded with zero bits to a whole byte */
+    CHECK_EQ(lcd_st7789_lossi_pack_words(one_word, 1, out), 2);
+    CHECK_BYTES(out, one_word_packed, 2);
+    CHECK_EQ(lcd_st7789_lossi_pack_words(three_words, 3, out), 4);
+    CHECK_BYTES(out, three_words_packed, 4);
+    CHECK_EQ(lcd_st7789_lossi_pack_words(three_words, 0, out), 0);
+}
+
+static void test_alignment(void)
+{
+    uint8_t data[8 * 64 + 7];
+    uint16_t words[sizeof (data)];
+    uint8_t out[sizeof (data) * 2];
+    uint8_t expect[sizeof (data) * 2];
+    uint32_t size, i, n;
+    uint8_t dc;
+
+    for (i = 0; i < sizeof (data); i++)
+	data[i] = (uint8_t)(i * 151 + 7);
+
+    for (dc = 0; dc < 2; dc++)
+    {
+	for (i = 0; i < sizeof (data); i++)
+	    words[i] = (uint16_t)((dc ? 0x100 : 0) | data[i]);
+
+	/* Whole groups: both encoders agree with the reference, 9 bytes per 8 words */
+	for (size = 8; size <= 8 * 64; size += 8)
+	{
+	    n = reference(words, size, expect);
+	    CHECK_EQ(n, size / 8 * 9);
+	    CHECK_EQ(lcd_st7789_lossi_pack(data, size, dc, out), n);
+	    CHECK_BYTES(out, expect, n);
+	    CHECK_EQ(lcd_st7789_lossi_pack_words(words, size, out), n);
+	    CHECK_BYTES(out, expect, n);
+	}
+
+	/* Any count of words, including the ones that end inside a byte */
+	for (size = 1; size < 40; size++)
+	{
+	    n = reference(words, size, expect);
+	    CHECK_EQ(n, (size * 9 + 7) / 8);
+	    CHECK_EQ(lcd_st7789_lossi_pack_words(words, size, out), n);
+	    CHECK_BYTES(out, expect, n);
+	}
+
+	/* The byte encoder only takes whole groups and leaves the rest untouched */
+	memset(out, 0xA5, sizeof (out));
+	CHECK_EQ(lcd_st7789_lossi_pack(data, 8 * 64 + 7, dc, out), 64 * 9);
+	CHECK_EQ(out[64 * 9], 0xA5);
+	CHECK_EQ(lcd_st7789_lossi_pack(data, 7, dc, out), 0);
+    }
+}
+
+int main(void)
+{
+    test_vectors();
+    test_alignment();
+
+    return CHECK_RESULT;
+}
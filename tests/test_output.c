@@ -0,0 +1,107 @@
+/* test_output.c
+// lcd_st7789 output() with frames shorter than the window, on the fake spidev:
+// a partial frame goes out when the next frame starts and, for the last one,
+// when the driver is cleaned, never later and never lost. An invalid window
+// leaves the bus closed, and nothing scrolls before a config.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "st7789.h"
+#include "fake_spidev.h"
+#include "check.h"
+
+#define WIDTH           240
+#define HEIGHT          320
+#define ROWS            (HEIGHT - 2)
+
+static void fill(uint8_t* frame, uint32_t size, uint32_t seed)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; i++)
+	frame[i] = (uint8_t)((i + seed) * 2654435761u >> 24) | 0x01;
+}
+
+/* Pixel bytes sent since the last call */
+static uint32_t sent(void)
+{
+    uint32_t n = 0;
+    uint32_t i;
+
+    for (i = 0; i < fake_spidev.count; i++)
+	n += fake_spidev.dc[i];
+    fake_spidev.count = 0;
+    return n;
+}
+
+int main(void)
+{
+    uint32_t size = WIDTH * ROWS * 2;
+    uint8_t* frame = (uint8_t*)malloc(WIDTH * HEIGHT * 2);
+    LCD_ST7789_DRI* lcd;
+
+    /* RGB565 only, so every changed pixel costs two bytes */
+    fake_spidev_reset(4096);
+    lcd = lcd_st7789_init_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, 0);
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, WIDTH - 1, HEIGHT - 1), 0);
+    sent();
+
+    /* The first partial frame is held until the frame is known to be complete */
+    fill(frame, size, 1);
+    CHECK_EQ(lcd->output(lcd, frame, size, 0), 0);
+    CHECK_EQ(sent(), 0);
+
+    /* Starting the next frame sends it */
+    fill(frame, size, 2);
+    CHECK_EQ(lcd->output(lcd, frame, size, 0), 0);
+    CHECK(sent() >= size);
+
+    /* A full window goes out at once, after the pending partial frame */
+    fill(frame, WIDTH * HEIGHT * 2, 3);
+    CHECK_EQ(lcd->output(lcd, frame, WIDTH * HEIGHT * 2, 0), 0);
+    CHECK(sent() >= size + WIDTH * HEIGHT * 2 / 2);
+
+    /* The last partial frame is sent by clean */
+    fill(frame, size, 4);
+    CHECK_EQ(lcd->output(lcd, frame, size, 0), 0);
+    CHECK_EQ(sent(), 0);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    CHECK(sent() >= size);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+
+    /* Nothing pending: clean sends no pixels */
+    lcd = lcd_st7789_init_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, WIDTH - 1, HEIGHT - 1), 0);
+    fill(frame, WIDTH * HEIGHT * 2, 5);
+    CHECK_EQ(lcd->output(lcd, frame, WIDTH * HEIGHT * 2, 0), 0);
+    sent();
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    CHECK_EQ(sent(), 0);
+
+    /* Scrolling needs a config like every other output path, also on the
+    // emulator, which takes commands on a bus that was never opened
+    */
+    lcd = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd->scroll_area(lcd, 0, HEIGHT), -1);
+    CHECK_EQ(lcd->scroll(lcd, 1, frame), -1);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    /* An invalid window is refused before the bus is opened */
+    lcd = lcd_st7789_init_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, 0);
+    CHECK_EQ(lcd->scroll_area(lcd, 0, HEIGHT), -1);
+    CHECK_EQ(lcd->config(lcd, 0, 0, WIDTH, HEIGHT - 1), -1);
+    CHECK_EQ(lcd->config(lcd, 10, 0, 9, HEIGHT - 1), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, WIDTH - 1, HEIGHT - 1), 0);
+    CHECK_EQ(fake_spidev.open_fds, 2);
+    CHECK_EQ(lcd->scroll_area(lcd, 0, HEIGHT), 0);
+    CHECK_EQ(lcd->scroll(lcd, 1, frame), 0);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+
+    free(frame);
+    return CHECK_RESULT;
+}
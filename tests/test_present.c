@@ -0,0 +1,265 @@
+/* test_present.c
+// Changed-tile detection and window planning on the emulator: frames that differ
+// from the previous one in chosen 16x16 tiles reach the GRAM exactly, in the
+// expected number of windows, with no pixel written twice, and the bytes sent
+// and saved against a full frame add up to what the panel received.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "st7789.h"
+#include "check.h"
+
+#define WIDTH           240
+#define HEIGHT          320
+#define TILE            16
+#define COLUMNS         (WIDTH / TILE)
+#define BANDS           (HEIGHT / TILE)
+#define WINDOW_BYTES    11      /* CASET, RASET and RAMWR with their parameters */
+#define EDGE_WIDTH      (WIDTH - TILE + 1)      /* the last tile column is one pixel wide */
+#define EDGE_HEIGHT     (HEIGHT - 2 * TILE + 1) /* the last band is a single row */
+
+static uint8_t frame[WIDTH * HEIGHT * 2];
+static uint8_t dirty[BANDS][COLUMNS];
+static uint32_t serial;
+static uint32_t width = WIDTH;      /* columns of the configured window */
+static uint32_t height = HEIGHT;    /* rows of the configured window */
+
+#define FULL_BYTES      (width * height * 2 + WINDOW_BYTES)
+
+static void set_pixel(uint32_t x, uint32_t y, uint16_t p)
+{
+    frame[(y * WIDTH + x) * 2] = (uint8_t)(p >> 8);
+    frame[(y * WIDTH + x) * 2 + 1] = (uint8_t)p;
+}
+
+/* New content in every tile marked in dirty, the rest unchanged */
+static void change_tiles(void)
+{
+    uint32_t tx, ty, x, y;
+
+    serial++;
+    for (ty = 0; ty < BANDS; ty++)
+	for (tx = 0; tx < COLUMNS; tx++)
+	    if (dirty[ty][tx])
+		for (y = ty * TILE; y < (ty + 1) * TILE && y < height; y++)
+		    for (x = tx * TILE; x < (tx + 1) * TILE && x < width; x++)
+			set_pixel(x, y, (uint16_t)((x * 7 + y * 131 + serial * 977) | 0x0821));
+}
+
+static void check_gram(LCD_ST7789_DRI* lcd)
+{
+    LCD_ST7789_PANEL panel;
+    const uint8_t* cell;
+    uint16_t p;
+    uint32_t i, x, y;
+
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    for (y = 0; y < height; y++)
+	for (x = 0; x < width; x++)
+	{
+	    i = y * WIDTH + x;
+	    p = (uint16_t)(frame[i * 2] << 8 | frame[i * 2 + 1]);
+	    cell = panel.gram + i * 3;
+	    if (cell[0] >> 3 != p >> 11 || cell[1] >> 2 != ((p >> 5) & 0x3F) || cell[2] >> 3 != (p & 0x1F))
+	    {
+		fprintf(stderr, "frame %u: pixel %u,%u differs\n", serial, x, y);
+		CHECK(!"GRAM differs from the frame");
+		return;
+	    }
+	}
+}
+
+/* Sends the frame and returns the number of windows it took; pixels is the
+// number of pixels written, checked against the tiles when expect_pixels is set
+*/
+static uint32_t present(LCD_ST7789_DRI* lcd, uint32_t expect_windows, uint32_t expect_pixels)
+{
+    LCD_ST7789_STATS before, after;
+    LCD_ST7789_PANEL panel;
+    uint32_t windows;
+
+    change_tiles();
+    CHECK_EQ(lcd->stats(lcd, &before), 0);
+    CHECK_EQ(lcd->output_image(lcd, frame, WIDTH * 2, width, height), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd->stats(lcd, &after), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    check_gram(lcd);
+
+    /* Three commands per window, COLMOD stays RGB565 */
+    CHECK_EQ(panel.frame_commands % 3, 0);
+    windows = panel.frame_commands / 3;
+    if (expect_windows > 0)
+	CHECK_EQ(windows, expect_windows);
+    if (expect_pixels > 0)
+	CHECK_EQ(panel.frame_pixels, expect_pixels);
+    /* Windows never overlap: no pixel is sent twice */
+    CHECK_EQ(panel.frame_rewrites, 0);
+
+    /* What was sent is what the panel received, the rest is saved */
+    CHECK_EQ(after.last_bytes, panel.frame_pixels * 2 + windows * WINDOW_BYTES);
+    CHECK_EQ(after.last_saved, FULL_BYTES - after.last_bytes);
+    CHECK_EQ(after.saved_bytes - before.saved_bytes, after.last_saved);
+    CHECK_EQ(after.frames, before.frames + 1);
+    return windows;
+}
+
+/* First frame after a config: everything differs from what the panel holds */
+static void first_frame(LCD_ST7789_DRI* lcd)
+{
+    CHECK_EQ(lcd->config(lcd, 0, 0, width - 1, height - 1), 0);
+    memset(dirty, 1, sizeof (dirty));
+    change_tiles();
+    CHECK_EQ(lcd->output_image(lcd, frame, WIDTH * 2, width, height), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    check_gram(lcd);
+}
+
+static void mark(uint32_t left, uint32_t top, uint32_t right, uint32_t bottom)
+{
+    uint32_t x, y;
+
+    for (y = top; y <= bottom; y++)
+	for (x = left; x <= right; x++)
+	    dirty[y][x] = 1;
+}
+
+static void test_maps(LCD_ST7789_DRI* lcd)
+{
+    uint32_t x, y;
+
+    /* One tile: one window of one tile, nearly all of the frame is saved */
+    memset(dirty, 0, sizeof (dirty));
+    mark(3, 4, 3, 4);
+    present(lcd, 1, TILE * TILE);
+
+    /* Opposite corners stay two windows */
+    memset(dirty, 0, sizeof (dirty));
+    mark(0, 0, 0, 0);
+    mark(COLUMNS - 1, BANDS - 1, COLUMNS - 1, BANDS - 1);
+    present(lcd, 2, 2 * TILE * TILE);
+
+    /* A block grows down band by band into one window */
+    memset(dirty, 0, sizeof (dirty));
+    mark(5, 5, 7, 7);
+    present(lcd, 1, 9 * TILE * TILE);
+
+    /* A full height column */
+    memset(dirty, 0, sizeof (dirty));
+    mark(7, 0, 7, BANDS - 1);
+    present(lcd, 1, BANDS * TILE * TILE);
+
+    /* A clean tile between two changed ones costs more than a second window */
+    memset(dirty, 0, sizeof (dirty));
+    mark(2, 2, 2, 2);
+    mark(4, 2, 4, 2);
+    present(lcd, 2, 2 * TILE * TILE);
+
+    /* Staircase: each step only partly under the one above, none of them
+    // extends, and no tile is sent twice
+    */
+    memset(dirty, 0, sizeof (dirty));
+    mark(0, 0, 3, 0);
+    mark(2, 1, 5, 1);
+    mark(4, 2, 7, 2);
+    present(lcd, 3, 12 * TILE * TILE);
+
+    /* A narrower row under a window: extending would send clean tiles */
+    memset(dirty, 0, sizeof (dirty));
+    mark(2, 3, 6, 3);
+    mark(3, 4, 5, 4);
+    present(lcd, 2, 8 * TILE * TILE);
+
+    /* Checkerboard: every changed tile on its own, still cheaper than a full frame */
+    memset(dirty, 0, sizeof (dirty));
+    for (y = 0; y < BANDS; y++)
+	for (x = 0; x < COLUMNS; x++)
+	    dirty[y][x] = (x + y) % 2 == 0;
+    present(lcd, COLUMNS * BANDS / 2, COLUMNS * BANDS / 2 * TILE * TILE);
+
+    /* One clean tile: skipping it is still cheaper than a full window, in four
+    // windows (above, left and right of it, below)
+    */
+    memset(dirty, 1, sizeof (dirty));
+    dirty[10][3] = 0;
+    present(lcd, 4, WIDTH * HEIGHT - TILE * TILE);
+
+    /* A clean tile in every band: still cheaper to skip them, two windows per
+    // band, one in the four bands where the clean tile is at the edge
+    */
+    memset(dirty, 1, sizeof (dirty));
+    for (y = 0; y < BANDS; y++)
+	dirty[y][(y * 7) % COLUMNS] = 0;
+    present(lcd, 2 * BANDS - 4, WIDTH * HEIGHT - BANDS * TILE * TILE);
+
+    /* Nothing changed: nothing sent, the whole frame saved */
+    memset(dirty, 0, sizeof (dirty));
+    present(lcd, 0, 0);
+}
+
+/* Random maps: exact GRAM, consistent byte counts, never more than a full frame */
+static void test_random(LCD_ST7789_DRI* lcd)
+{
+    LCD_ST7789_STATS stats;
+    uint32_t seed = 12345;
+    uint32_t k, x, y, density;
+
+    for (k = 0; k < 40; k++)
+    {
+	density = k % 8 + 1;
+	for (y = 0; y < BANDS; y++)
+	    for (x = 0; x < COLUMNS; x++)
+	    {
+		seed = seed * 1103515245u + 12345u;
+		dirty[y][x] = (seed >> 16) % 32 < density;
+	    }
+	present(lcd, 0, 0);
+	CHECK_EQ(lcd->stats(lcd, &stats), 0);
+	CHECK(stats.last_bytes <= FULL_BYTES);
+    }
+}
+
+/* A window whose last tile column is one pixel wide and whose last band is a
+// single row: a clean tile there costs less than a window, so the planner takes
+// clean tiles in, still without sending any pixel twice
+*/
+static void test_edges(LCD_ST7789_DRI* lcd)
+{
+    uint32_t seed = 777;
+    uint32_t k, x, y, density;
+
+    width = EDGE_WIDTH;
+    height = EDGE_HEIGHT;
+    first_frame(lcd);
+
+    for (k = 0; k < 100; k++)
+    {
+	density = k % 16 + 4;
+	for (y = 0; y < BANDS; y++)
+	    for (x = 0; x < COLUMNS; x++)
+	    {
+		seed = seed * 1103515245u + 12345u;
+		dirty[y][x] = (seed >> 16) % 32 < density;
+	    }
+	present(lcd, 0, 0);
+    }
+    width = WIDTH;
+    height = HEIGHT;
+}
+
+int main(void)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    first_frame(lcd);
+
+    test_maps(lcd);
+    test_random(lcd);
+    test_edges(lcd);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    return CHECK_RESULT;
+}
@@ -0,0 +1,71 @@
+/* test_refresh.c
+// lcd_st7789 refresh() on the emulator: the FRCTRL2 rate chosen for a content
+// frame rate is reported in the stats as refresh_hz and is what the panel
+// received, before and after config, and for a stripe of two panels. Choosing
+// it prints nothing; reporting it is up to the caller.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "st7789.h"
+#include "st7789_transport.h"
+#include "check.h"
+
+/* refresh() then the rate in the stats, which must be what the panel got */
+static uint32_t refresh(LCD_ST7789_DRI* lcd, uint32_t num, uint32_t den)
+{
+    LCD_ST7789_STATS stats;
+    LCD_ST7789_PANEL panel;
+
+    CHECK_EQ(lcd->refresh(lcd, num, den), 0);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(lcd_st7789_frame_rates[panel.frctrl2], stats.refresh_hz);
+    return stats.refresh_hz;
+}
+
+int main(void)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_DRI* stripe;
+    LCD_ST7789_STATS stats;
+    FILE* err = tmpfile();
+    int saved = dup(2);
+
+    /* The default rate until refresh is called */
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.refresh_hz, lcd_st7789_frame_rates[LCD_ST7789_FRCTRL2_DEFAULT]);
+
+    /* Before config the choice is only recorded, and sent with the init sequence */
+    CHECK_EQ(lcd->refresh(lcd, 25, 1), 0);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK_EQ(stats.refresh_hz, 50);
+    CHECK_EQ(lcd->config(lcd, 0, 0, 239, 319), 0);
+    CHECK_EQ(refresh(lcd, 25, 1), 50);
+
+    /* Nothing on stderr while choosing */
+    fflush(stderr);
+    dup2(fileno(err), 2);
+    CHECK_EQ(refresh(lcd, 24, 1), 48);
+    CHECK_EQ(refresh(lcd, 30, 1), 60);
+    CHECK_EQ(refresh(lcd, 30000, 1001), 60);
+    CHECK_EQ(refresh(lcd, 0, 1), 39);
+    fflush(stderr);
+    dup2(saved, 2);
+    CHECK_EQ(ftell(err), 0);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    /* A stripe reports the rate of its panels */
+    stripe = lcd_st7789_init_stripe(lcd_st7789_init_emulator(NULL), lcd_st7789_init_emulator(NULL));
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 319), 0);
+    CHECK_EQ(stripe->refresh(stripe, 24, 1), 0);
+    CHECK_EQ(stripe->stats(stripe, &stats), 0);
+    CHECK_EQ(stats.refresh_hz, 48);
+    CHECK_EQ(stripe->clean((void**)&stripe), 0);
+
+    fclose(err);
+    close(saved);
+    return CHECK_RESULT;
+}
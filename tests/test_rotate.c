@@ -0,0 +1,132 @@
+/* test_rotate.c
+// lcd_st7789 rotate() on the emulator: frames written in the 320x240 coordinates
+// of LCD_ST7789_ROTATE_90 leave the same GRAM as the same frames transposed
+// clockwise (ffmpeg transpose=clock) and written unrotated, for the full
+// display and for a window inside it, over full and changed-tile frames.
+// Rotating after config is refused and frames still land unrotated.
+*/
+
+#include <string.h>
+
+#include "st7789.h"
+#include "check.h"
+
+#define PANEL_WIDTH     240
+#define PANEL_HEIGHT    320
+#define GRAM_BYTES      (PANEL_WIDTH * PANEL_HEIGHT * 3)
+
+/* Frames in rotated coordinates and their clockwise transposition */
+static uint8_t rotated[PANEL_HEIGHT * PANEL_WIDTH * 2];
+static uint8_t transposed[PANEL_WIDTH * PANEL_HEIGHT * 2];
+
+static void fill(uint32_t width, uint32_t height, uint32_t seed, uint32_t changed)
+{
+    uint32_t x, y, i;
+
+    for (y = 0; y < height; y++)
+	for (x = 0; x < width; x++)
+	{
+	    /* Only a block in the middle changes after the first frame */
+	    if (changed && (x < width / 3 || x >= width / 2 || y < height / 4 || y >= height / 2))
+		continue;
+	    i = (y * width + x) * 2;
+	    rotated[i] = (uint8_t)((x * 13 + y * 7 + seed * 29) | 0x08);
+	    rotated[i + 1] = (uint8_t)((x * 3 + y * 41 + seed) | 0x21);
+	}
+}
+
+/* transpose=clock: output (x', y') is input (y', height - 1 - x') */
+static void transpose(uint32_t width, uint32_t height)
+{
+    uint32_t x, y, src, dst;
+
+    for (y = 0; y < width; y++)
+	for (x = 0; x < height; x++)
+	{
+	    src = ((height - 1 - x) * width + y) * 2;
+	    dst = (y * height + x) * 2;
+	    transposed[dst] = rotated[src];
+	    transposed[dst + 1] = rotated[src + 1];
+	}
+}
+
+static void compare(LCD_ST7789_DRI* lcd, LCD_ST7789_DRI* reference)
+{
+    LCD_ST7789_PANEL panel, expect;
+
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(reference), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(reference, &expect), 0);
+    CHECK_EQ(panel.madctl, 0x60);
+    CHECK_EQ(expect.madctl, 0x00);
+    CHECK(memcmp(panel.gram, expect.gram, GRAM_BYTES) == 0);
+}
+
+/* The rotated window left..right x top..bottom is, unrotated, columns
+// 239-bottom..239-top of rows left..right
+*/
+static void check_window(int16_t left, int16_t top, int16_t right, int16_t bottom)
+{
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_DRI* reference = lcd_st7789_init_emulator(NULL);
+    uint32_t width = right - left + 1, height = bottom - top + 1;
+    uint32_t seed;
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(reference->color(reference, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->rotate(lcd, LCD_ST7789_ROTATE_90), 0);
+    CHECK_EQ(lcd->config(lcd, left, top, right, bottom), 0);
+    CHECK_EQ(reference->config(reference, PANEL_WIDTH - 1 - bottom, left, PANEL_WIDTH - 1 - top, right), 0);
+
+    for (seed = 0; seed < 3; seed++)
+    {
+	fill(width, height, seed, seed > 0);
+	transpose(width, height);
+	CHECK_EQ(lcd->output_image(lcd, rotated, width * 2, width, height), 0);
+	CHECK_EQ(reference->output_image(reference, transposed, height * 2, height, width), 0);
+	compare(lcd, reference);
+    }
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    CHECK_EQ(reference->clean((void**)&reference), 0);
+}
+
+int main(void)
+{
+    LCD_ST7789_DRI* lcd;
+    LCD_ST7789_PANEL panel;
+    uint32_t i;
+    uint16_t p;
+
+    /* The whole display, and centred windows like the ones main.c sets up for scaled video */
+    check_window(0, 0, PANEL_HEIGHT - 1, PANEL_WIDTH - 1);
+    check_window(40, 0, 279, PANEL_WIDTH - 1);
+    check_window(17, 33, 250, 190);
+
+    /* After config the buffers are laid out for the old size: refused, and the
+    // frame still lands unrotated
+    */
+    lcd = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->rotate(lcd, 4), -1);
+    CHECK_EQ(lcd->config(lcd, 0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1), 0);
+    CHECK_EQ(lcd->rotate(lcd, LCD_ST7789_ROTATE_90), -1);
+    CHECK_EQ(lcd->rotate(lcd, LCD_ST7789_ROTATE_0), -1);
+    fill(PANEL_WIDTH, PANEL_HEIGHT, 5, 0);
+    CHECK_EQ(lcd->output_image(lcd, rotated, PANEL_WIDTH * 2, PANEL_WIDTH, PANEL_HEIGHT), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(panel.madctl, 0x00);
+    for (i = 0; i < PANEL_WIDTH * PANEL_HEIGHT; i++)
+    {
+	p = (uint16_t)(rotated[i * 2] << 8 | rotated[i * 2 + 1]);
+	if (panel.gram[i * 3] >> 3 != p >> 11 || panel.gram[i * 3 + 1] >> 2 != ((p >> 5) & 0x3F)
+	    || panel.gram[i * 3 + 2] >> 3 != (p & 0x1F))
+	    break;
+    }
+    CHECK_EQ(i, PANEL_WIDTH * PANEL_HEIGHT);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    return CHECK_RESULT;
+}
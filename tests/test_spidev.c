@@ -0,0 +1,280 @@
+/* test_spidev.c
+// The spidev transport on the fake spidev: message batching and bufsiz splitting,
+// DC grouping, buffer lifetime, the 3-wire 9-bit stream, and descriptors on the
+// open() error paths.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <linux/spi/spidev.h>
+
+#include "st7789.h"
+#include "st7789_transport.h"
+#include "fake_spidev.h"
+#include "check.h"
+
+/* What should reach the wire, byte by byte, with its DC level */
+static struct
+{
+    uint8_t bytes[FAKE_SPIDEV_MAX_BYTES];
+    uint8_t dc[FAKE_SPIDEV_MAX_BYTES];
+    uint32_t count;
+} expect;
+
+static void command(LCD_ST7789_TRANSPORT* transport, uint8_t cmd)
+{
+    CHECK_EQ(transport->command(transport, cmd), 0);
+    expect.bytes[expect.count] = cmd;
+    expect.dc[expect.count++] = 0;
+}
+
+static void data(LCD_ST7789_TRANSPORT* transport, const uint8_t* buf, uint32_t size)
+{
+    CHECK_EQ(transport->data(transport, buf, size), 0);
+    memcpy(expect.bytes + expect.count, buf, size);
+    memset(expect.dc + expect.count, 1, size);
+    expect.count += size;
+}
+
+static void check_wire(void)
+{
+    uint32_t i;
+
+    CHECK_EQ(fake_spidev.count, expect.count);
+    for (i = 0; i < expect.count && i < fake_spidev.count; i++)
+    {
+	if (fake_spidev.bytes[i] != expect.bytes[i] || fake_spidev.dc[i] != expect.dc[i])
+	{
+	    fprintf(stderr, "byte %u: sent %02x dc %u, expected %02x dc %u\n", i,
+		    fake_spidev.bytes[i], fake_spidev.dc[i], expect.bytes[i], expect.dc[i]);
+	    CHECK(!"wire differs");
+	    break;
+	}
+    }
+    CHECK(fake_spidev.max_transfers <= 64);
+    expect.count = 0;
+    fake_spidev.count = 0;
+}
+
+static LCD_ST7789_TRANSPORT* open_fake(uint8_t flags)
+{
+    LCD_ST7789_TRANSPORT* transport = lcd_st7789_transport_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, flags);
+    CHECK_EQ(transport->open(transport), 0);
+    return transport;
+}
+
+/* A window write with its parameters in a stack buffer that is reused right away */
+static void window(LCD_ST7789_TRANSPORT* transport, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    uint8_t param[4];
+
+    command(transport, 0x2A);
+    param[0] = x >> 8; param[1] = x & 0xFF; param[2] = (x + w - 1) >> 8; param[3] = (x + w - 1) & 0xFF;
+    data(transport, param, 4);
+    memset(param, 0xEE, sizeof (param));
+    command(transport, 0x2B);
+    param[0] = y >> 8; param[1] = y & 0xFF; param[2] = (y + h - 1) >> 8; param[3] = (y + h - 1) & 0xFF;
+    data(transport, param, 4);
+    memset(param, 0xEE, sizeof (param));
+    command(transport, 0x2C);
+}
+
+static void test_batching(void)
+{
+    LCD_ST7789_TRANSPORT* transport;
+    uint8_t small[16];
+    uint32_t i, j;
+
+    fake_spidev_reset(4096);
+    transport = open_fake(0);
+
+    /* Two hundred 16 byte writes from one reused buffer coalesce in the staging
+    // buffer, a handful of messages instead of one per write
+    */
+    window(transport, 0, 0, 8, 200);
+    fake_spidev.messages = 0;
+    for (i = 0; i < 200; i++)
+    {
+	for (j = 0; j < sizeof (small); j++)
+	    small[j] = (uint8_t)(i * 7 + j);
+	data(transport, small, sizeof (small));
+    }
+    CHECK_EQ(transport->flush(transport), 0);
+    CHECK(fake_spidev.messages <= 200 * sizeof (small) / 512 + 2);
+    check_wire();
+
+    CHECK_EQ(transport->close((void**)&transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+}
+
+static void test_lifetime(void)
+{
+    LCD_ST7789_TRANSPORT* transport;
+    uint8_t* frame;
+    uint32_t i;
+
+    fake_spidev_reset(4096);
+    transport = open_fake(0);
+
+    /* A large caller buffer is reused after data() returns, before the flush;
+    // commands and parameters come from the stack
+    */
+    frame = (uint8_t*)malloc(10000);
+    for (i = 0; i < 10000; i++)
+	frame[i] = (uint8_t)(i * 13 + (i >> 8));
+    window(transport, 10, 20, 50, 100);
+    data(transport, frame, 10000);
+    memset(frame, 0x55, 10000);
+    command(transport, 0x29);
+    CHECK_EQ(transport->flush(transport), 0);
+    CHECK(fake_spidev.max_len <= 4096);
+    check_wire();
+
+    /* Staging fills up in the middle of small writes */
+    for (i = 0; i < 100; i++)
+    {
+	command(transport, (uint8_t)(0x30 + i));
+	data(transport, frame + i, 60);
+    }
+    CHECK_EQ(transport->flush(transport), 0);
+    check_wire();
+
+    free(frame);
+    CHECK_EQ(transport->close((void**)&transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+}
+
+static void test_bufsiz(void)
+{
+    LCD_ST7789_TRANSPORT* transport;
+    uint8_t frame[1000];
+    uint32_t i;
+
+    /* A small spidev bufsiz splits writes, no message is ever larger */
+    fake_spidev_reset(100);
+    transport = open_fake(0);
+    for (i = 0; i < sizeof (frame); i++)
+	frame[i] = (uint8_t)(i * 3);
+    window(transport, 0, 0, 10, 50);
+    data(transport, frame, sizeof (frame));
+    data(transport, frame + 1, 90);
+    data(transport, frame + 2, 30);
+    CHECK_EQ(transport->flush(transport), 0);
+    CHECK(fake_spidev.max_len <= 100);
+    check_wire();
+    CHECK_EQ(transport->close((void**)&transport), 0);
+
+    /* No bufsiz parameter: the 4096 default */
+    fake_spidev_reset(0);
+    transport = open_fake(0);
+    window(transport, 0, 0, 10, 50);
+    data(transport, frame, sizeof (frame));
+    CHECK_EQ(transport->flush(transport), 0);
+    CHECK(fake_spidev.max_len <= 4096);
+    check_wire();
+    CHECK_EQ(transport->close((void**)&transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+}
+
+/* 3-wire mode: the wire carries 9-bit words with D/C in bit 8, in whole groups
+// of 8 words except the tail of the last message, which is zero padded
+*/
+static void test_3wire(void)
+{
+    LCD_ST7789_TRANSPORT* transport;
+    uint8_t frame[1003];
+    uint32_t words, bit, i;
+    uint16_t word;
+    int b;
+
+    fake_spidev_reset(100);
+    transport = open_fake(LCD_ST7789_FLAG_3WIRE);
+    for (i = 0; i < sizeof (frame); i++)
+	frame[i] = (uint8_t)(i * 29 + 1);
+    window(transport, 3, 5, 17, 29);
+    data(transport, frame, sizeof (frame));
+    command(transport, 0x29);
+    CHECK_EQ(transport->flush(transport), 0);
+    CHECK(fake_spidev.max_len <= 100);
+
+    words = expect.count;
+    CHECK_EQ(fake_spidev.count, (words * 9 + 7) / 8);
+    for (i = 0, bit = 0; i < words && bit + 9 <= fake_spidev.count * 8; i++)
+    {
+	for (word = 0, b = 0; b < 9; b++, bit++)
+	    word = (uint16_t)((word << 1) | ((fake_spidev.bytes[bit / 8] >> (7 - bit % 8)) & 1));
+	if (word != ((expect.dc[i] ? 0x100 : 0) | expect.bytes[i]))
+	{
+	    fprintf(stderr, "word %u: sent %03x, expected %03x\n", i, word, (expect.dc[i] ? 0x100 : 0) | expect.bytes[i]);
+	    CHECK(!"3-wire word differs");
+	    break;
+	}
+    }
+    if (bit % 8 != 0)
+	CHECK_EQ(fake_spidev.bytes[bit / 8] & (0xFF >> (bit % 8)), 0);
+    expect.count = 0;
+    fake_spidev.count = 0;
+
+    CHECK_EQ(transport->close((void**)&transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+}
+
+static void test_open_errors(void)
+{
+    LCD_ST7789_TRANSPORT* transport;
+
+    /* Every failing open leaves no descriptor behind, and a later open works */
+    fake_spidev_reset(4096);
+    transport = lcd_st7789_transport_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, 0);
+
+    fake_spidev.fail_open = FAKE_SPIDEV_DEVICE;
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    fake_spidev.fail_open = NULL;
+
+    fake_spidev.fail_ioctl = SPI_IOC_WR_MODE;
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    fake_spidev.fail_ioctl = SPI_IOC_WR_MAX_SPEED_HZ;
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    fake_spidev.fail_ioctl = 0;
+
+    fake_spidev.fail_open = FAKE_SPIDEV_GPIOCHIP;
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    fake_spidev.fail_open = NULL;
+
+    fake_spidev.fail_ioctl = GPIO_GET_LINEHANDLE_IOCTL;
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    fake_spidev.fail_ioctl = 0;
+
+    /* spidev and the line handle; opening again keeps them */
+    CHECK_EQ(transport->open(transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 2);
+    CHECK_EQ(transport->open(transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 2);
+    CHECK_EQ(transport->close((void**)&transport), 0);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+
+    /* 3-wire mode needs room for one packed group */
+    fake_spidev_reset(8);
+    transport = lcd_st7789_transport_spidev(FAKE_SPIDEV_DEVICE, FAKE_SPIDEV_GPIOCHIP, LCD_ST7789_FLAG_3WIRE);
+    CHECK_EQ(transport->open(transport), -1);
+    CHECK_EQ(fake_spidev.open_fds, 0);
+    CHECK_EQ(transport->close((void**)&transport), 0);
+}
+
+int main(void)
+{
+    test_batching();
+    test_lifetime();
+    test_bufsiz();
+    test_3wire();
+    test_open_errors();
+
+    return CHECK_RESULT;
+}
@@ -0,0 +1,307 @@
+/* test_startup.c
+// lcd_st7789 startup() on the emulator: a cold FAST config resets the panel and
+// leaves RDDST reporting it awake, displaying, in the configured direction; a
+// WARM config on top of that reads RDDST back, skips the reset and only rewrites
+// the runtime state (MADCTL, FRCTRL2, normal mode, scroll area, tearing) before
+// clearing. Each status bit WARM relies on, changed in the reply on its own, and
+// a failed read make it fall back to FAST, as does a panel still asleep.
+// FAST and SAFE sleep exactly their delay budgets and WARM not at all;
+// first_pixel_us covers the sleeps, and is shorter for WARM than for FAST.
+//
+// The emulator transport is captured through
+// -Wl,--wrap=lcd_st7789_transport_emulator so the test can issue RDDST itself
+// and rewrite the reply the driver gets; -Wl,--wrap=usleep adds up the delays.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "st7789.h"
+#include "st7789_transport.h"
+#include "check.h"
+
+#define PANEL_WIDTH     240
+#define PANEL_HEIGHT    320
+#define FAST_US         (5000 + 20 + 5000 + 5000)   /* SLPIN, reset pulse, reset, SLPOUT */
+#define SAFE_US         (4 * 100000)                /* the same four delays at 100ms */
+#define WARM_COMMANDS   11
+
+/* A change to one byte of the decoded RDDST status: bits cleared, then set */
+typedef struct {
+    const char* name;
+    int byte;
+    uint8_t clear;
+    uint8_t set;
+} TAMPER;
+
+LCD_ST7789_TRANSPORT* __real_lcd_st7789_transport_emulator(const char* snapshot);
+int __real_usleep(useconds_t us);
+
+static LCD_ST7789_TRANSPORT* transport;
+static int (*panel_read)(void* self, uint8_t cmd, uint8_t* data, uint32_t size);
+static const TAMPER* tamper;
+static int fail_read;
+static uint32_t rddst_reads;
+static uint32_t slept_us;
+
+int __wrap_usleep(useconds_t us)
+{
+    slept_us += us;
+    return __real_usleep(us);
+}
+
+/* RDDST has one dummy cycle: status bit 7 of byte i is bit 6 of raw byte i */
+static void decode(const uint8_t* raw, uint8_t* status)
+{
+    int i;
+
+    for (i = 0; i < 4; i++)
+	status[i] = (uint8_t)(raw[i] << 1 | raw[i + 1] >> 7);
+}
+
+static void encode(const uint8_t* status, uint8_t* raw)
+{
+    int i;
+
+    raw[0] = (uint8_t)((raw[0] & 0x80) | status[0] >> 1);
+    for (i = 1; i < 4; i++)
+	raw[i] = (uint8_t)(status[i - 1] << 7 | status[i] >> 1);
+    raw[4] = (uint8_t)(status[3] << 7 | (raw[4] & 0x7F));
+}
+
+static int tamper_read(void* self, uint8_t cmd, uint8_t* data, uint32_t size)
+{
+    uint8_t status[4];
+
+    if (cmd == 0x09)
+    {
+	rddst_reads++;
+	if (fail_read)
+	    return -1;
+    }
+    if (panel_read(self, cmd, data, size) != 0)
+	return -1;
+    if (cmd == 0x09 && tamper != NULL && size >= 5)
+    {
+	decode(data, status);
+	status[tamper->byte] = (uint8_t)((status[tamper->byte] & ~tamper->clear) | tamper->set);
+	encode(status, data);
+    }
+    return 0;
+}
+
+LCD_ST7789_TRANSPORT* __wrap_lcd_st7789_transport_emulator(const char* snapshot)
+{
+    transport = __real_lcd_st7789_transport_emulator(snapshot);
+    if (transport != NULL)
+    {
+	panel_read = transport->read;
+	transport->read = &tamper_read;
+    }
+    return transport;
+}
+
+/* What the panel itself reports, read past the driver */
+static void read_status(uint8_t* status)
+{
+    uint8_t raw[5];
+
+    CHECK_EQ(panel_read(transport, 0x09, raw, sizeof (raw)), 0);
+    decode(raw, status);
+}
+
+/* Awake, booster on, display on, inverted as the init table leaves it, tearing
+// off, in direction madctl
+*/
+static void check_ready(LCD_ST7789_DRI* lcd, uint8_t madctl)
+{
+    LCD_ST7789_PANEL panel;
+    uint8_t status[4];
+
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    read_status(status);
+    CHECK_EQ(panel.madctl, madctl);
+    CHECK_EQ(status[0], 0x80 | ((madctl >> 1) & 0x7E));
+    CHECK_EQ(status[1], ((panel.colmod & 0x07) << 4) | 0x02 | 0x01);
+    CHECK_EQ(status[2], 0x20 | 0x04);
+    CHECK_EQ(panel.tfa, 0);
+    CHECK_EQ(panel.vsa, PANEL_HEIGHT);
+    CHECK_EQ(panel.bfa, 0);
+    CHECK_EQ(panel.vsp, 0);
+}
+
+/* Configures a width x height window in mode and writes a first frame; returns
+// the hardware resets it took, the config commands in *commands and the time to
+// the first pixel in *first_us, which must include the delays slept
+*/
+static uint32_t start(LCD_ST7789_DRI* lcd, uint8_t mode, uint16_t width, uint16_t height,
+		      uint32_t* commands, uint32_t* first_us)
+{
+    static uint8_t frame[PANEL_WIDTH * PANEL_HEIGHT * 2];
+    static const uint8_t black[3] = { 0, 0, 0 };
+    LCD_ST7789_PANEL before, after;
+    LCD_ST7789_STATS stats;
+    uint32_t i;
+
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &before), 0);
+    CHECK_EQ(lcd->startup(lcd, mode), 0);
+    slept_us = 0;
+    CHECK_EQ(lcd->config(lcd, 0, 0, (int16_t)(width - 1), (int16_t)(height - 1)), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &after), 0);
+    *commands = after.frame_commands;
+
+    /* Cleared, whether the panel was reset or not */
+    for (i = 0; i < PANEL_WIDTH * PANEL_HEIGHT; i++)
+	if (memcmp(after.gram + i * 3, black, 3) != 0)
+	    break;
+    CHECK_EQ(i, PANEL_WIDTH * PANEL_HEIGHT);
+
+    for (i = 0; i < sizeof (frame); i++)
+	frame[i] = (uint8_t)(i * 29 + mode + 1);
+    CHECK_EQ(lcd->output_image(lcd, frame, width * 2, width, height), 0);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    CHECK(stats.first_pixel_us > 0);
+    CHECK(stats.first_pixel_us >= slept_us);
+    *first_us = stats.first_pixel_us;
+    return after.resets - before.resets;
+}
+
+/* A WARM config that must fall back to a full FAST init */
+static void check_fallback(LCD_ST7789_DRI* lcd, const char* why, uint8_t madctl, uint16_t width, uint16_t height)
+{
+    uint32_t reads = rddst_reads;
+    uint32_t resets, commands, first_us;
+
+    resets = start(lcd, LCD_ST7789_START_WARM, width, height, &commands, &first_us);
+    if (resets != 1)
+	fprintf(stderr, "%s: WARM did not fall back to FAST\n", why);
+    CHECK_EQ(resets, 1);
+    CHECK_EQ(rddst_reads, reads + 1);
+    CHECK_EQ(slept_us, FAST_US);
+    check_ready(lcd, madctl);
+}
+
+/* A WARM config that must skip the reset */
+static void check_warm(LCD_ST7789_DRI* lcd, const char* why, uint8_t madctl, uint16_t width, uint16_t height)
+{
+    uint32_t resets, commands, first_us;
+
+    resets = start(lcd, LCD_ST7789_START_WARM, width, height, &commands, &first_us);
+    if (resets != 0)
+	fprintf(stderr, "%s: WARM reset the panel\n", why);
+    CHECK_EQ(resets, 0);
+    /* RDDST, MADCTL, FRCTRL2, NORON, VSCRDEF, VSCSAD, TEOFF, then COLMOD and one
+    // window for the clear
+    */
+    CHECK_EQ(commands, WARM_COMMANDS);
+    CHECK_EQ(slept_us, 0);
+    check_ready(lcd, madctl);
+}
+
+int main(void)
+{
+    static const TAMPER fallbacks[] = {
+	{ "booster off",        0, 0x80, 0x00 },
+	{ "MADCTL mirrored",    0, 0x00, 0x20 },
+	{ "RGB666",             1, 0x70, 0x60 },
+	{ "asleep",             1, 0x02, 0x00 },
+	{ "not inverted",       2, 0x20, 0x00 },
+	{ "display off",        2, 0x04, 0x00 },
+    };
+    static const TAMPER tearing = { "tearing on", 2, 0x00, 0x02 };
+    static const TAMPER rotated = { "MADCTL not exchanged", 0, 0x10, 0x00 };
+    static uint8_t lines[5 * PANEL_WIDTH * 2];
+    LCD_ST7789_DRI* lcd = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_PANEL panel;
+    LCD_ST7789_STATS stats;
+    uint32_t commands, first_us, reads, cold_us, safe_us, warm_us;
+    uint64_t cold_bytes, warm_bytes;
+    size_t i;
+
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->startup(lcd, 3), -1);
+
+    /* A panel fresh out of power-on reset is asleep: WARM initializes it */
+    check_fallback(lcd, "power on", 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+
+    /* Cold FAST start, never reading the panel back */
+    reads = rddst_reads;
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    cold_bytes = stats.bytes;
+    CHECK_EQ(start(lcd, LCD_ST7789_START_FAST, PANEL_WIDTH, PANEL_HEIGHT, &commands, &cold_us), 1);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    cold_bytes = stats.bytes - cold_bytes;
+    CHECK_EQ(rddst_reads, reads);
+    CHECK_EQ(slept_us, FAST_US);
+    CHECK(commands > WARM_COMMANDS);
+    check_ready(lcd, 0x00);
+
+    /* Warm start on the panel just initialized */
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    warm_bytes = stats.bytes;
+    check_warm(lcd, "after FAST", 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+    CHECK_EQ(lcd->stats(lcd, &stats), 0);
+    warm_bytes = stats.bytes - warm_bytes;
+    warm_us = stats.first_pixel_us;
+    CHECK(warm_us < cold_us);
+
+    /* Runtime state changed since: a new rate, a scrolled area and TE on are
+    // all put back, the rate as the driver last chose it
+    */
+    CHECK_EQ(lcd->refresh(lcd, 24, 1), 0);
+    CHECK_EQ(lcd->scroll_area(lcd, 40, 200), 0);
+    CHECK_EQ(lcd->scroll(lcd, 5, lines), 0);
+    CHECK_EQ(lcd->vsync(lcd, 1), 0);
+    CHECK_EQ(lcd_st7789_emulator_frame(lcd), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(panel.vsa, 200);
+    CHECK_EQ(panel.vsp, 45);
+    check_warm(lcd, "runtime state", 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+    CHECK_EQ(lcd_st7789_emulator_panel(lcd, &panel), 0);
+    CHECK_EQ(lcd_st7789_frame_rates[panel.frctrl2], 48);
+
+    /* Each status bit WARM checks, wrong on its own, and a failed read */
+    for (i = 0; i < sizeof (fallbacks) / sizeof (fallbacks[0]); i++)
+    {
+	tamper = &fallbacks[i];
+	check_fallback(lcd, tamper->name, 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+	tamper = NULL;
+	check_warm(lcd, fallbacks[i].name, 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+    }
+    fail_read = 1;
+    check_fallback(lcd, "read failed", 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+    fail_read = 0;
+
+    /* TE left on is runtime state, not a reason to reset */
+    tamper = &tearing;
+    check_warm(lcd, tamper->name, 0x00, PANEL_WIDTH, PANEL_HEIGHT);
+    tamper = NULL;
+
+    /* SAFE always resets, with 100ms delays */
+    CHECK_EQ(start(lcd, LCD_ST7789_START_SAFE, PANEL_WIDTH, PANEL_HEIGHT, &commands, &safe_us), 1);
+    CHECK_EQ(slept_us, SAFE_US);
+    check_ready(lcd, 0x00);
+
+    printf("first pixel after config: SAFE %u us, FAST %u us, WARM %u us (host time, bus not included)\n",
+	   safe_us, cold_us, warm_us);
+    printf("config and first frame on the bus: FAST %llu bytes, WARM %llu bytes\n",
+	   (unsigned long long)cold_bytes, (unsigned long long)warm_bytes);
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    /* Rotated: the MADCTL bits read back must match 0x60 */
+    lcd = lcd_st7789_init_emulator(NULL);
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->rotate(lcd, LCD_ST7789_ROTATE_90), 0);
+    CHECK_EQ(start(lcd, LCD_ST7789_START_FAST, PANEL_HEIGHT, PANEL_WIDTH, &commands, &first_us), 1);
+    check_ready(lcd, 0x60);
+    check_warm(lcd, "rotated", 0x60, PANEL_HEIGHT, PANEL_WIDTH);
+    tamper = &rotated;
+    check_fallback(lcd, tamper->name, 0x60, PANEL_HEIGHT, PANEL_WIDTH);
+    tamper = NULL;
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+
+    return CHECK_RESULT;
+}
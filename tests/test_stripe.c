@@ -0,0 +1,149 @@
+/* test_stripe.c
+// The two-panel stripe on two emulated panels: every frame reaches both halves
+// in order and lines up across the seam, and a failed config is unwound so the
+// stripe can be configured again.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "st7789.h"
+#include "check.h"
+
+#define PANEL_WIDTH     240
+#define FRAMES          12
+
+static uint16_t pattern(uint32_t x, uint32_t y, uint32_t frame)
+{
+    return (uint16_t)(x * 7 + y * 131 + frame * 977);
+}
+
+static void fill(uint8_t* buf, uint32_t stride, int16_t left, int16_t top, int16_t right, int16_t bottom, uint32_t frame)
+{
+    uint16_t p;
+    int16_t x, y;
+
+    for (y = top; y <= bottom; y++)
+    {
+	for (x = left; x <= right; x++)
+	{
+	    p = pattern((uint32_t)x, (uint32_t)y, frame);
+	    buf[(y - top) * stride + (x - left) * 2] = (uint8_t)(p >> 8);
+	    buf[(y - top) * stride + (x - left) * 2 + 1] = (uint8_t)p;
+	}
+    }
+}
+
+/* Both panels show frame of the whole surface: pixel x of the surface is
+// column x on the left panel or x - 240 on the right one
+*/
+static void check_gram(LCD_ST7789_DRI* left, LCD_ST7789_DRI* right, int16_t l, int16_t t, int16_t r, int16_t b, uint32_t frame)
+{
+    LCD_ST7789_PANEL panel[2];
+    const uint8_t* cell;
+    uint16_t p;
+    int16_t x, y;
+
+    CHECK_EQ(lcd_st7789_emulator_panel(left, &panel[0]), 0);
+    CHECK_EQ(lcd_st7789_emulator_panel(right, &panel[1]), 0);
+    for (y = t; y <= b; y++)
+    {
+	for (x = l; x <= r; x++)
+	{
+	    p = pattern((uint32_t)x, (uint32_t)y, frame);
+	    cell = panel[x / PANEL_WIDTH].gram + ((uint32_t)y * PANEL_WIDTH + x % PANEL_WIDTH) * 3;
+	    if (cell[0] >> 3 != p >> 11 || cell[1] >> 2 != ((p >> 5) & 0x3F) || cell[2] >> 3 != (p & 0x1F))
+	    {
+		fprintf(stderr, "frame %u: pixel %d,%d on panel %d does not match\n", frame, x, y, x / PANEL_WIDTH);
+		CHECK(!"stripe pixel differs");
+		return;
+	    }
+	}
+    }
+}
+
+static void test_frames(int16_t l, int16_t t, int16_t r, int16_t b)
+{
+    LCD_ST7789_DRI* left = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_DRI* right = lcd_st7789_init_emulator(NULL);
+    LCD_ST7789_DRI* stripe = lcd_st7789_init_stripe(left, right);
+    uint32_t stride = (uint32_t)(r - l + 1) * 2 + 64;
+    uint8_t* image = (uint8_t*)malloc(stride * (b - t + 1));
+    LCD_ST7789_STATS stats;
+    uint8_t* frame;
+    uint32_t k;
+
+    CHECK_EQ(stripe->config(stripe, l, t, r, b), 0);
+
+    /* The stats query waits for both halves, after it the panels show the same frame */
+    for (k = 0; k < FRAMES; k++)
+    {
+	fill(image, stride, l, t, r, b, k);
+	CHECK_EQ(stripe->output_image(stripe, image, stride, (uint16_t)(r - l + 1), (uint16_t)(b - t + 1)), 0);
+	CHECK_EQ(stripe->stats(stripe, &stats), 0);
+	CHECK_EQ(stats.frames, k + 1);
+	check_gram(left, right, l, t, r, b, k);
+    }
+
+    /* Back to back frames through begin_frame/commit and output: the barrier keeps
+    // the halves in step, the last frame is the one both panels end on
+    */
+    for (k = FRAMES; k < 2 * FRAMES; k++)
+    {
+	frame = stripe->begin_frame(stripe);
+	CHECK(frame != NULL);
+	if (frame == NULL)
+	    break;
+	fill(frame, (uint32_t)(r - l + 1) * 2, l, t, r, b, k);
+	CHECK_EQ(stripe->commit(stripe), 0);
+    }
+    fill(image, (uint32_t)(r - l + 1) * 2, l, t, r, b, k);
+    CHECK_EQ(stripe->output(stripe, image, (uint32_t)(r - l + 1) * 2 * (b - t + 1), 0), 0);
+    CHECK_EQ(stripe->stats(stripe, &stats), 0);
+    CHECK_EQ(stats.frames, 2 * FRAMES + 1);
+    check_gram(left, right, l, t, r, b, k);
+
+    CHECK_EQ(stripe->clean((void**)&stripe), 0);
+    free(image);
+}
+
+static void test_config_unwind(void)
+{
+    LCD_ST7789_DRI* stripe;
+    uint8_t line[960];
+
+    /* Region outside the surface: nothing is touched, a valid config still works */
+    stripe = lcd_st7789_init_stripe(lcd_st7789_init_emulator(NULL), lcd_st7789_init_emulator(NULL));
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 320), -1);
+    CHECK_EQ(stripe->config(stripe, -1, 0, 479, 319), -1);
+    CHECK_EQ(stripe->config(stripe, 0, 0, 480, 319), -1);
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 319), 0);
+    CHECK_EQ(stripe->clean((void**)&stripe), 0);
+
+    /* The right panel cannot open its bus after the left one is configured:
+    // config fails as a whole, the stripe is back to unconfigured and clean
+    // releases everything
+    */
+    stripe = lcd_st7789_init_stripe(lcd_st7789_init_emulator(NULL),
+				    lcd_st7789_init_spidev("/nonexistent/spidev", "/nonexistent/gpiochip", 0));
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 319), -1);
+    memset(line, 0, sizeof (line));
+    CHECK_EQ(stripe->output(stripe, line, sizeof (line), 0), -1);
+    CHECK(stripe->begin_frame(stripe) == NULL);
+    CHECK_EQ(stripe->commit(stripe), -1);
+    CHECK_EQ(stripe->config(stripe, 0, 0, 479, 319), -1);
+    CHECK_EQ(stripe->clean((void**)&stripe), 0);
+}
+
+int main(void)
+{
+    /* The whole surface, a region across the seam at odd offsets, and one
+    // that stays on the left panel
+    */
+    test_frames(0, 0, 479, 319);
+    test_frames(13, 7, 301, 250);
+    test_frames(20, 30, 200, 100);
+    test_config_unwind();
+
+    return CHECK_RESULT;
+}
@@ -0,0 +1,155 @@
+/* test_vsync.c
+// lcd_st7789 vsync() on the bcm2835 transport and the simulator, with the
+// tearing effect input driven by bcm2835_sim_te(): every frame's first RAMWR
+// goes on the wire inside the vertical blanking, also when the panel refreshes
+// faster or slower than the nominal FRCTRL2 rate the transport predicts edges
+// from, and vsyncs counts those frames. Without TE each frame waits for the
+// timeout, is still written and counts in vsync_misses, and enabling vsync
+// fails.
+//
+// The simulator model is captured through -Wl,--wrap=bcm2835_trace_set_model
+// and called from a recording model that notes the simulated time of every
+// RAMWR command byte, i.e. a FIFO write with DC low.
+*/
+
+#include "st7789.h"
+#include "st7789_transport.h"
+#include "bcm2835.h"
+#include "bcm2835_sim.h"
+#include "check.h"
+
+#define NOMINAL_US      16667   /* FRCTRL2 default, 60 Hz */
+#define VBLANK_US       1000
+#define TIMEOUT_US      50000   /* LCD_ST7789_TE_TIMEOUT_US */
+#define SIZE            60      /* a small window: one window per frame, well inside a period */
+#define FRAMES          12
+#define MAX_RAMWR       64
+
+static bcm2835PeriModel sim;
+static uint32_t dc = 1;
+static uint64_t ramwr_ns[MAX_RAMWR];
+static uint32_t ramwrs;
+
+void __real_bcm2835_trace_set_model(const bcm2835PeriModel* model);
+
+static uint64_t now_ns(void)
+{
+    bcm2835SimStats stats;
+
+    bcm2835_sim_stats(&stats);
+    return stats.elapsed_ns;
+}
+
+static uint32_t record_read(void* self, uint32_t offset, uint32_t flags)
+{
+    (void)self;
+    return sim.read(sim.self, offset, flags);
+}
+
+static void record_write(void* self, uint32_t offset, uint32_t value, uint32_t flags)
+{
+    (void)self;
+    if (offset == BCM2835_GPIO_BASE + BCM2835_GPSET0 && (value & (1u << LCD_ST7789_GPIO_SPI_PIN_DC)))
+	dc = 1;
+    else if (offset == BCM2835_GPIO_BASE + BCM2835_GPCLR0 && (value & (1u << LCD_ST7789_GPIO_SPI_PIN_DC)))
+	dc = 0;
+    else if (offset == BCM2835_SPI0_BASE + BCM2835_SPI0_FIFO && !dc && (value & 0xFF) == 0x2C && ramwrs < MAX_RAMWR)
+	ramwr_ns[ramwrs++] = now_ns();
+    sim.write(sim.self, offset, value, flags);
+}
+
+void __wrap_bcm2835_trace_set_model(const bcm2835PeriModel* model)
+{
+    static const bcm2835PeriModel record = { &record_read, &record_write, NULL };
+
+    if (model == NULL)
+    {
+	__real_bcm2835_trace_set_model(NULL);
+	return;
+    }
+    sim = *model;
+    __real_bcm2835_trace_set_model(&record);
+}
+
+/* Writes FRAMES changed frames and checks that each one waited for TE and
+// started within a blanking period of length period_us
+*/
+static void check_frames(LCD_ST7789_DRI* lcd, uint8_t* frame, uint32_t period_us)
+{
+    LCD_ST7789_STATS before, after;
+    uint64_t phase;
+    uint32_t i, k;
+
+    CHECK_EQ(lcd->stats(lcd, &before), 0);
+    ramwrs = 0;
+    for (k = 0; k < FRAMES; k++)
+    {
+	for (i = 0; i < SIZE * SIZE * 2; i++)
+	    frame[i] = (uint8_t)(i * 7 + k * 61 + period_us);
+	CHECK_EQ(lcd->output_image(lcd, frame, SIZE * 2, SIZE, SIZE), 0);
+    }
+    CHECK_EQ(lcd->stats(lcd, &after), 0);
+
+    CHECK_EQ(ramwrs, FRAMES);
+    for (i = 0; i < ramwrs; i++)
+    {
+	phase = ramwr_ns[i] % ((uint64_t)period_us * 1000);
+	if (phase >= VBLANK_US * 1000ull)
+	    fprintf(stderr, "period %u us: RAMWR %u at %llu ns into the period\n",
+		    period_us, i, (unsigned long long)phase);
+	CHECK(phase < VBLANK_US * 1000ull);
+    }
+    CHECK_EQ(after.vsyncs - before.vsyncs, FRAMES);
+    CHECK_EQ(after.vsync_misses, before.vsync_misses);
+}
+
+int main(void)
+{
+    static uint8_t frame[SIZE * SIZE * 2];
+    LCD_ST7789_DRI* lcd;
+    LCD_ST7789_STATS before, after;
+    bcm2835SimStats sent, done;
+    uint64_t start;
+
+    if (!bcm2835_sim_begin(NULL))
+	return 77;
+
+    lcd = lcd_st7789_init_bcm2835(0);
+    CHECK_EQ(lcd->color(lcd, LCD_ST7789_COLOR_RGB565), 0);
+    CHECK_EQ(lcd->config(lcd, 0, 0, SIZE - 1, SIZE - 1), 0);
+
+    /* No TE signal: vsync cannot be enabled */
+    start = now_ns();
+    CHECK_EQ(lcd->vsync(lcd, 1), -1);
+    CHECK(now_ns() - start >= TIMEOUT_US * 1000ull);
+
+    /* The panel at its nominal rate, then faster and slower than predicted */
+    bcm2835_sim_te(LCD_ST7789_GPIO_SPI_PIN_TE, NOMINAL_US, VBLANK_US);
+    CHECK_EQ(lcd->vsync(lcd, 1), 0);
+    check_frames(lcd, frame, NOMINAL_US);
+    bcm2835_sim_te(LCD_ST7789_GPIO_SPI_PIN_TE, NOMINAL_US * 4 / 5, VBLANK_US);
+    check_frames(lcd, frame, NOMINAL_US * 4 / 5);
+    bcm2835_sim_te(LCD_ST7789_GPIO_SPI_PIN_TE, NOMINAL_US * 6 / 5, VBLANK_US);
+    check_frames(lcd, frame, NOMINAL_US * 6 / 5);
+
+    /* TE stops: each frame waits the timeout once, then is written anyway */
+    bcm2835_sim_te(LCD_ST7789_GPIO_SPI_PIN_TE, 0, 0);
+    CHECK_EQ(lcd->stats(lcd, &before), 0);
+    bcm2835_sim_stats(&sent);
+    frame[0]++;
+    CHECK_EQ(lcd->output_image(lcd, frame, SIZE * 2, SIZE, SIZE), 0);
+    frame[0]++;
+    CHECK_EQ(lcd->output_image(lcd, frame, SIZE * 2, SIZE, SIZE), 0);
+    bcm2835_sim_stats(&done);
+    CHECK_EQ(lcd->stats(lcd, &after), 0);
+    CHECK_EQ(after.vsyncs, before.vsyncs);
+    CHECK_EQ(after.vsync_misses - before.vsync_misses, 2);
+    CHECK_EQ(after.frames - before.frames, 2);
+    CHECK(done.spi0.bytes - sent.spi0.bytes >= 2 * 2);
+    CHECK(done.elapsed_ns - sent.elapsed_ns >= 2 * TIMEOUT_US * 1000ull);
+    CHECK(done.elapsed_ns - sent.elapsed_ns < 3 * TIMEOUT_US * 1000ull);
+
+    CHECK_EQ(lcd->clean((void**)&lcd), 0);
+    bcm2835_sim_end();
+    return CHECK_RESULT;
+}